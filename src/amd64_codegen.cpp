@@ -3,6 +3,9 @@
 #include "common.h"
 #include "compiler.h"
 #include "reg_alloc.h"
+#include "ir_ssa.h"
+#include "ir_eval.h"
+#include "ir_tail.h"
 #include "symbols.h"
 #include "hashtable.h"
 #include "time_profiler.h"
@@ -33,128 +36,6 @@ namespace hplang
 #define RA_DEBUG(ctx, x) \
         if ((ctx)->comp_ctx->options.debug_reg_alloc) x
 
-enum { Opcode_Mod_Shift = 7 };
-
-enum Opcode_Mod
-{
-    NO_MOD  = 0,
-    O1_REG  = 0x01,
-    O1_MEM  = 0x02,
-    O1_RM   = O1_REG | O1_MEM,
-    O1_IMM  = 0x04,
-    //O1_W8   = 0x08,
-    //O1_W16  = 0x10,
-    //O1_W32  = 0x20,
-    //O1_W64  = 0x40,
-
-    O2_REG = (O1_REG << Opcode_Mod_Shift),
-    O2_MEM = (O1_MEM << Opcode_Mod_Shift),
-    O2_RM = O2_REG | O2_MEM,
-    O2_IMM = (O1_IMM << Opcode_Mod_Shift),
-
-    O3_REG = (O2_REG << Opcode_Mod_Shift),
-    O3_MEM = (O2_MEM << Opcode_Mod_Shift),
-    O3_RM = O3_REG | O3_MEM,
-    O3_IMM = (O2_IMM << Opcode_Mod_Shift),
-};
-
-// Disabled or non-valid instruction opcode
-#define PASTE_OP_D(x, mods)
-
-// NOTE(henrik): Do we want (comiss and comisd) or (ucomiss and ucomisd)?
-
-// NOTE(henrik): Conditional move opcode cmovg is not valid when the operands
-// are 64 bit wide. The condition "cmovg a, b" can be replaced with "cmovl b, a".
-#define OPCODES\
-    PASTE_OP(LABEL,     NO_MOD)\
-    PASTE_OP(SPILL,     NO_MOD)\
-    \
-    PASTE_OP(nop,       NO_MOD)\
-    \
-    PASTE_OP(call,      NO_MOD)\
-    PASTE_OP(ret,       NO_MOD)\
-    PASTE_OP(jmp,       NO_MOD)\
-    PASTE_OP(je,        NO_MOD)\
-    PASTE_OP(jne,       NO_MOD)\
-    PASTE_OP(jb,        NO_MOD)\
-    PASTE_OP(jbe,       NO_MOD)\
-    PASTE_OP(ja,        NO_MOD)\
-    PASTE_OP(jae,       NO_MOD)\
-    PASTE_OP(jl,        NO_MOD)\
-    PASTE_OP(jle,       NO_MOD)\
-    PASTE_OP(jg,        NO_MOD)\
-    PASTE_OP(jge,       NO_MOD)\
-    \
-    PASTE_OP(cmp,       O1_REG | O2_REG | O2_IMM)\
-    PASTE_OP(comiss,    O1_REG | O2_RM)\
-    PASTE_OP(comisd,    O1_REG | O2_RM)\
-    \
-    PASTE_OP(lea,       O1_REG | O2_MEM)\
-    PASTE_OP(mov,       O1_RM | O2_RM | O2_IMM)\
-    PASTE_OP(movsx,     O1_RM | O2_RM)\
-    PASTE_OP(movzx,     O1_RM | O2_RM)\
-    PASTE_OP(movss,     O1_RM | O2_RM)\
-    PASTE_OP(movsd,     O1_RM | O2_RM)\
-    \
-    PASTE_OP(cmove,     O1_REG | O2_RM)\
-    PASTE_OP(cmovne,    O1_REG | O2_RM)\
-    PASTE_OP(cmova,     O1_REG | O2_RM)\
-    PASTE_OP(cmovae,    O1_REG | O2_RM)\
-    PASTE_OP(cmovb,     O1_REG | O2_RM)\
-    PASTE_OP(cmovbe,    O1_REG | O2_RM)\
-    PASTE_OP(cmovl,     O1_REG | O2_RM)\
-    PASTE_OP(cmovle,    O1_REG | O2_RM)\
-    PASTE_OP_D(cmovg,   O1_REG | O2_RM)\
-    PASTE_OP(cmovge,    O1_REG | O2_RM)\
-    \
-    PASTE_OP(cqo,       NO_MOD)\
-    \
-    PASTE_OP(add,       O1_REG | O2_RM | O2_IMM)\
-    PASTE_OP(sub,       O1_REG | O2_RM | O2_IMM)\
-    PASTE_OP(mul,       O1_RM)\
-    PASTE_OP(imul,      O1_REG | O2_RM)\
-    PASTE_OP(div,       O1_RM)\
-    PASTE_OP(idiv,      O1_RM)\
-    PASTE_OP(and,       O1_REG | O2_RM | O2_IMM)\
-    PASTE_OP(or,        O1_REG | O2_RM | O2_IMM)\
-    PASTE_OP(xor,       O1_REG | O2_RM | O2_IMM)\
-    PASTE_OP(neg,       O1_REG)\
-    PASTE_OP(not,       O1_REG)\
-    PASTE_OP(sal,       O1_REG | O2_REG | O2_IMM)\
-    PASTE_OP(shl,       O1_REG | O2_REG | O2_IMM)\
-    PASTE_OP(sar,       O1_REG | O2_REG | O2_IMM)\
-    PASTE_OP(shr,       O1_REG | O2_REG | O2_IMM)\
-    \
-    PASTE_OP(addss,     O1_REG | O2_REG)\
-    PASTE_OP(subss,     O1_REG | O2_REG)\
-    PASTE_OP(mulss,     O1_REG | O2_REG)\
-    PASTE_OP(divss,     O1_REG | O2_REG)\
-    PASTE_OP(addsd,     O1_REG | O2_REG)\
-    PASTE_OP(subsd,     O1_REG | O2_REG)\
-    PASTE_OP(mulsd,     O1_REG | O2_REG)\
-    PASTE_OP(divsd,     O1_REG | O2_REG)\
-    \
-    PASTE_OP(sqrtss,    O1_REG | O2_REG)\
-    PASTE_OP(sqrtsd,    O1_REG | O2_REG)\
-    \
-    PASTE_OP(push,      O1_REG)\
-    PASTE_OP(pop,       O1_REG)\
-    \
-    PASTE_OP(cvtsi2ss,  O1_REG | O2_REG)\
-    PASTE_OP(cvtsi2sd,  O1_REG | O2_REG)\
-    PASTE_OP(cvtss2si,  O1_REG | O2_REG)\
-    PASTE_OP(cvtsd2si,  O1_REG | O2_REG)\
-    PASTE_OP(cvtss2sd,  O1_REG | O2_REG)\
-    PASTE_OP(cvtsd2ss,  O1_REG | O2_REG)\
-
-
-#define PASTE_OP(x, mods) OP_##x,
-enum Amd64_Opcode
-{
-    OPCODES
-};
-#undef PASTE_OP
-
 #define PASTE_OP(x, mods) mods,
 static u32 opcode_flags[] = {
     OPCODES
@@ -168,53 +49,6 @@ static const char *opcode_names[] = {
 };
 #undef PASTE_OP
 
-/* AMD64 registers
- * rip and mmx registers not listed.
- */
-#define REGS\
-    PASTE_REG(NONE, NONE, NONE, NONE)\
-    PASTE_REG(rax, eax, ax, al)\
-    PASTE_REG(rbx, ebx, bx, bl)\
-    PASTE_REG(rcx, ecx, cx, cl)\
-    PASTE_REG(rdx, edx, dx, dl)\
-    PASTE_REG(rbp, ebp, bp, bpl)\
-    PASTE_REG(rsi, esi, si, sil)\
-    PASTE_REG(rdi, edi, di, dil)\
-    PASTE_REG(rsp, esp, sp, spl)\
-    PASTE_REG(r8, r8d, r8w, r8b)\
-    PASTE_REG(r9, r9d, r9w, r9b)\
-    PASTE_REG(r10, r10d, r10w, r10b)\
-    PASTE_REG(r11, r11d, r11w, r11b)\
-    PASTE_REG(r12, r12d, r12w, r12b)\
-    PASTE_REG(r13, r13d, r13w, r13b)\
-    PASTE_REG(r14, r14d, r14w, r14b)\
-    PASTE_REG(r15, r15d, r15w, r15b)\
-    \
-    PASTE_REG(xmm0, xmm0, xmm0, xmm0)\
-    PASTE_REG(xmm1, xmm1, xmm1, xmm1)\
-    PASTE_REG(xmm2, xmm2, xmm2, xmm2)\
-    PASTE_REG(xmm3, xmm3, xmm3, xmm3)\
-    PASTE_REG(xmm4, xmm4, xmm4, xmm4)\
-    PASTE_REG(xmm5, xmm5, xmm5, xmm5)\
-    PASTE_REG(xmm6, xmm6, xmm6, xmm6)\
-    PASTE_REG(xmm7, xmm7, xmm7, xmm7)\
-    PASTE_REG(xmm8, xmm8, xmm8, xmm8)\
-    PASTE_REG(xmm9, xmm9, xmm9, xmm9)\
-    PASTE_REG(xmm10, xmm10, xmm10, xmm10)\
-    PASTE_REG(xmm11, xmm11, xmm11, xmm11)\
-    PASTE_REG(xmm12, xmm12, xmm12, xmm12)\
-    PASTE_REG(xmm13, xmm13, xmm13, xmm13)\
-    PASTE_REG(xmm14, xmm14, xmm14, xmm14)\
-    PASTE_REG(xmm15, xmm15, xmm15, xmm15)\
-
-#define PASTE_REG(r8, r4, r2, r1) REG_##r8,
-enum Amd64_Register
-{
-    REGS
-    REG_COUNT
-};
-#undef PASTE_REG
-
 #define PASTE_REG(r8, r4, r2, r1) #r8,
 static const char *reg_name_strings_8b[] = {
     REGS
@@ -252,6 +86,11 @@ static Name reg_save_names[] = {
 };
 #undef PASTE_REG
 
+static const char *ymm_name_strings[] = {
+    "ymm0", "ymm1", "ymm2", "ymm3", "ymm4", "ymm5", "ymm6", "ymm7",
+    "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15",
+};
+
 static const char* GetRegNameStr(Reg reg)
 {
     return reg_name_strings_8b[reg.reg_index];
@@ -277,7 +116,11 @@ static const char* GetRegNameStr(Reg reg, Oper_Data_Type data_type)
         return reg_name_strings_8b[reg.reg_index];
     case Oper_Data_Type::F32:
     case Oper_Data_Type::F64:
+    case Oper_Data_Type::V128:
         return reg_name_strings_8b[reg.reg_index];
+    case Oper_Data_Type::V256:
+        ASSERT(reg.reg_index >= REG_xmm0 && reg.reg_index <= REG_xmm15);
+        return ymm_name_strings[reg.reg_index - REG_xmm0];
     }
     INVALID_CODE_PATH;
     return nullptr;
@@ -679,6 +522,14 @@ static Oper_Data_Type DataTypeFromType(Type *type)
 
         case TYP_pointer:
             return Oper_Data_Type::PTR;
+
+        case TYP_f32x4: case TYP_f64x2:
+        case TYP_s32x4: case TYP_s64x2:
+            return Oper_Data_Type::V128;
+        case TYP_f32x8: case TYP_f64x4:
+        case TYP_s32x8: case TYP_s64x4:
+            return Oper_Data_Type::V256;
+
         case TYP_bool:
             return Oper_Data_Type::BOOL;
         case TYP_char:
@@ -748,6 +599,7 @@ static Operand IrOperand(Codegen_Context *ctx,
     switch (ir_oper->oper_type)
     {
         case IR_OPER_None:
+        case IR_OPER_Phi:
             INVALID_CODE_PATH;
             break;
         case IR_OPER_Label:
@@ -1006,6 +858,8 @@ static Amd64_Opcode MoveOp(Oper_Data_Type data_type)
 {
     if (data_type == Oper_Data_Type::F32) return OP_movss;
     if (data_type == Oper_Data_Type::F64) return OP_movsd;
+    if (data_type == Oper_Data_Type::V128) return OP_movups;
+    if (data_type == Oper_Data_Type::V256) return OP_vmovups;
     return OP_mov;
 }
 
@@ -1077,6 +931,18 @@ static Operand ModifyOperand(Codegen_Context *ctx,
             return temp;
         }
     }
+    else if (oper.type == Oper_Type::Label &&
+            oper.addr_mode == Oper_Addr_Mode::Direct &&
+            opcode == OP_mov)
+    {
+        // NOTE(henrik): The address of a routine is loaded rip relative with
+        // lea, as mov would need an absolute relocation.
+        Operand temp = TempOperand(ctx, Oper_Data_Type::PTR, oper.access_flags);
+        oper.addr_mode = Oper_Addr_Mode::BaseOffset;
+        Instruction *load = NewInstruction(ctx, OP_lea, W_(temp), R_(oper));
+        array::Insert(instructions, instr_index, load);
+        return temp;
+    }
     else if (oper.addr_mode == Oper_Addr_Mode::BaseOffset
             //|| oper.addr_mode == Oper_Addr_Mode::BaseIndexOffset
             || IsSpilled(ctx, oper)
@@ -1246,10 +1112,17 @@ static void PushLabel(Codegen_Context *ctx, Name name)
     PushInstruction(ctx, OP_LABEL, oper);
 }
 
+static void GenerateVectorCompare(Codegen_Context *ctx, Ir_Instruction *ir_instr);
+
 static void GenerateCompare(Codegen_Context *ctx,
         Ir_Instruction *ir_instr, Ir_Instruction *ir_next_instr,
         bool *skip_next)
 {
+    if (TypeIsVector(ir_instr->oper1.type))
+    {
+        GenerateVectorCompare(ctx, ir_instr);
+        return;
+    }
     Amd64_Opcode cmp_op;
     if (ir_instr->oper1.type->tag == TYP_f32)
         cmp_op = OP_comiss;
@@ -1387,9 +1260,232 @@ static void GenerateCompare(Codegen_Context *ctx,
     }
 }
 
+// Returns the packed instruction for the arithmetic on the vector type; the
+// VEX encoded three operand form for the 256 bit vectors.
+static Amd64_Opcode GetVectorOp(Ir_Opcode opcode, Type *type)
+{
+    b32 avx = (DataTypeFromType(type) == Oper_Data_Type::V256);
+    switch (type->tag)
+    {
+    case TYP_f32x4: case TYP_f32x8:
+        switch (opcode)
+        {
+        case IR_Add:    return avx ? OP_vaddps : OP_addps;
+        case IR_Sub:    return avx ? OP_vsubps : OP_subps;
+        case IR_Mul:    return avx ? OP_vmulps : OP_mulps;
+        case IR_Div:    return avx ? OP_vdivps : OP_divps;
+        case IR_Sqrt:   return avx ? OP_vsqrtps : OP_sqrtps;
+        default:        break;
+        } break;
+    case TYP_f64x2: case TYP_f64x4:
+        switch (opcode)
+        {
+        case IR_Add:    return avx ? OP_vaddpd : OP_addpd;
+        case IR_Sub:    return avx ? OP_vsubpd : OP_subpd;
+        case IR_Mul:    return avx ? OP_vmulpd : OP_mulpd;
+        case IR_Div:    return avx ? OP_vdivpd : OP_divpd;
+        case IR_Sqrt:   return avx ? OP_vsqrtpd : OP_sqrtpd;
+        default:        break;
+        } break;
+    case TYP_s32x4: case TYP_s32x8:
+        switch (opcode)
+        {
+        case IR_Add:    return avx ? OP_vpaddd : OP_paddd;
+        case IR_Sub:    return avx ? OP_vpsubd : OP_psubd;
+        case IR_Mul:    if (avx) return OP_vpmulld; break;
+        default:        break;
+        } break;
+    case TYP_s64x2: case TYP_s64x4:
+        switch (opcode)
+        {
+        case IR_Add:    return avx ? OP_vpaddq : OP_paddq;
+        case IR_Sub:    return avx ? OP_vpsubq : OP_psubq;
+        default:        break;
+        } break;
+    default:
+        break;
+    }
+    switch (opcode)
+    {
+    case IR_And:    return avx ? OP_vpand : OP_pand;
+    case IR_Or:     return avx ? OP_vpor : OP_por;
+    case IR_Xor:    return avx ? OP_vpxor : OP_pxor;
+    default:        break;
+    }
+    INVALID_CODE_PATH;
+    return OP_nop;
+}
+
+// The negation subtracts from zero, as the scalar negation of the floats, and
+// the complement flips the bits with all ones.
+static void GenerateVectorUnary(Codegen_Context *ctx, Ir_Instruction *ir_instr)
+{
+    Operand target = IrOperand(ctx, &ir_instr->target, AF_Write);
+    Operand oper1 = IrOperand(ctx, &ir_instr->oper1, AF_Read);
+    ASSERT(target.data_type == Oper_Data_Type::V128);
+    Operand temp = TempOperand(ctx, target.data_type, AF_Write);
+    if (ir_instr->opcode == IR_Neg)
+    {
+        PushInstruction(ctx, OP_pxor, W_(temp), W_(temp));
+        PushInstruction(ctx, GetVectorOp(IR_Sub, ir_instr->target.type),
+                RW_(temp), oper1);
+    }
+    else
+    {
+        PushInstruction(ctx, OP_pcmpeqd, W_(temp), W_(temp));
+        PushInstruction(ctx, OP_pxor, RW_(temp), oper1);
+    }
+    PushLoad(ctx, target, R_(temp));
+}
+
+// SSE2 has no packed 32 bit multiplication, so the even and odd elements are
+// multiplied to 64 bit products with pmuludq, and the low halves of the
+// products are packed back together. The low 32 bits of the product are the
+// same for the signed and unsigned multiplication.
+static void GenerateVectorMulS32(Codegen_Context *ctx, Ir_Instruction *ir_instr)
+{
+    Operand target = IrOperand(ctx, &ir_instr->target, AF_Write);
+    Operand oper1 = IrOperand(ctx, &ir_instr->oper1, AF_Read);
+    Operand oper2 = IrOperand(ctx, &ir_instr->oper2, AF_Read);
+    Operand even = TempOperand(ctx, target.data_type, AF_Write);
+    Operand odd = TempOperand(ctx, target.data_type, AF_Write);
+    Operand temp = TempOperand(ctx, target.data_type, AF_Write);
+    PushLoad(ctx, even, oper1);
+    PushInstruction(ctx, OP_pmuludq, RW_(even), oper2);
+    PushInstruction(ctx, OP_pshufd, W_(odd), oper1, ImmOperand(0xf5, AF_Read));
+    PushInstruction(ctx, OP_pshufd, W_(temp), oper2, ImmOperand(0xf5, AF_Read));
+    PushInstruction(ctx, OP_pmuludq, RW_(odd), R_(temp));
+    PushInstruction(ctx, OP_pshufd, W_(target), R_(even), ImmOperand(0x08, AF_Read));
+    PushInstruction(ctx, OP_pshufd, W_(temp), R_(odd), ImmOperand(0x08, AF_Read));
+    PushInstruction(ctx, OP_punpckldq, RW_(target), R_(temp));
+}
+
+static void GenerateVectorArithmetic(Codegen_Context *ctx, Ir_Instruction *ir_instr)
+{
+    if (ir_instr->opcode == IR_Neg || ir_instr->opcode == IR_Compl)
+    {
+        GenerateVectorUnary(ctx, ir_instr);
+        return;
+    }
+    if (ir_instr->opcode == IR_Mul && ir_instr->target.type->tag == TYP_s32x4)
+    {
+        GenerateVectorMulS32(ctx, ir_instr);
+        return;
+    }
+    Amd64_Opcode op = GetVectorOp(ir_instr->opcode, ir_instr->target.type);
+    Operand target = IrOperand(ctx, &ir_instr->target, AF_Write);
+    Operand oper1 = IrOperand(ctx, &ir_instr->oper1, AF_Read);
+    if (ir_instr->opcode == IR_Sqrt)
+    {
+        PushInstruction(ctx, op, target, oper1);
+    }
+    else if (target.data_type == Oper_Data_Type::V256)
+    {
+        PushInstruction(ctx, op, target, oper1,
+                IrOperand(ctx, &ir_instr->oper2, AF_Read));
+    }
+    else
+    {
+        if (ir_instr->target != ir_instr->oper1)
+            PushLoad(ctx, target, oper1);
+        PushInstruction(ctx, op, RW_(target),
+                IrOperand(ctx, &ir_instr->oper2, AF_Read));
+    }
+}
+
+// Compares the elements of the vectors, setting the elements of the mask to
+// all ones, where the comparison is true. The float predicates of cmpps are
+// less-than forms, so the greater-than compares swap the operands. The
+// integer compares have only equal and greater-than; the rest are made by
+// swapping the operands and inverting the mask.
+static void GenerateVectorCompare(Codegen_Context *ctx, Ir_Instruction *ir_instr)
+{
+    Ir_Opcode opcode = ir_instr->opcode;
+    Type *type = ir_instr->oper1.type;
+    Operand target = IrOperand(ctx, &ir_instr->target, AF_Write);
+    Operand oper1 = IrOperand(ctx, &ir_instr->oper1, AF_Read);
+    Operand oper2 = IrOperand(ctx, &ir_instr->oper2, AF_Read);
+    ASSERT(target.data_type == Oper_Data_Type::V128);
+
+    b32 swap = (opcode == IR_Gt || opcode == IR_Geq);
+    if (TypeIsFloatVector(type))
+    {
+        u8 predicate = 0;
+        switch (opcode)
+        {
+        case IR_Eq:             predicate = 0; break;
+        case IR_Lt: case IR_Gt:   predicate = 1; break;
+        case IR_Leq: case IR_Geq: predicate = 2; break;
+        case IR_Neq:            predicate = 4; break;
+        default: INVALID_CODE_PATH;
+        }
+        Amd64_Opcode cmp_op = (type->tag == TYP_f32x4) ? OP_cmpps : OP_cmppd;
+        Operand temp = TempOperand(ctx, target.data_type, AF_Write);
+        PushLoad(ctx, temp, swap ? oper2 : oper1);
+        PushInstruction(ctx, cmp_op, RW_(temp), swap ? oper1 : oper2,
+                ImmOperand(predicate, AF_Read));
+        PushLoad(ctx, target, R_(temp));
+        return;
+    }
+
+    ASSERT(type->tag == TYP_s32x4);
+    // a < b is b > a, a <= b is !(a > b) and a >= b is !(b > a)
+    b32 invert = (opcode == IR_Neq || opcode == IR_Leq || opcode == IR_Geq);
+    swap = (opcode == IR_Lt || opcode == IR_Geq);
+    Amd64_Opcode cmp_op = (opcode == IR_Eq || opcode == IR_Neq) ? OP_pcmpeqd : OP_pcmpgtd;
+    Operand temp = TempOperand(ctx, target.data_type, AF_Write);
+    PushLoad(ctx, temp, swap ? oper2 : oper1);
+    PushInstruction(ctx, cmp_op, RW_(temp), swap ? oper1 : oper2);
+    if (invert)
+    {
+        Operand ones = TempOperand(ctx, target.data_type, AF_Write);
+        PushInstruction(ctx, OP_pcmpeqd, W_(ones), W_(ones));
+        PushInstruction(ctx, OP_pxor, RW_(temp), R_(ones));
+    }
+    PushLoad(ctx, target, R_(temp));
+}
+
+// Copies the scalar to every element of the vector. The integers are moved to
+// an xmm register first.
+static void GenerateBroadcast(Codegen_Context *ctx, Ir_Instruction *ir_instr)
+{
+    Operand target = IrOperand(ctx, &ir_instr->target, AF_Write);
+    Operand source = IrOperand(ctx, &ir_instr->oper1, AF_Read);
+    Type *type = ir_instr->oper1.type;
+    b32 is_64bit = (GetSize(type) == 8);
+    if (!TypeIsFloat(type))
+    {
+        Operand temp = TempOperand(ctx,
+                is_64bit ? Oper_Data_Type::F64 : Oper_Data_Type::F32, AF_Write);
+        PushInstruction(ctx, is_64bit ? OP_movq : OP_movd, temp, source);
+        source = R_(temp);
+    }
+    if (target.data_type == Oper_Data_Type::V256)
+    {
+        Amd64_Opcode op;
+        if (TypeIsFloat(type))
+            op = is_64bit ? OP_vbroadcastsd : OP_vbroadcastss;
+        else
+            op = is_64bit ? OP_vpbroadcastq : OP_vpbroadcastd;
+        PushInstruction(ctx, op, target, source);
+    }
+    else
+    {
+        // NOTE(henrik): The shuffle 0x44 selects the dwords 0, 1, 0, 1 and
+        // 0x00 the dword 0 for every element.
+        u8 order = is_64bit ? 0x44 : 0x00;
+        PushInstruction(ctx, OP_pshufd, target, source, ImmOperand(order, AF_Read));
+    }
+}
+
 static void GenerateArithmetic(Codegen_Context *ctx, Ir_Instruction *ir_instr)
 {
     Type *ltype = ir_instr->oper1.type;
+    if (TypeIsVector(ir_instr->target.type))
+    {
+        GenerateVectorArithmetic(ctx, ir_instr);
+        return;
+    }
     b32 is_float = TypeIsFloat(ltype);
     b32 is_signed = TypeIsSigned(ltype);
     switch (ir_instr->opcode)
@@ -1640,6 +1736,10 @@ static u32 GetSize(Oper_Data_Type data_type)
             return 4;
         case Oper_Data_Type::F64:
             return 8;
+        case Oper_Data_Type::V128:
+            return 16;
+        case Oper_Data_Type::V256:
+            return 32;
     }
     INVALID_CODE_PATH;
     return 0;
@@ -1668,6 +1768,10 @@ static u32 GetAlign(Oper_Data_Type data_type)
             return 4;
         case Oper_Data_Type::F64:
             return 8;
+        case Oper_Data_Type::V128:
+            return 16;
+        case Oper_Data_Type::V256:
+            return 32;
     }
     INVALID_CODE_PATH;
     return 0;
@@ -1685,6 +1789,9 @@ static void SetArgLocalOffset(Codegen_Context *ctx, Name name, s64 offset)
     hashtable::Put(routine->local_offsets, name, offs);
 }
 
+static b32 GetSharedStackSlot(Codegen_Context *ctx, Name name,
+        Oper_Data_Type data_type, s64 *offset);
+
 static s64 GetLocalOffset(Codegen_Context *ctx, Name name, Oper_Data_Type data_type)
 {
     Routine *routine = ctx->current_routine;
@@ -1692,12 +1799,14 @@ static s64 GetLocalOffset(Codegen_Context *ctx, Name name, Oper_Data_Type data_t
     if (offs) return offs->offset;
 
     offs = PushStruct<Local_Offset>(&ctx->arena);
-
-    routine->locals_size += GetSize(data_type);
-    routine->locals_size = Align(routine->locals_size, GetAlign(data_type));
-
     offs->name = name;
-    offs->offset = -routine->locals_size;
+
+    if (!GetSharedStackSlot(ctx, name, data_type, &offs->offset))
+    {
+        routine->locals_size += GetSize(data_type);
+        routine->locals_size = Align(routine->locals_size, GetAlign(data_type));
+        offs->offset = -routine->locals_size;
+    }
 
     hashtable::Put(routine->local_offsets, name, offs);
     return offs->offset;
@@ -1748,6 +1857,100 @@ static void PushOperandUse(Codegen_Context *ctx, Operand_Use **use, const Operan
     *use = oper_use;
 }
 
+// Returns true, if the routine is called with the native calling convention.
+// The toplevel routine is the entry point called from outside the program.
+static b32 UsesNativeCallConv(Ir_Routine *ir_routine)
+{
+    return ir_routine->name.str.size > 0 &&
+        (ir_routine->flags & ROUT_AddressTaken) == 0;
+}
+
+// Returns true, if the call is a direct call to a routine using the native
+// calling convention.
+static b32 IsNativeCall(Codegen_Context *ctx, Ir_Instruction *ir_instr)
+{
+    if (ir_instr->opcode != IR_Call ||
+        ir_instr->oper1.oper_type != IR_OPER_Routine)
+    {
+        return false;
+    }
+    Routine *callee = hashtable::Lookup(ctx->routine_table, ir_instr->oper1.var.name);
+    return callee && UsesNativeCallConv(callee->ir_routine);
+}
+
+// The registers the structs are returned in by the native calling convention.
+static const Amd64_Register struct_return_regs[] = { REG_rax, REG_rdx };
+
+// Gets the data types of the parts of a struct returned in registers by the
+// native calling convention, and returns the count of the parts. Returns 0,
+// if the struct does not fit in the registers, or its last part cannot be
+// loaded with a single move, and is returned as in the platform ABI.
+static s64 GetStructReturnParts(Type *type, Oper_Data_Type *part_types)
+{
+    s64 size = GetSize(type);
+    s64 part_count = 0;
+    for (s64 offset = 0; offset < size; offset += 8)
+    {
+        if (part_count == array_length(struct_return_regs))
+            return 0;
+        s64 part_size = size - offset;
+        switch ((part_size < 8) ? part_size : 8)
+        {
+            case 1: part_types[part_count] = Oper_Data_Type::U8; break;
+            case 2: part_types[part_count] = Oper_Data_Type::U16; break;
+            case 4: part_types[part_count] = Oper_Data_Type::U32; break;
+            case 8: part_types[part_count] = Oper_Data_Type::U64; break;
+            default: return 0;
+        }
+        part_count++;
+    }
+    return part_count;
+}
+
+// Returns the memory operand of the part of a struct at "offset": in the
+// stack slot of a local struct variable, or in the struct pointed to by the
+// operand otherwise.
+static Operand GetStructPart(Codegen_Context *ctx, Ir_Operand *ir_oper,
+        s64 offset, Oper_Data_Type data_type, Oper_Access_Flags access_flags)
+{
+    s64 local_offs;
+    if (ir_oper->oper_type == IR_OPER_Variable &&
+        GetLocalOffset(ctx, ir_oper->var.name, &local_offs) && local_offs < 0)
+    {
+        return BaseOffsetOperand(REG_rbp, local_offs + offset, data_type, access_flags);
+    }
+    Operand part = BaseOffsetOperand(ctx, ir_oper, offset, Oper_Data_Type::PTR, access_flags);
+    part.data_type = data_type;
+    return part;
+}
+
+// Loads the struct returned with the native calling convention to the
+// return registers, and jumps to the epilogue. The jump reads the registers,
+// so that they are not allocated before the return.
+static void PushStructReturn(Codegen_Context *ctx, Ir_Operand *ir_oper,
+        const Oper_Data_Type *part_types, s64 part_count)
+{
+    Operand parts[array_length(struct_return_regs)];
+    for (s64 i = 0; i < part_count; i++)
+    {
+        parts[i] = TempOperand(ctx, part_types[i], AF_Write);
+        PushLoad(ctx, parts[i],
+                GetStructPart(ctx, ir_oper, i * 8, part_types[i], AF_Read));
+    }
+    Operand_Use use_head = { };
+    Operand_Use *use = &use_head;
+    for (s64 i = 0; i < part_count; i++)
+    {
+        Operand ret_oper = FixedRegOperand(ctx,
+                MakeReg(struct_return_regs[i]), part_types[i], AF_Write);
+        PushLoad(ctx, ret_oper, R_(parts[i]));
+        PushOperandUse(ctx, &use, R_(ret_oper));
+    }
+    Instruction *jmp = PushInstruction(ctx, OP_jmp,
+            LabelOperand(ctx->return_label_name, AF_Read));
+    jmp->uses = use_head.next;
+}
+
 static s64 PushArgs(Codegen_Context *ctx,
         Ir_Routine *ir_routine, Ir_Instruction *ir_instr, Operand_Use **uses)
 {
@@ -1759,61 +1962,74 @@ static s64 PushArgs(Codegen_Context *ctx,
             RegOperand(REG_rsp, Oper_Data_Type::U64, AF_ReadWrite));
 
     ASSERT(ir_instr->oper2.oper_type == IR_OPER_Immediate);
-    s64 arg_instr_idx = ir_instr->oper2.imm_s64;
 
+    // NOTE(henrik): The arguments passed in the stack are stored first, so
+    // that the argument registers are not taken, while the stack arguments
+    // still need registers. The native calling convention can pass the
+    // arguments in all the float registers.
     Operand_Use use_head = { };
     Operand_Use *use = &use_head;
-    while (arg_instr_idx != -1)
+    for (s64 pass = 0; pass < 2; pass++)
     {
-        Ir_Instruction *arg_instr = &ir_routine->instructions[arg_instr_idx];
-        ASSERT(arg_instr->opcode == IR_Arg);
-
-        ctx->comment = &arg_instr->comment;
+        b32 reg_args = (pass == 1);
+        arg_reg_index = { };
+        arg_reg_index.native = IsNativeCall(ctx, ir_instr);
 
-        Type *arg_type = arg_instr->target.type;
-        Oper_Data_Type arg_data_type = DataTypeFromType(arg_type);
-        const Reg *arg_reg = GetArgRegister(ctx->reg_alloc, arg_data_type, &arg_reg_index);
-        s64 arg_sp_offset = GetOffsetFromStackPointer(ctx->reg_alloc, arg_reg_index);
-        if (TypeIsStruct(arg_type))
-        {
-            if (arg_reg)
-            {
-                Operand arg_target = FixedRegOperand(ctx, *arg_reg, Oper_Data_Type::PTR, AF_Write);
-                PushLoadAddr(ctx,
-                        arg_target,
-                        R_(GetAddress(ctx, &arg_instr->target)));
-                PushOperandUse(ctx, &use, arg_target);
-            }
-            else
-            {
-                Operand temp = TempOperand(ctx, Oper_Data_Type::PTR, AF_Write);
-                PushLoadAddr(ctx, W_(temp), R_(GetAddress(ctx, &arg_instr->target)));
-                PushLoad(ctx,
-                        BaseOffsetOperand(REG_rsp, arg_sp_offset, temp.data_type, AF_Write),
-                        R_(temp));
-                PushOperandUse(ctx, &use, IrOperand(ctx, &arg_instr->target, AF_Read));
-            }
-        }
-        else
+        s64 arg_instr_idx = ir_instr->oper2.imm_s64;
+        while (arg_instr_idx != -1)
         {
-            if (arg_reg)
+            Ir_Instruction *arg_instr = &ir_routine->instructions[arg_instr_idx];
+            ASSERT(arg_instr->opcode == IR_Arg);
+            ASSERT(arg_instr->oper1.oper_type == IR_OPER_Immediate);
+            arg_instr_idx = arg_instr->oper1.imm_s64;
+
+            Type *arg_type = arg_instr->target.type;
+            Oper_Data_Type arg_data_type = DataTypeFromType(arg_type);
+            const Reg *arg_reg = GetArgRegister(ctx->reg_alloc, arg_data_type, &arg_reg_index);
+            s64 arg_sp_offset = GetOffsetFromStackPointer(ctx->reg_alloc, arg_reg_index);
+            if ((arg_reg != nullptr) != reg_args)
+                continue;
+
+            ctx->comment = &arg_instr->comment;
+
+            if (TypeIsStruct(arg_type))
             {
-                Operand arg_target = FixedRegOperand(ctx, *arg_reg, arg_data_type, AF_Write);
-                Operand arg_oper = IrOperand(ctx, &arg_instr->target, AF_Read);
-                PushLoad(ctx, arg_target, arg_oper);
-                PushOperandUse(ctx, &use, arg_target);
+                if (arg_reg)
+                {
+                    Operand arg_target = FixedRegOperand(ctx, *arg_reg, Oper_Data_Type::PTR, AF_Write);
+                    PushLoadAddr(ctx,
+                            arg_target,
+                            R_(GetAddress(ctx, &arg_instr->target)));
+                    PushOperandUse(ctx, &use, arg_target);
+                }
+                else
+                {
+                    Operand temp = TempOperand(ctx, Oper_Data_Type::PTR, AF_Write);
+                    PushLoadAddr(ctx, W_(temp), R_(GetAddress(ctx, &arg_instr->target)));
+                    PushLoad(ctx,
+                            BaseOffsetOperand(REG_rsp, arg_sp_offset, temp.data_type, AF_Write),
+                            R_(temp));
+                    PushOperandUse(ctx, &use, IrOperand(ctx, &arg_instr->target, AF_Read));
+                }
             }
             else
             {
-                Operand arg_oper = IrOperand(ctx, &arg_instr->target, AF_Read);
-                PushLoad(ctx,
-                        BaseOffsetOperand(REG_rsp, arg_sp_offset, arg_oper.data_type, AF_Write),
-                        arg_oper);
+                if (arg_reg)
+                {
+                    Operand arg_target = FixedRegOperand(ctx, *arg_reg, arg_data_type, AF_Write);
+                    Operand arg_oper = IrOperand(ctx, &arg_instr->target, AF_Read);
+                    PushLoad(ctx, arg_target, arg_oper);
+                    PushOperandUse(ctx, &use, arg_target);
+                }
+                else
+                {
+                    Operand arg_oper = IrOperand(ctx, &arg_instr->target, AF_Read);
+                    PushLoad(ctx,
+                            BaseOffsetOperand(REG_rsp, arg_sp_offset, arg_oper.data_type, AF_Write),
+                            arg_oper);
+                }
             }
         }
-
-        ASSERT(arg_instr->oper1.oper_type == IR_OPER_Immediate);
-        arg_instr_idx = arg_instr->oper1.imm_s64;
     }
 
     *uses = use_head.next;
@@ -1823,6 +2039,36 @@ static s64 PushArgs(Codegen_Context *ctx,
     return arg_stack_alloc;
 }
 
+// Returns true, if the call can jump to the callee after the epilogue. The
+// arguments must be passed in registers, as the stack arguments would be
+// above the frame, that is torn down, and the frame must not be referred to
+// by the arguments.
+static b32 CanJumpToCallee(Ir_Routine *ir_routine, Ir_Instruction *ir_instr,
+        s64 arg_stack_alloc)
+{
+    if (ir_routine->name.str.size == 0)
+        return false;
+    if (arg_stack_alloc != 0)
+        return false;
+    if (ir_instr->oper1.oper_type != IR_OPER_Routine &&
+        ir_instr->oper1.oper_type != IR_OPER_ForeignRoutine)
+    {
+        return false;
+    }
+    if (TypeIsStruct(ir_instr->target.type))
+        return false;
+    s64 arg_index = ir_instr->oper2.imm_s64;
+    while (arg_index != -1)
+    {
+        Ir_Instruction *arg_instr = &ir_routine->instructions[arg_index];
+        if (TypeIsStruct(arg_instr->target.type))
+            return false;
+        arg_index = arg_instr->oper1.imm_s64;
+    }
+    s64 index = ir_instr - ir_routine->instructions.data;
+    return IsTailCall(ir_routine, index) && !HasLocalAddresses(ir_routine);
+}
+
 static void AddLocal(Codegen_Context *ctx, Ir_Operand *ir_oper)
 {
     if (TypeIsStruct(ir_oper->type))
@@ -1872,6 +2118,22 @@ static void Copy(Codegen_Context *ctx,
     }
 }
 
+// Returns the offset of the element, if the element instruction has a
+// constant index, and the offset fits in the displacement of an address.
+static b32 GetConstElementOffset(Ir_Instruction *ir_instr, s64 *offset)
+{
+    Ir_Operand *index = &ir_instr->oper2;
+    if (index->oper_type != IR_OPER_Immediate || !TypeIsIntegral(index->type))
+        return false;
+    s64 value = (s64)NormalizeIrValue(index->type, index->imm_u64);
+    s64 size = GetAlignedElementSize(ir_instr->oper1.type);
+    const s64 max_offset = 0x7fffffff;
+    if (value > max_offset / size || value < -max_offset / size)
+        return false;
+    *offset = value * size;
+    return true;
+}
+
 static void GenerateCode(Codegen_Context *ctx, Ir_Routine *routine,
         Ir_Instruction *ir_instr, Ir_Instruction *ir_next_instr,
         bool *skip_next)
@@ -1879,6 +2141,7 @@ static void GenerateCode(Codegen_Context *ctx, Ir_Routine *routine,
     switch (ir_instr->opcode)
     {
         case IR_COUNT:
+        case IR_Phi:
             INVALID_CODE_PATH;
             break;
 
@@ -1899,6 +2162,25 @@ static void GenerateCode(Codegen_Context *ctx, Ir_Routine *routine,
             GenerateArithmetic(ctx, ir_instr);
             break;
 
+        case IR_Broadcast:
+            GenerateBroadcast(ctx, ir_instr);
+            break;
+
+        case IR_Shuffle:
+            PushInstruction(ctx, OP_pshufd,
+                    IrOperand(ctx, &ir_instr->target, AF_Write),
+                    IrOperand(ctx, &ir_instr->oper1, AF_Read),
+                    ImmOperand((u8)ir_instr->oper2.imm_u64, AF_Read));
+            break;
+        case IR_MoveMask:
+            {
+                Type *type = ir_instr->oper1.type;
+                b32 is_64bit = (type->tag == TYP_f64x2 || type->tag == TYP_s64x2);
+                PushInstruction(ctx, is_64bit ? OP_movmskpd : OP_movmskps,
+                        IrOperand(ctx, &ir_instr->target, AF_Write),
+                        IrOperand(ctx, &ir_instr->oper1, AF_Read));
+            } break;
+
         case IR_Eq: case IR_Neq:
         case IR_Lt: case IR_Leq:
         case IR_Gt: case IR_Geq:
@@ -2055,9 +2337,15 @@ static void GenerateCode(Codegen_Context *ctx, Ir_Routine *routine,
             {
                 Operand target = IrOperand(ctx, &ir_instr->target, AF_Write);
                 s64 size = GetAlignedElementSize(ir_instr->oper1.type);
+                s64 offset;
+                if (GetConstElementOffset(ir_instr, &offset))
+                {
+                    PushLoad(ctx, target,
+                            BaseOffsetOperand(ctx, &ir_instr->oper1, offset, target.data_type, AF_Read));
+                }
                 // NOTE(henrik): If the size is valid as index scale, we will
                 // emit only one instruction.
-                if (size == 1 || size == 2 || size == 4 || size == 8)
+                else if (size == 1 || size == 2 || size == 4 || size == 8)
                 {
                     PushLoad(ctx, target,
                             BaseIndexOffsetOperand(ctx, &ir_instr->oper1, 0, target.data_type, AF_Read),
@@ -2084,9 +2372,15 @@ static void GenerateCode(Codegen_Context *ctx, Ir_Routine *routine,
                 Operand target = IrOperand(ctx, &ir_instr->target, AF_Write);
                 s64 size = GetAlignedElementSize(ir_instr->oper1.type);
                 ASSERT(target.data_type == Oper_Data_Type::PTR);
+                s64 offset;
+                if (GetConstElementOffset(ir_instr, &offset))
+                {
+                    PushLoadAddr(ctx, target,
+                            BaseOffsetOperand(ctx, &ir_instr->oper1, offset, target.data_type, AF_Read));
+                }
                 // NOTE(henrik): If the size is valid as index scale, we will
                 // emit only one instruction.
-                if (size == 1 || size == 2 || size == 4 || size == 8)
+                else if (size == 1 || size == 2 || size == 4 || size == 8)
                 {
                     PushLoadAddr(ctx, target,
                             BaseIndexOffsetOperand(ctx, &ir_instr->oper1, 0, target.data_type, AF_Read),
@@ -2121,10 +2415,48 @@ static void GenerateCode(Codegen_Context *ctx, Ir_Routine *routine,
                 Instruction *call = PushInstruction(ctx,
                         OP_call, IrOperand(ctx, &ir_instr->oper1, AF_Read));
                 call->uses = uses;
+                if (ir_instr->opcode == IR_CallForeign)
+                    call->flags |= IF_ForeignCall;
+                if (CanJumpToCallee(routine, ir_instr, arg_stack_alloc))
+                    call->flags |= IF_TailCall;
                 PushInstruction(ctx, OP_add,
                         RegOperand(REG_rsp, Oper_Data_Type::U64, AF_ReadWrite),
                         ImmOperand(arg_stack_alloc, AF_Read));
-                if (ir_instr->target.oper_type != IR_OPER_None)
+                Oper_Data_Type part_types[array_length(struct_return_regs)];
+                s64 part_count = 0;
+                if (TypeIsStruct(ir_instr->target.type) && IsNativeCall(ctx, ir_instr))
+                    part_count = GetStructReturnParts(ir_instr->target.type, part_types);
+                if (part_count > 0)
+                {
+                    // NOTE(henrik): The struct is stored from the return
+                    // registers to the stack slot of the call result, which
+                    // is then referred to by its address, like the structs
+                    // returned as in the platform ABI.
+                    Routine *current = ctx->current_routine;
+                    if (!hashtable::Lookup(current->local_offsets, ir_instr->target.var.name))
+                        AddLocal(ctx, &ir_instr->target);
+                    Operand address = GetAddress(ctx, &ir_instr->target);
+                    Operand ret_opers[array_length(struct_return_regs)];
+                    for (s64 i = 0; i < part_count; i++)
+                    {
+                        ret_opers[i] = FixedRegOperand(ctx,
+                                MakeReg(struct_return_regs[i]), part_types[i], AF_Write);
+                    }
+                    call->oper2 = S_(ret_opers[0]);
+                    if (part_count > 1)
+                        call->oper3 = S_(ret_opers[1]);
+                    for (s64 i = 0; i < part_count; i++)
+                    {
+                        Operand part = BaseOffsetOperand(REG_rbp,
+                                address.scale_offset + i * 8, part_types[i], AF_Write);
+                        Instruction *store = PushLoad(ctx, part, R_(ret_opers[i]));
+                        if (i == 0) store->uses = uses;
+                    }
+                    PushLoadAddr(ctx,
+                            IrOperand(ctx, &ir_instr->target, AF_Write),
+                            R_(address));
+                }
+                else if (ir_instr->target.oper_type != IR_OPER_None)
                 {
                     Oper_Data_Type data_type = DataTypeFromType(ir_instr->target.type);
                     const Reg *ret_reg = GetReturnRegister(ctx->reg_alloc, data_type, 0);
@@ -2154,6 +2486,16 @@ static void GenerateCode(Codegen_Context *ctx, Ir_Routine *routine,
             PushInstruction(ctx, OP_jne, LabelOperand(&ir_instr->target, AF_Read));
             break;
         case IR_Return:
+            if (TypeIsStruct(ir_instr->target.type) && UsesNativeCallConv(routine))
+            {
+                Oper_Data_Type part_types[array_length(struct_return_regs)];
+                s64 part_count = GetStructReturnParts(ir_instr->target.type, part_types);
+                if (part_count > 0)
+                {
+                    PushStructReturn(ctx, &ir_instr->target, part_types, part_count);
+                    break;
+                }
+            }
             if (ir_instr->target.oper_type != IR_OPER_None)
             {
                 Oper_Data_Type data_type = DataTypeFromType(ir_instr->target.type);
@@ -2166,6 +2508,13 @@ static void GenerateCode(Codegen_Context *ctx, Ir_Routine *routine,
             break;
 
         case IR_S_TO_F32:
+            if (TypeIsVector(ir_instr->target.type))
+            {
+                PushInstruction(ctx, OP_cvtdq2ps,
+                        IrOperand(ctx, &ir_instr->target, AF_Write),
+                        IrOperand(ctx, &ir_instr->oper1, AF_Read));
+            }
+            else
             {
                 Operand source = IrOperand(ctx, &ir_instr->oper1, AF_Read);
                 if (GetSize(source.data_type) < 4)
@@ -2190,6 +2539,14 @@ static void GenerateCode(Codegen_Context *ctx, Ir_Routine *routine,
             }
             break;
         case IR_F32_TO_S:
+            if (TypeIsVector(ir_instr->target.type))
+            {
+                // NOTE(henrik): cvtps2dq rounds as the scalar cvtss2si.
+                PushInstruction(ctx, OP_cvtps2dq,
+                        IrOperand(ctx, &ir_instr->target, AF_Write),
+                        IrOperand(ctx, &ir_instr->oper1, AF_Read));
+            }
+            else
             {
                 Operand target = IrOperand(ctx, &ir_instr->target, AF_Write);
                 Operand source = IrOperand(ctx, &ir_instr->oper1, AF_Read);
@@ -2257,21 +2614,6 @@ static void CollectLabelInstructions(Codegen_Context *ctx, Routine *routine)
     }
 }
 
-struct Name_Data_Type
-{
-    Name name;
-    Reg fixed_reg;
-    Oper_Data_Type data_type;
-    b32 spilled;
-    b32 arg;
-};
-
-struct Live_Sets
-{
-    Array<Name_Data_Type> live_in;
-    Array<Name_Data_Type> live_out;
-};
-
 struct Cfg_Edge
 {
     s32 instr_index;
@@ -2283,106 +2625,27 @@ struct Cfg_Edge
 };
 
 
-static b32 SetAddSpilled(Array<Name_Data_Type> &set, Name name, Oper_Data_Type data_type)
-{
-    for (s64 i = 0; i < set.count; i++)
-    {
-        if (set[i].name == name) return false;
-    }
-    Name_Data_Type nd = { };
-    nd.name = name;
-    nd.fixed_reg = { };
-    nd.data_type = data_type;
-    nd.spilled = true;
-    array::Push(set, nd);
-    return true;
-}
-
-static b32 SetAddArg(Array<Name_Data_Type> &set, Name name, Oper_Data_Type data_type, Reg fixed_reg = { })
-{
-    for (s64 i = 0; i < set.count; i++)
-    {
-        if (set[i].name == name) return false;
-    }
-    Name_Data_Type nd = { };
-    nd.name = name;
-    nd.fixed_reg = fixed_reg;
-    nd.data_type = data_type;
-    nd.arg = true;
-    array::Push(set, nd);
-    return true;
-}
-
-static b32 SetAdd(Array<Name_Data_Type> &set, Name name, Oper_Data_Type data_type, Reg fixed_reg = { })
+static Name GetOperName(Operand oper)
 {
-    for (s64 i = 0; i < set.count; i++)
+    Name name = { };
+    switch (oper.type)
     {
-        if (set[i].name == name) return false;
+        default: break;
+        //case Oper_Type::FixedRegister:      name = oper.fixed_reg.name; break;
+        //case Oper_Type::VirtualRegister:    name = oper.virtual_reg.name; break;
+        case Oper_Type::FixedRegister:
+        case Oper_Type::VirtualRegister:
+            name = oper.name;
+            break;
     }
-    Name_Data_Type nd = { };
-    nd.name = name;
-    nd.fixed_reg = fixed_reg;
-    nd.data_type = data_type;
-    array::Push(set, nd);
-    return true;
+    return name;
 }
 
-static b32 SetUnion(Array<Name_Data_Type> &a, const Array<Name_Data_Type> &b)
+static Name GetOperName(Operand oper, Reg *fixed_reg)
 {
-    b32 any_new = false;
-    for (s64 i = 0; i < b.count; i++)
-    {
-        Name_Data_Type nd = b[i];
-        any_new |= SetAdd(a, nd.name, nd.data_type, nd.fixed_reg);
-    }
-    return any_new;
-}
-
-static b32 SetUnion(Array<Name_Data_Type> &a, const Array<Name_Data_Type> &b, Name *exclude_names, s64 exclude_count)
-{
-    b32 any_new = false;
-    for (s64 i = 0; i < b.count; i++)
-    {
-        Name name = b[i].name;
-        b32 excluded = false;
-        for (s64 e = 0; e < exclude_count; e++)
-        {
-            if (name == exclude_names[e])
-            {
-                excluded = true;
-                break;
-            }
-        }
-        if (!excluded)
-        {
-            Name_Data_Type nd = b[i];
-            any_new |= SetAdd(a, nd.name, nd.data_type, nd.fixed_reg);
-        }
-    }
-    return any_new;
-}
-
-static Name GetOperName(Operand oper)
-{
-    Name name = { };
-    switch (oper.type)
-    {
-        default: break;
-        //case Oper_Type::FixedRegister:      name = oper.fixed_reg.name; break;
-        //case Oper_Type::VirtualRegister:    name = oper.virtual_reg.name; break;
-        case Oper_Type::FixedRegister:
-        case Oper_Type::VirtualRegister:
-            name = oper.name;
-            break;
-    }
-    return name;
-}
-
-static Name GetOperName(Operand oper, Reg *fixed_reg)
-{
-    Name name = { };
-    *fixed_reg = { };
-    switch (oper.type)
+    Name name = { };
+    *fixed_reg = { };
+    switch (oper.type)
     {
         default: break;
         //case Oper_Type::FixedRegister:
@@ -2403,264 +2666,771 @@ static Name GetOperName(Operand oper, Reg *fixed_reg)
     return name;
 }
 
-static b32 AddOper(Array<Name_Data_Type> &set, Operand oper, Oper_Access_Flags access_flags)
+static void PrintInstruction(IoFile *file, const Instruction *instr);
+
+
+// Liveness analysis
+
+// NOTE(henrik): The virtual registers of a routine are numbered densely in the
+// order they first appear, so that the live sets can be bit vectors.
+struct Live_Vreg
 {
-    if ((oper.access_flags & access_flags) != 0)
+    Name name;
+    s32 index;
+    Reg fixed_reg;
+    Oper_Data_Type data_type;   // The data type of the first appearance
+    s32 *uses;                  // The instructions reading or writing it
+    s32 use_count;
+    s32 kill_count;             // The instructions overwriting it
+    s32 kill_instr;             // The last of them
+    const Instruction *remat;   // The rematerializable definition
+};
+
+struct Live_Def
+{
+    s32 vreg;
+    Oper_Data_Type data_type;
+};
+
+struct Live_Arg
+{
+    s32 vreg;
+    Reg reg;
+    Oper_Data_Type data_type;
+    b32 spilled;
+};
+
+// The virtual registers read, written and overwritten by an instruction. A
+// register used in a memory operand is written, but not overwritten.
+struct Live_Instr
+{
+    s32 reads_start, reads_end;
+    s32 def_count;
+    s32 kill_count;
+    Live_Def defs[3];
+    s32 kills[3];
+};
+
+struct Basic_Block
+{
+    s32 start, end;
+    s32 succ_count;
+    s32 succs[2];
+    Array<s32> preds;
+};
+
+struct Liveness
+{
+    Memory_Arena arena;
+    Array<Live_Vreg*> vreg_table;
+    Array<Live_Vreg*> vregs;
+    Array<Live_Arg> args;
+
+    Array<s32> reads;
+    Live_Instr *instrs;
+    s32 *branch_targets;
+
+    Array<Basic_Block> blocks;
+    s32 *block_of;
+
+    // The live sets; set_words u64 words per set.
+    s64 set_words;
+    u64 *gen;
+    u64 *kill;
+    u64 *live_in;
+    u64 *live_out;
+};
+
+static inline u64* LiveSet(u64 *sets, s64 set_words, s64 index)
+{
+    return sets + index * set_words;
+}
+
+static inline void SetBit(u64 *set, s32 bit)
+{
+    set[bit >> 6] |= (u64)1 << (bit & 63);
+}
+
+static inline void ClearBit(u64 *set, s32 bit)
+{
+    set[bit >> 6] &= ~((u64)1 << (bit & 63));
+}
+
+static inline b32 TestBit(const u64 *set, s32 bit)
+{
+    return (set[bit >> 6] >> (bit & 63)) & 1;
+}
+
+static s32 GetVirtualReg(Liveness *lv, Operand oper, Oper_Data_Type *data_type)
+{
+    Reg fixed_reg = { };
+    Name name = GetOperName(oper, &fixed_reg);
+    if (name.str.size == 0) return -1;
+
+    *data_type = oper.data_type;
+    if (oper.addr_mode != Oper_Addr_Mode::Direct)
+        *data_type = Oper_Data_Type::PTR;
+
+    Live_Vreg *vreg = hashtable::Lookup(lv->vreg_table, name);
+    if (!vreg)
     {
-        Reg fixed_reg = { };
-        Name name = GetOperName(oper, &fixed_reg);
-        if (name.str.size != 0)
+        vreg = PushStruct<Live_Vreg>(&lv->arena);
+        *vreg = { };
+        vreg->name = name;
+        vreg->index = lv->vregs.count;
+        vreg->fixed_reg = fixed_reg;
+        vreg->data_type = *data_type;
+        hashtable::Put(lv->vreg_table, name, vreg);
+        array::Push(lv->vregs, vreg);
+    }
+    return vreg->index;
+}
+
+static void AddRead(Liveness *lv, Operand oper, Oper_Access_Flags access_flags)
+{
+    if ((oper.access_flags & access_flags) == 0) return;
+    Oper_Data_Type data_type;
+    s32 vreg = GetVirtualReg(lv, oper, &data_type);
+    if (vreg >= 0)
+        array::Push(lv->reads, vreg);
+}
+
+static void AddWrite(Liveness *lv, Live_Instr *li, Operand oper)
+{
+    if ((oper.access_flags & AF_Write) == 0) return;
+    Oper_Data_Type data_type;
+    s32 vreg = GetVirtualReg(lv, oper, &data_type);
+    if (vreg < 0) return;
+
+    Live_Def def = { };
+    def.vreg = vreg;
+    def.data_type = data_type;
+    li->defs[li->def_count++] = def;
+    if (oper.addr_mode == Oper_Addr_Mode::Direct)
+        li->kills[li->kill_count++] = vreg;
+}
+
+// Returns true, if the instruction loads a constant, that can be loaded again
+// instead of reloading it from a stack slot: an immediate, the address of a
+// global or a routine, or a float constant. The loads do not change the flags,
+// so they can be inserted anywhere.
+static b32 IsRematerializable(Codegen_Context *ctx, const Instruction *instr)
+{
+    if (instr->oper1.type != Oper_Type::VirtualRegister ||
+        instr->oper1.addr_mode != Oper_Addr_Mode::Direct ||
+        instr->oper3.type != Oper_Type::None || instr->uses)
+    {
+        return false;
+    }
+    Operand src = instr->oper2;
+    switch ((Amd64_Opcode)instr->opcode)
+    {
+    default: break;
+    case OP_mov:
+        return src.type == Oper_Type::Immediate;
+    case OP_lea:
+        return src.type == Oper_Type::Label &&
+            src.addr_mode == Oper_Addr_Mode::BaseOffset;
+    case OP_movss:
+        if (src.type != Oper_Type::Label) break;
+        for (s64 i = 0; i < ctx->float32_consts.count; i++)
         {
-            Oper_Data_Type data_type = oper.data_type;
-            if (oper.addr_mode != Oper_Addr_Mode::Direct)
-                data_type = Oper_Data_Type::PTR;
-            return SetAdd(set, name, data_type, fixed_reg);
+            if (ctx->float32_consts[i].label_name == src.name)
+                return true;
         }
+        break;
+    case OP_movsd:
+        if (src.type != Oper_Type::Label) break;
+        for (s64 i = 0; i < ctx->float64_consts.count; i++)
+        {
+            if (ctx->float64_consts[i].label_name == src.name)
+                return true;
+        }
+        break;
     }
     return false;
 }
 
-static void PrintInstruction(IoFile *file, const Instruction *instr);
-
-static void FreeLiveSets(Array<Live_Sets> &live_sets)
+// Finds the virtual registers, that are written once with a rematerializable
+// instruction. The arguments and the registers spilled for taking their
+// address are excluded, as their value is also in the stack.
+static void CollectRematDefs(Codegen_Context *ctx, Routine *routine, Liveness *lv)
 {
-    for (s64 i = 0; i < live_sets.count; i++)
+    Instruction_List &instructions = routine->instructions;
+    for (s64 v = 0; v < lv->vregs.count; v++)
     {
-        array::Free(live_sets[i].live_in);
-        array::Free(live_sets[i].live_out);
+        Live_Vreg *vreg = lv->vregs[v];
+        if (vreg->kill_count != 1 || vreg->fixed_reg.reg_index != REG_NONE)
+            continue;
+        const Instruction *def = instructions[vreg->kill_instr];
+        if (IsRematerializable(ctx, def))
+            vreg->remat = def;
+    }
+    for (s64 a = 0; a < lv->args.count; a++)
+        lv->vregs[lv->args[a].vreg]->remat = nullptr;
+    for (s64 i = 0; i < instructions.count; i++)
+    {
+        if ((Amd64_Opcode)instructions[i]->opcode != OP_SPILL) continue;
+        Live_Vreg *vreg = hashtable::Lookup(lv->vreg_table,
+                GetOperName(instructions[i]->oper1));
+        if (vreg) vreg->remat = nullptr;
     }
-    array::Free(live_sets);
 }
 
-static void ComputeLiveness(Codegen_Context *ctx,
-        Ir_Routine *ir_routine, Routine *routine,
-        Array<Live_Interval*> &live_intervals,
-        Array<Cfg_Edge> &cfg_edges)
+// Numbers the virtual registers and collects the reads and writes of each
+// instruction.
+static void CollectLiveInstrs(Codegen_Context *ctx,
+        Ir_Routine *ir_routine, Routine *routine, Liveness *lv)
 {
     Instruction_List &instructions = routine->instructions;
 
-    Array<Live_Sets> live_sets = { };
-    array::Resize(live_sets, instructions.count);
-
-    // Add argument registers to the first instructions live out set.
-    Live_Sets &entry = live_sets[0];
+    // NOTE(henrik): The table is sized up front, as the hashtable grows only
+    // when it gets full.
+    s64 oper_count = ir_routine->arg_count + instructions.count * 3;
+    for (s64 i = 0; i < instructions.count; i++)
+    {
+        for (Operand_Use *use = instructions[i]->uses; use; use = use->next)
+            oper_count++;
+    }
+    array::Resize(lv->vreg_table, oper_count * 2 + 1);
 
     Reg_Seq_Index arg_reg_index = { };
+    arg_reg_index.native = UsesNativeCallConv(ir_routine);
     for (s64 i = 0; i < ir_routine->arg_count; i++)
     {
         Ir_Operand *arg = &ir_routine->args[i];
         Oper_Data_Type data_type = DataTypeFromType(arg->type);
         const Reg *arg_reg = GetArgRegister(ctx->reg_alloc, data_type, &arg_reg_index);
+
+        Live_Arg live_arg = { };
+        live_arg.data_type = data_type;
         if (arg_reg)
         {
-            SetAddArg(entry.live_out, arg->var.name, data_type, *arg_reg);
+            live_arg.reg = *arg_reg;
         }
-        else if (i >= ctx->reg_alloc->shadow_arg_reg_count)
+        else if (arg_reg_index.native || i >= ctx->reg_alloc->shadow_arg_reg_count)
+        {
+            live_arg.spilled = true;
+        }
+        else
         {
-            SetAddSpilled(entry.live_out, arg->var.name, data_type);
+            continue;
         }
+        Oper_Data_Type vreg_data_type;
+        live_arg.vreg = GetVirtualReg(lv,
+                VirtualRegOperand(arg->var.name, data_type, AF_Write), &vreg_data_type);
+        array::Push(lv->args, live_arg);
     }
 
-    bool changed = true;
-    while (changed)
+    lv->instrs = PushArray<Live_Instr>(&lv->arena, instructions.count);
+    for (s64 i = 0; i < instructions.count; i++)
     {
-        changed = false;
-        for (s64 i = 0; i < instructions.count; i++)
+        Instruction *instr = instructions[i];
+        Live_Instr *li = &lv->instrs[i];
+        *li = { };
+
+        li->reads_start = lv->reads.count;
+        AddRead(lv, instr->oper1, AF_Read);
+        AddRead(lv, instr->oper2, AF_Read);
+        AddRead(lv, instr->oper3, AF_Read);
+        for (Operand_Use *use = instr->uses; use; use = use->next)
         {
-            Instruction *instr = instructions[i];
-            Instruction *next_instr = nullptr;
-            s64 next_i = -1;
-            for (s64 n = i + 1; n < instructions.count; n++)
-            {
-                Instruction *next = instructions[n];
-                if ((Amd64_Opcode)next->opcode != OP_LABEL)
-                {
-                    next_instr = next;
-                    next_i = n;
-                    break;
-                }
-            }
+            // NOTE(henrik): the operands are reads, but their access flags
+            // may not be set as reads, thus use AF_ReadWrite for now.
+            AddRead(lv, use->oper, AF_ReadWrite);
+        }
+        li->reads_end = lv->reads.count;
 
-            changed |= AddOper(live_sets[i].live_in, instr->oper1, AF_Read);
-            changed |= AddOper(live_sets[i].live_in, instr->oper2, AF_Read);
-            changed |= AddOper(live_sets[i].live_in, instr->oper3, AF_Read);
+        AddWrite(lv, li, instr->oper1);
+        AddWrite(lv, li, instr->oper2);
+        AddWrite(lv, li, instr->oper3);
+        for (s32 k = 0; k < li->kill_count; k++)
+        {
+            Live_Vreg *vreg = lv->vregs[li->kills[k]];
+            vreg->kill_count++;
+            vreg->kill_instr = i;
+        }
+    }
+}
 
-            for (Operand_Use *use = instr->uses; use; use = use->next)
-            {
-                // NOTE(henrik): the operands are reads, but their access flags
-                // may not be set as reads, thus use AF_ReadWrite for now.
-                changed |= AddOper(live_sets[i].live_in, use->oper, AF_ReadWrite);
-            }
+static void AddUse(Live_Vreg *vreg, s32 instr_index)
+{
+    if (vreg->use_count > 0 && vreg->uses[vreg->use_count - 1] == instr_index)
+        return;
+    vreg->uses[vreg->use_count++] = instr_index;
+}
 
-            Name writes[3] = { };
-            if (instr->oper1.addr_mode == Oper_Addr_Mode::Direct && (instr->oper1.access_flags & AF_Write) != 0)
-                writes[0] = GetOperName(instr->oper1);
-            if (instr->oper2.addr_mode == Oper_Addr_Mode::Direct && (instr->oper2.access_flags & AF_Write) != 0)
-                writes[1] = GetOperName(instr->oper2);
-            if (instr->oper3.addr_mode == Oper_Addr_Mode::Direct && (instr->oper3.access_flags & AF_Write) != 0)
-                writes[2] = GetOperName(instr->oper3);
+// Collects the use positions of the virtual registers for the splitting of
+// the live intervals. The positions are allocated from the codegen arena, as
+// the intervals refer to them after the liveness is freed.
+static void CollectUsePositions(Codegen_Context *ctx, Liveness *lv, s32 instr_count)
+{
+    s32 *counts = PushArray<s32>(&lv->arena, lv->vregs.count);
+    memset(counts, 0, lv->vregs.count * sizeof(s32));
+    for (s32 i = 0; i < instr_count; i++)
+    {
+        Live_Instr *li = &lv->instrs[i];
+        for (s32 r = li->reads_start; r < li->reads_end; r++)
+            counts[lv->reads[r]]++;
+        for (s32 d = 0; d < li->def_count; d++)
+            counts[li->defs[d].vreg]++;
+    }
+    for (s64 v = 0; v < lv->vregs.count; v++)
+    {
+        Live_Vreg *vreg = lv->vregs[v];
+        vreg->uses = PushArray<s32>(&ctx->arena, counts[v]);
+        vreg->use_count = 0;
+    }
+    for (s32 i = 0; i < instr_count; i++)
+    {
+        Live_Instr *li = &lv->instrs[i];
+        for (s32 r = li->reads_start; r < li->reads_end; r++)
+            AddUse(lv->vregs[lv->reads[r]], i);
+        for (s32 d = 0; d < li->def_count; d++)
+            AddUse(lv->vregs[li->defs[d].vreg], i);
+    }
+}
 
-            changed |= SetUnion(live_sets[i].live_in, live_sets[i].live_out, writes, 3);
+static void AddBlockEdge(Liveness *lv, s32 from, s32 to)
+{
+    Basic_Block *block = &lv->blocks[from];
+    for (s32 i = 0; i < block->succ_count; i++)
+    {
+        if (block->succs[i] == to) return;
+    }
+    block->succs[block->succ_count++] = to;
+    array::Push(lv->blocks[to].preds, from);
+}
 
-            changed |= AddOper(live_sets[i].live_out, instr->oper1, AF_Write);
-            changed |= AddOper(live_sets[i].live_out, instr->oper2, AF_Write);
-            changed |= AddOper(live_sets[i].live_out, instr->oper3, AF_Write);
+// Splits the instructions to basic blocks. A block begins at a branch target
+// and after an instruction that does not fall through to the next one.
+static void CollectBasicBlocks(Routine *routine, Liveness *lv)
+{
+    Instruction_List &instructions = routine->instructions;
+    s64 instr_count = instructions.count;
 
-            if (((instr->flags & IF_FallsThrough) != 0) && next_instr)
-            {
-                changed |= SetUnion(live_sets[i].live_out, live_sets[next_i].live_in);
-            }
-            if ((instr->flags & IF_Branch) != 0)
+    lv->branch_targets = PushArray<s32>(&lv->arena, instr_count);
+    u8 *leaders = PushArray<u8>(&lv->arena, instr_count);
+    memset(leaders, 0, instr_count);
+    leaders[0] = 1;
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Instruction *instr = instructions[i];
+        lv->branch_targets[i] = -1;
+        if ((instr->flags & IF_Branch) != 0)
+        {
+            ASSERT(instr->oper1.type == Oper_Type::Label);
+            Name label_name = instr->oper1.name;
+            const Label_Instr *label = hashtable::Lookup(routine->labels, label_name);
+            ASSERT(label != nullptr);
+            if (label->instr && label->instr_index < instr_count)
             {
-                ASSERT(instr->oper1.type == Oper_Type::Label);
-                //Name label_name = instr->oper1.label.name;
-                Name label_name = instr->oper1.name;
-                const Label_Instr *li = hashtable::Lookup(routine->labels, label_name);
-                ASSERT(li != nullptr);
-                if (li->instr)
-                {
-                    s64 label_instr_i = li->instr_index;
-                    //while (label_instr_i < instructions.count &&
-                    //    (Amd64_Opcode)instructions[label_instr_i]->opcode == OP_LABEL)
-                    //{
-                    //    label_instr_i++;
-                    //}
-                    if (label_instr_i < live_sets.count)
-                        changed |= SetUnion(live_sets[i].live_out, live_sets[label_instr_i].live_in);
-                }
+                lv->branch_targets[i] = label->instr_index;
+                leaders[label->instr_index] = 1;
             }
         }
+        if (((instr->flags & IF_Branch) != 0 || (instr->flags & IF_FallsThrough) == 0) &&
+            i + 1 < instr_count)
+        {
+            leaders[i + 1] = 1;
+        }
     }
 
-    // Collect CFG edges
-    for (s64 current_I = 0; current_I < instructions.count; current_I++)
+    lv->block_of = PushArray<s32>(&lv->arena, instr_count);
+    for (s64 i = 0; i < instr_count; i++)
     {
-        Instruction *instr = instructions[current_I];
-        if ((instr->flags & IF_Branch) != 0)
+        if (leaders[i])
         {
-            ASSERT(instr->oper1.type == Oper_Type::Label);
-            //Name label_name = instr->oper1.label.name;
-            Name label_name = instr->oper1.name;
-            const Label_Instr *li = hashtable::Lookup(routine->labels, label_name);
-            ASSERT(li != nullptr);
-            s64 label_instr_index = -1;
-            if (li->instr)
+            Basic_Block block = { };
+            block.start = i;
+            array::Push(lv->blocks, block);
+        }
+        s32 block_index = lv->blocks.count - 1;
+        lv->blocks[block_index].end = i + 1;
+        lv->block_of[i] = block_index;
+    }
+
+    for (s32 b = 0; b < lv->blocks.count; b++)
+    {
+        s32 last = lv->blocks[b].end - 1;
+        Instruction *instr = instructions[last];
+        if ((instr->flags & IF_FallsThrough) != 0 && last + 1 < instr_count)
+            AddBlockEdge(lv, b, lv->block_of[last + 1]);
+        if (lv->branch_targets[last] != -1)
+            AddBlockEdge(lv, b, lv->block_of[lv->branch_targets[last]]);
+    }
+}
+
+// Computes the registers read before written (gen) and overwritten (kill) in
+// each block, by composing the transfer functions of the instructions from the
+// end of the block.
+static void ComputeBlockGenKill(Liveness *lv)
+{
+    s64 set_words = lv->set_words;
+    for (s64 b = 0; b < lv->blocks.count; b++)
+    {
+        Basic_Block &block = lv->blocks[b];
+        u64 *gen = LiveSet(lv->gen, set_words, b);
+        u64 *kill = LiveSet(lv->kill, set_words, b);
+        for (s32 i = block.end - 1; i >= block.start; i--)
+        {
+            Live_Instr *li = &lv->instrs[i];
+            for (s32 d = 0; d < li->def_count; d++)
+            {
+                SetBit(gen, li->defs[d].vreg);
+            }
+            if (i == 0)
             {
-                label_instr_index = li->instr_index;
+                for (s64 a = 0; a < lv->args.count; a++)
+                    SetBit(gen, lv->args[a].vreg);
             }
+            for (s32 k = 0; k < li->kill_count; k++)
+            {
+                ClearBit(gen, li->kills[k]);
+                SetBit(kill, li->kills[k]);
+            }
+            for (s32 r = li->reads_start; r < li->reads_end; r++)
+            {
+                SetBit(gen, lv->reads[r]);
+            }
+        }
+    }
+}
 
-            Cfg_Edge edge = { };
-            edge.instr_index = current_I;
-            edge.branch_instr_index = label_instr_index;
-            edge.falls_through = (instr->flags & IF_FallsThrough) != 0;
+// Orders the blocks in postorder of a depth first search from the entry
+// block. The blocks not reachable from the entry come last.
+static void PostorderBlocks(Liveness *lv, Array<s32> &order)
+{
+    s32 block_count = lv->blocks.count;
+    u8 *visited = PushArray<u8>(&lv->arena, block_count);
+    s32 *stack = PushArray<s32>(&lv->arena, block_count);
+    s32 *next_succ = PushArray<s32>(&lv->arena, block_count);
+    memset(visited, 0, block_count);
 
+    for (s32 root = 0; root < block_count; root++)
+    {
+        if (visited[root]) continue;
+        s32 top = 0;
+        stack[top++] = root;
+        visited[root] = 1;
+        next_succ[root] = 0;
+        while (top > 0)
+        {
+            s32 b = stack[top - 1];
+            Basic_Block &block = lv->blocks[b];
+            if (next_succ[b] < block.succ_count)
             {
-                Live_Sets ls = live_sets[current_I];
-                for (s64 i = 0; i < ls.live_in.count; i++)
+                s32 succ = block.succs[next_succ[b]++];
+                if (!visited[succ])
                 {
-                    Name_Data_Type name_dt = ls.live_in[i];
-                    array::Push(edge.intervals, name_dt.name);
+                    visited[succ] = 1;
+                    next_succ[succ] = 0;
+                    stack[top++] = succ;
                 }
             }
-            if (label_instr_index != -1)
+            else
             {
-                Live_Sets ls = live_sets[label_instr_index];
-                for (s64 i = 0; i < ls.live_in.count; i++)
-                {
-                    Name_Data_Type name_dt = ls.live_in[i];
-                    array::Push(edge.branch_intervals, name_dt.name);
-                }
+                array::Push(order, b);
+                top--;
             }
-
-            array::Push(cfg_edges, edge);
         }
     }
+}
+
+// Solves the live in and live out sets of the blocks. Liveness flows
+// backwards, so the blocks are visited in postorder (the reverse postorder of
+// the reversed control flow graph), and only the blocks, whose successors
+// have changed, are visited again.
+static void SolveLiveness(Liveness *lv)
+{
+    Array<s32> order = { };
+    PostorderBlocks(lv, order);
 
-    // Reduce liveness information to coarse live intervals
-    for (s64 current_I = 0; current_I < live_sets.count; current_I++)
+    s64 set_words = lv->set_words;
+    u8 *pending = PushArray<u8>(&lv->arena, lv->blocks.count);
+    memset(pending, 1, lv->blocks.count);
+
+    b32 any_pending = true;
+    while (any_pending)
     {
-        Live_Sets &sets = live_sets[current_I];
-        for (s64 out_I = 0; out_I < sets.live_out.count; out_I++)
+        any_pending = false;
+        for (s64 o = 0; o < order.count; o++)
         {
-            Name_Data_Type name_dt = sets.live_out[out_I];
-            Live_Interval li = { };
-            li.start = current_I;
-            li.name = name_dt.name;
-            li.reg = name_dt.fixed_reg;
-            li.data_type = name_dt.data_type;
-            li.is_fixed = (name_dt.fixed_reg.reg_index != REG_NONE) && !name_dt.arg;
-            li.is_spilled = name_dt.spilled;
-            for (s64 instr_i = current_I + 1; instr_i < live_sets.count; instr_i++)
+            s32 b = order[o];
+            if (!pending[b]) continue;
+            pending[b] = 0;
+
+            Basic_Block &block = lv->blocks[b];
+            u64 *live_out = LiveSet(lv->live_out, set_words, b);
+            for (s32 s = 0; s < block.succ_count; s++)
             {
-                Live_Sets &ls = live_sets[instr_i];
-                b32 live_in = false;
-                for (s64 i = 0; i < ls.live_in.count; i++)
-                {
-                    if (ls.live_in[i].name == li.name)
-                    { live_in = true; break; }
-                }
-                if (!live_in)
-                {
-                    li.end = instr_i - 1;
-                    break;
-                }
-                else
-                {
-                    for (s64 i = 0; i < ls.live_out.count; i++)
-                    {
-                        if (ls.live_out[i].name == li.name)
-                        { array::EraseBySwap(ls.live_out, i); break; }
-                    }
-                }
+                const u64 *succ_in = LiveSet(lv->live_in, set_words, block.succs[s]);
+                for (s64 w = 0; w < set_words; w++)
+                    live_out[w] |= succ_in[w];
             }
-            Live_Interval *new_li = PushStruct<Live_Interval>(&ctx->arena);
-            *new_li = li;
 
-            Live_Interval *prev_li = nullptr;
-            for (s64 i = 0; i < live_intervals.count; i++)
+            u64 *live_in = LiveSet(lv->live_in, set_words, b);
+            const u64 *gen = LiveSet(lv->gen, set_words, b);
+            const u64 *kill = LiveSet(lv->kill, set_words, b);
+            b32 changed = false;
+            for (s64 w = 0; w < set_words; w++)
             {
-                if (li.name == live_intervals[i]->name)
-                {
-                    prev_li = live_intervals[i];
-                    break;
-                }
+                u64 in = gen[w] | (live_out[w] & ~kill[w]);
+                changed |= (in != live_in[w]);
+                live_in[w] = in;
             }
-            if (!prev_li)
-                array::Push(live_intervals, new_li);
-            else
+            if (changed)
             {
-                while (prev_li->next)
-                    prev_li = prev_li->next;
-                prev_li->next = new_li;
+                for (s64 p = 0; p < block.preds.count; p++)
+                    pending[block.preds[p]] = 1;
+                any_pending = true;
             }
         }
     }
+    array::Free(order);
+}
+
+static void AddInstrWrites(Liveness *lv, s32 instr_index, u64 *live)
+{
+    Live_Instr *li = &lv->instrs[instr_index];
+    for (s32 d = 0; d < li->def_count; d++)
+    {
+        SetBit(live, li->defs[d].vreg);
+    }
+    if (instr_index == 0)
+    {
+        // The arguments are live out from the first instruction.
+        for (s64 a = 0; a < lv->args.count; a++)
+            SetBit(live, lv->args[a].vreg);
+    }
+}
+
+static void PushLiveNames(Liveness *lv, const u64 *set, Array<Name> &names)
+{
+    for (s64 w = 0; w < lv->set_words; w++)
+    {
+        for (u64 bits = set[w]; bits; bits &= bits - 1)
+        {
+            s32 v = w * 64 + __builtin_ctzll(bits);
+            array::Push(names, lv->vregs[v]->name);
+        }
+    }
+}
+
+static void PrintLiveSet(IoFile *file, Liveness *lv, const u64 *set)
+{
+    for (s32 v = 0; v < lv->vregs.count; v++)
+    {
+        if (TestBit(set, v))
+        {
+            PrintName(file, lv->vregs[v]->name);
+            fprintf((FILE*)file, ", ");
+        }
+    }
+}
+
+static Live_Interval* NewLiveInterval(Codegen_Context *ctx, Liveness *lv,
+        s32 vreg_index, s32 instr_index)
+{
+    Live_Vreg *vreg = lv->vregs[vreg_index];
+    Live_Interval *interval = PushStruct<Live_Interval>(&ctx->arena);
+    *interval = { };
+    interval->start = instr_index;
+    interval->name = vreg->name;
+    interval->reg = vreg->fixed_reg;
+    interval->data_type = vreg->data_type;
+    interval->is_fixed = (vreg->fixed_reg.reg_index != REG_NONE);
+    interval->uses = vreg->uses;
+    interval->use_count = vreg->use_count;
+    interval->remat = vreg->remat;
+
+    Live_Instr *li = &lv->instrs[instr_index];
+    for (s32 d = 0; d < li->def_count; d++)
+    {
+        if (li->defs[d].vreg == vreg_index)
+        {
+            interval->data_type = li->defs[d].data_type;
+            break;
+        }
+    }
+    if (instr_index == 0)
+    {
+        for (s64 a = 0; a < lv->args.count; a++)
+        {
+            Live_Arg arg = lv->args[a];
+            if (arg.vreg != vreg_index) continue;
+            interval->reg = arg.reg;
+            interval->data_type = arg.data_type;
+            interval->is_fixed = false;
+            interval->is_spilled = arg.spilled;
+            break;
+        }
+    }
+    return interval;
+}
+
+static void FreeLiveness(Liveness *lv)
+{
+    for (s64 i = 0; i < lv->blocks.count; i++)
+    {
+        array::Free(lv->blocks[i].preds);
+    }
+    array::Free(lv->blocks);
+    array::Free(lv->reads);
+    array::Free(lv->args);
+    array::Free(lv->vregs);
+    array::Free(lv->vreg_table);
+    FreeMemoryArena(&lv->arena);
+}
+
+static void ComputeLiveness(Codegen_Context *ctx,
+        Ir_Routine *ir_routine, Routine *routine,
+        Array<Live_Interval*> &live_intervals,
+        Array<Cfg_Edge> &cfg_edges)
+{
+    PROFILE_SCOPE("Compute liveness");
+    Instruction_List &instructions = routine->instructions;
+    ASSERT(instructions.count > 0);
+
+    Liveness lv = { };
+    CollectLiveInstrs(ctx, ir_routine, routine, &lv);
+    CollectRematDefs(ctx, routine, &lv);
+    CollectUsePositions(ctx, &lv, instructions.count);
+    CollectBasicBlocks(routine, &lv);
+
+    s64 set_words = (lv.vregs.count + 63) / 64;
+    if (set_words == 0) set_words = 1;
+    lv.set_words = set_words;
+
+    s64 block_count = lv.blocks.count;
+    s64 block_sets_size = block_count * set_words;
+    lv.gen = PushArray<u64>(&lv.arena, block_sets_size);
+    lv.kill = PushArray<u64>(&lv.arena, block_sets_size);
+    lv.live_in = PushArray<u64>(&lv.arena, block_sets_size);
+    lv.live_out = PushArray<u64>(&lv.arena, block_sets_size);
+    memset(lv.gen, 0, block_sets_size * sizeof(u64));
+    memset(lv.kill, 0, block_sets_size * sizeof(u64));
+    memset(lv.live_in, 0, block_sets_size * sizeof(u64));
+    memset(lv.live_out, 0, block_sets_size * sizeof(u64));
+
+    ComputeBlockGenKill(&lv);
+    SolveLiveness(&lv);
+
+    // Reduce liveness information to coarse live intervals. An interval
+    // begins where the register is live out, and ends before the first
+    // instruction, where the register is not live in.
+    s64 max_block_size = 0;
+    for (s64 b = 0; b < block_count; b++)
+    {
+        s64 block_size = lv.blocks[b].end - lv.blocks[b].start;
+        if (block_size > max_block_size)
+            max_block_size = block_size;
+    }
+    u64 *instr_live_in = PushArray<u64>(&lv.arena, max_block_size * set_words);
+    u64 *live_out = PushArray<u64>(&lv.arena, set_words);
+    u64 *open = PushArray<u64>(&lv.arena, set_words);
+    memset(open, 0, set_words * sizeof(u64));
+    Live_Interval **last_interval = PushArray<Live_Interval*>(&lv.arena, lv.vregs.count);
+    for (s64 v = 0; v < lv.vregs.count; v++)
+        last_interval[v] = nullptr;
 
     RA_DEBUG(ctx, {
         fprintf(stderr, "\n--Live in/out-- ");
         PrintName((IoFile*)stderr, routine->name);
         fprintf(stderr, "\n");
-        for (s64 instr_i = 0; instr_i < live_sets.count; instr_i++)
+    })
+
+    for (s64 b = 0; b < block_count; b++)
+    {
+        Basic_Block &block = lv.blocks[b];
+        const u64 *block_out = LiveSet(lv.live_out, set_words, b);
+
+        // Live in sets of the instructions of the block, from the end.
+        const u64 *live = block_out;
+        for (s32 i = block.end - 1; i >= block.start; i--)
+        {
+            u64 *live_in = LiveSet(instr_live_in, set_words, i - block.start);
+            memcpy(live_in, live, set_words * sizeof(u64));
+            AddInstrWrites(&lv, i, live_in);
+
+            Live_Instr *li = &lv.instrs[i];
+            for (s32 k = 0; k < li->kill_count; k++)
+                ClearBit(live_in, li->kills[k]);
+            for (s32 r = li->reads_start; r < li->reads_end; r++)
+                SetBit(live_in, lv.reads[r]);
+            live = live_in;
+        }
+
+        for (s32 i = block.start; i < block.end; i++)
         {
-            Live_Sets sets = live_sets[instr_i];
-            fprintf(stderr, "instr %" PRId64 ": ", instr_i);
-            PrintInstruction((IoFile*)stderr, instructions[instr_i]);
-            fprintf(stderr, "   in: ");
-            for (s64 i = 0; i < sets.live_in.count; i++)
+            const u64 *live_in = LiveSet(instr_live_in, set_words, i - block.start);
+            const u64 *next_in = (i + 1 < block.end) ?
+                LiveSet(instr_live_in, set_words, i + 1 - block.start) : block_out;
+            memcpy(live_out, next_in, set_words * sizeof(u64));
+            AddInstrWrites(&lv, i, live_out);
+
+            for (s64 w = 0; w < set_words; w++)
             {
-                Name name = sets.live_in[i].name;
-                PrintName((IoFile*)stderr, name);
-                fprintf(stderr, ", ");
+                u64 continuing = open[w] & live_in[w];
+                u64 ending = open[w] & ~live_in[w];
+                u64 beginning = live_out[w] & ~continuing;
+                open[w] = continuing | beginning;
+
+                for (; ending; ending &= ending - 1)
+                {
+                    s32 v = w * 64 + __builtin_ctzll(ending);
+                    last_interval[v]->end = i - 1;
+                }
+                for (; beginning; beginning &= beginning - 1)
+                {
+                    s32 v = w * 64 + __builtin_ctzll(beginning);
+                    Live_Interval *interval = NewLiveInterval(ctx, &lv, v, i);
+                    if (last_interval[v])
+                        last_interval[v]->next = interval;
+                    else
+                        array::Push(live_intervals, interval);
+                    last_interval[v] = interval;
+                }
             }
-            fprintf(stderr, "\n  out: ");
-            for (s64 i = 0; i < sets.live_out.count; i++)
+
+            // Collect CFG edges
+            if ((instructions[i]->flags & IF_Branch) != 0)
             {
-                Name name = sets.live_out[i].name;
-                PrintName((IoFile*)stderr, name);
-                fprintf(stderr, ", ");
+                Cfg_Edge edge = { };
+                edge.instr_index = i;
+                edge.branch_instr_index = lv.branch_targets[i];
+                edge.falls_through = (instructions[i]->flags & IF_FallsThrough) != 0;
+                PushLiveNames(&lv, live_in, edge.intervals);
+                if (edge.branch_instr_index != -1)
+                {
+                    s32 target_block = lv.block_of[edge.branch_instr_index];
+                    PushLiveNames(&lv, LiveSet(lv.live_in, set_words, target_block),
+                            edge.branch_intervals);
+                }
+                array::Push(cfg_edges, edge);
             }
-            fprintf(stderr, "\n");
+
+            RA_DEBUG(ctx, {
+                fprintf(stderr, "instr %d: ", i);
+                PrintInstruction((IoFile*)stderr, instructions[i]);
+                fprintf(stderr, "   in: ");
+                PrintLiveSet((IoFile*)stderr, &lv, live_in);
+                fprintf(stderr, "\n  out: ");
+                PrintLiveSet((IoFile*)stderr, &lv, live_out);
+                fprintf(stderr, "\n");
+            })
         }
+    }
+    for (s64 w = 0; w < set_words; w++)
+    {
+        for (u64 bits = open[w]; bits; bits &= bits - 1)
+        {
+            s32 v = w * 64 + __builtin_ctzll(bits);
+            last_interval[v]->end = instructions.count - 1;
+        }
+    }
+
+    RA_DEBUG(ctx, {
         fprintf(stderr, "--Live in/out end--\n");
 
         fprintf(stderr, "\n--Live intervals-- ");
@@ -2674,9 +3444,10 @@ static void ComputeLiveness(Codegen_Context *ctx,
             PrintName((IoFile*)stderr, interval->name);
             do
             {
-                fprintf(stderr, "%s: \t[%d,%d] %d %s\n", indent,
+                fprintf(stderr, "%s: \t[%d,%d] %d %s%s\n", indent,
                         interval->start, interval->end, (s32)interval->data_type,
-                        (interval->is_spilled) ? "(spilled)" : "");
+                        (interval->is_spilled) ? "(spilled)" : "",
+                        (interval->remat) ? "(remat)" : "");
                 indent = "\t";
                 interval = interval->next;
             } while (interval);
@@ -2684,7 +3455,7 @@ static void ComputeLiveness(Codegen_Context *ctx,
         fprintf(stderr, "--Live intervals end--\n\n");
     })
 
-    FreeLiveSets(live_sets);
+    FreeLiveness(&lv);
 }
 
 
@@ -2712,23 +3483,68 @@ static void MakeSpillComment(Codegen_Context *ctx, Ir_Comment *comment,
     comment->end = buf + note_size - 1; // take out null termination
 }
 
-static void InsertSpills(Codegen_Context *ctx, Routine *routine)
+// Returns the stack slot of the spilled interval. The save slot of a register
+// is shared by all the values saved in the register, so it is sized for the
+// whole register.
+static s64 GetSpillOffset(Codegen_Context *ctx, Live_Interval interval)
 {
-    Reg_Alloc *reg_alloc = ctx->reg_alloc;
-    Array<Spill_Info> &spills = reg_alloc->spills;
-    // Sort spills
-    for (s64 i = 0; i < spills.count - 1; i++)
+    Oper_Data_Type slot_type = interval.data_type;
+    if (interval.name == reg_save_names[interval.reg.reg_index])
+    {
+        if (IsFloatRegister(ctx->reg_alloc, interval.reg))
+        {
+            if (slot_type != Oper_Data_Type::V256)
+                slot_type = Oper_Data_Type::V128;
+        }
+        else
+        {
+            slot_type = Oper_Data_Type::U64;
+        }
+    }
+    return GetLocalOffset(ctx, interval.name, slot_type);
+}
+
+// Sorts the spills by the instruction index with a bottom up merge sort. The
+// sort is stable, as the spills at the same position must be inserted in the
+// order they were added; e.g. a register is spilled before it is reloaded
+// with another value.
+static void SortSpills(Array<Spill_Info> &spills)
+{
+    Array<Spill_Info> temp = { };
+    array::Resize(temp, spills.count);
+    Spill_Info *src = spills.data;
+    Spill_Info *dst = temp.data;
+    for (s64 width = 1; width < spills.count; width *= 2)
     {
-        for (s64 j = i + 1; j < spills.count; j++)
+        for (s64 lo = 0; lo < spills.count; lo += width * 2)
         {
-            if (spills[j].instr_index < spills[i].instr_index)
+            s64 mid = lo + width;
+            s64 hi = mid + width;
+            if (mid > spills.count) mid = spills.count;
+            if (hi > spills.count) hi = spills.count;
+            s64 a = lo, b = mid;
+            for (s64 i = lo; i < hi; i++)
             {
-                Spill_Info spill = spills[j];
-                spills[j] = spills[i];
-                spills[i] = spill;
+                if (a < mid && (b >= hi || src[a].instr_index <= src[b].instr_index))
+                    dst[i] = src[a++];
+                else
+                    dst[i] = src[b++];
             }
         }
+        Spill_Info *swap = src;
+        src = dst;
+        dst = swap;
     }
+    if (src != spills.data)
+        memcpy(spills.data, src, spills.count * sizeof(Spill_Info));
+    array::Free(temp);
+}
+
+static void InsertSpills(Codegen_Context *ctx, Routine *routine)
+{
+    Reg_Alloc *reg_alloc = ctx->reg_alloc;
+    Array<Spill_Info> &spills = reg_alloc->spills;
+    SortSpills(spills);
     s64 idx_offset = 0;
     for (s64 i = 0; i < spills.count; i++)
     {
@@ -2742,6 +3558,13 @@ static void InsertSpills(Codegen_Context *ctx, Routine *routine)
         ctx->comment = &comment;
         String spill_name = spill_info.interval.name.str;
 
+        // NOTE(henrik): The registers written by the moves and the reloads
+        // count in the registers clobbered by the routine.
+        if (spill_info.spill_type == Spill_Type::Move)
+            DirtyRegister(reg_alloc, spill_info.target);
+        else if (spill_info.spill_type == Spill_Type::Unspill)
+            DirtyRegister(reg_alloc, spill_info.interval.reg);
+
         switch (spill_info.spill_type)
         {
         case Spill_Type::Move:
@@ -2753,6 +3576,16 @@ static void InsertSpills(Codegen_Context *ctx, Routine *routine)
             } break;
         case Spill_Type::Spill:
             {
+                // NOTE(henrik): A rematerialized value is stored only, if it
+                // is used from its stack slot.
+                s64 offs;
+                if (spill_info.interval.remat &&
+                    !GetLocalOffset(ctx, spill_info.interval.name, &offs))
+                {
+                    ctx->comment = nullptr;
+                    break;
+                }
+
                 RA_DEBUG(ctx,
                 {
                     fprintf(stderr, "Insert spill of ");
@@ -2762,15 +3595,27 @@ static void InsertSpills(Codegen_Context *ctx, Routine *routine)
                 })
 
                 MakeSpillComment(ctx, &comment, spill_name, "spill", spill_info.note);
-                s64 offs = GetLocalOffset(ctx, spill_info.interval.name, spill_info.interval.data_type);
+                offs = GetSpillOffset(ctx, spill_info.interval);
                 InsertLoad(ctx, routine->instructions, index,
                         BaseOffsetOperand(REG_rbp, offs, spill_info.interval.data_type, AF_Write),
                         RegOperand(spill_info.interval.reg, spill_info.interval.data_type, AF_Read));
             } break;
         case Spill_Type::Unspill:
             {
+                const Instruction *remat = spill_info.interval.remat;
+                if (remat)
+                {
+                    MakeSpillComment(ctx, &comment, spill_name, "remat", spill_info.note);
+                    Operand reg_oper = RegOperand(spill_info.interval.reg,
+                            remat->oper1.data_type, AF_Write);
+                    Instruction *instr = NewInstruction(ctx,
+                            (Amd64_Opcode)remat->opcode, reg_oper, remat->oper2);
+                    array::Insert(routine->instructions, index, instr);
+                    ctx->opt_counts.remat_values++;
+                    break;
+                }
                 MakeSpillComment(ctx, &comment, spill_name, "unspill", spill_info.note);
-                s64 offs = GetLocalOffset(ctx, spill_info.interval.name, spill_info.interval.data_type);
+                s64 offs = GetSpillOffset(ctx, spill_info.interval);
                 InsertLoad(ctx, routine->instructions, index,
                         RegOperand(spill_info.interval.reg, spill_info.interval.data_type, AF_Write),
                         BaseOffsetOperand(REG_rbp, offs, spill_info.interval.data_type, AF_Read));
@@ -2780,11 +3625,63 @@ static void InsertSpills(Codegen_Context *ctx, Routine *routine)
     }
 }
 
+// Returns the position of the moves resolving the conflicts on the edge. The
+// moves of a conditional branch must not be executed on the fall through
+// path, so the edge is split: the branch is redirected to a block of its own,
+// that does the moves and jumps to the original target. The blocks are placed
+// before the return label, behind a jump to it.
+static s32 EdgeMovePosition(Codegen_Context *ctx, Routine *routine,
+        Cfg_Edge edge, s32 *move_pos)
+{
+    if (!edge.falls_through)
+        return edge.instr_index;
+    if (*move_pos != -1)
+        return *move_pos;
+
+    Instruction_List &instructions = routine->instructions;
+    s64 index = instructions.count - 1;
+    s64 old_label_index = index;
+    ASSERT((Amd64_Opcode)instructions[index]->opcode == OP_LABEL);
+    if ((instructions[index - 1]->flags & IF_FallsThrough) != 0)
+    {
+        Instruction *jmp = NewInstruction(ctx, OP_jmp,
+                LabelOperand(ctx->return_label_name, AF_Read));
+        array::Insert(instructions, index, jmp);
+        index++;
+    }
+
+    const s64 buf_size = 40;
+    char buf[buf_size];
+    s64 name_len = snprintf(buf, buf_size, ".E%d", edge.instr_index);
+    Name stub_name = PushName(&ctx->arena, buf, name_len);
+
+    Instruction *branch = instructions[edge.instr_index];
+    Instruction *label = NewInstruction(ctx, OP_LABEL,
+            LabelOperand(stub_name, AF_Read));
+    Instruction *jmp = NewInstruction(ctx, OP_jmp,
+            LabelOperand(branch->oper1.name, AF_Read));
+    branch->oper1.name = stub_name;
+    array::Insert(instructions, index, label);
+    array::Insert(instructions, index + 1, jmp);
+
+    // The moves already placed at the return label stay before it.
+    s32 inserted = (s32)(instructions.count - 1 - old_label_index);
+    Array<Spill_Info> &spills = ctx->reg_alloc->spills;
+    for (s64 i = 0; i < spills.count; i++)
+    {
+        if (spills[i].instr_index >= old_label_index * 2)
+            spills[i].instr_index += inserted * 2;
+    }
+
+    *move_pos = index + 1;
+    return *move_pos;
+}
+
 // Resolves conflicts in register allocations across basic blocks by inserting
 // required moves.
 // TODO(henrik): This seems to work in most cases, but fails in some. Investigate!
 // TODO(henrik): This algorithm could be drastically accelerated.
-static void CfgEdgeResolution(Codegen_Context *ctx,
+static void CfgEdgeResolution(Codegen_Context *ctx, Routine *routine,
         Array<Live_Interval> &live_intervals,
         Array<Cfg_Edge> &cfg_edges)
 {
@@ -2813,6 +3710,7 @@ static void CfgEdgeResolution(Codegen_Context *ctx,
     for (s64 ei = 0; ei < cfg_edges.count; ei++)
     {
         Cfg_Edge edge = cfg_edges[ei];
+        s32 move_pos = -1;
         for (s64 i = 0; i < live_intervals.count; i++)
         {
             Live_Interval li = live_intervals[i];
@@ -2825,6 +3723,8 @@ static void CfgEdgeResolution(Codegen_Context *ctx,
                 // thus representing the same virtual register, but with
                 // different register) at the branch target.
                 s64 index = -1;
+                b32 in_register = (li.start <= edge.branch_instr_index &&
+                                   edge.branch_instr_index <= li.end);
                 for (s64 j = 0; j < live_intervals.count; j++)
                 {
                     iters++;
@@ -2835,6 +3735,7 @@ static void CfgEdgeResolution(Codegen_Context *ctx,
                     {
                         if (li.name == lj.name)
                         {
+                            in_register = true;
                             if (li.reg != lj.reg)
                             {
                                 index = j;
@@ -2851,6 +3752,23 @@ static void CfgEdgeResolution(Codegen_Context *ctx,
                         }
                     }
                 }
+                // NOTE(henrik): If the value is live at the branch target, but
+                // no interval covers the target, the value is read from its
+                // stack slot there. Store it before the branch.
+                if (!in_register && edge.branch_instr_index != -1)
+                {
+                    for (s64 ii = 0; ii < edge.branch_intervals.count; ii++)
+                    {
+                        iters++;
+                        if (edge.branch_intervals[ii] == li.name)
+                        {
+                            Spill(ctx->reg_alloc, li,
+                                    EdgeMovePosition(ctx, routine, edge, &move_pos),
+                                    0, "consistency (in memory at target)");
+                            break;
+                        }
+                    }
+                }
                 // No confilicting interval found, continue to next interval.
 #if 1
                 if (index == -1) continue;
@@ -2891,46 +3809,24 @@ static void CfgEdgeResolution(Codegen_Context *ctx,
                         }
                     }
                 }
-                if (edge.falls_through) //&& active_index != -1)
-                {
-                    Live_Interval spill = (active_index == -1) ? interval : live_intervals[active_index];
-                    Spill(ctx->reg_alloc, spill, edge.instr_index, 0, "consistency (used in fall thru)");
-                }
+                // NOTE(henrik): Only the reloads write the registers in use,
+                // and they are done after all the other moves, so the order of
+                // the values does not matter.
+                s32 pos = EdgeMovePosition(ctx, routine, edge, &move_pos);
                 // If the register was in use..
                 if (active_index != -1)
                 {
                     // ..use spilling to make sure that no value is
                     // overwritten.
+                    Spill(ctx->reg_alloc, li, pos, 0, "consistency");
                     Live_Interval spill = li;
-                    Spill(ctx->reg_alloc, spill, edge.instr_index, 0, "consistency");
                     spill.reg = interval.reg;
-                    Unspill(ctx->reg_alloc, spill, edge.instr_index, 1, "consistency");
+                    Unspill(ctx->reg_alloc, spill, pos, 1, "consistency");
                 }
                 else
                 {
                     // Otherwise we can do just a straight copy.
-                    Move(ctx->reg_alloc, li, interval.reg, edge.instr_index, "consistency");
-                }
-                if (edge.falls_through)
-                {
-                    if (active_index != -1)
-                    {
-                        Live_Interval spill = li;
-                        spill.reg = interval.reg;
-                        Spill(ctx->reg_alloc, spill, edge.instr_index + 1, 0, "consistency (fall thru)");
-                        spill.reg = li.reg;
-                        Unspill(ctx->reg_alloc, spill, edge.instr_index + 1, 1, "consistency (fall thru)");
-                    }
-                    else
-                    {
-                        Move(ctx->reg_alloc, interval, li.reg, edge.instr_index + 1, "consistency (fall thru)");
-                    }
-                    //if (active_index != -1)
-                    {
-                        Live_Interval spill = (active_index == -1) ? interval : live_intervals[active_index];
-                        Unspill(ctx->reg_alloc, spill, edge.instr_index + 1, 1, "consistency (used in fall thru)");
-                        //Unspill(ctx->reg_alloc, spill, edge.instr_index + 1, 0, "consistency (used in fall thru)");
-                    }
+                    Move(ctx->reg_alloc, li, interval.reg, pos, "consistency");
                 }
             }
             else if (li.start <= edge.branch_instr_index &&
@@ -2961,7 +3857,9 @@ static void CfgEdgeResolution(Codegen_Context *ctx,
                         {
                             //PrintName((IoFile*)dbgout, li.name);
                             //fprintf(dbgout, "; no active interval at %d; must have been spilled!\n", edge.instr_index);
-                            Unspill(ctx->reg_alloc, li, edge.instr_index, 1, "consistency");
+                            Unspill(ctx->reg_alloc, li,
+                                    EdgeMovePosition(ctx, routine, edge, &move_pos),
+                                    1, "consistency");
                             break;
                         }
                     }
@@ -2994,36 +3892,295 @@ static void CfgEdgeResolution(Codegen_Context *ctx,
     //fprintf(stdout, "iters %" PRId64 "\n", iters);
 }
 
+// An instruction range of a loop, from the labels of the target of a backward
+// branch to the branch, or of a fixed register interval.
+struct Instr_Range
+{
+    s32 start, end;
+};
+
+// NOTE(henrik): The unhandled and the inactive intervals are kept in binary
+// heaps ordered by the interval start. The active intervals are kept sorted
+// by the interval end, as there are at most as many of them as there are
+// registers.
 struct Interval_Sets
 {
     Array<Live_Interval> unhandled;
     Array<Live_Interval> active;
     Array<Live_Interval> inactive;
     Array<Live_Interval> allocated;
+
+    Array<Instr_Range> loops;
+    // The fixed intervals of each physical register ordered by start, and the
+    // calls of the routine with the registers each of them clobbers, for
+    // checking the allocation hints and saving the caller save registers.
+    Array<Instr_Range> fixed_ranges[REG_COUNT];
+    Array<s32> calls;
+    Array<u64> call_clobbers;
 };
 
-// Adds live interval "inteval" to the "set". The set is kept sorted by
-// ascending iterval end.
-static void AddToSetSortedByEnd(Array<Live_Interval> &set, Live_Interval interval)
+// The instruction ranges, where the value of a spilled virtual register or a
+// saved caller save register is kept in its stack slot, and the size of the
+// largest value kept.
+struct Slot_User
+{
+    Name name;
+    Instr_Range *ranges;
+    s32 range_count;
+    u32 size;
+    // The value is rematerialized, and gets a slot only if it is used from
+    // the stack.
+    b32 remat;
+};
+
+// A stack slot and the instruction ranges of all its users.
+struct Stack_Slot
+{
+    s64 offset;
+    u32 size;
+    Array<Instr_Range> ranges;
+};
+
+// NOTE(henrik): The stack slots are shared only by the spilled virtual
+// registers and the saved caller save registers, whose live ranges are known.
+// The locals, whose address is taken, the callee save slots and the stack
+// arguments get a slot of their own.
+struct Stack_Slots
+{
+    Array<Slot_User*> users;
+    Array<Stack_Slot> slots;
+};
+
+// Adds the live intervals of the virtual registers as the users of the stack
+// slots. A register is live wherever its value can be reloaded, so
+// registers, whose intervals do not overlap, can share a slot.
+static void InitStackSlots(Codegen_Context *ctx, Stack_Slots *stack_slots,
+        Array<Live_Interval*> &live_intervals)
+{
+    *stack_slots = { };
+    array::Resize(stack_slots->users, (live_intervals.count + REG_COUNT) * 2 + 1);
+    for (s64 i = 0; i < live_intervals.count; i++)
+    {
+        Live_Interval *first = live_intervals[i];
+        if (first->is_fixed) continue;
+
+        Slot_User *user = PushStruct<Slot_User>(&ctx->arena);
+        *user = { };
+        user->name = first->name;
+        user->remat = (first->remat != nullptr);
+        for (Live_Interval *interval = first; interval; interval = interval->next)
+            user->range_count++;
+        user->ranges = PushArray<Instr_Range>(&ctx->arena, user->range_count);
+
+        s32 index = 0;
+        for (Live_Interval *interval = first; interval; interval = interval->next)
+        {
+            Instr_Range range = { interval->start, interval->end };
+            user->ranges[index++] = range;
+            u32 size = GetSize(interval->data_type);
+            if (size > user->size)
+                user->size = size;
+        }
+        hashtable::Put(stack_slots->users, user->name, user);
+    }
+    ctx->stack_slots = stack_slots;
+}
+
+// Adds the calls, around which the caller save registers are saved, as the
+// users of the save slots.
+static void AddCallerSaveSlotUsers(Codegen_Context *ctx, Stack_Slots *stack_slots)
+{
+    Array<Spill_Info> &spills = ctx->reg_alloc->spills;
+    s32 save_counts[REG_COUNT] = { };
+    for (s64 i = 0; i < spills.count; i++)
+    {
+        Live_Interval interval = spills[i].interval;
+        if (interval.name == reg_save_names[interval.reg.reg_index])
+            save_counts[interval.reg.reg_index]++;
+    }
+
+    Slot_User *users[REG_COUNT] = { };
+    for (s64 r = 0; r < REG_COUNT; r++)
+    {
+        if (save_counts[r] == 0) continue;
+        Slot_User *user = PushStruct<Slot_User>(&ctx->arena);
+        *user = { };
+        user->name = reg_save_names[r];
+        user->ranges = PushArray<Instr_Range>(&ctx->arena, save_counts[r]);
+        users[r] = user;
+        hashtable::Put(stack_slots->users, user->name, user);
+    }
+    for (s64 i = 0; i < spills.count; i++)
+    {
+        Live_Interval interval = spills[i].interval;
+        if (interval.name == reg_save_names[interval.reg.reg_index])
+        {
+            Slot_User *user = users[interval.reg.reg_index];
+            s32 instr_index = spills[i].instr_index / 2;
+            Instr_Range range = { instr_index, instr_index };
+            user->ranges[user->range_count++] = range;
+        }
+    }
+}
+
+static void FreeStackSlots(Codegen_Context *ctx, Stack_Slots *stack_slots)
+{
+    for (s64 i = 0; i < stack_slots->slots.count; i++)
+        array::Free(stack_slots->slots[i].ranges);
+    array::Free(stack_slots->slots);
+    array::Free(stack_slots->users);
+    ctx->stack_slots = nullptr;
+}
+
+static b32 SlotIsFree(Stack_Slot *slot, Slot_User *user)
+{
+    for (s64 i = 0; i < slot->ranges.count; i++)
+    {
+        Instr_Range range = slot->ranges[i];
+        for (s32 u = 0; u < user->range_count; u++)
+        {
+            if (range.start <= user->ranges[u].end &&
+                user->ranges[u].start <= range.end)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Gets a stack slot for a spilled virtual register or a saved caller save
+// register. The slot is shared with the users of the same size, that are not
+// live at the same instructions. Returns false, if the name is not a user of
+// the shared slots.
+static b32 GetSharedStackSlot(Codegen_Context *ctx, Name name,
+        Oper_Data_Type data_type, s64 *offset)
+{
+    Stack_Slots *stack_slots = ctx->stack_slots;
+    if (!stack_slots) return false;
+    Slot_User *user = hashtable::Lookup(stack_slots->users, name);
+    if (!user) return false;
+
+    u32 size = GetSize(data_type);
+    if (user->size > size)
+        size = user->size;
+
+    Stack_Slot *slot = nullptr;
+    for (s64 i = 0; i < stack_slots->slots.count; i++)
+    {
+        Stack_Slot *s = &stack_slots->slots[i];
+        if (s->size == size && SlotIsFree(s, user))
+        {
+            slot = s;
+            ctx->opt_counts.shared_stack_slots++;
+            break;
+        }
+    }
+    if (!slot)
+    {
+        Routine *routine = ctx->current_routine;
+        routine->locals_size += size;
+        routine->locals_size = Align(routine->locals_size, size);
+
+        Stack_Slot new_slot = { };
+        new_slot.offset = -routine->locals_size;
+        new_slot.size = size;
+        array::Push(stack_slots->slots, new_slot);
+        slot = &array::Back(stack_slots->slots);
+    }
+    for (s32 u = 0; u < user->range_count; u++)
+        array::Push(slot->ranges, user->ranges[u]);
+    *offset = slot->offset;
+    return true;
+}
+
+// Gets the stack slot of a rematerialized value, that is used from the stack,
+// as its interval was not given a register at the use. Returns false, if the
+// name is not of a rematerialized value.
+static b32 GetRematStackSlot(Codegen_Context *ctx, Name name,
+        Oper_Data_Type data_type, s64 *offset)
+{
+    Stack_Slots *stack_slots = ctx->stack_slots;
+    if (!stack_slots) return false;
+    Slot_User *user = hashtable::Lookup(stack_slots->users, name);
+    if (!user || !user->remat) return false;
+    *offset = GetLocalOffset(ctx, name, data_type);
+    return true;
+}
+
+// Returns true, if interval "a" is handled before interval "b". Of the
+// intervals starting at the same instruction, the ones having a fixed or an
+// argument register are handled first, so that they do not need to take the
+// register from the others.
+static b32 HandledBefore(const Live_Interval &a, const Live_Interval &b)
+{
+    if (a.start != b.start)
+        return a.start < b.start;
+    b32 a_has_reg = (a.reg.reg_index != REG_NONE);
+    b32 b_has_reg = (b.reg.reg_index != REG_NONE);
+    if (a_has_reg != b_has_reg)
+        return a_has_reg;
+    return a.end < b.end;
+}
+
+static void SwapIntervals(Array<Live_Interval> &heap, s64 a, s64 b)
+{
+    Live_Interval interval = heap[a];
+    heap[a] = heap[b];
+    heap[b] = interval;
+}
+
+static void PushToHeap(Array<Live_Interval> &heap, Live_Interval interval)
+{
+    s64 index = heap.count;
+    array::Push(heap, interval);
+    while (index > 0)
+    {
+        s64 parent = (index - 1) / 2;
+        if (!HandledBefore(heap[index], heap[parent]))
+            break;
+        SwapIntervals(heap, index, parent);
+        index = parent;
+    }
+}
+
+static Live_Interval PopFromHeap(Array<Live_Interval> &heap)
 {
+    Live_Interval top = heap[0];
+    heap[0] = array::Back(heap);
+    array::Pop(heap);
+
     s64 index = 0;
-    for (; index < set.count; index++)
+    for (;;)
     {
-        ASSERT(set[index].reg != interval.reg);
-        if (interval.end <= set[index].end)
+        s64 first = index;
+        s64 left = index * 2 + 1;
+        s64 right = left + 1;
+        if (left < heap.count && HandledBefore(heap[left], heap[first]))
+            first = left;
+        if (right < heap.count && HandledBefore(heap[right], heap[first]))
+            first = right;
+        if (first == index)
             break;
+        SwapIntervals(heap, index, first);
+        index = first;
     }
-    array::Insert(set, index, interval);
+    return top;
 }
 
 // Adds live interval "inteval" to the "set". The set is kept sorted by
-// ascending iterval start.
-static void AddToSetSortedByStart(Array<Live_Interval> &set, Live_Interval interval)
+// ascending iterval end.
+static void AddToSetSortedByEnd(Array<Live_Interval> &set, Live_Interval interval)
 {
     s64 index = 0;
     for (; index < set.count; index++)
     {
-        if (interval.start <= set[index].start)
+        // NOTE(henrik): Only an interval ending at the start of the other
+        // may share its register.
+        ASSERT(set[index].reg != interval.reg ||
+               set[index].end == interval.start ||
+               interval.end == set[index].start);
+        if (interval.end <= set[index].end)
             break;
     }
     array::Insert(set, index, interval);
@@ -3033,7 +4190,7 @@ static void AddToActive(Interval_Sets &is, Live_Interval interval)
 { AddToSetSortedByEnd(is.active, interval); }
 
 static void AddToUnhandled(Interval_Sets &is, Live_Interval interval)
-{ AddToSetSortedByStart(is.unhandled, interval); }
+{ PushToHeap(is.unhandled, interval); }
 
 static void AddNextIntervalToInactive(Interval_Sets &is, Live_Interval interval)
 {
@@ -3041,7 +4198,7 @@ static void AddNextIntervalToInactive(Interval_Sets &is, Live_Interval interval)
     {
         Live_Interval *next = interval.next;
         next->reg = interval.reg;
-        AddToSetSortedByStart(is.inactive, *next);
+        PushToHeap(is.inactive, *next);
     }
 }
 
@@ -3051,6 +4208,19 @@ static void AddToAllocated(Interval_Sets &is, Live_Interval interval)
     AddNextIntervalToInactive(is, interval);
 }
 
+// Returns true, if the register is allocated for an interval in the "active"
+// set. A fixed interval may take over the register of an interval ending at
+// its start, so there can be two active intervals with the same register.
+static b32 RegIsActive(Interval_Sets &is, Reg reg)
+{
+    for (s64 i = 0; i < is.active.count; i++)
+    {
+        if (is.active[i].reg == reg)
+            return true;
+    }
+    return false;
+}
+
 // Remove expired intervals from "active" set to the "handled" set and add the
 // inteval's next, if it has one, to the "inactive" set.
 static void ExpireOldIntervals(Codegen_Context *ctx, Interval_Sets &is, s64 instr_index)
@@ -3063,71 +4233,316 @@ static void ExpireOldIntervals(Codegen_Context *ctx, Interval_Sets &is, s64 inst
         array::Erase(is.active, i);
         AddToAllocated(is, active_interval);
 
-        ReleaseRegister(ctx->reg_alloc, active_interval.reg, active_interval.data_type);
+        if (!RegIsActive(is, active_interval.reg))
+            ReleaseRegister(ctx->reg_alloc, active_interval.reg, active_interval.data_type);
     }
 }
 
-// Remove intervals that have expired from the "inactive" set, and move
-// intervals that overlap current instruction index "instr_index" from the
-// "inactive" to the "active" set.
-static void RenewInactiveIntervals(Codegen_Context *ctx, Interval_Sets &is, s64 instr_index)
+enum { NO_USE = 0x7fffffff };
+
+// Returns the first use of the interval at or after "pos", or NO_USE, if the
+// interval is not used again before its end.
+static s32 NextUse(Live_Interval interval, s32 pos)
+{
+    s32 lo = 0;
+    s32 hi = interval.use_count;
+    while (lo < hi)
+    {
+        s32 mid = (lo + hi) / 2;
+        if (interval.uses[mid] < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < interval.use_count && interval.uses[lo] <= interval.end)
+        return interval.uses[lo];
+    return NO_USE;
+}
+
+// Returns the index of the first call at or after "pos" in the calls.
+static s64 FindCall(Interval_Sets &is, s32 pos)
+{
+    s64 lo = 0;
+    s64 hi = is.calls.count;
+    while (lo < hi)
+    {
+        s64 mid = (lo + hi) / 2;
+        if (is.calls[mid] < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Returns the first call at or after "pos", or NO_USE, if there are no more
+// calls.
+static s32 NextCall(Interval_Sets &is, s32 pos)
+{
+    s64 index = FindCall(is, pos);
+    return (index < is.calls.count) ? is.calls[index] : NO_USE;
+}
+
+// Returns the registers clobbered by the calls from "start" to "end"
+// inclusive.
+static u64 CallClobbers(Interval_Sets &is, s32 start, s32 end)
+{
+    u64 clobbered_regs = 0;
+    for (s64 i = FindCall(is, start); i < is.calls.count && is.calls[i] <= end; i++)
+        clobbered_regs |= is.call_clobbers[i];
+    return clobbered_regs;
+}
+
+// Returns the registers clobbered by the calls the interval is live across,
+// and which would need saving, if the interval was given one of them.
+static u64 CallClobbers(Interval_Sets &is, Live_Interval interval)
+{
+    return CallClobbers(is, interval.start, interval.end - 1);
+}
+
+// Returns the next use of an active interval for choosing the interval to
+// spill. A value used earlier in the innermost loop around "pos" and live
+// through the loop is needed again in the next iteration, so its next use is
+// at the latest at the end of the loop.
+static s32 NextUseInLoop(Interval_Sets &is, Live_Interval interval, s32 pos)
 {
-    for (s64 i = 0; i < is.inactive.count; )
+    s32 next_use = NextUse(interval, pos);
+    const Instr_Range *inner = nullptr;
+    for (s64 i = 0; i < is.loops.count; i++)
     {
-        Live_Interval interval = is.inactive[i];
-        if (interval.end < instr_index)
+        const Instr_Range *loop = &is.loops[i];
+        if (loop->start <= pos && pos <= loop->end &&
+            (!inner || loop->end - loop->start < inner->end - inner->start))
         {
-            // NOTE(henrik): I don't know when this should happen, but it is
-            // included in the algorithm given in [2].
-            INVALID_CODE_PATH;
-            array::Erase(is.inactive, i);
-            continue;
+            inner = loop;
         }
-        if (interval.start <= instr_index)
+    }
+    if (inner && next_use > inner->end && interval.end >= inner->end &&
+        NextUse(interval, inner->start) < pos)
+    {
+        next_use = inner->end;
+    }
+    return next_use;
+}
+
+// Returns the position, where an active interval is spilled to free its
+// register at "pos". If the interval lives through loops around "pos", and
+// is not used in them before "pos", the spill is moved to the entry of the
+// outermost such loop, so that it is not repeated in every iteration.
+static s32 SpillPosition(Interval_Sets &is, Live_Interval interval, s32 pos)
+{
+    s32 spill_pos = pos;
+    for (s64 i = 0; i < is.loops.count; i++)
+    {
+        Instr_Range loop = is.loops[i];
+        if (interval.start < loop.start && loop.start < spill_pos &&
+            pos <= loop.end && NextUse(interval, loop.start) >= pos)
         {
-            array::Erase(is.inactive, i);
-            if (!HasFreeRegisters(ctx->reg_alloc, interval.data_type))
-            {
-                GetLocalOffset(ctx, interval.name, interval.data_type);
-                continue;
-            }
-            if (!TryAllocateRegister(ctx->reg_alloc, interval.reg, interval.data_type))
-            {
-                Reg free_reg = AllocateFreeRegister(ctx->reg_alloc, interval.data_type);
-                interval.reg = free_reg;
-            }
-            AddToActive(is, interval);
-            continue;
+            spill_pos = loop.start;
         }
-        i++;
     }
+    return spill_pos;
 }
 
-// Spill either "interval" or the last interval in the "active" set, depending
-// on which expires earlier.
-static void SpillAtInterval(Codegen_Context *ctx, Interval_Sets &is, Live_Interval interval)
+// Returns the first of the labels preceding the instruction, or the
+// instruction itself. The code inserted before a branch target would be
+// executed also, when jumping to the target, so the spills and reloads at the
+// start of a block are inserted before its labels.
+static s32 BlockEntryPosition(Instruction_List &instructions, s32 instr_index, s32 min_index)
+{
+    while (instr_index - 1 > min_index &&
+           (Amd64_Opcode)instructions[instr_index - 1]->opcode == OP_LABEL)
+    {
+        instr_index--;
+    }
+    return instr_index;
+}
+
+// Returns the position, where a spilled interval is reloaded for its use at
+// "use". If the use is in loops beginning after "pos", the reload is moved to
+// the entry of the outermost such loop.
+static s32 ReloadPosition(Codegen_Context *ctx, Interval_Sets &is, s32 use, s32 pos)
+{
+    s32 reload_pos = use;
+    for (s64 i = 0; i < is.loops.count; i++)
+    {
+        Instr_Range loop = is.loops[i];
+        if (pos < loop.start && loop.start < reload_pos && use <= loop.end)
+            reload_pos = loop.start;
+    }
+    return BlockEntryPosition(ctx->current_routine->instructions, reload_pos, pos);
+}
+
+// Adds the rest of a spilled interval, from its reload before the next use at
+// or after "reload_from", to the unhandled intervals. If there are no more uses,
+// the interval stays in its stack slot to its end.
+static void AddSplitRestToUnhandled(Codegen_Context *ctx, Interval_Sets &is,
+        Live_Interval interval, s32 pos, s32 reload_from)
 {
-    s64 spill_i = is.active.count - 1;
-    Live_Interval spill = is.active[spill_i];
-    if (spill.end > interval.end)
+    s32 use = NextUse(interval, reload_from);
+    if (use == NO_USE)
     {
-        Spill(ctx->reg_alloc, spill, interval.start, 0, "at interval");
+        if (interval.next)
+            AddToUnhandled(is, *interval.next);
+        return;
+    }
+    interval.start = ReloadPosition(ctx, is, use, pos);
+    interval.reg = { };
+    interval.is_spilled = true;
+    AddToUnhandled(is, interval);
+}
 
-        interval.reg = spill.reg;
+// Splits the active interval at "active_index" to free its register at "pos".
+// The interval is spilled, and the rest of it is reloaded before its next use
+// at or after "reload_from".
+static void SplitActiveInterval(Codegen_Context *ctx, Interval_Sets &is,
+        s64 active_index, s32 pos, s32 reload_from, const char *note)
+{
+    Live_Interval spill = is.active[active_index];
+    array::Erase(is.active, active_index);
+
+    s32 spill_pos = SpillPosition(is, spill, pos);
+    Spill(ctx->reg_alloc, spill, spill_pos, 0, note);
+    if (!spill.remat)
         GetLocalOffset(ctx, spill.name, spill.data_type);
-        array::Erase(is.active, spill_i);
-        spill.end = interval.start;
-        AddToAllocated(is, spill);
 
+    RA_DEBUG(ctx,
+    {
+        fprintf(stderr, "Split ");
+        PrintName((IoFile*)stderr, spill.name);
+        fprintf(stderr, " in reg %s at instr %d, spilled at %d\n",
+                GetRegNameStr(spill.reg), pos, spill_pos);
+    })
+
+    Live_Interval handled = spill;
+    handled.end = (spill_pos < pos) ? spill_pos - 1 : pos;
+    handled.next = nullptr;
+    array::Push(is.allocated, handled);
+
+    if (NextUse(spill, reload_from) == NO_USE)
+    {
+        // NOTE(henrik): The next interval of the register keeps the register
+        // as a hint, as it is not reloaded, but moved to the register on the
+        // control flow edges.
+        AddNextIntervalToInactive(is, spill);
+        return;
+    }
+    AddSplitRestToUnhandled(ctx, is, spill, pos, reload_from);
+}
+
+// Frees a register for "interval", when there are no free registers, by
+// splitting the active interval of the same register class, whose next use is
+// the furthest. Of the intervals used later than "interval", a rematerialized
+// one is preferred, as it is not stored. If "interval" is used later than all
+// of them, "interval" stays in its stack slot until its next use instead.
+static void SpillAtInterval(Codegen_Context *ctx, Interval_Sets &is, Live_Interval interval)
+{
+    Reg_Alloc *reg_alloc = ctx->reg_alloc;
+    b32 is_float = DataTypeIsFloat(interval.data_type);
+    s32 interval_use = NextUse(interval, interval.start);
+
+    s64 spill_i = -1;
+    s32 spill_use = 0;
+    b32 spill_remat = false;
+    for (s64 i = 0; i < is.active.count; i++)
+    {
+        Live_Interval active = is.active[i];
+        if (active.is_fixed || IsFloatRegister(reg_alloc, active.reg) != is_float)
+            continue;
+        s32 use = NextUseInLoop(is, active, interval.start);
+        b32 remat = (active.remat && use > interval_use);
+        if (spill_i == -1 || remat > spill_remat ||
+            (remat == spill_remat && use > spill_use))
+        {
+            spill_i = i;
+            spill_use = use;
+            spill_remat = remat;
+        }
+    }
+
+    if (spill_i != -1 && spill_use > interval_use)
+    {
+        interval.reg = is.active[spill_i].reg;
+        SplitActiveInterval(ctx, is, spill_i,
+                interval.start, interval.start + 1, "at interval");
+        if (interval.is_spilled)
+            Unspill(reg_alloc, interval, interval.start, 1);
         AddToActive(is, interval);
     }
     else
     {
-        GetLocalOffset(ctx, interval.name, interval.data_type);
+        if (!interval.remat)
+            GetLocalOffset(ctx, interval.name, interval.data_type);
+        AddSplitRestToUnhandled(ctx, is, interval, interval.start, interval.start + 1);
+    }
+}
 
-        if (interval.next)
-            AddToUnhandled(is, *interval.next);
+// Moves the intervals beginning at "instr_index" from the "inactive" set to
+// the "active" set, keeping the register of the previous interval of the same
+// virtual register, if it is free.
+static void RenewInactiveIntervals(Codegen_Context *ctx, Interval_Sets &is, s64 instr_index)
+{
+    Reg_Alloc *reg_alloc = ctx->reg_alloc;
+    while (is.inactive.count > 0 && is.inactive[0].start <= instr_index)
+    {
+        Live_Interval interval = PopFromHeap(is.inactive);
+        ASSERT(interval.end >= instr_index);
+
+        if (TryAllocateRegister(reg_alloc, interval.reg, interval.data_type))
+        {
+            AddToActive(is, interval);
+        }
+        else if (HasFreeRegisters(reg_alloc, interval.data_type))
+        {
+            interval.reg = AllocateFreeRegister(reg_alloc, interval.data_type,
+                    CallClobbers(is, interval));
+            AddToActive(is, interval);
+        }
+        else
+        {
+            SpillAtInterval(ctx, is, interval);
+        }
+    }
+}
+
+static b32 IsMove(Opcode opcode);
+
+// Returns true, if the instruction can access the virtual register "name" in
+// its stack slot: the instruction moves it from or to another register.
+static b32 CanUseStackSlot(const Instruction *instr, Name name)
+{
+    if (!IsMove(instr->opcode)) return false;
+    Operand oper1 = instr->oper1;
+    Operand oper2 = instr->oper2;
+    if (oper1.addr_mode != Oper_Addr_Mode::Direct ||
+        oper2.addr_mode != Oper_Addr_Mode::Direct)
+    {
+        return false;
+    }
+    if (GetOperName(oper2) == name)
+    {
+        Operand swap = oper1;
+        oper1 = oper2;
+        oper2 = swap;
+    }
+    return GetOperName(oper1) == name &&
+        (oper2.type == Oper_Type::VirtualRegister ||
+         oper2.type == Oper_Type::FixedRegister) &&
+        GetOperName(oper2) != name;
+}
+
+// Returns the first use of the interval from "start" to "end", that needs the
+// value in a register, or "end" + 1, if all the uses can access the value in
+// its stack slot.
+static s32 FirstRegisterUse(Codegen_Context *ctx, Live_Interval interval, s32 start, s32 end)
+{
+    Instruction_List &instructions = ctx->current_routine->instructions;
+    for (s32 use = NextUse(interval, start); use <= end; use = NextUse(interval, use + 1))
+    {
+        if (!CanUseStackSlot(instructions[use], interval.name))
+            return use;
     }
+    return end + 1;
 }
 
 // Spill interval from "active" set that has the fixed register of "interval"
@@ -3164,46 +4579,138 @@ static void SpillFixedRegAtInterval(Codegen_Context *ctx, Interval_Sets &is, Liv
 
         Live_Interval spill = is.active[spill_i];
         // NOTE(henrik): This here prevents spilling registers whose live
-        // interval ends after this instruction.
+        // interval ends after this instruction. The register is handed over
+        // to the fixed interval, when the active interval expires.
         if (spill.end == interval.start)
+        {
+            AddToActive(is, interval);
             return;
+        }
+
+        // NOTE(henrik): The rest of the spilled interval is reloaded only
+        // before its next use after the fixed interval, unless it is used
+        // during the fixed interval by an instruction, that cannot access
+        // the stack slot instead.
+        s32 reload_from = FirstRegisterUse(ctx, spill, interval.start, interval.end);
+        SplitActiveInterval(ctx, is, spill_i,
+                interval.start, reload_from, nullptr);
+        AddToActive(is, interval);
+    }
+}
 
-        Spill(ctx->reg_alloc, spill, interval.start);
+// Returns true, if the instruction copies a register to another register of
+// the same data type, so that the copy can be removed, if both get the same
+// physical register.
+static b32 IsRegisterCopy(Instruction *instr)
+{
+    if (!IsMove(instr->opcode)) return false;
+    Operand dest = instr->oper1;
+    Operand src = instr->oper2;
+    if (dest.addr_mode != Oper_Addr_Mode::Direct) return false;
+    if (src.addr_mode != Oper_Addr_Mode::Direct) return false;
+    if (dest.type != Oper_Type::VirtualRegister &&
+        dest.type != Oper_Type::FixedRegister)
+        return false;
+    if (src.type != Oper_Type::VirtualRegister &&
+        src.type != Oper_Type::FixedRegister)
+        return false;
+    return dest.data_type == src.data_type;
+}
 
-        RA_DEBUG(ctx,
-        {
-            fprintf(stderr, "Spilled ");
-            PrintName((IoFile*)stderr, spill.name);
-            fprintf(stderr, " in reg %s at instr %d",
-                    GetRegNameStr(spill.reg), interval.start);
+// Returns true, if "reg" can be given to "interval" as a hint. The register
+// may not be needed by a fixed interval during "interval", and a caller save
+// register may not be live across a call, as it would need to be saved.
+static b32 CanUseHintRegister(Reg_Alloc *reg_alloc, Interval_Sets &is,
+        Live_Interval interval, Reg reg)
+{
+    if ((reg_alloc->reg_info[reg.reg_index].reg_flags & RF_NonAllocable) != 0)
+        return false;
+    if (IsFloatRegister(reg_alloc, reg) != DataTypeIsFloat(interval.data_type))
+        return false;
 
-            s64 offs = GetLocalOffset(ctx, spill.name, spill.data_type);
-            fprintf(stderr, " at offset %" PRId64 "\n", offs);
-        })
+    // NOTE(henrik): The fixed intervals of a register do not overlap, so they
+    // are ordered by their ends, too. A fixed interval may end at the start
+    // of "interval" or begin at its end, as the register can be handed over
+    // there.
+    Array<Instr_Range> &ranges = is.fixed_ranges[reg.reg_index];
+    s64 lo = 0;
+    s64 hi = ranges.count;
+    while (lo < hi)
+    {
+        s64 mid = (lo + hi) / 2;
+        if (ranges[mid].end <= interval.start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < ranges.count && ranges[lo].start < interval.end)
+        return false;
 
-        GetLocalOffset(ctx, spill.name, spill.data_type);
+    u64 clobbered_regs = CallClobbers(is, interval.start + 1, interval.end);
+    if ((clobbered_regs & (1ull << reg.reg_index)) != 0)
+        return false;
+    return true;
+}
+
+// Gets the register of the copy source, when "interval" begins with a copy
+// from an active interval ending at the copy. The interval can share the
+// register with the source, as they do not interfere.
+static b32 GetCopySourceHint(Routine *routine, Interval_Sets &is,
+        Live_Interval interval, Reg *reg)
+{
+    Instruction *instr = routine->instructions[interval.start];
+    if (!IsRegisterCopy(instr)) return false;
+    if (!(GetOperName(instr->oper1) == interval.name)) return false;
+
+    Name src_name = GetOperName(instr->oper2);
+    s64 src_i = -1;
+    for (s64 i = 0; i < is.active.count; i++)
+    {
+        if (is.active[i].name == src_name && is.active[i].end == interval.start)
+        {
+            src_i = i;
+            break;
+        }
+    }
+    if (src_i == -1) return false;
+
+    Reg src_reg = is.active[src_i].reg;
+    for (s64 i = 0; i < is.active.count; i++)
+    {
+        if (i != src_i && is.active[i].reg == src_reg)
+            return false;
+    }
+    *reg = src_reg;
+    return true;
+}
 
-        array::Erase(is.active, spill_i);
-        Live_Interval handled_li = spill;
-        handled_li.end = interval.start;
-        handled_li.next = nullptr;
-        AddToAllocated(is, handled_li);
+// Gets the fixed register, when "interval" ends with a copy to an argument
+// or a return register.
+static b32 GetCopyTargetHint(Routine *routine, Live_Interval interval, Reg *reg)
+{
+    Instruction *instr = routine->instructions[interval.end];
+    if (!IsRegisterCopy(instr)) return false;
+    if (instr->oper1.type != Oper_Type::FixedRegister) return false;
+    if (!(GetOperName(instr->oper2) == interval.name)) return false;
 
-        AddToActive(is, interval);
+    *reg = instr->oper1.fixed_reg.reg;
+    return true;
+}
 
-        spill.start = interval.end + 1;
-        if (spill.end > spill.start)
-        {
-            Unspill(ctx->reg_alloc, spill, spill.start);
-            AddToUnhandled(is, spill);
-        }
-        else
+// Returns true, if "reg" is taken only by fixed intervals beginning at the end
+// of "interval", so that the register is handed over to them there.
+static b32 RegIsHandedOver(Interval_Sets &is, Live_Interval interval, Reg reg)
+{
+    for (s64 i = 0; i < is.active.count; i++)
+    {
+        Live_Interval active = is.active[i];
+        if (active.reg == reg &&
+            (!active.is_fixed || active.start != interval.end))
         {
-            // Add next interval to inactive only, when spill is not added to unhandled.
-            // This way we do not add it twice.
-            AddNextIntervalToInactive(is, spill);
+            return false;
         }
     }
+    return true;
 }
 
 static b32 SetRegOperand(Reg_Alloc *reg_alloc, Array<Live_Interval> active, Operand *oper, Name oper_name)
@@ -3249,7 +4756,8 @@ static void SetOperand(Codegen_Context *ctx,
 
     (void)instr_index;
     s64 offs;
-    if (GetLocalOffset(ctx, oper_name, &offs))
+    if (GetLocalOffset(ctx, oper_name, &offs) ||
+        GetRematStackSlot(ctx, oper_name, oper->data_type, &offs))
     {
         // TODO(henrik): Here is a problem: if the operand oper is not a direct
         // operand, we will only try to load the spilled base operand. Example:
@@ -3298,11 +4806,23 @@ static void SetOperand(Codegen_Context *ctx,
     }
 }
 
-static void SpillCallerSaves(Reg_Alloc *reg_alloc, Array<Live_Interval> active, s64 instr_index)
+// Returns true, if the active interval needs to be saved around the call at
+// "call_index", that clobbers "clobbered_regs". An interval ending at the call
+// is not live after it, and must not be restored over the return value.
+static b32 NeedsCallerSave(Live_Interval interval, s64 call_index, u64 clobbered_regs)
+{
+    return !interval.is_fixed && interval.end > call_index &&
+        (clobbered_regs & (1ull << interval.reg.reg_index)) != 0;
+}
+
+// NOTE(henrik): The rematerialized values are not saved, but loaded again
+// after the call.
+static void SpillCallerSaves(Reg_Alloc *reg_alloc, Array<Live_Interval> active,
+        s64 instr_index, u64 clobbered_regs)
 {
     for (s64 i = 0; i < active.count; i++)
     {
-        if (!active[i].is_fixed && IsCallerSave(reg_alloc, active[i].reg))
+        if (NeedsCallerSave(active[i], instr_index, clobbered_regs) && !active[i].remat)
         {
             Live_Interval interval = active[i];
             interval.name = reg_save_names[interval.reg.reg_index];
@@ -3311,28 +4831,57 @@ static void SpillCallerSaves(Reg_Alloc *reg_alloc, Array<Live_Interval> active,
     }
 }
 
-static void UnspillCallerSaves(Reg_Alloc *reg_alloc, Array<Live_Interval> active, s64 instr_index)
+static void UnspillCallerSaves(Reg_Alloc *reg_alloc, Array<Live_Interval> active,
+        s64 instr_index, u64 clobbered_regs)
 {
     for (s64 i = 0; i < active.count; i++)
     {
-        if (!active[i].is_fixed && IsCallerSave(reg_alloc, active[i].reg))
+        if (NeedsCallerSave(active[i], instr_index - 1, clobbered_regs))
         {
             Live_Interval interval = active[i];
-            interval.name = reg_save_names[interval.reg.reg_index];
+            if (!interval.remat)
+                interval.name = reg_save_names[interval.reg.reg_index];
             Unspill(reg_alloc, interval, instr_index, 0, "caller save");
         }
     }
 }
 
+// Splits the active intervals in caller save registers, that are live across
+// the call at "call_index", but not used before the next call. They are
+// spilled once and reloaded before their next use, instead of being saved and
+// restored around each call.
+static void SplitCallerSaves(Codegen_Context *ctx, Interval_Sets &is,
+        s32 call_index, u64 clobbered_regs)
+{
+    Reg_Alloc *reg_alloc = ctx->reg_alloc;
+    s32 next_call = NextCall(is, call_index + 1);
+    for (s64 i = is.active.count - 1; i >= 0; i--)
+    {
+        Live_Interval interval = is.active[i];
+        if (!NeedsCallerSave(interval, call_index, clobbered_regs))
+            continue;
+        s32 use = NextUse(interval, call_index + 1);
+        if (use != NO_USE && use <= next_call)
+            continue;
+
+        SplitActiveInterval(ctx, is, i, call_index, call_index + 1, "caller save");
+        if (!RegIsActive(is, interval.reg))
+            ReleaseRegister(reg_alloc, interval.reg, interval.data_type);
+    }
+}
+
 static void ScanInstruction(Codegen_Context *ctx, Routine *routine,
-        Array<Live_Interval> &active, s64 instr_i)
+        Interval_Sets &is, s64 instr_i)
 {
     Reg_Alloc *reg_alloc = ctx->reg_alloc;
+    Array<Live_Interval> &active = is.active;
     Instruction *instr = routine->instructions[instr_i];
     if ((Amd64_Opcode)instr->opcode == OP_call)
     {
-        SpillCallerSaves(reg_alloc, active, instr_i);
-        UnspillCallerSaves(reg_alloc, active, instr_i + 1);
+        u64 clobbered_regs = CallClobbers(is, instr_i, instr_i);
+        SplitCallerSaves(ctx, is, instr_i, clobbered_regs);
+        SpillCallerSaves(reg_alloc, active, instr_i, clobbered_regs);
+        UnspillCallerSaves(reg_alloc, active, instr_i + 1, clobbered_regs);
     }
     else if ((Amd64_Opcode)instr->opcode == OP_SPILL)
     {
@@ -3355,6 +4904,14 @@ static void ScanInstruction(Codegen_Context *ctx, Routine *routine,
                     RegOperand(interval.reg, interval.data_type, AF_Read));
                 array::Erase(active, i);
                 ReleaseRegister(reg_alloc, interval.reg, interval.data_type);
+
+                // NOTE(henrik): The interval is kept in the allocated
+                // intervals, so that the edges jumping in before the store
+                // move the value to its register, and not to its stack slot.
+                Live_Interval handled = interval;
+                handled.end = instr_i;
+                handled.next = nullptr;
+                array::Push(is.allocated, handled);
                 return;
 #endif
             }
@@ -3379,17 +4936,24 @@ static void PrintIntervals(Array<Live_Interval> intervals)
     fprintf(stderr, "\n");
 }
 
-static void ScanInstructions(Codegen_Context *ctx, Routine *routine,
-        Interval_Sets &is,
-        s64 interval_start, s64 next_interval_start)
+// Scans the instructions from "instr_index" to "end", stopping at the start
+// of the next unhandled interval. Returns the index of the first instruction
+// not scanned.
+static s64 ScanInstructions(Codegen_Context *ctx, Routine *routine,
+        Interval_Sets &is, s64 instr_index, s64 end)
 {
     RA_DEBUG(ctx,
-        fprintf(stderr, "Scanning instructions in live interval [%" PRId64 ",%" PRId64 "[\n",
-                interval_start, next_interval_start);
+        fprintf(stderr, "Scanning instructions from %" PRId64 "\n", instr_index);
     )
 
-    for (s64 instr_index = interval_start; instr_index < next_interval_start; instr_index++)
+    for (; instr_index < end; instr_index++)
     {
+        // NOTE(henrik): Renewing the inactive intervals may split an active
+        // interval and add the rest of it to the unhandled intervals, so the
+        // next start is checked for every instruction.
+        if (is.unhandled.count > 0 && is.unhandled[0].start <= instr_index)
+            break;
+
         ExpireOldIntervals(ctx, is, instr_index);
         RenewInactiveIntervals(ctx, is, instr_index);
 
@@ -3401,8 +4965,9 @@ static void ScanInstructions(Codegen_Context *ctx, Routine *routine,
             PrintIntervals(is.inactive);
         })
 
-        ScanInstruction(ctx, routine, is.active, instr_index);
+        ScanInstruction(ctx, routine, is, instr_index);
     }
+    return instr_index;
 }
 
 static void LinearScanRegAllocation(Codegen_Context *ctx, Routine *routine,
@@ -3413,28 +4978,52 @@ static void LinearScanRegAllocation(Codegen_Context *ctx, Routine *routine,
     bool is_leaf = (routine->flags & ROUT_Leaf) != 0;
     ResetRegAlloc(reg_alloc, !is_leaf);
 
-    s64 last_interval_start = 0;
-    for (s64 i = 0; i < is.unhandled.count; i++)
+    s64 instr_count = routine->instructions.count;
+    s64 scanned_until = 0;
+    while (is.unhandled.count > 0)
     {
-        Live_Interval interval = is.unhandled[i];
-        s64 next_interval_start = interval.end;
-        if (i + 1 < is.unhandled.count)
-            next_interval_start = is.unhandled[i + 1].start;
+        Live_Interval interval = PopFromHeap(is.unhandled);
 
         ExpireOldIntervals(ctx, is, interval.start);
         RenewInactiveIntervals(ctx, is, interval.start);
 
+        Reg hint_reg = { };
         if (interval.reg.reg_index != REG_NONE)
         {
             SpillFixedRegAtInterval(ctx, is, interval);
         }
+        else if (!interval.is_spilled &&
+                 GetCopySourceHint(routine, is, interval, &hint_reg) &&
+                 CanUseHintRegister(reg_alloc, is, interval, hint_reg))
+        {
+            // NOTE(henrik): The register is released, when the latter of
+            // the source and the copy expires.
+            interval.reg = hint_reg;
+            AddToActive(is, interval);
+            ctx->opt_counts.coalesced_moves++;
+        }
+        else if (GetCopyTargetHint(routine, interval, &hint_reg) &&
+                 CanUseHintRegister(reg_alloc, is, interval, hint_reg) &&
+                 (TryAllocateRegister(reg_alloc, hint_reg, interval.data_type) ||
+                  RegIsHandedOver(is, interval, hint_reg)))
+        {
+            interval.reg = hint_reg;
+            AddToActive(is, interval);
+            ctx->opt_counts.fixed_reg_hints++;
+
+            if (interval.is_spilled)
+            {
+                Unspill(reg_alloc, interval, interval.start);
+            }
+        }
         else if (!HasFreeRegisters(reg_alloc, interval.data_type))
         {
             SpillAtInterval(ctx, is, interval);
         }
         else
         {
-            Reg free_reg = AllocateFreeRegister(reg_alloc, interval.data_type);
+            Reg free_reg = AllocateFreeRegister(reg_alloc, interval.data_type,
+                    CallClobbers(is, interval));
             interval.reg = free_reg;
             AddToActive(is, interval);
 
@@ -3444,15 +5033,11 @@ static void LinearScanRegAllocation(Codegen_Context *ctx, Routine *routine,
             }
         }
 
-        ScanInstructions(ctx, routine, is,
-                interval.start, next_interval_start);
-
-        last_interval_start = interval.start;
+        if (scanned_until < interval.start)
+            scanned_until = interval.start;
+        scanned_until = ScanInstructions(ctx, routine, is, scanned_until, instr_count);
     }
-
-    s64 last_interval_end = routine->instructions.count;
-    ScanInstructions(ctx, routine, is,
-            last_interval_start, last_interval_end);
+    ScanInstructions(ctx, routine, is, scanned_until, instr_count);
 
     // Scan through physical registers that are callee saves and have been used
     // in this routine.  Add stores and loads for them in the prologue and
@@ -3463,8 +5048,10 @@ static void LinearScanRegAllocation(Codegen_Context *ctx, Routine *routine,
         Reg reg = { (u8)i };
         if (IsCalleeSave(reg_alloc, reg) && IsRegisterDirty(reg_alloc, reg))
         {
+            // NOTE(henrik): The whole xmm register is saved, as the vectorized
+            // loops use all of it.
             Oper_Data_Type data_type = (IsFloatRegister(reg_alloc, reg)) ?
-                Oper_Data_Type::F64 : Oper_Data_Type::U64;
+                Oper_Data_Type::V128 : Oper_Data_Type::U64;
             s64 offs = GetLocalOffset(ctx, reg_save_names[i], data_type);
             Amd64_Opcode mov_op = MoveOp(data_type);
 
@@ -3479,6 +5066,53 @@ static void LinearScanRegAllocation(Codegen_Context *ctx, Routine *routine,
     }
 }
 
+struct Ir_Use_Count
+{
+    Name name;
+    s64 count;
+};
+
+// Counts the uses of the variables and temporaries of the routine.
+static void CountIrUses(Ir_Routine *ir_routine, Memory_Arena *arena,
+        Array<Ir_Use_Count*> &use_table)
+{
+    array::Resize(use_table, 2 * ir_routine->instructions.count + 31);
+    for (s64 i = 0; i < ir_routine->instructions.count; i++)
+    {
+        Ir_Instruction *ir_instr = &ir_routine->instructions[i];
+        Ir_Operand *uses[2];
+        s64 use_count = GetIrUses(ir_instr, uses);
+        for (s64 u = 0; u < use_count; u++)
+        {
+            if (!IsIrLocal(*uses[u])) continue;
+            Name name = GetIrLocalName(*uses[u]);
+            Ir_Use_Count *count = hashtable::Lookup(use_table, name);
+            if (!count)
+            {
+                count = PushStruct<Ir_Use_Count>(arena);
+                count->name = name;
+                count->count = 0;
+                hashtable::Put(use_table, name, count);
+            }
+            count->count++;
+        }
+    }
+}
+
+// NOTE(henrik): The compare is fused with the conditional jump following it
+// only if the jump is the only use of the result; otherwise the result is
+// needed in the target operand.
+static b32 CanFuseCompare(Array<Ir_Use_Count*> &use_table,
+        Ir_Instruction *ir_instr, Ir_Instruction *ir_next_instr)
+{
+    if (ir_next_instr->opcode != IR_Jz && ir_next_instr->opcode != IR_Jnz)
+        return true;
+    if (!IsIrLocal(ir_instr->target) || ir_next_instr->oper1 != ir_instr->target)
+        return false;
+    Ir_Use_Count *count = hashtable::Lookup(use_table, GetIrLocalName(ir_instr->target));
+    return count && count->count == 1;
+}
+
 static void GenerateCode(Codegen_Context *ctx, Ir_Routine *ir_routine, Routine *routine)
 {
     PROFILE_SCOPE("Select instructions");
@@ -3486,6 +5120,10 @@ static void GenerateCode(Codegen_Context *ctx, Ir_Routine *ir_routine, Routine *
     routine->ir_routine = ir_routine;
     routine->flags = ir_routine->flags;
 
+    // NOTE(henrik): The spilled operands are looked up by name, and the
+    // overloads of a routine have the same local names.
+    array::Free(ctx->spilled_opers);
+
     bool toplevel = (ir_routine->name.str.size == 0);
     routine->name = (toplevel)
         ? PushName(&ctx->arena, "init_")
@@ -3493,6 +5131,7 @@ static void GenerateCode(Codegen_Context *ctx, Ir_Routine *ir_routine, Routine *
 
     // Set local offsets for arguments
     Reg_Seq_Index arg_reg_index = { };
+    arg_reg_index.native = UsesNativeCallConv(ir_routine);
     for (s64 i = 0; i < ir_routine->arg_count; i++)
     {
         Ir_Operand *arg = &ir_routine->args[i];
@@ -3525,6 +5164,10 @@ static void GenerateCode(Codegen_Context *ctx, Ir_Routine *ir_routine, Routine *
     PushPrologue(ctx, OP_mov, W_(rbp), R_(rsp));
 
 
+    Memory_Arena use_arena = { };
+    Array<Ir_Use_Count*> use_table = { };
+    CountIrUses(ir_routine, &use_arena, use_table);
+
     for (s64 i = 0; i < ir_routine->instructions.count; i++)
     {
         Ir_Instruction *ir_instr = &ir_routine->instructions[i];
@@ -3533,10 +5176,15 @@ static void GenerateCode(Codegen_Context *ctx, Ir_Routine *ir_routine, Routine *
         Ir_Instruction *ir_next_instr = nullptr;
         if (i + 1 < ir_routine->instructions.count)
             ir_next_instr = &ir_routine->instructions[i + 1];
+        if (ir_next_instr && !CanFuseCompare(use_table, ir_instr, ir_next_instr))
+            ir_next_instr = nullptr;
         bool skip_next = false;
         GenerateCode(ctx, ir_routine, ir_instr, ir_next_instr, &skip_next);
         if (skip_next) i++;
     }
+    array::Free(use_table);
+    FreeMemoryArena(&use_arena);
+
     if (toplevel)
     {
         // Add call to main function
@@ -3554,11 +5202,232 @@ static void GenerateCode(Codegen_Context *ctx, Ir_Routine *ir_routine, Routine *
 
         Name exit_name = MakeConstName("exit");
         Operand exit_label = LabelOperand(exit_name, AF_Read);
-        PushInstruction(ctx, OP_call, exit_label);
+        Instruction *exit_call = PushInstruction(ctx, OP_call, exit_label);
+        exit_call->flags |= IF_ForeignCall;
     }
     PushInstruction(ctx, OP_LABEL, LabelOperand(ctx->return_label_name, AF_Read));
 }
 
+static void InsertCopies(Codegen_Context *ctx, Instruction_List &instructions,
+        s64 &index, Instruction_List &copied)
+{
+    for (s64 i = 0; i < copied.count; i++)
+    {
+        if ((Amd64_Opcode)copied[i]->opcode == OP_ret)
+            continue;
+        Instruction *copy = PushStruct<Instruction>(&ctx->arena);
+        *copy = *copied[i];
+        array::Insert(instructions, index++, copy);
+    }
+}
+
+// Replaces the tail calls with the restoring of the callee saves and the
+// epilogue without the return, followed by a jump to the callee. The callee
+// returns directly to the caller of the routine.
+static void ExpandTailCalls(Codegen_Context *ctx, Routine *routine)
+{
+    Instruction_List &instructions = routine->instructions;
+    for (s64 i = 0; i < instructions.count; i++)
+    {
+        Instruction *instr = instructions[i];
+        if ((instr->flags & IF_TailCall) == 0)
+            continue;
+        InsertCopies(ctx, instructions, i, routine->callee_save_unspills);
+        InsertCopies(ctx, instructions, i, routine->epilogue);
+        instr->opcode = (Opcode)OP_jmp;
+    }
+}
+
+static b32 HasV256Operand(const Instruction *instr)
+{
+    return instr->oper1.data_type == Oper_Data_Type::V256 ||
+        instr->oper2.data_type == Oper_Data_Type::V256 ||
+        instr->oper3.data_type == Oper_Data_Type::V256;
+}
+
+// Flags the places for vzeroupper after the 256 bit code of the vectorized
+// loops: the first label or call after an instruction with a V256 operand,
+// where no V256 value is live. Clearing the upper halves of the ymm registers
+// there avoids the penalty of the transitions from the AVX code to the legacy
+// SSE code.
+static void MarkVZeroUppers(Codegen_Context *ctx, Routine *routine,
+        Array<Live_Interval*> live_interval_set)
+{
+    b32 has_v256 = false;
+    for (s64 i = 0; i < live_interval_set.count && !has_v256; i++)
+        has_v256 = (live_interval_set[i]->data_type == Oper_Data_Type::V256);
+    if (!has_v256) return;
+
+    s64 instr_count = routine->instructions.count;
+    b32 *v256_live = PushArray<b32>(&ctx->arena, instr_count);
+    for (s64 i = 0; i < instr_count; i++)
+        v256_live[i] = false;
+    for (s64 i = 0; i < live_interval_set.count; i++)
+    {
+        for (Live_Interval *ival = live_interval_set[i]; ival; ival = ival->next)
+        {
+            if (ival->data_type != Oper_Data_Type::V256)
+                continue;
+            for (s64 index = ival->start; index <= ival->end && index < instr_count; index++)
+                v256_live[index] = true;
+        }
+    }
+
+    b32 dirty = false;
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Instruction *instr = routine->instructions[i];
+        Amd64_Opcode opcode = (Amd64_Opcode)instr->opcode;
+        if ((opcode == OP_LABEL || opcode == OP_call) && dirty && !v256_live[i])
+        {
+            instr->flags |= IF_VZeroUpper;
+            dirty = false;
+        }
+        if (HasV256Operand(instr))
+            dirty = true;
+    }
+}
+
+static void InsertVZeroUppers(Codegen_Context *ctx, Routine *routine)
+{
+    ctx->comment = nullptr;
+    Instruction_List &instructions = routine->instructions;
+    for (s64 i = 0; i < instructions.count; i++)
+    {
+        Instruction *instr = instructions[i];
+        if ((instr->flags & IF_VZeroUpper) == 0)
+            continue;
+        if ((Amd64_Opcode)instr->opcode == OP_LABEL)
+            i++;
+        InsertInstruction(ctx, instructions, i, OP_vzeroupper);
+    }
+}
+
+// Returns the registers clobbered by the call: the registers clobbered by
+// the callee, if it is a routine of the program allocated registers already,
+// and all the caller save registers otherwise. The foreign and indirect calls
+// follow the calling convention, as do the recursive calls.
+static u64 GetCallClobbers(Codegen_Context *ctx, const Instruction *call)
+{
+    Reg_Alloc *reg_alloc = ctx->reg_alloc;
+    if ((call->flags & IF_ForeignCall) != 0 ||
+        call->oper1.type != Oper_Type::Label ||
+        call->oper1.addr_mode != Oper_Addr_Mode::Direct)
+    {
+        return reg_alloc->caller_save_regs;
+    }
+    Routine *callee = hashtable::Lookup(ctx->routine_table, call->oper1.name);
+    if (!callee)
+        return reg_alloc->caller_save_regs;
+    return callee->clobbered_regs;
+}
+
+// Returns the caller save registers written by the routine or by the routines
+// it calls. The vzeroupper clears the upper halves of all the vector
+// registers, so they are all clobbered by it.
+static u64 GetClobberedRegs(Codegen_Context *ctx, Routine *routine)
+{
+    Reg_Alloc *reg_alloc = ctx->reg_alloc;
+    u64 clobbered_regs = reg_alloc->dirty_regs;
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        Instruction *instr = routine->instructions[i];
+        if ((Amd64_Opcode)instr->opcode == OP_call)
+        {
+            clobbered_regs |= GetCallClobbers(ctx, instr);
+        }
+        else if ((Amd64_Opcode)instr->opcode == OP_vzeroupper)
+        {
+            for (s64 r = 0; r < reg_alloc->reg_count; r++)
+            {
+                if ((reg_alloc->reg_info[r].reg_flags & RF_Float) != 0)
+                    clobbered_regs |= (1ull << r);
+            }
+        }
+    }
+    return clobbered_regs & reg_alloc->caller_save_regs;
+}
+
+// The size of the area below the stack pointer, that is not clobbered by the
+// signal handlers, on the System V target.
+static const s64 RED_ZONE_SIZE = 128;
+
+// Returns true, if the operand refers to "reg" other than as the base of a
+// memory operand.
+static b32 UsesRegDirectly(const Operand &oper, Amd64_Register reg)
+{
+    if (oper.type != Oper_Type::Register || oper.reg.reg_index != reg)
+        return false;
+    return oper.addr_mode != Oper_Addr_Mode::BaseOffset &&
+        oper.addr_mode != Oper_Addr_Mode::BaseIndexOffset;
+}
+
+static b32 UsesFrameRegsDirectly(Instruction_List &instructions)
+{
+    for (s64 i = 0; i < instructions.count; i++)
+    {
+        Instruction *instr = instructions[i];
+        const Operand *opers[] = { &instr->oper1, &instr->oper2, &instr->oper3 };
+        for (s64 o = 0; o < array_length(opers); o++)
+        {
+            const Operand &oper = *opers[o];
+            if (UsesRegDirectly(oper, REG_rbp))
+                return true;
+            if (oper.type == Oper_Type::Register && oper.reg.reg_index == REG_rsp)
+                return true;
+        }
+    }
+    return false;
+}
+
+// Returns true, if the routine can do without the frame: a leaf routine on
+// the System V target, whose stack slots fit in the red zone, and that uses
+// the frame pointer only as the base of its stack slots.
+static b32 CanOmitFrame(Codegen_Context *ctx, Routine *routine)
+{
+    if (ctx->target != CGT_AMD64_Unix)
+        return false;
+    if ((routine->flags & ROUT_Leaf) == 0 || routine->ir_routine->name.str.size == 0)
+        return false;
+    // NOTE(henrik): The stack slots stay where they would be below the
+    // pushed frame pointer, which takes the first word of the red zone.
+    if (routine->locals_size + 8 > RED_ZONE_SIZE)
+        return false;
+    return !UsesFrameRegsDirectly(routine->instructions) &&
+        !UsesFrameRegsDirectly(routine->callee_save_spills) &&
+        !UsesFrameRegsDirectly(routine->callee_save_unspills);
+}
+
+// Rebases the memory operands on the frame pointer to the stack pointer,
+// that points to the return address, a word above the frame pointer.
+static void RebaseOnStackPointer(Instruction_List &instructions)
+{
+    for (s64 i = 0; i < instructions.count; i++)
+    {
+        Instruction *instr = instructions[i];
+        Operand *opers[] = { &instr->oper1, &instr->oper2, &instr->oper3 };
+        for (s64 o = 0; o < array_length(opers); o++)
+        {
+            Operand &oper = *opers[o];
+            if (oper.type == Oper_Type::Register && oper.reg.reg_index == REG_rbp)
+            {
+                oper.reg = MakeReg(REG_rsp);
+                oper.scale_offset -= 8;
+            }
+        }
+    }
+}
+
+// Removes the frame setup of the routine, keeping its stack slots in the red
+// zone below the stack pointer. The frame pointer is not touched.
+static void OmitFrame(Routine *routine)
+{
+    array::Clear(routine->prologue);
+    RebaseOnStackPointer(routine->instructions);
+    RebaseOnStackPointer(routine->callee_save_spills);
+    RebaseOnStackPointer(routine->callee_save_unspills);
+}
+
 static void AllocateRegisters(Codegen_Context *ctx, Ir_Routine *ir_routine, Routine *routine)
 {
     PROFILE_SCOPE("Allocate registers");
@@ -3571,80 +5440,100 @@ static void AllocateRegisters(Codegen_Context *ctx, Ir_Routine *ir_routine, Rout
     ComputeLiveness(ctx, ir_routine, routine,
             live_interval_set, cfg_edges);
 
-    // Sort the intervals in the singly linked list of every interval.
+    MarkVZeroUppers(ctx, routine, live_interval_set);
+
+    Stack_Slots stack_slots;
+    InitStackSlots(ctx, &stack_slots, live_interval_set);
+
+    // NOTE(henrik): The intervals of a virtual register are linked in the
+    // order they begin, as the liveness is reduced to intervals in the
+    // instruction order.
+    Interval_Sets is = { };
     for (s64 i = 0; i < live_interval_set.count; i++)
     {
-        Live_Interval **interval = &live_interval_set[i];
-        bool done = false;
-        while (!done)
+        AddToUnhandled(is, *live_interval_set[i]);
+        for (Live_Interval *interval = live_interval_set[i];
+             interval; interval = interval->next)
         {
-            Live_Interval **prev = interval;
-            Live_Interval *ival = *interval;
-            Live_Interval *next = ival->next;
-
-            done = true;
-
-            while (next)
-            {
-                if (next->start < ival->start)
-                {
-                    ival->next = next->next;
-                    next->next = ival;
-                    *prev = next;
-
-                    done = false;
-                }
-                prev = &ival->next;
-                ival = next;
-                next = next->next;
-            }
+            if (!interval->is_fixed) continue;
+            Array<Instr_Range> &ranges = is.fixed_ranges[interval->reg.reg_index];
+            Instr_Range range = { interval->start, interval->end };
+            s64 index = ranges.count;
+            while (index > 0 && ranges[index - 1].start > range.start)
+                index--;
+            array::Insert(ranges, index, range);
         }
     }
+    array::Free(live_interval_set);
 
-    // Sort live intervals and move them to live_intervals array.
-    Array<Live_Interval> live_intervals = { };
-    for (s64 i = 0; i < live_interval_set.count; i++)
+    for (s64 i = 0; i < routine->instructions.count; i++)
     {
-        Live_Interval *interval = live_interval_set[i];
-
-        s64 index = 0;
-        for (index = 0; index < live_intervals.count; index++)
+        Instruction *instr = routine->instructions[i];
+        if ((Amd64_Opcode)instr->opcode == OP_call)
         {
-            if (interval->start < live_intervals[index].start)
-                break;
+            array::Push(is.calls, (s32)i);
+            array::Push(is.call_clobbers, GetCallClobbers(ctx, instr));
         }
-        array::Insert(live_intervals, index, *interval);
     }
-    array::Free(live_interval_set);
 
-    Interval_Sets is = { };
-    is.unhandled = live_intervals;
+    for (s64 i = 0; i < cfg_edges.count; i++)
+    {
+        Cfg_Edge edge = cfg_edges[i];
+        if (edge.branch_instr_index != -1 && edge.branch_instr_index <= edge.instr_index)
+        {
+            s32 start = BlockEntryPosition(routine->instructions, edge.branch_instr_index, -1);
+            Instr_Range loop = { start, edge.instr_index };
+            array::Push(is.loops, loop);
+        }
+    }
 
     LinearScanRegAllocation(ctx, routine, is);
 
-    CfgEdgeResolution(ctx, is.allocated, cfg_edges);
+    CfgEdgeResolution(ctx, routine, is.allocated, cfg_edges);
 
     array::Free(is.unhandled);
     array::Free(is.active);
     array::Free(is.inactive);
     array::Free(is.allocated);
+    array::Free(is.loops);
+    for (s64 i = 0; i < REG_COUNT; i++)
+        array::Free(is.fixed_ranges[i]);
+    array::Free(is.calls);
+    array::Free(is.call_clobbers);
     array::Free(cfg_edges);
 
+    AddCallerSaveSlotUsers(ctx, &stack_slots);
     InsertSpills(ctx, routine);
+    InsertVZeroUppers(ctx, routine);
+    FreeStackSlots(ctx, &stack_slots);
 
     s64 locals_size = routine->locals_size;
-    if (locals_size > 0)
+    if (CanOmitFrame(ctx, routine))
     {
-        locals_size = Align(locals_size, 16);
-        PushPrologue(ctx, OP_sub,
-                RegOperand(REG_rsp, Oper_Data_Type::U64, AF_Write),
-                ImmOperand(locals_size, AF_Read));
-        PushEpilogue(ctx, OP_mov,
-                RegOperand(REG_rsp, Oper_Data_Type::PTR, AF_Write),
-                RegOperand(REG_rbp, Oper_Data_Type::PTR, AF_Read));
+        OmitFrame(routine);
+        ctx->opt_counts.omitted_frames++;
+    }
+    else
+    {
+        if (locals_size > 0)
+        {
+            locals_size = Align(locals_size, 16);
+            PushPrologue(ctx, OP_sub,
+                    RegOperand(REG_rsp, Oper_Data_Type::U64, AF_Write),
+                    ImmOperand(locals_size, AF_Read));
+            PushEpilogue(ctx, OP_mov,
+                    RegOperand(REG_rsp, Oper_Data_Type::PTR, AF_Write),
+                    RegOperand(REG_rbp, Oper_Data_Type::PTR, AF_Read));
+        }
+        PushEpilogue(ctx, OP_pop, RegOperand(REG_rbp, Oper_Data_Type::U64, AF_Write));
     }
-    PushEpilogue(ctx, OP_pop, RegOperand(REG_rbp, Oper_Data_Type::U64, AF_Write));
     PushEpilogue(ctx, OP_ret);
+
+    // NOTE(henrik): The summary is computed before the tail calls become
+    // jumps, so that it includes the registers clobbered by the tail callees.
+    routine->clobbered_regs = GetClobberedRegs(ctx, routine);
+
+    ExpandTailCalls(ctx, routine);
 }
 
 // Some "optimizations" to the generated code.
@@ -3653,7 +5542,9 @@ static b32 IsMove(Opcode opcode)
 {
     return ((Amd64_Opcode)opcode == OP_mov ||
             (Amd64_Opcode)opcode == OP_movss ||
-            (Amd64_Opcode)opcode == OP_movsd);
+            (Amd64_Opcode)opcode == OP_movsd ||
+            (Amd64_Opcode)opcode == OP_movups ||
+            (Amd64_Opcode)opcode == OP_vmovups);
 }
 
 #if 0
@@ -3704,6 +5595,13 @@ static void CommentOut(Instruction *instr)
     instr->flags |= IF_CommentedOut;
 }
 
+static void CommentOutMove(Instruction *instr, s64 *count)
+{
+    if (!IsCommentedOut(instr))
+        (*count)++;
+    CommentOut(instr);
+}
+
 static bool HasSideEffectsBesidesDefOper1(Instruction *instr)
 {
     return
@@ -3717,7 +5615,7 @@ static void OptimizeCode(Codegen_Context *ctx, Routine *routine)
 {
     PROFILE_SCOPE("Optimize code");
 
-    (void)ctx;
+    Codegen_Opt_Counts *counts = &ctx->opt_counts;
     for (s64 i = 0; i < routine->instructions.count; i++)
     {
         Instruction *instr = routine->instructions[i];
@@ -3726,7 +5624,7 @@ static void OptimizeCode(Codegen_Context *ctx, Routine *routine)
             if (IsSame(instr->oper1, instr->oper2))
             {
                 //MakeNop(instr);
-                CommentOut(instr);
+                CommentOutMove(instr, &counts->same_reg_moves);
             }
         }
     }
@@ -3755,7 +5653,7 @@ static void OptimizeCode(Codegen_Context *ctx, Routine *routine)
                 if (IsSame(instr_0->oper1, instr_1->oper2) &&
                     IsSame(instr_0->oper2, instr_1->oper1))
                 {
-                    CommentOut(instr_1);
+                    CommentOutMove(instr_1, &counts->redundant_moves);
                 }
                 else
                 if (IsMove(instr_0->opcode) &&
@@ -3764,14 +5662,14 @@ static void OptimizeCode(Codegen_Context *ctx, Routine *routine)
                     if (IsSame(instr_0->oper1, instr_1->oper1) &&
                         IsSame(instr_0->oper2, instr_1->oper2))
                     {
-                        CommentOut(instr_1);
+                        CommentOutMove(instr_1, &counts->redundant_moves);
                     }
                 }
                 else
                 if (IsSame(instr_0->oper1, instr_1->oper1) &&
                     !IsCommentedOut(instr_1))
                 {
-                    CommentOut(instr_0);
+                    CommentOutMove(instr_0, &counts->redundant_moves);
                 }
             }
             else
@@ -3803,6 +5701,66 @@ static s64 CountInstructions(Routine *routine)
     return count;
 }
 
+static s64 CountRegisterMoves(Routine *routine)
+{
+    s64 count = 0;
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        Instruction *instr = routine->instructions[i];
+        if (!IsCommentedOut(instr) && IsMove(instr->opcode) &&
+            instr->oper1.type == Oper_Type::Register &&
+            instr->oper1.addr_mode == Oper_Addr_Mode::Direct &&
+            instr->oper2.type == Oper_Type::Register &&
+            instr->oper2.addr_mode == Oper_Addr_Mode::Direct)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Flags the routines, whose address is used other than as the target of a
+// direct call, as they may be called through routine pointers.
+// NOTE(henrik): The globals holding routine addresses are not baked into the
+// global data at compile time, as the interpreter has no program addresses
+// for them. They are initialized in the top level routine, so the routine
+// operands of the instructions cover also the global routine pointers.
+static void MarkAddressTakenRoutines(Codegen_Context *ctx, Ir_Routine_List ir_routines)
+{
+    for (s64 i = 0; i < ctx->global_var_count; i++)
+    {
+        ASSERT(ctx->global_vars[i]->type->tag != TYP_Function ||
+                ctx->global_data[i] == nullptr);
+    }
+    for (s64 i = 0; i < ir_routines.count; i++)
+    {
+        Ir_Routine *ir_routine = ir_routines[i];
+        for (s64 j = 0; j < ir_routine->instructions.count; j++)
+        {
+            Ir_Instruction *ir_instr = &ir_routine->instructions[j];
+            Ir_Operand *opers[] = { &ir_instr->target, &ir_instr->oper1, &ir_instr->oper2 };
+            for (s64 k = 0; k < array_length(opers); k++)
+            {
+                if (opers[k]->oper_type != IR_OPER_Routine)
+                    continue;
+                if (k == 1 && (ir_instr->opcode == IR_Call || ir_instr->opcode == IR_CallForeign))
+                    continue;
+                Routine *routine = hashtable::Lookup(ctx->routine_table, opers[k]->var.name);
+                if (routine)
+                    routine->ir_routine->flags |= ROUT_AddressTaken;
+            }
+        }
+    }
+}
+
+// A routine on the depth first walk of the call graph, which orders the
+// register allocation, and the instruction to continue the walk from.
+struct Alloc_Order_Item
+{
+    s64 routine_index;
+    s64 instr_index;
+};
+
 void GenerateCode_Amd64(Codegen_Context *ctx, Ir_Routine_List ir_routines)
 {
     ctx->routine_count = ir_routines.count;
@@ -3811,6 +5769,17 @@ void GenerateCode_Amd64(Codegen_Context *ctx, Ir_Routine_List ir_routines)
     {
         Routine *routine = &ctx->routines[i];
         *routine = { };
+        routine->name = ir_routines[i]->name;
+        routine->ir_routine = ir_routines[i];
+        routine->clobbered_regs = ctx->reg_alloc->caller_save_regs;
+        if (routine->name.str.size > 0)
+            hashtable::Put(ctx->routine_table, routine->name, routine);
+    }
+    MarkAddressTakenRoutines(ctx, ir_routines);
+
+    for (s64 i = 0; i < ir_routines.count; i++)
+    {
+        Routine *routine = &ctx->routines[i];
         ctx->current_routine = routine;
         GenerateCode(ctx, ir_routines[i], routine);
     }
@@ -3829,12 +5798,53 @@ void GenerateCode_Amd64(Codegen_Context *ctx, Ir_Routine_List ir_routines)
         ctx->code_out = f;
     })
 
+    // NOTE(henrik): The routines are allocated registers callees first, so
+    // that the calls save only the registers clobbered by the callee.
+    Array<Alloc_Order_Item> order_stack = { };
+    u8 *visited = PushArray<u8>(&ctx->arena, ir_routines.count);
+    for (s64 i = 0; i < ir_routines.count; i++)
+        visited[i] = 0;
     for (s64 i = 0; i < ir_routines.count; i++)
     {
-        Routine *routine = &ctx->routines[i];
-        ctx->current_routine = routine;
-        AllocateRegisters(ctx, ir_routines[i], routine);
+        if (visited[i]) continue;
+        visited[i] = 1;
+        Alloc_Order_Item root = { i, 0 };
+        array::Push(order_stack, root);
+        while (order_stack.count > 0)
+        {
+            Alloc_Order_Item &item = array::Back(order_stack);
+            Routine *routine = &ctx->routines[item.routine_index];
+            Routine *callee = nullptr;
+            while (!callee && item.instr_index < routine->instructions.count)
+            {
+                Instruction *instr = routine->instructions[item.instr_index++];
+                if ((Amd64_Opcode)instr->opcode != OP_call ||
+                    (instr->flags & IF_ForeignCall) != 0 ||
+                    instr->oper1.type != Oper_Type::Label)
+                {
+                    continue;
+                }
+                callee = hashtable::Lookup(ctx->routine_table, instr->oper1.name);
+                if (callee && visited[callee - ctx->routines])
+                    callee = nullptr;
+            }
+            if (callee)
+            {
+                s64 callee_index = callee - ctx->routines;
+                visited[callee_index] = 1;
+                Alloc_Order_Item next = { callee_index, 0 };
+                array::Push(order_stack, next);
+            }
+            else
+            {
+                s64 index = item.routine_index;
+                array::Pop(order_stack);
+                ctx->current_routine = routine;
+                AllocateRegisters(ctx, ir_routines[index], routine);
+            }
+        }
     }
+    array::Free(order_stack);
 
     s64 instruction_count = 0;
     if (ctx->comp_ctx->options.profile_instr_count)
@@ -3852,14 +5862,26 @@ void GenerateCode_Amd64(Codegen_Context *ctx, Ir_Routine_List ir_routines)
 
     if (ctx->comp_ctx->options.profile_instr_count)
     {
+        Codegen_Opt_Counts *counts = &ctx->opt_counts;
         s64 opt_instruction_count = 0;
         for (s64 i = 0; i < ir_routines.count; i++)
         {
             opt_instruction_count += CountInstructions(&ctx->routines[i]);
+            counts->reg_moves_left += CountRegisterMoves(&ctx->routines[i]);
         }
 
         fprintf(stdout, "    instruction count: %" PRId64 "\n", instruction_count);
         fprintf(stdout, "opt instruction count: %" PRId64 "\n", opt_instruction_count);
+        fprintf(stdout, "coalesced moves: %" PRId64 "\n", counts->coalesced_moves);
+        fprintf(stdout, "fixed register hints: %" PRId64 "\n", counts->fixed_reg_hints);
+        fprintf(stdout, "eliminated moves: %" PRId64 "\n",
+                counts->same_reg_moves + counts->redundant_moves);
+        fprintf(stdout, "  same register moves: %" PRId64 "\n", counts->same_reg_moves);
+        fprintf(stdout, "  redundant moves: %" PRId64 "\n", counts->redundant_moves);
+        fprintf(stdout, "register moves left: %" PRId64 "\n", counts->reg_moves_left);
+        fprintf(stdout, "shared stack slots: %" PRId64 "\n", counts->shared_stack_slots);
+        fprintf(stdout, "rematerialized values: %" PRId64 "\n", counts->remat_values);
+        fprintf(stdout, "omitted frames: %" PRId64 "\n", counts->omitted_frames);
     }
 }
 
@@ -3956,6 +5978,10 @@ static s64 PrintOperand(IoFile *file,
                 case Oper_Data_Type::F64:
                 case Oper_Data_Type::PTR:
                     len += fprintf((FILE*)file, "qword "); break;
+                case Oper_Data_Type::V128:
+                    len += fprintf((FILE*)file, "oword "); break;
+                case Oper_Data_Type::V256:
+                    len += fprintf((FILE*)file, "yword "); break;
             }
         }
         len += fprintf((FILE*)file, "[");
@@ -4050,12 +6076,22 @@ static void PrintInstruction(IoFile *file, const Instruction *instr)
             len += PrintOperand(file, instr->oper1, &instr->oper2, true, lea);
             len += PrintOperand(file, instr->oper2, &instr->oper3, false, lea);
             len += PrintOperand(file, instr->oper3, nullptr, false, lea);
+            if ((instr->flags & IF_ForeignCall) != 0 &&
+                instr->oper1.type == Oper_Type::Label)
+            {
+                len += fprintf((FILE*)file, " wrt ..plt");
+            }
         }
     }
     PrintComment((FILE*)file, len, instr->comment);
     fprintf((FILE*)file, "\n");
 }
 
+void PrintInstruction_Amd64(IoFile *file, const Instruction *instr)
+{
+    PrintInstruction(file, instr);
+}
+
 static void PrintInstructions(IoFile *file, Instruction_List &instructions)
 {
     for (s64 i = 0; i < instructions.count; i++)
@@ -4090,7 +6126,8 @@ void OutputCode_Amd64(Codegen_Context *ctx)
     fprintf(f, "; Target:      %s\n", GetTargetString(ctx->target));
     fprintf(f, "; -----\n\n");
 
-    fprintf(f, "bits 64\n\n");
+    fprintf(f, "bits 64\n");
+    fprintf(f, "default rel\n\n");
     for (s64 routine_idx = 0; routine_idx < ctx->foreign_routine_count; routine_idx++)
     {
         Name foreign_routine = ctx->foreign_routines[routine_idx];
@@ -4136,6 +6173,28 @@ void OutputCode_Amd64(Codegen_Context *ctx)
         fprintf(f, "; -----\n\n");
     }
 
+    fprintf(f, "\nsection .data\n");
+
+    // initialized globals
+
+    for (s64 i = 0; i < ctx->global_var_count; i++)
+    {
+        u8 *data = ctx->global_data[i];
+        if (!data) continue;
+
+        Symbol *symbol = ctx->global_vars[i];
+        u32 size = GetAlignedSize(symbol->type);
+        fprintf(f, "align %u, db 0\n", GetAlign(symbol->type));
+        PrintName(file, symbol->unique_name);
+        fprintf(f, ":\t; ");
+        PrintType(file, symbol->type);
+        for (u32 b = 0; b < size; b++)
+        {
+            fprintf(f, (b % 16 == 0) ? "\n\tdb %u" : ", %u", data[b]);
+        }
+        fprintf(f, "\n");
+    }
+
     fprintf(f, "\nsection .bss\n");
 
     // globals
@@ -4146,9 +6205,11 @@ void OutputCode_Amd64(Codegen_Context *ctx)
         fprintf(f, "\n;global variables\n");
         for (s64 i = 0; i < ctx->global_var_count; i++)
         {
+            if (ctx->global_data[i]) continue;
+
             Symbol *symbol = ctx->global_vars[i];
             u32 align = GetAlign(symbol->type);
-            u32 align_res_size = offset & (align - 1);
+            u32 align_res_size = (align - (offset & (align - 1))) & (align - 1);
             offset += align_res_size;
 
             if (align_res_size)
@@ -4164,7 +6225,7 @@ void OutputCode_Amd64(Codegen_Context *ctx)
         }
     }
 
-    fprintf(f, "\nsection .data\n");
+    fprintf(f, "\nsection .rodata\n");
 
     // constants
 
@@ -4193,6 +6254,9 @@ void OutputCode_Amd64(Codegen_Context *ctx)
     {
         Array<String> str_data = { };
 
+        // NOTE(henrik): The size and pointer pairs need an absolute
+        // relocation for the pointer, so they are kept in writable data.
+        fprintf(f, "\nsection .data\n");
         fprintf(f, "\nalign 8\n");
         for (s64 i = 0; i < ctx->str_consts.count; i++)
         {
@@ -4203,6 +6267,7 @@ void OutputCode_Amd64(Codegen_Context *ctx)
             array::Push(str_data, sconst.value);
         }
 
+        fprintf(f, "\nsection .rodata\n");
         fprintf(f, "\nalign 1\n");
         for (s64 i = 0; i < str_data.count; i++)
         {
@@ -2,15 +2,249 @@
 
 #include "types.h"
 #include "codegen.h"
+#include "object_code.h"
 
 namespace hplang
 {
 
+enum { Opcode_Mod_Shift = 7 };
+
+enum Opcode_Mod
+{
+    NO_MOD  = 0,
+    O1_REG  = 0x01,
+    O1_MEM  = 0x02,
+    O1_RM   = O1_REG | O1_MEM,
+    O1_IMM  = 0x04,
+    //O1_W8   = 0x08,
+    //O1_W16  = 0x10,
+    //O1_W32  = 0x20,
+    //O1_W64  = 0x40,
+
+    O2_REG = (O1_REG << Opcode_Mod_Shift),
+    O2_MEM = (O1_MEM << Opcode_Mod_Shift),
+    O2_RM = O2_REG | O2_MEM,
+    O2_IMM = (O1_IMM << Opcode_Mod_Shift),
+
+    O3_REG = (O2_REG << Opcode_Mod_Shift),
+    O3_MEM = (O2_MEM << Opcode_Mod_Shift),
+    O3_RM = O3_REG | O3_MEM,
+    O3_IMM = (O2_IMM << Opcode_Mod_Shift),
+};
+
+// Disabled or non-valid instruction opcode
+#define PASTE_OP_D(x, mods)
+
+// NOTE(henrik): Do we want (comiss and comisd) or (ucomiss and ucomisd)?
+
+// NOTE(henrik): The packed instructions operate on the V128 and V256 operands
+// of the vectorized loops. The ones with the v prefix are VEX encoded and are
+// used only, when the target has AVX2.
+
+// NOTE(henrik): Conditional move opcode cmovg is not valid when the operands
+// are 64 bit wide. The condition "cmovg a, b" can be replaced with "cmovl b, a".
+#define OPCODES\
+    PASTE_OP(LABEL,     NO_MOD)\
+    PASTE_OP(SPILL,     NO_MOD)\
+    \
+    PASTE_OP(nop,       NO_MOD)\
+    \
+    PASTE_OP(call,      NO_MOD)\
+    PASTE_OP(ret,       NO_MOD)\
+    PASTE_OP(jmp,       NO_MOD)\
+    PASTE_OP(je,        NO_MOD)\
+    PASTE_OP(jne,       NO_MOD)\
+    PASTE_OP(jb,        NO_MOD)\
+    PASTE_OP(jbe,       NO_MOD)\
+    PASTE_OP(ja,        NO_MOD)\
+    PASTE_OP(jae,       NO_MOD)\
+    PASTE_OP(jl,        NO_MOD)\
+    PASTE_OP(jle,       NO_MOD)\
+    PASTE_OP(jg,        NO_MOD)\
+    PASTE_OP(jge,       NO_MOD)\
+    \
+    PASTE_OP(cmp,       O1_REG | O2_REG | O2_IMM)\
+    PASTE_OP(comiss,    O1_REG | O2_RM)\
+    PASTE_OP(comisd,    O1_REG | O2_RM)\
+    \
+    PASTE_OP(lea,       O1_REG | O2_MEM)\
+    PASTE_OP(mov,       O1_RM | O2_RM | O2_IMM)\
+    PASTE_OP(movsx,     O1_RM | O2_RM)\
+    PASTE_OP(movzx,     O1_RM | O2_RM)\
+    PASTE_OP(movss,     O1_RM | O2_RM)\
+    PASTE_OP(movsd,     O1_RM | O2_RM)\
+    \
+    PASTE_OP(cmove,     O1_REG | O2_RM)\
+    PASTE_OP(cmovne,    O1_REG | O2_RM)\
+    PASTE_OP(cmova,     O1_REG | O2_RM)\
+    PASTE_OP(cmovae,    O1_REG | O2_RM)\
+    PASTE_OP(cmovb,     O1_REG | O2_RM)\
+    PASTE_OP(cmovbe,    O1_REG | O2_RM)\
+    PASTE_OP(cmovl,     O1_REG | O2_RM)\
+    PASTE_OP(cmovle,    O1_REG | O2_RM)\
+    PASTE_OP_D(cmovg,   O1_REG | O2_RM)\
+    PASTE_OP(cmovge,    O1_REG | O2_RM)\
+    \
+    PASTE_OP(cqo,       NO_MOD)\
+    \
+    PASTE_OP(add,       O1_REG | O2_RM | O2_IMM)\
+    PASTE_OP(sub,       O1_REG | O2_RM | O2_IMM)\
+    PASTE_OP(mul,       O1_RM)\
+    PASTE_OP(imul,      O1_REG | O2_RM)\
+    PASTE_OP(div,       O1_RM)\
+    PASTE_OP(idiv,      O1_RM)\
+    PASTE_OP(and,       O1_REG | O2_RM | O2_IMM)\
+    PASTE_OP(or,        O1_REG | O2_RM | O2_IMM)\
+    PASTE_OP(xor,       O1_REG | O2_RM | O2_IMM)\
+    PASTE_OP(neg,       O1_REG)\
+    PASTE_OP(not,       O1_REG)\
+    PASTE_OP(sal,       O1_REG | O2_REG | O2_IMM)\
+    PASTE_OP(shl,       O1_REG | O2_REG | O2_IMM)\
+    PASTE_OP(sar,       O1_REG | O2_REG | O2_IMM)\
+    PASTE_OP(shr,       O1_REG | O2_REG | O2_IMM)\
+    \
+    PASTE_OP(addss,     O1_REG | O2_REG)\
+    PASTE_OP(subss,     O1_REG | O2_REG)\
+    PASTE_OP(mulss,     O1_REG | O2_REG)\
+    PASTE_OP(divss,     O1_REG | O2_REG)\
+    PASTE_OP(addsd,     O1_REG | O2_REG)\
+    PASTE_OP(subsd,     O1_REG | O2_REG)\
+    PASTE_OP(mulsd,     O1_REG | O2_REG)\
+    PASTE_OP(divsd,     O1_REG | O2_REG)\
+    \
+    PASTE_OP(sqrtss,    O1_REG | O2_REG)\
+    PASTE_OP(sqrtsd,    O1_REG | O2_REG)\
+    \
+    PASTE_OP(push,      O1_REG)\
+    PASTE_OP(pop,       O1_REG)\
+    \
+    PASTE_OP(cvtsi2ss,  O1_REG | O2_REG)\
+    PASTE_OP(cvtsi2sd,  O1_REG | O2_REG)\
+    PASTE_OP(cvtss2si,  O1_REG | O2_REG)\
+    PASTE_OP(cvtsd2si,  O1_REG | O2_REG)\
+    PASTE_OP(cvtss2sd,  O1_REG | O2_REG)\
+    PASTE_OP(cvtsd2ss,  O1_REG | O2_REG)\
+    \
+    PASTE_OP(movups,    O1_RM | O2_RM)\
+    PASTE_OP(movd,      O1_REG | O2_REG)\
+    PASTE_OP(movq,      O1_REG | O2_REG)\
+    PASTE_OP(pshufd,    O1_REG | O2_REG | O3_IMM)\
+    PASTE_OP(addps,     O1_REG | O2_REG)\
+    PASTE_OP(subps,     O1_REG | O2_REG)\
+    PASTE_OP(mulps,     O1_REG | O2_REG)\
+    PASTE_OP(divps,     O1_REG | O2_REG)\
+    PASTE_OP(sqrtps,    O1_REG | O2_REG)\
+    PASTE_OP(addpd,     O1_REG | O2_REG)\
+    PASTE_OP(subpd,     O1_REG | O2_REG)\
+    PASTE_OP(mulpd,     O1_REG | O2_REG)\
+    PASTE_OP(divpd,     O1_REG | O2_REG)\
+    PASTE_OP(sqrtpd,    O1_REG | O2_REG)\
+    PASTE_OP(paddd,     O1_REG | O2_REG)\
+    PASTE_OP(psubd,     O1_REG | O2_REG)\
+    PASTE_OP(paddq,     O1_REG | O2_REG)\
+    PASTE_OP(psubq,     O1_REG | O2_REG)\
+    PASTE_OP(pand,      O1_REG | O2_REG)\
+    PASTE_OP(por,       O1_REG | O2_REG)\
+    PASTE_OP(pxor,      O1_REG | O2_REG)\
+    PASTE_OP(pmuludq,   O1_REG | O2_REG)\
+    PASTE_OP(punpckldq, O1_REG | O2_REG)\
+    PASTE_OP(pcmpeqd,   O1_REG | O2_REG)\
+    PASTE_OP(pcmpgtd,   O1_REG | O2_REG)\
+    PASTE_OP(cmpps,     O1_REG | O2_REG | O3_IMM)\
+    PASTE_OP(cmppd,     O1_REG | O2_REG | O3_IMM)\
+    PASTE_OP(cvtdq2ps,  O1_REG | O2_REG)\
+    PASTE_OP(cvtps2dq,  O1_REG | O2_REG)\
+    PASTE_OP(movmskps,  O1_REG | O2_REG)\
+    PASTE_OP(movmskpd,  O1_REG | O2_REG)\
+    \
+    PASTE_OP(vmovups,   O1_RM | O2_RM)\
+    PASTE_OP(vaddps,    O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vsubps,    O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vmulps,    O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vdivps,    O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vsqrtps,   O1_REG | O2_REG)\
+    PASTE_OP(vaddpd,    O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vsubpd,    O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vmulpd,    O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vdivpd,    O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vsqrtpd,   O1_REG | O2_REG)\
+    PASTE_OP(vpaddd,    O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vpsubd,    O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vpmulld,   O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vpaddq,    O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vpsubq,    O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vpand,     O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vpor,      O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vpxor,     O1_REG | O2_REG | O3_REG)\
+    PASTE_OP(vbroadcastss, O1_REG | O2_REG)\
+    PASTE_OP(vbroadcastsd, O1_REG | O2_REG)\
+    PASTE_OP(vpbroadcastd, O1_REG | O2_REG)\
+    PASTE_OP(vpbroadcastq, O1_REG | O2_REG)\
+    PASTE_OP(vzeroupper, NO_MOD)\
+
+
+#define PASTE_OP(x, mods) OP_##x,
+enum Amd64_Opcode
+{
+    OPCODES
+};
+#undef PASTE_OP
+
+/* AMD64 registers
+ * rip and mmx registers not listed.
+ */
+#define REGS\
+    PASTE_REG(NONE, NONE, NONE, NONE)\
+    PASTE_REG(rax, eax, ax, al)\
+    PASTE_REG(rbx, ebx, bx, bl)\
+    PASTE_REG(rcx, ecx, cx, cl)\
+    PASTE_REG(rdx, edx, dx, dl)\
+    PASTE_REG(rbp, ebp, bp, bpl)\
+    PASTE_REG(rsi, esi, si, sil)\
+    PASTE_REG(rdi, edi, di, dil)\
+    PASTE_REG(rsp, esp, sp, spl)\
+    PASTE_REG(r8, r8d, r8w, r8b)\
+    PASTE_REG(r9, r9d, r9w, r9b)\
+    PASTE_REG(r10, r10d, r10w, r10b)\
+    PASTE_REG(r11, r11d, r11w, r11b)\
+    PASTE_REG(r12, r12d, r12w, r12b)\
+    PASTE_REG(r13, r13d, r13w, r13b)\
+    PASTE_REG(r14, r14d, r14w, r14b)\
+    PASTE_REG(r15, r15d, r15w, r15b)\
+    \
+    PASTE_REG(xmm0, xmm0, xmm0, xmm0)\
+    PASTE_REG(xmm1, xmm1, xmm1, xmm1)\
+    PASTE_REG(xmm2, xmm2, xmm2, xmm2)\
+    PASTE_REG(xmm3, xmm3, xmm3, xmm3)\
+    PASTE_REG(xmm4, xmm4, xmm4, xmm4)\
+    PASTE_REG(xmm5, xmm5, xmm5, xmm5)\
+    PASTE_REG(xmm6, xmm6, xmm6, xmm6)\
+    PASTE_REG(xmm7, xmm7, xmm7, xmm7)\
+    PASTE_REG(xmm8, xmm8, xmm8, xmm8)\
+    PASTE_REG(xmm9, xmm9, xmm9, xmm9)\
+    PASTE_REG(xmm10, xmm10, xmm10, xmm10)\
+    PASTE_REG(xmm11, xmm11, xmm11, xmm11)\
+    PASTE_REG(xmm12, xmm12, xmm12, xmm12)\
+    PASTE_REG(xmm13, xmm13, xmm13, xmm13)\
+    PASTE_REG(xmm14, xmm14, xmm14, xmm14)\
+    PASTE_REG(xmm15, xmm15, xmm15, xmm15)\
+
+#define PASTE_REG(r8, r4, r2, r1) REG_##r8,
+enum Amd64_Register
+{
+    REGS
+    REG_COUNT
+};
+#undef PASTE_REG
+
 void InitializeCodegen_Amd64(Codegen_Context *ctx, Codegen_Target cg_target);
 void GenerateCode_Amd64(Codegen_Context *ctx,
         Ir_Routine_List routines);
 
 void OutputCode_Amd64(Codegen_Context *ctx);
+void EncodeCode_Amd64(Codegen_Context *ctx, Object_Code *obj);
+
+void PrintInstruction_Amd64(IoFile *file, const Instruction *instr);
 
 } // hplang
 
@@ -0,0 +1,1323 @@
+
+#include "amd64_codegen.h"
+#include "object_code.h"
+#include "symbols.h"
+#include "common.h"
+#include "hashtable.h"
+#include "time_profiler.h"
+
+#include <cstdio>
+#include <cinttypes>
+
+// The encoder translates the instruction lists of the code generator directly
+// to machine code and relocations, without the round-trip through assembly
+// text and nasm. The instruction forms are selected the same way nasm selects
+// them (short immediates, short branches, accumulator forms), so that the code
+// produced by both paths can be compared byte by byte.
+//
+// Data references are encoded rip relative and calls to foreign routines go
+// through the plt, which is also what the assembly text output asks nasm to do.
+
+namespace hplang
+{
+
+// Hardware register numbers, indexed by Amd64_Register
+static const u8 reg_encodings[] = {
+    0,      // NONE
+    0,      // rax
+    3,      // rbx
+    1,      // rcx
+    2,      // rdx
+    5,      // rbp
+    6,      // rsi
+    7,      // rdi
+    4,      // rsp
+    8, 9, 10, 11, 12, 13, 14, 15,                       // r8 - r15
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, // xmm0 - xmm15
+};
+
+static u8 RegEncoding(Reg reg)
+{
+    ASSERT(reg.reg_index != REG_NONE && reg.reg_index < REG_COUNT);
+    return reg_encodings[reg.reg_index];
+}
+
+static s64 GetDataSize(Oper_Data_Type data_type)
+{
+    switch (data_type)
+    {
+        case Oper_Data_Type::BOOL:
+        case Oper_Data_Type::U8:
+        case Oper_Data_Type::S8:
+            return 1;
+        case Oper_Data_Type::U16:
+        case Oper_Data_Type::S16:
+            return 2;
+        case Oper_Data_Type::U32:
+        case Oper_Data_Type::S32:
+        case Oper_Data_Type::F32:
+            return 4;
+        case Oper_Data_Type::PTR:
+        case Oper_Data_Type::U64:
+        case Oper_Data_Type::S64:
+        case Oper_Data_Type::F64:
+            return 8;
+        case Oper_Data_Type::V128:
+            return 16;
+        case Oper_Data_Type::V256:
+            return 32;
+    }
+    INVALID_CODE_PATH;
+    return 0;
+}
+
+
+// Operands in encodable form
+
+enum Enc_Oper_Kind
+{
+    EO_None,
+    EO_Reg,
+    EO_Mem,
+    EO_Imm,
+    EO_Label,
+};
+
+struct Enc_Mem
+{
+    b32 rip;        // rip relative reference to label
+    Name label;
+    s32 base;
+    s32 index;      // -1, if no index
+    s32 scale;
+    s64 disp;
+};
+
+struct Enc_Oper
+{
+    Enc_Oper_Kind kind;
+    s64 size;
+    u8 reg;
+    Enc_Mem mem;
+    u64 imm;
+    Name label;
+};
+
+static Enc_Oper GetEncOper(const Operand &oper, const Operand *next_oper)
+{
+    Enc_Oper result = { };
+    result.size = GetDataSize(oper.data_type);
+    switch (oper.type)
+    {
+        case Oper_Type::None:
+        case Oper_Type::VirtualRegister:
+            INVALID_CODE_PATH;
+            break;
+        case Oper_Type::Register:
+        case Oper_Type::FixedRegister:
+            if (oper.addr_mode == Oper_Addr_Mode::Direct)
+            {
+                result.kind = EO_Reg;
+                result.reg = RegEncoding(oper.reg);
+            }
+            else
+            {
+                result.kind = EO_Mem;
+                result.mem.base = RegEncoding(oper.reg);
+                result.mem.index = -1;
+                result.mem.disp = oper.scale_offset;
+                if (oper.addr_mode == Oper_Addr_Mode::BaseIndexOffset)
+                {
+                    ASSERT(next_oper);
+                    ASSERT(next_oper->addr_mode == Oper_Addr_Mode::IndexScale);
+                    ASSERT(next_oper->scale_offset == 1 || next_oper->scale_offset == 2 ||
+                           next_oper->scale_offset == 4 || next_oper->scale_offset == 8);
+                    result.mem.index = RegEncoding(next_oper->reg);
+                    result.mem.scale = next_oper->scale_offset;
+                }
+            }
+            break;
+        case Oper_Type::Immediate:
+            result.kind = EO_Imm;
+            result.imm = oper.imm_u64;
+            break;
+        case Oper_Type::Label:
+            if (oper.addr_mode == Oper_Addr_Mode::Direct)
+            {
+                result.kind = EO_Label;
+                result.label = oper.name;
+            }
+            else
+            {
+                ASSERT(oper.addr_mode == Oper_Addr_Mode::BaseOffset);
+                result.kind = EO_Mem;
+                result.mem.rip = true;
+                result.mem.label = oper.name;
+                result.mem.index = -1;
+                result.mem.disp = oper.scale_offset;
+            }
+            break;
+    }
+    return result;
+}
+
+// Collects the operands that are visible in the instruction; shadow operands
+// are only used for liveness and index operands are part of the preceding
+// memory operand.
+static s64 GetEncOpers(const Instruction *instr, Enc_Oper *opers)
+{
+    const Operand *instr_opers[] = { &instr->oper1, &instr->oper2, &instr->oper3, nullptr };
+    s64 count = 0;
+    for (s64 i = 0; i < 3; i++)
+    {
+        const Operand *oper = instr_opers[i];
+        if (oper->type == Oper_Type::None) continue;
+        if (oper->addr_mode == Oper_Addr_Mode::IndexScale) continue;
+        if ((oper->access_flags & AF_Shadow) != 0) continue;
+        opers[count++] = GetEncOper(*oper, instr_opers[i + 1]);
+    }
+    return count;
+}
+
+
+// Encoded instructions
+
+enum Enc_Fixup
+{
+    FIX_None,
+    FIX_Branch,     // jmp or jcc to a label, can be encoded short or near
+    FIX_Call,       // rel32 to a routine
+    FIX_Data,       // rip relative disp32 to a data label
+};
+
+static const u8 JMP_COND = 0xff;
+
+struct Enc_Instr
+{
+    const Instruction *instr;
+    u8 bytes[16];
+    u8 size;
+
+    Enc_Fixup fixup;
+    u8 fixup_pos;       // Position of the 32 bit fixup field in bytes
+    u8 cond;            // Condition code for branches, JMP_COND for jmp
+    b32 is_near;        // The branch needs 32 bit displacement
+    s64 target_index;   // Instruction index of the branch target, or -1
+    Name target;
+    s64 addend;
+    s64 offset;
+};
+
+static void PutByte(Enc_Instr *e, u8 b)
+{
+    ASSERT(e->size < sizeof(e->bytes));
+    e->bytes[e->size++] = b;
+}
+
+static void PutImm(Enc_Instr *e, u64 value, s64 size)
+{
+    for (s64 i = 0; i < size; i++)
+    {
+        PutByte(e, (u8)(value >> (i * 8)));
+    }
+}
+
+static b32 FitsS8(u64 value, s64 size)
+{
+    s64 v;
+    switch (size)
+    {
+        case 1: v = (s8)value; break;
+        case 2: v = (s16)value; break;
+        case 4: v = (s32)value; break;
+        default: v = (s64)value; break;
+    }
+    return (v >= -128 && v <= 127);
+}
+
+static b32 FitsS32(s64 value)
+{
+    return (value >= INT32_MIN && value <= INT32_MAX);
+}
+
+enum Rex_Flag_Bits
+{
+    REXF_W      = 1,    // 64 bit operand size
+    REXF_ByteR  = 2,    // The ModRM.reg operand is a byte register
+    REXF_ByteRM = 4,    // The ModRM.rm operand is a byte register
+};
+
+// Immediate size in bytes of the operand size, imm64 is only used by mov.
+static s64 ImmSize(s64 size)
+{
+    return (size == 8) ? 4 : size;
+}
+
+// Encodes modrm [sib] [disp]
+static void PutModRM(Enc_Instr *e, u8 reg, const Enc_Oper &rm)
+{
+    reg &= 7;
+    if (rm.kind == EO_Reg)
+    {
+        PutByte(e, 0xc0 | (reg << 3) | (rm.reg & 7));
+    }
+    else if (rm.mem.rip)
+    {
+        PutByte(e, 0x05 | (reg << 3));
+        ASSERT(e->fixup == FIX_None);
+        e->fixup = FIX_Data;
+        e->fixup_pos = e->size;
+        e->target = rm.mem.label;
+        e->addend = rm.mem.disp;
+        PutImm(e, 0, 4);
+    }
+    else
+    {
+        u8 base = rm.mem.base & 7;
+        s64 disp = rm.mem.disp;
+        u8 mod;
+        if (disp == 0 && base != 5)
+            mod = 0x00;
+        else if (disp >= -128 && disp <= 127)
+            mod = 0x40;
+        else
+            mod = 0x80;
+
+        if (rm.mem.index < 0 && base != 4)
+        {
+            PutByte(e, mod | (reg << 3) | base);
+        }
+        else
+        {
+            u8 scale = 0;
+            u8 index = 4;
+            if (rm.mem.index >= 0)
+            {
+                ASSERT(rm.mem.index != 4);
+                index = rm.mem.index & 7;
+                switch (rm.mem.scale)
+                {
+                    case 1: scale = 0; break;
+                    case 2: scale = 1; break;
+                    case 4: scale = 2; break;
+                    case 8: scale = 3; break;
+                    default: INVALID_CODE_PATH;
+                }
+            }
+            PutByte(e, mod | (reg << 3) | 4);
+            PutByte(e, (scale << 6) | (index << 3) | base);
+        }
+        if (mod == 0x40)
+            PutImm(e, (u64)disp, 1);
+        else if (mod == 0x80)
+            PutImm(e, (u64)disp, 4);
+    }
+}
+
+// Returns true, if the base or the index register of the memory operand, or
+// the register operand, needs the extension bit (REX.B and REX.X).
+static b32 NeedsExtB(const Enc_Oper &rm)
+{
+    if (rm.kind == EO_Reg) return (rm.reg & 8) != 0;
+    return !rm.mem.rip && (rm.mem.base & 8) != 0;
+}
+
+static b32 NeedsExtX(const Enc_Oper &rm)
+{
+    return rm.kind == EO_Mem && !rm.mem.rip &&
+        rm.mem.index >= 0 && (rm.mem.index & 8) != 0;
+}
+
+// Encodes [prefix] [rex] opcode modrm [sib] [disp] [imm]
+static void EncodeModRM(Enc_Instr *e, u8 prefix, u32 rex_flags,
+        const u8 *opcode, s64 opcode_len,
+        u8 reg, const Enc_Oper &rm,
+        s64 imm_size = 0, u64 imm = 0)
+{
+    ASSERT(rm.kind == EO_Reg || rm.kind == EO_Mem);
+    u8 rex = 0;
+    if ((rex_flags & REXF_W) != 0) rex |= 0x48;
+    if ((reg & 8) != 0) rex |= 0x44;
+    if ((rex_flags & REXF_ByteR) != 0 && reg >= 4 && reg < 8) rex |= 0x40;
+    if (NeedsExtB(rm)) rex |= 0x41;
+    if (NeedsExtX(rm)) rex |= 0x42;
+    if (rm.kind == EO_Reg)
+    {
+        if ((rex_flags & REXF_ByteRM) != 0 && rm.reg >= 4 && rm.reg < 8) rex |= 0x40;
+    }
+
+    if (prefix) PutByte(e, prefix);
+    if (rex) PutByte(e, rex);
+    for (s64 i = 0; i < opcode_len; i++)
+        PutByte(e, opcode[i]);
+
+    PutModRM(e, reg, rm);
+    PutImm(e, imm, imm_size);
+}
+
+static void EncodeModRM(Enc_Instr *e, u8 prefix, u32 rex_flags,
+        u8 opcode, u8 reg, const Enc_Oper &rm,
+        s64 imm_size = 0, u64 imm = 0)
+{
+    EncodeModRM(e, prefix, rex_flags, &opcode, 1, reg, rm, imm_size, imm);
+}
+
+static void EncodeModRM0F(Enc_Instr *e, u8 prefix, u32 rex_flags,
+        u8 opcode, u8 reg, const Enc_Oper &rm,
+        s64 imm_size = 0, u64 imm = 0)
+{
+    u8 opcode_bytes[] = { 0x0f, opcode };
+    EncodeModRM(e, prefix, rex_flags, opcode_bytes, 2, reg, rm, imm_size, imm);
+}
+
+enum Vex_Map
+{
+    VEX_0F      = 1,
+    VEX_0F38    = 2,
+};
+
+enum Vex_Prefix
+{
+    VEX_NP      = 0,    // No implied prefix
+    VEX_66      = 1,
+};
+
+// Encodes the VEX prefix, opcode and modrm of the AVX instructions. The 2 byte
+// prefix is used, when the instruction does not need the fields of the 3 byte
+// prefix, as nasm does. vvvv is the second source register, or 0, if the
+// instruction has none.
+static void EncodeVex(Enc_Instr *e, u8 pp, u8 map, b32 vex_256,
+        u8 opcode, u8 reg, u8 vvvv, const Enc_Oper &rm)
+{
+    ASSERT(rm.kind == EO_Reg || rm.kind == EO_Mem);
+    u8 r = ((reg & 8) != 0) ? 0 : 0x80;
+    u8 x = NeedsExtX(rm) ? 0 : 0x40;
+    u8 b = NeedsExtB(rm) ? 0 : 0x20;
+    u8 lpp = (u8)(((~vvvv & 15) << 3) | (vex_256 ? 0x04 : 0) | pp);
+    if (x != 0 && b != 0 && map == VEX_0F)
+    {
+        PutByte(e, 0xc5);
+        PutByte(e, r | lpp);
+    }
+    else
+    {
+        PutByte(e, 0xc4);
+        PutByte(e, r | x | b | map);
+        PutByte(e, lpp);
+    }
+    PutByte(e, opcode);
+    PutModRM(e, reg, rm);
+}
+
+// Encodes the 256 bit AVX instruction "op dst, src1, src2".
+static void EncodeAvx(Enc_Instr *e, u8 pp, u8 map, u8 opcode,
+        const Enc_Oper &dst, const Enc_Oper &src1, const Enc_Oper &src2)
+{
+    ASSERT(dst.kind == EO_Reg && src1.kind == EO_Reg);
+    EncodeVex(e, pp, map, true, opcode, dst.reg, src1.reg, src2);
+}
+
+// Encodes the 256 bit AVX instruction "op dst, src", that has no second
+// source.
+static void EncodeAvx(Enc_Instr *e, u8 pp, u8 map, u8 opcode,
+        const Enc_Oper &dst, const Enc_Oper &src)
+{
+    ASSERT(dst.kind == EO_Reg);
+    EncodeVex(e, pp, map, true, opcode, dst.reg, 0, src);
+}
+
+// Encodes [66] [rex] opcode+reg [imm]
+static void EncodeOpReg(Enc_Instr *e, u8 prefix, u32 rex_flags,
+        u8 opcode, u8 reg, s64 imm_size = 0, u64 imm = 0)
+{
+    u8 rex = 0;
+    if ((rex_flags & REXF_W) != 0) rex |= 0x48;
+    if ((reg & 8) != 0) rex |= 0x41;
+    if ((rex_flags & REXF_ByteRM) != 0 && reg >= 4 && reg < 8) rex |= 0x40;
+    if (prefix) PutByte(e, prefix);
+    if (rex) PutByte(e, rex);
+    PutByte(e, opcode + (reg & 7));
+    PutImm(e, imm, imm_size);
+}
+
+static u8 OperandSizePrefix(s64 size)
+{
+    return (size == 2) ? 0x66 : 0;
+}
+
+static u32 OperandSizeRex(s64 size)
+{
+    return (size == 8) ? REXF_W : 0;
+}
+
+static u32 ByteRex(s64 size, u32 byte_flags)
+{
+    return (size == 1) ? byte_flags : 0;
+}
+
+// Encodes the integer arithmetic instructions add, or, and, sub, xor and cmp,
+// that share their forms; op_ext is the ModRM.reg extension of the immediate
+// forms.
+static void EncodeAluOp(Enc_Instr *e, u8 op_ext, const Enc_Oper &dst, const Enc_Oper &src)
+{
+    s64 size = dst.size;
+    u8 prefix = OperandSizePrefix(size);
+    u32 rex_w = OperandSizeRex(size);
+    u8 base_op = op_ext * 8;
+    if (src.kind == EO_Imm)
+    {
+        if (size == 1)
+        {
+            if (dst.kind == EO_Reg && dst.reg == 0)
+            {
+                PutByte(e, base_op + 4);
+                PutImm(e, src.imm, 1);
+            }
+            else
+            {
+                EncodeModRM(e, prefix, ByteRex(size, REXF_ByteRM),
+                        0x80, op_ext, dst, 1, src.imm);
+            }
+        }
+        else if (FitsS8(src.imm, size))
+        {
+            EncodeModRM(e, prefix, rex_w, 0x83, op_ext, dst, 1, src.imm);
+        }
+        else if (dst.kind == EO_Reg && dst.reg == 0)
+        {
+            if (prefix) PutByte(e, prefix);
+            if (rex_w) PutByte(e, 0x48);
+            PutByte(e, base_op + 5);
+            PutImm(e, src.imm, ImmSize(size));
+        }
+        else
+        {
+            EncodeModRM(e, prefix, rex_w, 0x81, op_ext, dst, ImmSize(size), src.imm);
+        }
+    }
+    else if (src.kind == EO_Reg)
+    {
+        u8 op = base_op + ((size == 1) ? 0 : 1);
+        EncodeModRM(e, prefix, rex_w | ByteRex(size, REXF_ByteR | REXF_ByteRM),
+                op, src.reg, dst);
+    }
+    else
+    {
+        ASSERT(dst.kind == EO_Reg && src.kind == EO_Mem);
+        u8 op = base_op + ((size == 1) ? 2 : 3);
+        EncodeModRM(e, prefix, rex_w | ByteRex(size, REXF_ByteR), op, dst.reg, src);
+    }
+}
+
+static void EncodeMov(Enc_Instr *e, const Enc_Oper &dst, const Enc_Oper &src)
+{
+    s64 size = dst.size;
+    u8 prefix = OperandSizePrefix(size);
+    u32 rex_w = OperandSizeRex(size);
+    if (src.kind == EO_Imm)
+    {
+        if (dst.kind == EO_Reg)
+        {
+            if (size == 1)
+            {
+                EncodeOpReg(e, 0, REXF_ByteRM, 0xb0, dst.reg, 1, src.imm);
+            }
+            else if (size == 8)
+            {
+                // NOTE(henrik): Like nasm, use the shortest form that gives
+                // the same value in the 64 bit register.
+                if (src.imm <= UINT32_MAX)
+                    EncodeOpReg(e, 0, 0, 0xb8, dst.reg, 4, src.imm);
+                else if (FitsS32((s64)src.imm))
+                    EncodeModRM(e, 0, REXF_W, 0xc7, 0, dst, 4, src.imm);
+                else
+                    EncodeOpReg(e, 0, REXF_W, 0xb8, dst.reg, 8, src.imm);
+            }
+            else
+            {
+                EncodeOpReg(e, prefix, 0, 0xb8, dst.reg, size, src.imm);
+            }
+        }
+        else
+        {
+            u8 op = (size == 1) ? 0xc6 : 0xc7;
+            EncodeModRM(e, prefix, rex_w, op, 0, dst, ImmSize(size), src.imm);
+        }
+    }
+    else if (src.kind == EO_Reg)
+    {
+        u8 op = (size == 1) ? 0x88 : 0x89;
+        EncodeModRM(e, prefix, rex_w | ByteRex(size, REXF_ByteR | REXF_ByteRM),
+                op, src.reg, dst);
+    }
+    else
+    {
+        ASSERT(dst.kind == EO_Reg && src.kind == EO_Mem);
+        u8 op = (size == 1) ? 0x8a : 0x8b;
+        EncodeModRM(e, prefix, rex_w | ByteRex(size, REXF_ByteR), op, dst.reg, src);
+    }
+}
+
+static void EncodeMovExtend(Enc_Instr *e, b32 sign_extend,
+        const Enc_Oper &dst, const Enc_Oper &src)
+{
+    ASSERT(dst.kind == EO_Reg);
+    s64 size = dst.size;
+    u8 prefix = OperandSizePrefix(size);
+    u32 rex_w = OperandSizeRex(size);
+    switch (src.size)
+    {
+        case 1:
+            EncodeModRM0F(e, prefix, rex_w | REXF_ByteRM,
+                    sign_extend ? 0xbe : 0xb6, dst.reg, src);
+            break;
+        case 2:
+            EncodeModRM0F(e, prefix, rex_w,
+                    sign_extend ? 0xbf : 0xb7, dst.reg, src);
+            break;
+        case 4:
+            ASSERT(size == 8);
+            if (sign_extend)
+            {
+                // movsxd
+                EncodeModRM(e, 0, REXF_W, 0x63, dst.reg, src);
+            }
+            else
+            {
+                // NOTE(henrik): Writing a 32 bit register zero extends it.
+                EncodeModRM(e, 0, 0, 0x8b, dst.reg, src);
+            }
+            break;
+        default:
+            INVALID_CODE_PATH;
+    }
+}
+
+// Encodes the single operand group 3 instructions not, neg, mul, imul, div
+// and idiv.
+static void EncodeGroup3(Enc_Instr *e, u8 op_ext, const Enc_Oper &oper)
+{
+    s64 size = oper.size;
+    u8 op = (size == 1) ? 0xf6 : 0xf7;
+    EncodeModRM(e, OperandSizePrefix(size),
+            OperandSizeRex(size) | ByteRex(size, REXF_ByteRM),
+            op, op_ext, oper);
+}
+
+static void EncodeShift(Enc_Instr *e, u8 op_ext, const Enc_Oper &dst, const Enc_Oper &src)
+{
+    s64 size = dst.size;
+    u8 prefix = OperandSizePrefix(size);
+    u32 rex = OperandSizeRex(size) | ByteRex(size, REXF_ByteRM);
+    if (src.kind == EO_Imm)
+    {
+        u8 count = (u8)src.imm;
+        if (count == 1)
+            EncodeModRM(e, prefix, rex, (size == 1) ? 0xd0 : 0xd1, op_ext, dst);
+        else
+            EncodeModRM(e, prefix, rex, (size == 1) ? 0xc0 : 0xc1, op_ext, dst, 1, count);
+    }
+    else
+    {
+        // The shift count is always in cl
+        ASSERT(src.kind == EO_Reg && src.reg == 1);
+        EncodeModRM(e, prefix, rex, (size == 1) ? 0xd2 : 0xd3, op_ext, dst);
+    }
+}
+
+static void EncodeSse(Enc_Instr *e, u8 prefix, u8 opcode,
+        const Enc_Oper &dst, const Enc_Oper &src)
+{
+    ASSERT(dst.kind == EO_Reg);
+    EncodeModRM0F(e, prefix, 0, opcode, dst.reg, src);
+}
+
+static void EncodeSseMov(Enc_Instr *e, u8 prefix,
+        const Enc_Oper &dst, const Enc_Oper &src)
+{
+    if (dst.kind == EO_Reg)
+        EncodeModRM0F(e, prefix, 0, 0x10, dst.reg, src);
+    else
+        EncodeModRM0F(e, prefix, 0, 0x11, src.reg, dst);
+}
+
+static u8 GetConditionCode(Amd64_Opcode opcode)
+{
+    switch (opcode)
+    {
+        case OP_jmp:    return JMP_COND;
+        case OP_jb:     case OP_cmovb:  return 0x2;
+        case OP_jae:    case OP_cmovae: return 0x3;
+        case OP_je:     case OP_cmove:  return 0x4;
+        case OP_jne:    case OP_cmovne: return 0x5;
+        case OP_jbe:    case OP_cmovbe: return 0x6;
+        case OP_ja:     case OP_cmova:  return 0x7;
+        case OP_jl:     case OP_cmovl:  return 0xc;
+        case OP_jge:    case OP_cmovge: return 0xd;
+        case OP_jle:    case OP_cmovle: return 0xe;
+        case OP_jg:     return 0xf;
+        default:
+            INVALID_CODE_PATH;
+    }
+    return 0;
+}
+
+static void EncodeInstruction(Enc_Instr *e)
+{
+    const Instruction *instr = e->instr;
+    Amd64_Opcode opcode = (Amd64_Opcode)instr->opcode;
+
+    Enc_Oper opers[3] = { };
+    s64 oper_count = GetEncOpers(instr, opers);
+    const Enc_Oper &o1 = opers[0];
+    const Enc_Oper &o2 = opers[1];
+
+    switch (opcode)
+    {
+        case OP_LABEL:
+        case OP_SPILL:
+            break;
+
+        case OP_nop:
+            PutByte(e, 0x90);
+            break;
+
+        case OP_call:
+            ASSERT(oper_count == 1);
+            if (o1.kind == EO_Label)
+            {
+                PutByte(e, 0xe8);
+                e->fixup = FIX_Call;
+                e->fixup_pos = e->size;
+                e->target = o1.label;
+                PutImm(e, 0, 4);
+            }
+            else
+            {
+                EncodeModRM(e, 0, 0, 0xff, 2, o1);
+            }
+            break;
+        case OP_ret:
+            PutByte(e, 0xc3);
+            break;
+        case OP_jmp:
+        case OP_je:
+        case OP_jne:
+        case OP_jb:
+        case OP_jbe:
+        case OP_ja:
+        case OP_jae:
+        case OP_jl:
+        case OP_jle:
+        case OP_jg:
+        case OP_jge:
+            ASSERT(oper_count == 1);
+            if (o1.kind == EO_Label)
+            {
+                // The bytes are filled in after the branch size is known.
+                e->fixup = FIX_Branch;
+                e->cond = GetConditionCode(opcode);
+                e->target = o1.label;
+            }
+            else
+            {
+                ASSERT(opcode == OP_jmp);
+                EncodeModRM(e, 0, 0, 0xff, 4, o1);
+            }
+            break;
+
+        case OP_cmp:    EncodeAluOp(e, 7, o1, o2); break;
+        case OP_add:    EncodeAluOp(e, 0, o1, o2); break;
+        case OP_or:     EncodeAluOp(e, 1, o1, o2); break;
+        case OP_and:    EncodeAluOp(e, 4, o1, o2); break;
+        case OP_sub:    EncodeAluOp(e, 5, o1, o2); break;
+        case OP_xor:    EncodeAluOp(e, 6, o1, o2); break;
+
+        case OP_comiss: EncodeSse(e, 0, 0x2f, o1, o2); break;
+        case OP_comisd: EncodeSse(e, 0x66, 0x2f, o1, o2); break;
+
+        case OP_lea:
+            ASSERT(o1.kind == EO_Reg && o2.kind == EO_Mem);
+            EncodeModRM(e, OperandSizePrefix(o1.size), OperandSizeRex(o1.size),
+                    0x8d, o1.reg, o2);
+            break;
+        case OP_mov:
+            ASSERT(o2.kind != EO_Label);
+            EncodeMov(e, o1, o2);
+            break;
+        case OP_movsx:
+            EncodeMovExtend(e, true, o1, o2);
+            break;
+        case OP_movzx:
+            EncodeMovExtend(e, false, o1, o2);
+            break;
+        case OP_movss:
+            EncodeSseMov(e, 0xf3, o1, o2);
+            break;
+        case OP_movsd:
+            EncodeSseMov(e, 0xf2, o1, o2);
+            break;
+
+        case OP_cmove:
+        case OP_cmovne:
+        case OP_cmova:
+        case OP_cmovae:
+        case OP_cmovb:
+        case OP_cmovbe:
+        case OP_cmovl:
+        case OP_cmovle:
+        case OP_cmovge:
+            ASSERT(o1.kind == EO_Reg);
+            EncodeModRM0F(e, OperandSizePrefix(o1.size), OperandSizeRex(o1.size),
+                    0x40 + GetConditionCode(opcode), o1.reg, o2);
+            break;
+
+        case OP_cqo:
+            PutByte(e, 0x48);
+            PutByte(e, 0x99);
+            break;
+
+        case OP_mul:    EncodeGroup3(e, 4, o1); break;
+        case OP_div:    EncodeGroup3(e, 6, o1); break;
+        case OP_idiv:   EncodeGroup3(e, 7, o1); break;
+        case OP_neg:    EncodeGroup3(e, 3, o1); break;
+        case OP_not:    EncodeGroup3(e, 2, o1); break;
+        case OP_imul:
+            if (oper_count == 1)
+            {
+                EncodeGroup3(e, 5, o1);
+            }
+            else
+            {
+                ASSERT(o1.kind == EO_Reg && o1.size != 1);
+                EncodeModRM0F(e, OperandSizePrefix(o1.size), OperandSizeRex(o1.size),
+                        0xaf, o1.reg, o2);
+            }
+            break;
+
+        case OP_sal:
+        case OP_shl:    EncodeShift(e, 4, o1, o2); break;
+        case OP_shr:    EncodeShift(e, 5, o1, o2); break;
+        case OP_sar:    EncodeShift(e, 7, o1, o2); break;
+
+        case OP_addss:  EncodeSse(e, 0xf3, 0x58, o1, o2); break;
+        case OP_subss:  EncodeSse(e, 0xf3, 0x5c, o1, o2); break;
+        case OP_mulss:  EncodeSse(e, 0xf3, 0x59, o1, o2); break;
+        case OP_divss:  EncodeSse(e, 0xf3, 0x5e, o1, o2); break;
+        case OP_addsd:  EncodeSse(e, 0xf2, 0x58, o1, o2); break;
+        case OP_subsd:  EncodeSse(e, 0xf2, 0x5c, o1, o2); break;
+        case OP_mulsd:  EncodeSse(e, 0xf2, 0x59, o1, o2); break;
+        case OP_divsd:  EncodeSse(e, 0xf2, 0x5e, o1, o2); break;
+        case OP_sqrtss: EncodeSse(e, 0xf3, 0x51, o1, o2); break;
+        case OP_sqrtsd: EncodeSse(e, 0xf2, 0x51, o1, o2); break;
+
+        case OP_push:
+            ASSERT(o1.kind == EO_Reg);
+            EncodeOpReg(e, 0, 0, 0x50, o1.reg);
+            break;
+        case OP_pop:
+            ASSERT(o1.kind == EO_Reg);
+            EncodeOpReg(e, 0, 0, 0x58, o1.reg);
+            break;
+
+        case OP_cvtsi2ss:
+            EncodeModRM0F(e, 0xf3, OperandSizeRex(o2.size), 0x2a, o1.reg, o2);
+            break;
+        case OP_cvtsi2sd:
+            EncodeModRM0F(e, 0xf2, OperandSizeRex(o2.size), 0x2a, o1.reg, o2);
+            break;
+        case OP_cvtss2si:
+            EncodeModRM0F(e, 0xf3, OperandSizeRex(o1.size), 0x2d, o1.reg, o2);
+            break;
+        case OP_cvtsd2si:
+            EncodeModRM0F(e, 0xf2, OperandSizeRex(o1.size), 0x2d, o1.reg, o2);
+            break;
+        case OP_cvtss2sd:
+            EncodeSse(e, 0xf3, 0x5a, o1, o2);
+            break;
+        case OP_cvtsd2ss:
+            EncodeSse(e, 0xf2, 0x5a, o1, o2);
+            break;
+
+        case OP_movups:
+            EncodeSseMov(e, 0, o1, o2);
+            break;
+        case OP_movd:
+            EncodeModRM0F(e, 0x66, 0, 0x6e, o1.reg, o2);
+            break;
+        case OP_movq:
+            EncodeModRM0F(e, 0x66, REXF_W, 0x6e, o1.reg, o2);
+            break;
+        case OP_pshufd:
+            ASSERT(o1.kind == EO_Reg && opers[2].kind == EO_Imm);
+            EncodeModRM0F(e, 0x66, 0, 0x70, o1.reg, o2, 1, opers[2].imm);
+            break;
+        case OP_addps:  EncodeSse(e, 0, 0x58, o1, o2); break;
+        case OP_subps:  EncodeSse(e, 0, 0x5c, o1, o2); break;
+        case OP_mulps:  EncodeSse(e, 0, 0x59, o1, o2); break;
+        case OP_divps:  EncodeSse(e, 0, 0x5e, o1, o2); break;
+        case OP_sqrtps: EncodeSse(e, 0, 0x51, o1, o2); break;
+        case OP_addpd:  EncodeSse(e, 0x66, 0x58, o1, o2); break;
+        case OP_subpd:  EncodeSse(e, 0x66, 0x5c, o1, o2); break;
+        case OP_mulpd:  EncodeSse(e, 0x66, 0x59, o1, o2); break;
+        case OP_divpd:  EncodeSse(e, 0x66, 0x5e, o1, o2); break;
+        case OP_sqrtpd: EncodeSse(e, 0x66, 0x51, o1, o2); break;
+        case OP_paddd:  EncodeSse(e, 0x66, 0xfe, o1, o2); break;
+        case OP_psubd:  EncodeSse(e, 0x66, 0xfa, o1, o2); break;
+        case OP_paddq:  EncodeSse(e, 0x66, 0xd4, o1, o2); break;
+        case OP_psubq:  EncodeSse(e, 0x66, 0xfb, o1, o2); break;
+        case OP_pand:   EncodeSse(e, 0x66, 0xdb, o1, o2); break;
+        case OP_por:    EncodeSse(e, 0x66, 0xeb, o1, o2); break;
+        case OP_pxor:   EncodeSse(e, 0x66, 0xef, o1, o2); break;
+        case OP_pmuludq:    EncodeSse(e, 0x66, 0xf4, o1, o2); break;
+        case OP_punpckldq:  EncodeSse(e, 0x66, 0x62, o1, o2); break;
+        case OP_pcmpeqd:    EncodeSse(e, 0x66, 0x76, o1, o2); break;
+        case OP_pcmpgtd:    EncodeSse(e, 0x66, 0x66, o1, o2); break;
+        case OP_cmpps:
+            ASSERT(o1.kind == EO_Reg && opers[2].kind == EO_Imm);
+            EncodeModRM0F(e, 0, 0, 0xc2, o1.reg, o2, 1, opers[2].imm);
+            break;
+        case OP_cmppd:
+            ASSERT(o1.kind == EO_Reg && opers[2].kind == EO_Imm);
+            EncodeModRM0F(e, 0x66, 0, 0xc2, o1.reg, o2, 1, opers[2].imm);
+            break;
+        case OP_cvtdq2ps:   EncodeSse(e, 0, 0x5b, o1, o2); break;
+        case OP_cvtps2dq:   EncodeSse(e, 0x66, 0x5b, o1, o2); break;
+        case OP_movmskps:   EncodeSse(e, 0, 0x50, o1, o2); break;
+        case OP_movmskpd:   EncodeSse(e, 0x66, 0x50, o1, o2); break;
+
+        case OP_vmovups:
+            if (o1.kind == EO_Reg)
+                EncodeVex(e, VEX_NP, VEX_0F, true, 0x10, o1.reg, 0, o2);
+            else
+                EncodeVex(e, VEX_NP, VEX_0F, true, 0x11, o2.reg, 0, o1);
+            break;
+        case OP_vaddps:  EncodeAvx(e, VEX_NP, VEX_0F, 0x58, o1, o2, opers[2]); break;
+        case OP_vsubps:  EncodeAvx(e, VEX_NP, VEX_0F, 0x5c, o1, o2, opers[2]); break;
+        case OP_vmulps:  EncodeAvx(e, VEX_NP, VEX_0F, 0x59, o1, o2, opers[2]); break;
+        case OP_vdivps:  EncodeAvx(e, VEX_NP, VEX_0F, 0x5e, o1, o2, opers[2]); break;
+        case OP_vsqrtps: EncodeAvx(e, VEX_NP, VEX_0F, 0x51, o1, o2); break;
+        case OP_vaddpd:  EncodeAvx(e, VEX_66, VEX_0F, 0x58, o1, o2, opers[2]); break;
+        case OP_vsubpd:  EncodeAvx(e, VEX_66, VEX_0F, 0x5c, o1, o2, opers[2]); break;
+        case OP_vmulpd:  EncodeAvx(e, VEX_66, VEX_0F, 0x59, o1, o2, opers[2]); break;
+        case OP_vdivpd:  EncodeAvx(e, VEX_66, VEX_0F, 0x5e, o1, o2, opers[2]); break;
+        case OP_vsqrtpd: EncodeAvx(e, VEX_66, VEX_0F, 0x51, o1, o2); break;
+        case OP_vpaddd:  EncodeAvx(e, VEX_66, VEX_0F, 0xfe, o1, o2, opers[2]); break;
+        case OP_vpsubd:  EncodeAvx(e, VEX_66, VEX_0F, 0xfa, o1, o2, opers[2]); break;
+        case OP_vpmulld: EncodeAvx(e, VEX_66, VEX_0F38, 0x40, o1, o2, opers[2]); break;
+        case OP_vpaddq:  EncodeAvx(e, VEX_66, VEX_0F, 0xd4, o1, o2, opers[2]); break;
+        case OP_vpsubq:  EncodeAvx(e, VEX_66, VEX_0F, 0xfb, o1, o2, opers[2]); break;
+        case OP_vpand:   EncodeAvx(e, VEX_66, VEX_0F, 0xdb, o1, o2, opers[2]); break;
+        case OP_vpor:    EncodeAvx(e, VEX_66, VEX_0F, 0xeb, o1, o2, opers[2]); break;
+        case OP_vpxor:   EncodeAvx(e, VEX_66, VEX_0F, 0xef, o1, o2, opers[2]); break;
+        case OP_vbroadcastss: EncodeAvx(e, VEX_66, VEX_0F38, 0x18, o1, o2); break;
+        case OP_vbroadcastsd: EncodeAvx(e, VEX_66, VEX_0F38, 0x19, o1, o2); break;
+        case OP_vpbroadcastd: EncodeAvx(e, VEX_66, VEX_0F38, 0x58, o1, o2); break;
+        case OP_vpbroadcastq: EncodeAvx(e, VEX_66, VEX_0F38, 0x59, o1, o2); break;
+        case OP_vzeroupper:
+            PutByte(e, 0xc5);
+            PutByte(e, 0xf8);
+            PutByte(e, 0x77);
+            break;
+    }
+
+    if (e->fixup == FIX_Data)
+    {
+        // NOTE(henrik): rip points to the end of the instruction, which
+        // can have an immediate after the displacement field.
+        e->addend -= (e->size - e->fixup_pos);
+    }
+}
+
+static s64 BranchSize(const Enc_Instr *e)
+{
+    if (!e->is_near) return 2;
+    return (e->cond == JMP_COND) ? 5 : 6;
+}
+
+static void EncodeBranch(Enc_Instr *e, s64 disp)
+{
+    e->size = 0;
+    if (!e->is_near)
+    {
+        ASSERT(disp >= -128 && disp <= 127);
+        PutByte(e, (e->cond == JMP_COND) ? 0xeb : 0x70 + e->cond);
+        PutImm(e, (u64)disp, 1);
+    }
+    else
+    {
+        if (e->cond == JMP_COND)
+        {
+            PutByte(e, 0xe9);
+        }
+        else
+        {
+            PutByte(e, 0x0f);
+            PutByte(e, 0x80 + e->cond);
+        }
+        e->fixup_pos = e->size;
+        PutImm(e, (u64)disp, 4);
+    }
+}
+
+
+// Routine encoding
+
+struct Enc_Label
+{
+    Name name;
+    s64 instr_index;
+};
+
+struct Enc_Call
+{
+    s64 offset;         // Offset of the rel32 field in text
+    Name target;
+};
+
+struct Encoder
+{
+    Codegen_Context *ctx;
+    Object_Code *obj;
+    Memory_Arena arena;
+
+    Array<Enc_Instr> instrs;
+    Array<Enc_Label*> labels;
+    Array<Enc_Call> calls;
+
+    IoFile *listing;
+};
+
+static void CollectInstructions(Encoder *enc, Instruction_List &instructions)
+{
+    for (s64 i = 0; i < instructions.count; i++)
+    {
+        Instruction *instr = instructions[i];
+        if ((instr->flags & IF_CommentedOut) != 0) continue;
+
+        Amd64_Opcode opcode = (Amd64_Opcode)instr->opcode;
+        if (opcode == OP_LABEL)
+        {
+            Enc_Label *label = PushStruct<Enc_Label>(&enc->arena);
+            label->name = instr->oper1.name;
+            label->instr_index = enc->instrs.count;
+            hashtable::Put(enc->labels, label->name, label);
+        }
+        else if (opcode == OP_SPILL)
+        {
+            continue;
+        }
+
+        Enc_Instr e = { };
+        e.instr = instr;
+        e.target_index = -1;
+        array::Push(enc->instrs, e);
+    }
+}
+
+static s64 ComputeOffsets(Encoder *enc, s64 start_offset)
+{
+    s64 offset = start_offset;
+    for (s64 i = 0; i < enc->instrs.count; i++)
+    {
+        Enc_Instr *e = &enc->instrs[i];
+        e->offset = offset;
+        offset += (e->fixup == FIX_Branch) ? BranchSize(e) : e->size;
+    }
+    return offset;
+}
+
+// Selects short branches where the displacement fits in 8 bits. All branches
+// start short and are grown until none of them needs to change, as growing a
+// branch can push other branches out of range.
+static void RelaxBranches(Encoder *enc, s64 start_offset)
+{
+    b32 changed = true;
+    while (changed)
+    {
+        changed = false;
+        ComputeOffsets(enc, start_offset);
+        for (s64 i = 0; i < enc->instrs.count; i++)
+        {
+            Enc_Instr *e = &enc->instrs[i];
+            if (e->fixup != FIX_Branch || e->is_near) continue;
+
+            s64 target_offset = enc->instrs[e->target_index].offset;
+            s64 disp = target_offset - (e->offset + BranchSize(e));
+            if (disp < -128 || disp > 127)
+            {
+                e->is_near = true;
+                changed = true;
+            }
+        }
+    }
+}
+
+static void PrintListingLine(IoFile *file, const Enc_Instr *e)
+{
+    FILE *f = (FILE*)file;
+    if ((Amd64_Opcode)e->instr->opcode == OP_LABEL)
+    {
+        PrintInstruction_Amd64(file, e->instr);
+        return;
+    }
+    s64 len = fprintf(f, "%08" PRIx64 "  ", e->offset);
+    for (s64 i = 0; i < e->size; i++)
+        len += fprintf(f, "%02x", e->bytes[i]);
+    while (len < 44)
+    {
+        fputc(' ', f);
+        len++;
+    }
+    PrintInstruction_Amd64(file, e->instr);
+}
+
+static void EncodeRoutine(Encoder *enc, Routine *routine)
+{
+    Object_Code *obj = enc->obj;
+
+    array::Clear(enc->instrs);
+    array::Clear(enc->labels);
+    FreeMemoryArena(&enc->arena);
+
+    CollectInstructions(enc, routine->prologue);
+    CollectInstructions(enc, routine->callee_save_spills);
+    CollectInstructions(enc, routine->instructions);
+    CollectInstructions(enc, routine->callee_save_unspills);
+    CollectInstructions(enc, routine->epilogue);
+
+    for (s64 i = 0; i < enc->instrs.count; i++)
+    {
+        Enc_Instr *e = &enc->instrs[i];
+        EncodeInstruction(e);
+        if (e->fixup == FIX_Branch)
+        {
+            Enc_Label *label = hashtable::Lookup(enc->labels, e->target);
+            if (label)
+            {
+                e->target_index = label->instr_index;
+            }
+            else
+            {
+                // NOTE(henrik): Branch to a routine; the target is not known
+                // until all routines are encoded.
+                e->is_near = true;
+            }
+        }
+    }
+
+    s64 start_offset = GetSectionOffset(obj, OBJ_SECT_Text);
+    RelaxBranches(enc, start_offset);
+    s64 end_offset = ComputeOffsets(enc, start_offset);
+
+    Object_Symbol *symbol = GetObjectSymbol(obj, routine->name);
+    ASSERT(symbol != nullptr);
+    symbol->section = OBJ_SECT_Text;
+    symbol->offset = start_offset;
+    symbol->size = end_offset - start_offset;
+    symbol->flags = OSYM_Global | OSYM_Routine;
+
+    if (enc->listing)
+    {
+        PrintName(enc->listing, routine->name);
+        fprintf((FILE*)enc->listing, ":\n");
+    }
+
+    for (s64 i = 0; i < enc->instrs.count; i++)
+    {
+        Enc_Instr *e = &enc->instrs[i];
+        switch (e->fixup)
+        {
+            case FIX_None:
+                break;
+            case FIX_Branch:
+                if (e->target_index >= 0)
+                {
+                    s64 target_offset = enc->instrs[e->target_index].offset;
+                    EncodeBranch(e, target_offset - (e->offset + BranchSize(e)));
+                }
+                else
+                {
+                    EncodeBranch(e, 0);
+                    Enc_Call call = { e->offset + e->fixup_pos, e->target };
+                    array::Push(enc->calls, call);
+                }
+                break;
+            case FIX_Call:
+                {
+                    Enc_Call call = { e->offset + e->fixup_pos, e->target };
+                    array::Push(enc->calls, call);
+                } break;
+            case FIX_Data:
+                {
+                    Object_Symbol *data_symbol = GetObjectSymbol(obj, e->target);
+                    ASSERT(data_symbol != nullptr);
+                    AddRelocation(obj, OBJ_RELOC_Pc32, OBJ_SECT_Text,
+                            e->offset + e->fixup_pos, data_symbol, e->addend);
+                } break;
+        }
+        PushSectionData(obj, OBJ_SECT_Text, e->bytes, e->size);
+
+        if (enc->listing)
+            PrintListingLine(enc->listing, e);
+    }
+    ASSERT(GetSectionOffset(obj, OBJ_SECT_Text) == end_offset);
+}
+
+// Resolves the calls to routines defined in the object, like nasm does for
+// references inside a section, and adds relocations for the rest.
+static void ResolveCalls(Encoder *enc)
+{
+    Object_Code *obj = enc->obj;
+    for (s64 i = 0; i < enc->calls.count; i++)
+    {
+        Enc_Call call = enc->calls[i];
+        Object_Symbol *symbol = GetObjectSymbol(obj, call.target);
+        if (symbol && symbol->section == OBJ_SECT_Text)
+        {
+            s32 rel = (s32)(symbol->offset - (call.offset + 4));
+            PatchSectionData(obj, OBJ_SECT_Text, call.offset, &rel, 4);
+        }
+        else
+        {
+            if (!symbol)
+            {
+                symbol = AddObjectSymbol(obj, call.target,
+                        OBJ_SECT_Undefined, 0, OSYM_Global | OSYM_Routine);
+            }
+            AddRelocation(obj, OBJ_RELOC_Plt32, OBJ_SECT_Text,
+                    call.offset, symbol, -4);
+        }
+    }
+}
+
+
+// Data encoding
+
+static void EncodeGlobals(Codegen_Context *ctx, Object_Code *obj)
+{
+    for (s64 i = 0; i < ctx->global_var_count; i++)
+    {
+        Symbol *symbol = ctx->global_vars[i];
+        u8 *data = ctx->global_data[i];
+        Object_Section_Id section = data ? OBJ_SECT_Data : OBJ_SECT_Bss;
+        s64 offset = AlignSection(obj, section, GetAlign(symbol->type));
+        s64 size = GetAlignedSize(symbol->type);
+        if (data)
+            PushSectionData(obj, section, data, size);
+        else
+            ReserveSectionData(obj, section, size);
+
+        Object_Symbol *obj_symbol = AddObjectSymbol(obj, symbol->unique_name,
+                section, offset, 0);
+        obj_symbol->size = size;
+    }
+}
+
+static void EncodeConstants(Codegen_Context *ctx, Object_Code *obj)
+{
+    if (ctx->float32_consts.count)
+    {
+        AlignSection(obj, OBJ_SECT_Rodata, 16);
+        for (s64 i = 0; i < ctx->float32_consts.count; i++)
+        {
+            Float32_Const fconst = ctx->float32_consts[i];
+            s64 offset = PushSectionData(obj, OBJ_SECT_Rodata, &fconst.uvalue, 4);
+            AddObjectSymbol(obj, fconst.label_name, OBJ_SECT_Rodata, offset, 0)->size = 4;
+        }
+    }
+    if (ctx->float64_consts.count)
+    {
+        AlignSection(obj, OBJ_SECT_Rodata, 16);
+        for (s64 i = 0; i < ctx->float64_consts.count; i++)
+        {
+            Float64_Const fconst = ctx->float64_consts[i];
+            s64 offset = PushSectionData(obj, OBJ_SECT_Rodata, &fconst.uvalue, 8);
+            AddObjectSymbol(obj, fconst.label_name, OBJ_SECT_Rodata, offset, 0)->size = 8;
+        }
+    }
+
+    if (ctx->str_consts.count)
+    {
+        // The string constants are pairs of size and pointer to the string
+        // data, which is null terminated. The pairs stay in .data, as the
+        // pointer needs an absolute relocation, but the bytes are read-only.
+        s64 str_count = ctx->str_consts.count;
+        s64 *data_ptr_offsets = PushArray<s64>(&obj->arena, str_count);
+
+        AlignSection(obj, OBJ_SECT_Data, 8);
+        for (s64 i = 0; i < str_count; i++)
+        {
+            String_Const sconst = ctx->str_consts[i];
+            u64 size = sconst.value.size;
+            s64 offset = PushSectionData(obj, OBJ_SECT_Data, &size, 8);
+            data_ptr_offsets[i] = ReserveSectionData(obj, OBJ_SECT_Data, 8);
+            AddObjectSymbol(obj, sconst.label_name, OBJ_SECT_Data, offset, 0)->size = 16;
+        }
+
+        for (s64 i = 0; i < str_count; i++)
+        {
+            String str = ctx->str_consts[i].value;
+            char label[32];
+            snprintf(label, sizeof(label), "str_data@%" PRId64, i);
+            Name data_name = PushName(&obj->arena, label);
+
+            s64 offset = PushSectionData(obj, OBJ_SECT_Rodata, str.data, str.size);
+            ReserveSectionData(obj, OBJ_SECT_Rodata, 1);
+
+            Object_Symbol *data_symbol = AddObjectSymbol(obj, data_name,
+                    OBJ_SECT_Rodata, offset, 0);
+            data_symbol->size = str.size + 1;
+            AddRelocation(obj, OBJ_RELOC_Abs64, OBJ_SECT_Data,
+                    data_ptr_offsets[i], data_symbol, 0);
+        }
+    }
+}
+
+void EncodeCode_Amd64(Codegen_Context *ctx, Object_Code *obj)
+{
+    Encoder enc = { };
+    enc.ctx = ctx;
+    enc.obj = obj;
+    enc.listing = ctx->code_out;
+
+    for (s64 i = 0; i < ctx->foreign_routine_count; i++)
+    {
+        Name name = ctx->foreign_routines[i];
+        if (!GetObjectSymbol(obj, name))
+        {
+            AddObjectSymbol(obj, name, OBJ_SECT_Undefined, 0,
+                    OSYM_Global | OSYM_Routine);
+        }
+    }
+
+    EncodeGlobals(ctx, obj);
+    EncodeConstants(ctx, obj);
+
+    AlignSection(obj, OBJ_SECT_Text, 16);
+
+    // NOTE(henrik): The routines are declared before any of them is encoded,
+    // as the address of a routine can be taken before the routine itself is
+    // encoded, e.g. in the initialization of a global routine pointer.
+    for (s64 i = 0; i < ctx->routine_count; i++)
+    {
+        Name name = ctx->routines[i].name;
+        if (!GetObjectSymbol(obj, name))
+        {
+            AddObjectSymbol(obj, name, OBJ_SECT_Text, 0,
+                    OSYM_Global | OSYM_Routine);
+        }
+    }
+    for (s64 i = 0; i < ctx->routine_count; i++)
+    {
+        EncodeRoutine(&enc, &ctx->routines[i]);
+    }
+    ResolveCalls(&enc);
+
+    array::Free(enc.instrs);
+    array::Free(enc.labels);
+    array::Free(enc.calls);
+    FreeMemoryArena(&enc.arena);
+}
+
+} // hplang
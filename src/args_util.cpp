@@ -148,7 +148,7 @@ bool GetNextOption(Arg_Options_Context *ctx, Arg_Option_Result *result)
                         {
                             long_arg = opt->long_args[i];
                             if (!long_arg) break;
-                            if (strcmp(long_arg, arg)) break;
+                            if (strcmp(long_arg, arg) == 0) break;
                         }
                         arg = long_arg;
                     }
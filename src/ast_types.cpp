@@ -164,6 +164,10 @@ static void FreeAstNode(Ast_Node *node)
         case AST_ExpressionStmt:
             FreeAstExpr(node->expr_stmt.expr);
             break;
+
+        case AST_ExecDirective:
+            FreeAstExpr(node->exec_directive.expr);
+            break;
     }
 }
 
@@ -643,6 +647,11 @@ static void PrintNode(IoFile *file, Ast_Node *node, s64 level, s64 lev_diff, s64
             fprintf(f, "\n");
             PrintExpr(file, node->expr_stmt.expr, level, 1, parent_level);
             break;
+        case AST_ExecDirective:
+            fprintf(f, "<exec>");
+            fprintf(f, "\n");
+            PrintExpr(file, node->exec_directive.expr, level, 1, parent_level);
+            break;
     }
 }
 
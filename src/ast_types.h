@@ -24,6 +24,7 @@ enum Ast_Node_Type
     AST_StructDef,      // <ident> :: struct {<struct_body>}
     AST_StructMember,
     AST_Typealias,      // <ident> :: typealias <type>;
+    AST_ExecDirective,  // #exec <expr>;
 
     AST_Type_Plain,
     AST_Type_Pointer,
@@ -307,12 +308,21 @@ struct Ast_Import
     String module_name;
 };
 
+// Set by the #inline and #noinline directives before the function.
+enum Inline_Hint
+{
+    INL_Default,
+    INL_Inline,     // Inline at every call site, where possible
+    INL_NoInline,   // Never inline
+};
+
 struct Ast_Function_Def
 {
     Name name;
     Ast_Node_List parameters;
     Ast_Node *return_type; // NOTE(henrik): This is optional, so may be null
     Ast_Node *body;
+    Inline_Hint inline_hint;
 
     Symbol *symbol;
 };
@@ -423,6 +433,11 @@ struct Ast_Expr_Stmt
     Ast_Expr *expr;
 };
 
+struct Ast_Exec_Directive
+{
+    Ast_Expr *expr;
+};
+
 struct Ast_Node
 {
     Ast_Node_Type type;
@@ -446,6 +461,7 @@ struct Ast_Node
         Ast_Return_Stmt     return_stmt;
         Ast_Block_Stmt      block_stmt;
         Ast_Expr_Stmt       expr_stmt;
+        Ast_Exec_Directive  exec_directive;
     };
 };
 
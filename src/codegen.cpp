@@ -46,6 +46,7 @@ void FreeCodegenContext(Codegen_Context *ctx)
     }
     ctx->routine_count = 0;
     ctx->routines = nullptr;
+    array::Free(ctx->routine_table);
 
     array::Free(ctx->float32_consts);
     array::Free(ctx->float64_consts);
@@ -56,7 +57,8 @@ void FreeCodegenContext(Codegen_Context *ctx)
 }
 
 void GenerateCode(Codegen_Context *ctx, Ir_Routine_List routines,
-        Array<Name> foreign_routines, Array<Symbol*> global_vars)
+        Array<Name> foreign_routines, Array<Symbol*> global_vars,
+        Array<u8*> global_data)
 {
     ctx->foreign_routine_count = foreign_routines.count;
     ctx->foreign_routines = PushArray<Name>(&ctx->arena, foreign_routines.count);
@@ -72,6 +74,13 @@ void GenerateCode(Codegen_Context *ctx, Ir_Routine_List routines,
         ctx->global_vars[i] = global_vars[i];
     }
 
+    ASSERT(global_data.count == 0 || global_data.count == global_vars.count);
+    ctx->global_data = PushArray<u8*>(&ctx->arena, global_vars.count);
+    for (s64 i = 0; i < ctx->global_var_count; i++)
+    {
+        ctx->global_data[i] = (i < global_data.count) ? global_data[i] : nullptr;
+    }
+
     switch (ctx->target)
     {
         case CGT_COUNT:
@@ -98,6 +107,20 @@ void OutputCode(Codegen_Context *ctx)
     }
 }
 
+void EncodeCode(Codegen_Context *ctx, Object_Code *obj)
+{
+    switch (ctx->target)
+    {
+        case CGT_COUNT:
+            INVALID_CODE_PATH;
+            break;
+        case CGT_AMD64_Windows:
+        case CGT_AMD64_Unix:
+            EncodeCode_Amd64(ctx, obj);
+            break;
+    }
+}
+
 static const char *target_strings[CGT_COUNT] = {
     /*[CGT_AMD64_Windows] =*/   "AMD64 Windows",
     /*[CGT_AMD64_Unix] =*/      "AMD64 Unix",
@@ -44,6 +44,8 @@ enum class Oper_Data_Type : u8
     S64,
     F32,
     F64,
+    V128,       // A packed vector in an xmm register
+    V256,       // A packed vector in an ymm register
 };
 
 enum class Oper_Addr_Mode : u8
@@ -114,6 +116,9 @@ enum Instr_Flag_Bits
     IF_FallsThrough = 1,
     IF_Branch       = 2,
     IF_CommentedOut = 4,
+    IF_ForeignCall  = 8,    // The call target is a foreign routine
+    IF_TailCall     = 16,   // The call becomes a jump after the epilogue
+    IF_VZeroUpper   = 32,   // vzeroupper goes after the label or before the call
 };
 
 typedef Flag<Instr_Flag_Bits, u8> Instr_Flags;
@@ -163,6 +168,11 @@ struct Routine
 
     Ir_Routine *ir_routine;
 
+    // The caller save registers overwritten by a call to the routine, the
+    // registers written by it or by its callees; all the caller save registers
+    // until the routine has been allocated registers.
+    u64 clobbered_regs;
+
     Instruction_List instructions;
     Instruction_List prologue;
     Instruction_List callee_save_spills;
@@ -199,8 +209,24 @@ struct Spilled_Oper
     Name name;
 };
 
+// The counts of the moves and the stack accesses eliminated by the register
+// allocation and by the optimizations after it.
+struct Codegen_Opt_Counts
+{
+    s64 coalesced_moves;    // The copies given the register of their source
+    s64 fixed_reg_hints;    // The values given the argument or return register they are copied to
+    s64 same_reg_moves;     // The moves removed having the same source and destination
+    s64 redundant_moves;    // The moves removed repeating, undoing or overwriting the previous move
+    s64 reg_moves_left;     // The register to register moves left in the code
+    s64 shared_stack_slots; // The spilled registers given the stack slot of another
+    s64 remat_values;       // The reloads replaced by loading the constant again
+    s64 omitted_frames;     // The leaf routines without the frame setup
+};
+
 struct Compiler_Context;
 struct Reg_Alloc;
+struct Stack_Slots;
+struct Object_Code;
 
 struct Codegen_Context
 {
@@ -212,6 +238,9 @@ struct Codegen_Context
     Name return_label_name;
 
     Routine *current_routine;
+    // The stack slots shared by the spilled registers of the current routine
+    // during the register allocation; null otherwise.
+    Stack_Slots *stack_slots;
 
     s64 current_arg_count;
     s64 fixed_reg_id;
@@ -224,14 +253,21 @@ struct Codegen_Context
 
     Array<Spilled_Oper*> spilled_opers;
 
+    Codegen_Opt_Counts opt_counts;
+
     s64 routine_count;
     Routine *routines;
+    // The routines by name for looking up the registers clobbered by a call.
+    Array<Routine*> routine_table;
 
     s64 foreign_routine_count;
     Name *foreign_routines;
 
     s64 global_var_count;
     Symbol **global_vars;
+    // The initial values of the global variables; null for the zero
+    // initialized variables, which go to bss.
+    u8 **global_data;
 
     IoFile *code_out;
     Compiler_Context *comp_ctx;
@@ -242,9 +278,11 @@ Codegen_Context NewCodegenContext(IoFile *out,
 void FreeCodegenContext(Codegen_Context *ctx);
 
 void GenerateCode(Codegen_Context *ctx, Ir_Routine_List routines,
-        Array<Name> foreign_routines, Array<Symbol*> global_vars);
+        Array<Name> foreign_routines, Array<Symbol*> global_vars,
+        Array<u8*> global_data);
 
 void OutputCode(Codegen_Context *ctx);
+void EncodeCode(Codegen_Context *ctx, Object_Code *obj);
 
 const char* GetTargetString(Codegen_Target target);
 
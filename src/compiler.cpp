@@ -6,7 +6,22 @@
 #include "ast_types.h"
 #include "semantic_check.h"
 #include "ir_gen.h"
+#include "ir_interpreter.h"
+#include "ir_tail.h"
+#include "ir_inline.h"
+#include "ir_cfg.h"
+#include "ir_ssa.h"
+#include "ir_sccp.h"
+#include "ir_gvn.h"
+#include "ir_licm.h"
+#include "ir_strength.h"
+#include "ir_vectorize.h"
+#include "ir_prune.h"
 #include "codegen.h"
+#include "object_code.h"
+#include "elf_writer.h"
+#include "elf_linker.h"
+#include "jit.h"
 #include "time_profiler.h"
 
 #include <cstdio>
@@ -364,13 +379,113 @@ b32 CompileModule(Compiler_Context *ctx, Open_File *open_file)
 
 static b32 Compile_(Compiler_Context *ctx, Open_File *open_file);
 
+static void RunProgram(Compiler_Context *ctx)
+{
+    PROFILE_SCOPE("Running");
+    fflush((FILE*)ctx->error_ctx.file);
+    fflush((FILE*)ctx->debug_file);
+    ctx->program_exit_code = RunJitProgram(&ctx->jit_program);
+    FreeJitProgram(&ctx->jit_program);
+}
+
 b32 Compile(Compiler_Context *ctx, Open_File *open_file)
 {
     b32 result = Compile_(ctx, open_file);
+    // NOTE(henrik): The program is run outside of the compilation scope, so
+    // that the run time is profiled separately from the compile time.
+    if (result && ctx->jit_program.entry)
+        RunProgram(ctx);
     CollateProfilingData(ctx);
     return result;
 }
 
+// Runs the optimizations: the tail calls and the inlining on the IR, the
+// passes on the SSA form and the removal of the unused routines.
+static void OptimizeIr(Compiler_Context *ctx, Ir_Gen_Context *ir_ctx)
+{
+    {
+        PROFILE_SCOPE("Tail call elimination");
+        EliminateTailCalls(ir_ctx);
+    }
+
+    {
+        PROFILE_SCOPE("Inlining");
+        InlineRoutines(ir_ctx);
+    }
+
+    {
+        PROFILE_SCOPE("CFG construction");
+        BuildCfgs(ir_ctx);
+
+        if (ctx->options.debug_cfg)
+            PrintCfgs(ctx->debug_file, ir_ctx);
+    }
+
+    {
+        PROFILE_SCOPE("SSA construction");
+        ConvertToSsa(ir_ctx);
+    }
+
+    {
+        PROFILE_SCOPE("Constant propagation");
+        PropagateConstants(ir_ctx);
+    }
+
+    {
+        PROFILE_SCOPE("Value numbering");
+        NumberValues(ir_ctx);
+    }
+
+    {
+        PROFILE_SCOPE("Loop invariant code motion");
+        HoistLoopInvariants(ir_ctx);
+    }
+
+    {
+        PROFILE_SCOPE("Strength reduction");
+        ReduceStrength(ir_ctx);
+    }
+
+    {
+        PROFILE_SCOPE("Loop vectorization");
+        VectorizeLoops(ir_ctx);
+    }
+
+    if (ctx->options.debug_ssa)
+        PrintIr(ctx->debug_file, ir_ctx);
+
+    if (ctx->options.profile_instr_count)
+    {
+        Ir_Opt_Counts *counts = &ir_ctx->opt_counts;
+        fprintf(stdout, "folded instructions: %" PRId64 "\n", counts->folded_instrs);
+        fprintf(stdout, "folded branches: %" PRId64 "\n", counts->folded_branches);
+        fprintf(stdout, "unreachable instructions: %" PRId64 "\n", counts->unreachable_instrs);
+        fprintf(stdout, "redundant instructions: %" PRId64 "\n", counts->redundant_instrs);
+        fprintf(stdout, "hoisted instructions: %" PRId64 "\n", counts->hoisted_instrs);
+        fprintf(stdout, "reduced instructions: %" PRId64 "\n", counts->reduced_instrs);
+        fprintf(stdout, "inlined calls: %" PRId64 "\n", counts->inlined_calls);
+        fprintf(stdout, "tail calls: %" PRId64 "\n", counts->tail_calls);
+        fprintf(stdout, "vectorized loops: %" PRId64 "\n", counts->vectorized_loops);
+    }
+
+    {
+        PROFILE_SCOPE("SSA destruction");
+        ConvertFromSsa(ir_ctx);
+    }
+
+    {
+        PROFILE_SCOPE("Dead routine elimination");
+        PruneProgram(ir_ctx);
+
+        if (ctx->options.profile_instr_count)
+        {
+            Ir_Opt_Counts *counts = &ir_ctx->opt_counts;
+            fprintf(stdout, "removed routines: %" PRId64 "\n", counts->removed_routines);
+            fprintf(stdout, "removed globals: %" PRId64 "\n", counts->removed_globals);
+        }
+    }
+}
+
 static b32 Compile_(Compiler_Context *ctx, Open_File *open_file)
 {
     PROFILE_SCOPE("Compilation");
@@ -413,32 +528,130 @@ static b32 Compile_(Compiler_Context *ctx, Open_File *open_file)
         return true;
     }
 
+    {
+        PROFILE_SCOPE("Compile time execution");
+        if (!ExecuteCompileTimeCode(&ir_ctx))
+        {
+            FreeIrGenContext(&ir_ctx);
+            ctx->result = RES_FAIL_CompileTimeExecution;
+            return false;
+        }
+    }
+
+    if (ctx->options.optimize)
+    {
+        OptimizeIr(ctx, &ir_ctx);
+    }
+    else
+    {
+        PROFILE_SCOPE("CFG construction");
+        BuildCfgs(&ir_ctx);
+
+        if (ctx->options.debug_cfg)
+            PrintCfgs(ctx->debug_file, &ir_ctx);
+    }
+
+    // NOTE(henrik): Running the program needs the encoded object code.
+    b32 run_program = ctx->options.run_program;
+    b32 builtin_asm = (ctx->options.assembler == ASM_Builtin) || run_program;
+    if (run_program && ctx->options.target != CGT_AMD64_Unix)
+    {
+        fprintf((FILE*)ctx->error_ctx.file,
+                "Only elf64 programs can be run in-process\n");
+        ctx->result = RES_FAIL_InternalError;
+        return false;
+    }
+    if (builtin_asm && ctx->options.target != CGT_AMD64_Unix)
+    {
+        fprintf((FILE*)ctx->error_ctx.file,
+                "The builtin assembler outputs only elf64 objects; "
+                "use -a nasm for this target\n");
+        ctx->result = RES_FAIL_InternalError;
+        return false;
+    }
+
     const char *asm_filename = "out.s";
+    const char *listing_filename = "out.lst";
+    const char *obj_filename = "out.o";
     {
         PROFILE_SCOPE("Code generation");
-        FILE *asm_file = fopen(asm_filename, "w");
-        if (!asm_file)
+        FILE *out_file = nullptr;
+        if (!builtin_asm || ctx->options.debug_encoding)
         {
-            fprintf((FILE*)ctx->error_ctx.file, "Could not open '%s' for output\n",
-                    asm_filename);
-            return false;
+            const char *out_filename = builtin_asm ? listing_filename : asm_filename;
+            out_file = fopen(out_filename, "w");
+            if (!out_file)
+            {
+                fprintf((FILE*)ctx->error_ctx.file, "Could not open '%s' for output\n",
+                        out_filename);
+                return false;
+            }
         }
 
-        Codegen_Context cg_ctx = NewCodegenContext((IoFile*)asm_file, ctx, ctx->options.target);
-        GenerateCode(&cg_ctx, ir_ctx.routines, ir_ctx.foreign_routines, ir_ctx.global_vars);
+        Codegen_Context cg_ctx = NewCodegenContext((IoFile*)out_file, ctx, ctx->options.target);
+        GenerateCode(&cg_ctx, ir_ctx.routines, ir_ctx.foreign_routines,
+                ir_ctx.global_vars, ir_ctx.global_data);
 
-        OutputCode(&cg_ctx);
+        b32 obj_written = true;
+        b32 jit_loaded = true;
+        if (builtin_asm)
+        {
+            Object_Code obj = NewObjectCode();
+            {
+                PROFILE_SCOPE("Encoding");
+                EncodeCode(&cg_ctx, &obj);
+            }
+
+            // NOTE(henrik): The object is written before freeing the codegen
+            // context, as the symbol names of the constants live there.
+            if (run_program)
+            {
+                PROFILE_SCOPE("JIT");
+                jit_loaded = LoadJitProgram(&ctx->jit_program, &obj, "init_",
+                        "stdlib/libstdlib.so", ctx->error_ctx.file);
+            }
+            else if (ctx->options.stop_after != PHASE_CodeGen)
+            {
+                PROFILE_SCOPE("Writing object");
+                FILE *obj_file = fopen(obj_filename, "wb");
+                obj_written = (obj_file != nullptr);
+                if (obj_file)
+                {
+                    obj_written = WriteElfObject(&obj, (IoFile*)obj_file);
+                    fclose(obj_file);
+                }
+            }
+            FreeObjectCode(&obj);
+        }
+        else
+        {
+            OutputCode(&cg_ctx);
+        }
 
-        fclose(asm_file);
+        if (out_file) fclose(out_file);
 
         FreeIrGenContext(&ir_ctx);
         FreeCodegenContext(&cg_ctx);
 
         fflush((FILE*)ctx->error_ctx.file);
         fflush((FILE*)ctx->debug_file);
+
+        if (!obj_written)
+        {
+            fprintf((FILE*)ctx->error_ctx.file, "Could not write the object file '%s'\n",
+                    obj_filename);
+            ctx->result = RES_FAIL_InternalError;
+            return false;
+        }
+        if (!jit_loaded)
+        {
+            fprintf((FILE*)ctx->error_ctx.file, "Could not load the program\n");
+            ctx->result = RES_FAIL_Linking;
+            return false;
+        }
     }
 
-    if (ctx->options.stop_after == PHASE_CodeGen)
+    if (run_program || ctx->options.stop_after == PHASE_CodeGen)
     {
         ctx->result = RES_OK;
         return true;
@@ -447,32 +660,34 @@ static b32 Compile_(Compiler_Context *ctx, Open_File *open_file)
     // TODO(henrik): Specify the options for nasm and gcc somewhere else.
     // Mayby also move the assembling and linking to their own place.
 
-    const char *obj_filename = "out.o";
-    const char *nasm_fmt = nullptr;
-    switch (ctx->options.target)
-    {
-        case CGT_AMD64_Windows:
-            nasm_fmt = "-fwin64";
-            break;
-        case CGT_AMD64_Unix:
-            nasm_fmt = "-felf64";
-            break;
-        case CGT_COUNT:
-            INVALID_CODE_PATH;
-            break;
-    }
-    const char *nasm_args[] = {
-        nasm_fmt,
-        "-o", obj_filename,
-        "--", asm_filename};
+    if (!builtin_asm)
     {
-        PROFILE_SCOPE("Assembling");
-        if (Invoke("nasm", nasm_args, array_length(nasm_args)) != 0)
+        const char *nasm_fmt = nullptr;
+        switch (ctx->options.target)
         {
-            fprintf((FILE*)ctx->error_ctx.file, "Could not assemble the file '%s'\n",
-                    asm_filename);
-            ctx->result = RES_FAIL_InternalError;
-            return false;
+            case CGT_AMD64_Windows:
+                nasm_fmt = "-fwin64";
+                break;
+            case CGT_AMD64_Unix:
+                nasm_fmt = "-felf64";
+                break;
+            case CGT_COUNT:
+                INVALID_CODE_PATH;
+                break;
+        }
+        const char *nasm_args[] = {
+            nasm_fmt,
+            "-o", obj_filename,
+            "--", asm_filename};
+        {
+            PROFILE_SCOPE("Assembling");
+            if (Invoke("nasm", nasm_args, array_length(nasm_args)) != 0)
+            {
+                fprintf((FILE*)ctx->error_ctx.file, "Could not assemble the file '%s'\n",
+                        asm_filename);
+                ctx->result = RES_FAIL_InternalError;
+                return false;
+            }
         }
     }
 
@@ -492,6 +707,44 @@ static b32 Compile_(Compiler_Context *ctx, Open_File *open_file)
         output_fname = PushNullTerminatedString(&ctx->arena, output_fname.data, output_fname.size);
         bin_filename = output_fname.data;
     }
+    if (ctx->options.linker == LINK_Builtin)
+    {
+        if (ctx->options.target != CGT_AMD64_Unix)
+        {
+            fprintf((FILE*)ctx->error_ctx.file,
+                    "The builtin linker outputs only elf64 executables; "
+                    "use -l gcc for this target\n");
+            ctx->result = RES_FAIL_Linking;
+            return false;
+        }
+
+        const char *objects[] = { obj_filename };
+        const char *archives[] = { "stdlib/libstdlib.a" };
+        const char *shared_libraries[] = { "libc.so.6" };
+
+        Link_Options link_options = { };
+        link_options.output_filename = bin_filename;
+        link_options.entry_name = "init_";
+        link_options.interpreter = "/lib64/ld-linux-x86-64.so.2";
+        link_options.object_filenames = objects;
+        link_options.object_count = array_length(objects);
+        link_options.archive_filenames = archives;
+        link_options.archive_count = array_length(archives);
+        link_options.shared_libraries = shared_libraries;
+        link_options.shared_library_count = array_length(shared_libraries);
+
+        PROFILE_SCOPE("Linking");
+        if (!LinkElfExecutable(&link_options, ctx->error_ctx.file))
+        {
+            fprintf((FILE*)ctx->error_ctx.file, "Could not link the file '%s'\n",
+                    obj_filename);
+            ctx->result = RES_FAIL_Linking;
+            return false;
+        }
+        ctx->result = RES_OK;
+        return true;
+    }
+
     const char *gcc_target = nullptr;
     switch (ctx->options.target)
     {
@@ -516,7 +769,9 @@ static b32 Compile_(Compiler_Context *ctx, Open_File *open_file)
         "-Lstdlib",
         "-o", bin_filename,
         obj_filename,
-        "-lstdlib"};
+        // NOTE(henrik): stdlib also has a shared build for running programs
+        // in-process; the executables link the static one.
+        "-l:libstdlib.a"};
     {
         PROFILE_SCOPE("Linking");
         if (Invoke("gcc", gcc_args, array_length(gcc_args)) != 0)
@@ -4,6 +4,7 @@
 #include "memory.h"
 #include "error.h"
 #include "compiler_options.h"
+#include "jit.h"
 
 //#include "token.h"
 #include "ast_types.h"
@@ -18,6 +19,7 @@ enum Compilation_Result
     RES_FAIL_Lexing,
     RES_FAIL_Parsing,
     RES_FAIL_SemanticCheck,
+    RES_FAIL_CompileTimeExecution,
     RES_FAIL_Linking,
     RES_FAIL_InternalError
 };
@@ -42,6 +44,9 @@ struct Compiler_Context
     Environment env;
 
     Compilation_Result result;
+
+    Jit_Program jit_program;
+    s32 program_exit_code;
 };
 
 Compiler_Context NewCompilerContext();
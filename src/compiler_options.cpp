@@ -18,6 +18,16 @@ Compiler_Options DefaultCompilerOptions()
         CGT_AMD64_Unix;
 #endif
 
+    // NOTE(henrik): The builtin assembler writes only elf64 objects.
+    result.assembler =
+#ifdef HP_WIN
+        ASM_Nasm;
+#else
+        ASM_Builtin;
+#endif
+    result.linker = LINK_Gcc;
+    result.optimize = true;
+
     result.max_error_count = 6;
     result.max_line_arrow_error_count = 4;
     result.stop_after = PHASE_Linking;
@@ -16,10 +16,33 @@ enum Compilation_Phase
     PHASE_Linking
 };
 
+enum Assembler_Backend
+{
+    ASM_Nasm,       // Outputs assembly text and assembles it with nasm
+    ASM_Builtin,    // Encodes the machine code and writes the object file directly
+};
+
+enum Linker_Backend
+{
+    LINK_Gcc,       // Links the executable with gcc
+    LINK_Builtin,   // Links the executable in-process
+};
+
+// The optional instruction set extensions, that the generated code may use.
+enum Target_Feature_Bits
+{
+    TF_Avx2 = 1,    // The vectorized loops use the 256 bit AVX2 instructions
+};
+
 struct Compiler_Options
 {
     const char *output_filename;
     Codegen_Target target;
+    u32 target_features;
+    Assembler_Backend assembler;
+    Linker_Backend linker;
+    b32 run_program;        // Runs the program in-process instead of linking
+    b32 optimize;           // Runs the inlining, the tail calls and the SSA passes
 
     s64 max_error_count;
     s64 max_line_arrow_error_count;
@@ -28,7 +51,10 @@ struct Compiler_Options
     b32 diagnose_memory;
     b32 debug_ast;
     b32 debug_ir;
+    b32 debug_cfg;
+    b32 debug_ssa;
     b32 debug_reg_alloc;
+    b32 debug_encoding;
 
     b32 profile_time;
     b32 profile_instr_count;
@@ -0,0 +1,1259 @@
+
+#include "elf_linker.h"
+#include "elf_types.h"
+#include "elf_reader.h"
+#include "elf_writer.h"
+#include "object_code.h"
+#include "hplang.h"
+#include "common.h"
+#include "hashtable.h"
+#include "memory.h"
+#include "assert.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+
+#ifdef HP_UNIX
+#include <sys/stat.h>
+#endif
+
+// The linker produces a non position independent executable, loaded at a
+// fixed address. The symbols not defined by the objects or the archives are
+// looked up from the shared libraries and bound by the dynamic linker at load
+// time: routines are called through plt stubs jumping via the got, and data is
+// copied next to the executable's own data with copy relocations. All the
+// dynamic relocations are processed at load time, so there is no lazy binding
+// machinery.
+//
+// The layout of the executable is
+//   R  segment: headers, .interp, .hash, .dynsym, .dynstr, .rela.dyn, .rodata
+//   RX segment: .text, .plt
+//   RW segment: .dynamic, .got, .data, .bss
+
+namespace hplang
+{
+
+static const u64 IMAGE_BASE = 0x400000;
+static const s64 PAGE_SIZE = 0x1000;
+static const s64 PLT_ENTRY_SIZE = 8;
+
+static const char *shared_library_dirs[] = {
+    "/lib/x86_64-linux-gnu",
+    "/usr/lib/x86_64-linux-gnu",
+    "/lib64",
+    "/usr/lib64",
+    "/lib",
+    "/usr/lib",
+};
+
+enum Exe_Section
+{
+    EXE_SECT_Null,
+    EXE_SECT_Interp,
+    EXE_SECT_Hash,
+    EXE_SECT_Dynsym,
+    EXE_SECT_Dynstr,
+    EXE_SECT_RelaDyn,
+    EXE_SECT_Rodata,
+    EXE_SECT_Text,
+    EXE_SECT_Plt,
+    EXE_SECT_Dynamic,
+    EXE_SECT_Got,
+    EXE_SECT_Data,
+    EXE_SECT_Bss,
+    EXE_SECT_Shstrtab,
+    EXE_SECT_COUNT
+};
+
+enum Exe_Segment
+{
+    EXE_SEG_Phdr,
+    EXE_SEG_Interp,
+    EXE_SEG_LoadR,
+    EXE_SEG_LoadRX,
+    EXE_SEG_LoadRW,
+    EXE_SEG_Dynamic,
+    EXE_SEG_GnuStack,
+    EXE_SEG_COUNT
+};
+
+// The object sections map to these executable sections
+static const Exe_Section exe_sections[OBJ_SECT_COUNT] = {
+    /*[OBJ_SECT_Text] =*/     EXE_SECT_Text,
+    /*[OBJ_SECT_Data] =*/     EXE_SECT_Data,
+    /*[OBJ_SECT_Rodata] =*/   EXE_SECT_Rodata,
+    /*[OBJ_SECT_Bss] =*/      EXE_SECT_Bss,
+};
+
+struct Link_Input
+{
+    const char *name;
+    Object_Code obj;
+    // Offsets of the object sections in the executable sections
+    s64 section_offsets[OBJ_SECT_COUNT];
+};
+
+struct Archive_Member
+{
+    const char *name;
+    const u8 *data;
+    s64 size;
+    s64 header_offset;
+    b32 loaded;
+};
+
+struct Archive_Symbol
+{
+    Name name;
+    Archive_Member *member;
+};
+
+struct Link_Symbol
+{
+    Name name;
+    Link_Input *input;          // The defining input, or null
+    Object_Symbol *symbol;      // The definition, or null
+
+    b32 strong_reference;       // Referenced by a non-weak undefined symbol
+    b32 is_dynamic;             // Defined by a shared library
+    b32 is_routine;
+    b32 is_copied;              // Has a copy relocation
+    s64 size;
+
+    s64 dynsym_index;
+    s64 got_index;
+    s64 plt_index;
+    s64 copy_offset;            // Offset in the bss of the copy
+};
+
+struct Linker
+{
+    const Link_Options *options;
+    IoFile *err_file;
+    Memory_Arena arena;
+    b32 has_errors;
+
+    Array<Pointer> file_contents;
+    Array<Link_Input*> inputs;
+    Array<Archive_Member*> members;
+    Array<Archive_Symbol> archive_symbols;
+
+    Array<Link_Symbol*> symbols;
+    Array<Link_Symbol*> symbol_table;   // hashtable of symbols
+
+    Array<Link_Symbol*> dynamic_symbols;
+    Array<Link_Symbol*> got_symbols;
+    Array<Link_Symbol*> plt_symbols;
+    Array<Link_Symbol*> copy_symbols;
+
+    Array<u8> section_data[OBJ_SECT_COUNT];
+    s64 section_sizes[OBJ_SECT_COUNT];
+    s64 section_alignments[OBJ_SECT_COUNT];
+    s64 plt_offset;                     // Offset of the plt in the text
+
+    Array<u8> dynstr;
+    Array<u8> shstrtab;
+    Array<u32> hash;
+    Array<u32> needed;                  // dynstr offsets of the needed libraries
+
+    Elf64_Section_Header shdrs[EXE_SECT_COUNT];
+    Elf64_Program_Header phdrs[EXE_SEG_COUNT];
+    s64 file_size;
+};
+
+
+// Input
+
+static b32 ReadWholeFile(Linker *linker, const char *filename, Pointer *contents)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file) return false;
+
+    fseek(file, 0, SEEK_END);
+    s64 size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    b32 result = false;
+    if (size > 0)
+    {
+        *contents = Alloc(size);
+        if (contents->ptr)
+        {
+            result = (fread(contents->ptr, 1, size, file) == (size_t)size);
+            array::Push(linker->file_contents, *contents);
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+static Link_Symbol* GetLinkSymbol(Linker *linker, Name name)
+{
+    Link_Symbol *symbol = hashtable::Lookup(linker->symbol_table, name);
+    if (!symbol)
+    {
+        symbol = PushStruct<Link_Symbol>(&linker->arena);
+        *symbol = { };
+        symbol->name = name;
+        symbol->dynsym_index = -1;
+        symbol->got_index = -1;
+        symbol->plt_index = -1;
+        symbol->copy_offset = -1;
+        array::Push(linker->symbols, symbol);
+        hashtable::Put(linker->symbol_table, name, symbol);
+    }
+    return symbol;
+}
+
+static Link_Symbol* GetLinkSymbol(Linker *linker, Object_Symbol *symbol)
+{
+    if (!(symbol->flags & OSYM_Global) || symbol->name.str.size == 0)
+        return nullptr;
+    return hashtable::Lookup(linker->symbol_table, symbol->name);
+}
+
+static b32 AddInput(Linker *linker, const char *name, const u8 *data, s64 size)
+{
+    Link_Input *input = PushStruct<Link_Input>(&linker->arena);
+    *input = { };
+    input->name = name;
+    input->obj = NewObjectCode();
+    array::Push(linker->inputs, input);
+
+    if (!ReadElfObject(&input->obj, data, size, name, linker->err_file))
+        return false;
+
+    Object_Code *obj = &input->obj;
+    for (s64 i = 0; i < obj->symbols.count; i++)
+    {
+        Object_Symbol *symbol = obj->symbols[i];
+        if (!(symbol->flags & OSYM_Global) || symbol->name.str.size == 0)
+            continue;
+
+        Link_Symbol *link_symbol = GetLinkSymbol(linker, symbol->name);
+        if (symbol->section == OBJ_SECT_Undefined)
+        {
+            if (!(symbol->flags & OSYM_Weak))
+                link_symbol->strong_reference = true;
+            continue;
+        }
+        if (link_symbol->symbol)
+        {
+            if (symbol->flags & OSYM_Weak)
+                continue;
+            if (!(link_symbol->symbol->flags & OSYM_Weak))
+            {
+                fprintf((FILE*)linker->err_file,
+                        "%s: multiple definition of '%.*s', first defined in %s\n",
+                        name, (int)symbol->name.str.size, symbol->name.str.data,
+                        link_symbol->input->name);
+                linker->has_errors = true;
+                continue;
+            }
+        }
+        link_symbol->input = input;
+        link_symbol->symbol = symbol;
+    }
+    return true;
+}
+
+static s64 ParseArchiveNumber(const char *field, s64 length)
+{
+    s64 result = 0;
+    for (s64 i = 0; i < length && field[i] >= '0' && field[i] <= '9'; i++)
+    {
+        result = result * 10 + (field[i] - '0');
+    }
+    return result;
+}
+
+static u64 ReadBigEndian(const u8 *data, s64 size)
+{
+    u64 result = 0;
+    for (s64 i = 0; i < size; i++)
+    {
+        result = (result << 8) | data[i];
+    }
+    return result;
+}
+
+static b32 ReadArchiveIndex(Linker *linker, const char *filename,
+        const u8 *data, s64 size, s64 entry_size,
+        Archive_Member **members, s64 member_count)
+{
+    if (size < entry_size) return false;
+    s64 count = ReadBigEndian(data, entry_size);
+    if ((count + 1) * entry_size > size) return false;
+
+    const u8 *offsets = data + entry_size;
+    const char *names = (const char*)(offsets + count * entry_size);
+    const char *names_end = (const char*)(data + size);
+    for (s64 i = 0; i < count; i++)
+    {
+        s64 offset = ReadBigEndian(offsets + i * entry_size, entry_size);
+        s64 name_len = strnlen(names, names_end - names);
+        if (names + name_len >= names_end)
+            return false;
+
+        Archive_Member *member = nullptr;
+        for (s64 mi = 0; mi < member_count; mi++)
+        {
+            if (members[mi]->header_offset == offset)
+            {
+                member = members[mi];
+                break;
+            }
+        }
+        if (!member)
+        {
+            fprintf((FILE*)linker->err_file,
+                    "%s: the symbol index refers to an invalid member\n", filename);
+            return false;
+        }
+
+        Archive_Symbol symbol = { };
+        symbol.name = PushName(&linker->arena, names, name_len);
+        symbol.member = member;
+        array::Push(linker->archive_symbols, symbol);
+        names += name_len + 1;
+    }
+    return true;
+}
+
+// Reads the members and the symbol index of an ar archive. The members are
+// loaded on demand, when they define a symbol that is referenced.
+static b32 ReadArchive(Linker *linker, const char *filename)
+{
+    Pointer contents;
+    if (!ReadWholeFile(linker, filename, &contents))
+    {
+        fprintf((FILE*)linker->err_file, "Could not read the archive '%s'\n", filename);
+        return false;
+    }
+    const u8 *data = (const u8*)contents.ptr;
+    s64 size = contents.size;
+
+    const s64 magic_size = 8;
+    const s64 header_size = 60;
+    if (size < magic_size || memcmp(data, "!<arch>\n", magic_size) != 0)
+    {
+        fprintf((FILE*)linker->err_file, "%s: not an ar archive\n", filename);
+        return false;
+    }
+
+    s64 first_member = linker->members.count;
+    const u8 *index = nullptr;
+    s64 index_size = 0;
+    s64 index_entry_size = 0;
+    const char *long_names = nullptr;
+    s64 long_names_size = 0;
+
+    s64 offset = magic_size;
+    while (offset + header_size <= size)
+    {
+        const char *header = (const char*)(data + offset);
+        s64 member_size = ParseArchiveNumber(header + 48, 10);
+        s64 data_offset = offset + header_size;
+        if (data_offset + member_size > size)
+        {
+            fprintf((FILE*)linker->err_file, "%s: truncated archive\n", filename);
+            return false;
+        }
+        const u8 *member_data = data + data_offset;
+
+        if (strncmp(header, "/ ", 2) == 0)
+        {
+            index = member_data;
+            index_size = member_size;
+            index_entry_size = 4;
+        }
+        else if (strncmp(header, "/SYM64/ ", 8) == 0)
+        {
+            index = member_data;
+            index_size = member_size;
+            index_entry_size = 8;
+        }
+        else if (strncmp(header, "// ", 3) == 0)
+        {
+            long_names = (const char*)member_data;
+            long_names_size = member_size;
+        }
+        else
+        {
+            const char *name = header;
+            s64 name_len = 0;
+            if (header[0] == '/' && long_names)
+            {
+                s64 name_offset = ParseArchiveNumber(header + 1, 15);
+                if (name_offset < long_names_size)
+                    name = long_names + name_offset;
+                while (name_offset + name_len < long_names_size &&
+                        name[name_len] != '/' && name[name_len] != '\n')
+                {
+                    name_len++;
+                }
+            }
+            else
+            {
+                while (name_len < 16 && name[name_len] != '/' && name[name_len] != ' ')
+                    name_len++;
+            }
+
+            char buf[256];
+            snprintf(buf, sizeof(buf), "%s(%.*s)", filename, (int)name_len, name);
+
+            Archive_Member *member = PushStruct<Archive_Member>(&linker->arena);
+            *member = { };
+            member->name = PushNullTerminatedString(&linker->arena, buf).data;
+            member->data = member_data;
+            member->size = member_size;
+            member->header_offset = offset;
+            array::Push(linker->members, member);
+        }
+        offset = data_offset + member_size + (member_size & 1);
+    }
+
+    if (!index)
+    {
+        fprintf((FILE*)linker->err_file,
+                "%s: the archive has no symbol index\n", filename);
+        return false;
+    }
+    if (!ReadArchiveIndex(linker, filename, index, index_size, index_entry_size,
+                linker->members.data + first_member,
+                linker->members.count - first_member))
+    {
+        fprintf((FILE*)linker->err_file, "%s: invalid symbol index\n", filename);
+        return false;
+    }
+    return true;
+}
+
+static b32 LoadArchiveMembers(Linker *linker)
+{
+    b32 changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (s64 i = 0; i < linker->archive_symbols.count; i++)
+        {
+            Archive_Symbol archive_symbol = linker->archive_symbols[i];
+            Archive_Member *member = archive_symbol.member;
+            if (member->loaded) continue;
+
+            Link_Symbol *symbol = hashtable::Lookup(linker->symbol_table, archive_symbol.name);
+            if (symbol && !symbol->symbol && symbol->strong_reference)
+            {
+                member->loaded = true;
+                if (!AddInput(linker, member->name, member->data, member->size))
+                    return false;
+                changed = true;
+            }
+        }
+    }
+    return true;
+}
+
+static b32 FindSharedLibrary(const char *name, char *path, s64 path_size)
+{
+    if (strchr(name, '/'))
+    {
+        snprintf(path, path_size, "%s", name);
+        return true;
+    }
+    for (s64 i = 0; i < array_length(shared_library_dirs); i++)
+    {
+        snprintf(path, path_size, "%s/%s", shared_library_dirs[i], name);
+        FILE *file = fopen(path, "rb");
+        if (file)
+        {
+            fclose(file);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Marks the undefined symbols that the shared library defines as dynamic.
+static b32 ResolveSharedSymbols(Linker *linker, const char *library)
+{
+    char path[256];
+    Pointer contents;
+    if (!FindSharedLibrary(library, path, sizeof(path)) ||
+        !ReadWholeFile(linker, path, &contents))
+    {
+        fprintf((FILE*)linker->err_file, "Could not find the shared library '%s'\n", library);
+        return false;
+    }
+    const u8 *data = (const u8*)contents.ptr;
+    s64 size = contents.size;
+
+    Elf64_Header header;
+    if (size < (s64)sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.ident, "\x7f" "ELF", 4) != 0 ||
+        header.ident[4] != ELF_CLASS_64 ||
+        header.type != ELF_ET_DYN ||
+        header.machine != ELF_EM_X86_64 ||
+        header.shoff + (u64)header.shnum * sizeof(Elf64_Section_Header) > (u64)size)
+    {
+        fprintf((FILE*)linker->err_file, "%s: not an x86-64 shared library\n", path);
+        return false;
+    }
+
+    const Elf64_Section_Header *shdrs = (const Elf64_Section_Header*)(data + header.shoff);
+    for (s64 i = 0; i < header.shnum; i++)
+    {
+        const Elf64_Section_Header *dynsym = &shdrs[i];
+        if (dynsym->type != ELF_SHT_DYNSYM) continue;
+        if (dynsym->link >= header.shnum) break;
+
+        const Elf64_Section_Header *dynstr = &shdrs[dynsym->link];
+        if (dynsym->offset + dynsym->size > (u64)size ||
+            dynstr->offset + dynstr->size > (u64)size)
+        {
+            break;
+        }
+        const Elf64_Symbol *syms = (const Elf64_Symbol*)(data + dynsym->offset);
+        const char *strs = (const char*)(data + dynstr->offset);
+        s64 symbol_count = dynsym->size / sizeof(Elf64_Symbol);
+        for (s64 si = 1; si < symbol_count; si++)
+        {
+            const Elf64_Symbol *sym = &syms[si];
+            u8 bind = ElfSymbolBind(sym->info);
+            u8 type = ElfSymbolType(sym->info);
+            if (sym->shndx == ELF_SHN_UNDEF) continue;
+            if (bind != ELF_STB_GLOBAL && bind != ELF_STB_WEAK) continue;
+            if (sym->name >= dynstr->size) continue;
+
+            String name_str;
+            name_str.data = const_cast<char*>(strs + sym->name);
+            name_str.size = strnlen(name_str.data, dynstr->size - sym->name);
+            Link_Symbol *symbol = hashtable::Lookup(linker->symbol_table, MakeName(name_str));
+            if (symbol && !symbol->symbol && !symbol->is_dynamic)
+            {
+                symbol->is_dynamic = true;
+                symbol->is_routine = (type == ELF_STT_FUNC || type == ELF_STT_GNU_IFUNC);
+                symbol->size = sym->size;
+            }
+        }
+        break;
+    }
+    return true;
+}
+
+static b32 CheckUndefinedSymbols(Linker *linker)
+{
+    b32 result = true;
+    for (s64 i = 0; i < linker->symbols.count; i++)
+    {
+        Link_Symbol *symbol = linker->symbols[i];
+        if (!symbol->symbol && !symbol->is_dynamic && symbol->strong_reference)
+        {
+            fprintf((FILE*)linker->err_file, "Undefined reference to '%.*s'\n",
+                    (int)symbol->name.str.size, symbol->name.str.data);
+            result = false;
+        }
+    }
+    return result;
+}
+
+
+// Dynamic symbols
+
+static void AddDynamicSymbol(Linker *linker, Link_Symbol *symbol)
+{
+    if (symbol->dynsym_index >= 0) return;
+    array::Push(linker->dynamic_symbols, symbol);
+    symbol->dynsym_index = linker->dynamic_symbols.count;
+}
+
+static void AddGotEntry(Linker *linker, Link_Symbol *symbol)
+{
+    if (symbol->got_index >= 0) return;
+    symbol->got_index = linker->got_symbols.count;
+    array::Push(linker->got_symbols, symbol);
+    if (symbol->is_dynamic)
+        AddDynamicSymbol(linker, symbol);
+}
+
+static void AddPltEntry(Linker *linker, Link_Symbol *symbol)
+{
+    if (symbol->plt_index >= 0) return;
+    symbol->plt_index = linker->plt_symbols.count;
+    array::Push(linker->plt_symbols, symbol);
+    AddGotEntry(linker, symbol);
+}
+
+static void AddCopy(Linker *linker, Link_Symbol *symbol)
+{
+    if (symbol->is_copied) return;
+    symbol->is_copied = true;
+    array::Push(linker->copy_symbols, symbol);
+    AddDynamicSymbol(linker, symbol);
+}
+
+// Finds the got entries, plt stubs and copies that the relocations need.
+static b32 ScanRelocations(Linker *linker)
+{
+    b32 result = true;
+    for (s64 i = 0; i < linker->inputs.count; i++)
+    {
+        Link_Input *input = linker->inputs[i];
+        Object_Code *obj = &input->obj;
+        for (s64 ri = 0; ri < obj->relocs.count; ri++)
+        {
+            Object_Reloc reloc = obj->relocs[ri];
+            Object_Symbol *obj_symbol = obj->symbols[reloc.symbol_index];
+            Link_Symbol *symbol = GetLinkSymbol(linker, obj_symbol);
+            if (!symbol)
+            {
+                if (obj_symbol->section == OBJ_SECT_Undefined ||
+                    reloc.type == OBJ_RELOC_GotPc32)
+                {
+                    fprintf((FILE*)linker->err_file,
+                            "%s: unsupported relocation against a local symbol\n",
+                            input->name);
+                    result = false;
+                }
+                continue;
+            }
+
+            if (reloc.type == OBJ_RELOC_GotPc32)
+                AddGotEntry(linker, symbol);
+            else if (symbol->is_dynamic && symbol->is_routine)
+                AddPltEntry(linker, symbol);
+            else if (symbol->is_dynamic)
+                AddCopy(linker, symbol);
+        }
+    }
+    return result;
+}
+
+static u32 ElfHash(String name)
+{
+    u32 h = 0;
+    for (s64 i = 0; i < name.size; i++)
+    {
+        h = (h << 4) + (u8)name.data[i];
+        u32 g = h & 0xf0000000;
+        if (g) h ^= g >> 24;
+        h &= ~g;
+    }
+    return h;
+}
+
+static void BuildDynamicTables(Linker *linker)
+{
+    for (s64 i = 0; i < linker->options->shared_library_count; i++)
+    {
+        const char *library = linker->options->shared_libraries[i];
+        array::Push(linker->needed, AddElfString(linker->dynstr, library, strlen(library)));
+    }
+
+    // NOTE(henrik): The symbol names are added to dynstr in the order of the
+    // dynamic symbols, when the dynsym is written.
+    s64 symbol_count = linker->dynamic_symbols.count + 1;
+    u32 bucket_count = symbol_count;
+    array::Resize(linker->hash, 2 + bucket_count + symbol_count);
+    linker->hash[0] = bucket_count;
+    linker->hash[1] = symbol_count;
+    u32 *buckets = linker->hash.data + 2;
+    u32 *chains = buckets + bucket_count;
+    for (s64 i = 0; i < linker->dynamic_symbols.count; i++)
+    {
+        Link_Symbol *symbol = linker->dynamic_symbols[i];
+        u32 index = symbol->dynsym_index;
+        u32 bucket = ElfHash(symbol->name.str) % bucket_count;
+        chains[index] = buckets[bucket];
+        buckets[bucket] = index;
+    }
+}
+
+
+// Layout
+
+static void MergeSections(Linker *linker)
+{
+    for (s64 s = 0; s < OBJ_SECT_COUNT; s++)
+        linker->section_alignments[s] = 1;
+
+    for (s64 i = 0; i < linker->inputs.count; i++)
+    {
+        Link_Input *input = linker->inputs[i];
+        for (s64 s = 0; s < OBJ_SECT_COUNT; s++)
+        {
+            Object_Section *section = &input->obj.sections[s];
+            s64 alignment = section->alignment;
+            if (linker->section_alignments[s] < alignment)
+                linker->section_alignments[s] = alignment;
+
+            s64 offset = Align(linker->section_sizes[s], alignment);
+            input->section_offsets[s] = offset;
+            linker->section_sizes[s] = offset + section->size;
+            if (s != OBJ_SECT_Bss)
+            {
+                array::Resize(linker->section_data[s], offset);
+                PushElfBytes(linker->section_data[s], section->data.data, section->size);
+            }
+        }
+    }
+
+    // The plt stubs follow the code
+    s64 plt_offset = Align(linker->section_sizes[OBJ_SECT_Text], 16);
+    linker->plt_offset = plt_offset;
+    linker->section_sizes[OBJ_SECT_Text] = plt_offset +
+        linker->plt_symbols.count * PLT_ENTRY_SIZE;
+    array::Resize(linker->section_data[OBJ_SECT_Text], linker->section_sizes[OBJ_SECT_Text]);
+
+    // The copies of shared library data follow the bss
+    for (s64 i = 0; i < linker->copy_symbols.count; i++)
+    {
+        Link_Symbol *symbol = linker->copy_symbols[i];
+        s64 size = symbol->size > 0 ? symbol->size : 8;
+        s64 alignment = size >= 16 ? 16 : 8;
+        if (linker->section_alignments[OBJ_SECT_Bss] < alignment)
+            linker->section_alignments[OBJ_SECT_Bss] = alignment;
+        symbol->copy_offset = Align(linker->section_sizes[OBJ_SECT_Bss], alignment);
+        linker->section_sizes[OBJ_SECT_Bss] = symbol->copy_offset + size;
+    }
+}
+
+static void PlaceSection(Linker *linker, Exe_Section index, const char *name,
+        u32 type, u64 flags, s64 *offset, s64 size, s64 alignment, s64 entry_size)
+{
+    Elf64_Section_Header *shdr = &linker->shdrs[index];
+    *offset = Align(*offset, alignment);
+    shdr->name = AddElfString(linker->shstrtab, name, strlen(name));
+    shdr->type = type;
+    shdr->flags = flags;
+    shdr->addr = (flags & ELF_SHF_ALLOC) ? IMAGE_BASE + *offset : 0;
+    shdr->offset = *offset;
+    shdr->size = size;
+    shdr->addralign = alignment;
+    shdr->entsize = entry_size;
+    if (type != ELF_SHT_NOBITS)
+        *offset += size;
+}
+
+static void PlaceSegment(Linker *linker, Exe_Segment index, u32 type, u32 flags,
+        Exe_Section first, Exe_Section last, s64 alignment)
+{
+    Elf64_Program_Header *phdr = &linker->phdrs[index];
+    const Elf64_Section_Header *first_shdr = &linker->shdrs[first];
+    const Elf64_Section_Header *last_shdr = &linker->shdrs[last];
+    phdr->type = type;
+    phdr->flags = flags;
+    phdr->offset = first_shdr->offset;
+    phdr->vaddr = first_shdr->addr;
+    phdr->paddr = first_shdr->addr;
+    phdr->memsz = last_shdr->addr + last_shdr->size - first_shdr->addr;
+    phdr->filesz = phdr->memsz;
+    if (last_shdr->type == ELF_SHT_NOBITS)
+    {
+        // NOTE(henrik): The padding before the bss is not in the file, so the
+        // file part of the segment ends with the section before the bss.
+        const Elf64_Section_Header *prev_shdr = last_shdr - 1;
+        phdr->filesz = prev_shdr->offset + prev_shdr->size - first_shdr->offset;
+    }
+    phdr->align = alignment;
+}
+
+static s64 DynamicEntryCount(Linker *linker)
+{
+    // NEEDED entries and HASH, STRTAB, SYMTAB, STRSZ, SYMENT, RELA, RELASZ,
+    // RELAENT, DEBUG, FLAGS, FLAGS_1 and NULL
+    return linker->needed.count + 12;
+}
+
+static void LayoutExecutable(Linker *linker)
+{
+    const Link_Options *options = linker->options;
+    s64 offset = sizeof(Elf64_Header) + EXE_SEG_COUNT * sizeof(Elf64_Program_Header);
+
+    // NOTE(henrik): The dynsym names are in dynstr after the needed
+    // libraries, so the final size of dynstr is computed here.
+    s64 dynstr_size = linker->dynstr.count;
+    if (dynstr_size == 0) dynstr_size = 1;
+    for (s64 i = 0; i < linker->dynamic_symbols.count; i++)
+        dynstr_size += linker->dynamic_symbols[i]->name.str.size + 1;
+
+    s64 rela_count = linker->copy_symbols.count;
+    for (s64 i = 0; i < linker->got_symbols.count; i++)
+    {
+        if (linker->got_symbols[i]->is_dynamic)
+            rela_count++;
+    }
+
+    PlaceSection(linker, EXE_SECT_Interp, ".interp", ELF_SHT_PROGBITS, ELF_SHF_ALLOC,
+            &offset, strlen(options->interpreter) + 1, 1, 0);
+    PlaceSection(linker, EXE_SECT_Hash, ".hash", ELF_SHT_HASH, ELF_SHF_ALLOC,
+            &offset, linker->hash.count * sizeof(u32), 8, sizeof(u32));
+    PlaceSection(linker, EXE_SECT_Dynsym, ".dynsym", ELF_SHT_DYNSYM, ELF_SHF_ALLOC,
+            &offset, (linker->dynamic_symbols.count + 1) * sizeof(Elf64_Symbol),
+            8, sizeof(Elf64_Symbol));
+    PlaceSection(linker, EXE_SECT_Dynstr, ".dynstr", ELF_SHT_STRTAB, ELF_SHF_ALLOC,
+            &offset, dynstr_size, 1, 0);
+    PlaceSection(linker, EXE_SECT_RelaDyn, ".rela.dyn", ELF_SHT_RELA, ELF_SHF_ALLOC,
+            &offset, rela_count * sizeof(Elf64_Rela), 8, sizeof(Elf64_Rela));
+    PlaceSection(linker, EXE_SECT_Rodata, ".rodata", ELF_SHT_PROGBITS, ELF_SHF_ALLOC,
+            &offset, linker->section_sizes[OBJ_SECT_Rodata],
+            linker->section_alignments[OBJ_SECT_Rodata], 0);
+
+    offset = Align(offset, PAGE_SIZE);
+    PlaceSection(linker, EXE_SECT_Text, ".text", ELF_SHT_PROGBITS,
+            ELF_SHF_ALLOC | ELF_SHF_EXECINSTR,
+            &offset, linker->plt_offset, linker->section_alignments[OBJ_SECT_Text], 0);
+    PlaceSection(linker, EXE_SECT_Plt, ".plt", ELF_SHT_PROGBITS,
+            ELF_SHF_ALLOC | ELF_SHF_EXECINSTR,
+            &offset, linker->plt_symbols.count * PLT_ENTRY_SIZE, 16, PLT_ENTRY_SIZE);
+
+    offset = Align(offset, PAGE_SIZE);
+    PlaceSection(linker, EXE_SECT_Dynamic, ".dynamic", ELF_SHT_DYNAMIC,
+            ELF_SHF_ALLOC | ELF_SHF_WRITE,
+            &offset, DynamicEntryCount(linker) * sizeof(Elf64_Dynamic),
+            8, sizeof(Elf64_Dynamic));
+    PlaceSection(linker, EXE_SECT_Got, ".got", ELF_SHT_PROGBITS,
+            ELF_SHF_ALLOC | ELF_SHF_WRITE,
+            &offset, linker->got_symbols.count * 8, 8, 8);
+    PlaceSection(linker, EXE_SECT_Data, ".data", ELF_SHT_PROGBITS,
+            ELF_SHF_ALLOC | ELF_SHF_WRITE,
+            &offset, linker->section_sizes[OBJ_SECT_Data],
+            linker->section_alignments[OBJ_SECT_Data], 0);
+    PlaceSection(linker, EXE_SECT_Bss, ".bss", ELF_SHT_NOBITS,
+            ELF_SHF_ALLOC | ELF_SHF_WRITE,
+            &offset, linker->section_sizes[OBJ_SECT_Bss],
+            linker->section_alignments[OBJ_SECT_Bss], 0);
+
+    // NOTE(henrik): The size of .shstrtab is known only after its own name
+    // has been added.
+    PlaceSection(linker, EXE_SECT_Shstrtab, ".shstrtab", ELF_SHT_STRTAB, 0,
+            &offset, 0, 1, 0);
+    linker->shdrs[EXE_SECT_Shstrtab].size = linker->shstrtab.count;
+    offset += linker->shstrtab.count;
+
+    linker->shdrs[EXE_SECT_Hash].link = EXE_SECT_Dynsym;
+    linker->shdrs[EXE_SECT_Dynsym].link = EXE_SECT_Dynstr;
+    linker->shdrs[EXE_SECT_Dynsym].info = 1;
+    linker->shdrs[EXE_SECT_RelaDyn].link = EXE_SECT_Dynsym;
+    linker->shdrs[EXE_SECT_Dynamic].link = EXE_SECT_Dynstr;
+
+    offset = Align(offset, 8);
+    linker->file_size = offset + EXE_SECT_COUNT * sizeof(Elf64_Section_Header);
+
+    Elf64_Program_Header *phdr = &linker->phdrs[EXE_SEG_Phdr];
+    phdr->type = ELF_PT_PHDR;
+    phdr->flags = ELF_PF_R;
+    phdr->offset = sizeof(Elf64_Header);
+    phdr->vaddr = IMAGE_BASE + phdr->offset;
+    phdr->paddr = phdr->vaddr;
+    phdr->filesz = EXE_SEG_COUNT * sizeof(Elf64_Program_Header);
+    phdr->memsz = phdr->filesz;
+    phdr->align = 8;
+
+    PlaceSegment(linker, EXE_SEG_Interp, ELF_PT_INTERP, ELF_PF_R,
+            EXE_SECT_Interp, EXE_SECT_Interp, 1);
+    PlaceSegment(linker, EXE_SEG_LoadR, ELF_PT_LOAD, ELF_PF_R,
+            EXE_SECT_Interp, EXE_SECT_Rodata, PAGE_SIZE);
+    // The first load segment includes the headers
+    linker->phdrs[EXE_SEG_LoadR].filesz += linker->phdrs[EXE_SEG_LoadR].offset;
+    linker->phdrs[EXE_SEG_LoadR].memsz += linker->phdrs[EXE_SEG_LoadR].offset;
+    linker->phdrs[EXE_SEG_LoadR].offset = 0;
+    linker->phdrs[EXE_SEG_LoadR].vaddr = IMAGE_BASE;
+    linker->phdrs[EXE_SEG_LoadR].paddr = IMAGE_BASE;
+    PlaceSegment(linker, EXE_SEG_LoadRX, ELF_PT_LOAD, ELF_PF_R | ELF_PF_X,
+            EXE_SECT_Text, EXE_SECT_Plt, PAGE_SIZE);
+    PlaceSegment(linker, EXE_SEG_LoadRW, ELF_PT_LOAD, ELF_PF_R | ELF_PF_W,
+            EXE_SECT_Dynamic, EXE_SECT_Bss, PAGE_SIZE);
+    PlaceSegment(linker, EXE_SEG_Dynamic, ELF_PT_DYNAMIC, ELF_PF_R | ELF_PF_W,
+            EXE_SECT_Dynamic, EXE_SECT_Dynamic, 8);
+
+    Elf64_Program_Header *stack = &linker->phdrs[EXE_SEG_GnuStack];
+    stack->type = ELF_PT_GNU_STACK;
+    stack->flags = ELF_PF_R | ELF_PF_W;
+    stack->align = 16;
+}
+
+
+// Relocation
+
+static u64 GetSectionAddress(Linker *linker, Object_Section_Id section)
+{
+    return linker->shdrs[exe_sections[section]].addr;
+}
+
+static u64 GetSymbolAddress(Linker *linker, Link_Input *input, Object_Symbol *symbol)
+{
+    Object_Section_Id section = symbol->section;
+    ASSERT(section != OBJ_SECT_Undefined);
+    return GetSectionAddress(linker, section) +
+        input->section_offsets[section] + symbol->offset;
+}
+
+static u64 GetSymbolAddress(Linker *linker, Link_Symbol *symbol)
+{
+    if (symbol->symbol)
+        return GetSymbolAddress(linker, symbol->input, symbol->symbol);
+    if (symbol->is_copied)
+        return GetSectionAddress(linker, OBJ_SECT_Bss) + symbol->copy_offset;
+    if (symbol->plt_index >= 0)
+        return linker->shdrs[EXE_SECT_Plt].addr + symbol->plt_index * PLT_ENTRY_SIZE;
+    // Undefined weak symbol
+    return 0;
+}
+
+static u64 GetGotAddress(Linker *linker, Link_Symbol *symbol)
+{
+    ASSERT(symbol->got_index >= 0);
+    return linker->shdrs[EXE_SECT_Got].addr + symbol->got_index * 8;
+}
+
+static b32 FitsS32(s64 value)
+{
+    return value >= -(s64)0x80000000 && value <= (s64)0x7fffffff;
+}
+
+static b32 ApplyRelocations(Linker *linker, Link_Input *input)
+{
+    b32 result = true;
+    Object_Code *obj = &input->obj;
+    for (s64 i = 0; i < obj->relocs.count; i++)
+    {
+        Object_Reloc reloc = obj->relocs[i];
+        s64 offset = input->section_offsets[reloc.section] + reloc.offset;
+        u8 *location = linker->section_data[reloc.section].data + offset;
+        u64 P = GetSectionAddress(linker, reloc.section) + offset;
+        s64 A = reloc.addend;
+
+        Object_Symbol *obj_symbol = obj->symbols[reloc.symbol_index];
+        Link_Symbol *symbol = GetLinkSymbol(linker, obj_symbol);
+        u64 S = symbol ?
+            GetSymbolAddress(linker, symbol) :
+            GetSymbolAddress(linker, input, obj_symbol);
+
+        s64 value = 0;
+        s64 size = 4;
+        b32 overflow = false;
+        switch (reloc.type)
+        {
+            case OBJ_RELOC_Pc32:
+            case OBJ_RELOC_Plt32:
+                value = S + A - P;
+                overflow = !FitsS32(value);
+                break;
+            case OBJ_RELOC_GotPc32:
+                value = GetGotAddress(linker, symbol) + A - P;
+                overflow = !FitsS32(value);
+                break;
+            case OBJ_RELOC_Abs64:
+                value = S + A;
+                size = 8;
+                break;
+            case OBJ_RELOC_Abs32:
+                value = S + A;
+                overflow = ((u64)value > 0xffffffff);
+                break;
+            case OBJ_RELOC_Abs32S:
+                value = S + A;
+                overflow = !FitsS32(value);
+                break;
+        }
+        if (overflow)
+        {
+            fprintf((FILE*)linker->err_file, "%s: relocation overflow at %s+0x%" PRIx64 "\n",
+                    input->name, GetSectionName(reloc.section), (u64)reloc.offset);
+            result = false;
+        }
+        memcpy(location, &value, size);
+    }
+    return result;
+}
+
+static void WritePlt(Linker *linker)
+{
+    u8 *plt = linker->section_data[OBJ_SECT_Text].data + linker->plt_offset;
+    u64 plt_address = linker->shdrs[EXE_SECT_Plt].addr;
+    for (s64 i = 0; i < linker->plt_symbols.count; i++)
+    {
+        Link_Symbol *symbol = linker->plt_symbols[i];
+        u8 *entry = plt + i * PLT_ENTRY_SIZE;
+        u64 entry_address = plt_address + i * PLT_ENTRY_SIZE;
+
+        // jmp [rip + got entry]
+        s32 disp = (s32)(GetGotAddress(linker, symbol) - (entry_address + 6));
+        entry[0] = 0xff;
+        entry[1] = 0x25;
+        memcpy(entry + 2, &disp, 4);
+        entry[6] = 0xcc;
+        entry[7] = 0xcc;
+    }
+}
+
+
+// Output
+
+static void CopyToFile(Array<u8> &file, const Elf64_Section_Header *shdr,
+        const void *data, s64 size)
+{
+    ASSERT(size <= (s64)shdr->size);
+    if (size > 0)
+        memcpy(file.data + shdr->offset, data, size);
+}
+
+static void WriteDynamicSections(Linker *linker, Array<u8> &file)
+{
+    const Elf64_Section_Header *shdrs = linker->shdrs;
+
+    const char *interp = linker->options->interpreter;
+    CopyToFile(file, &shdrs[EXE_SECT_Interp], interp, strlen(interp) + 1);
+    CopyToFile(file, &shdrs[EXE_SECT_Hash], linker->hash.data,
+            linker->hash.count * sizeof(u32));
+
+    Array<Elf64_Symbol> dynsym = { };
+    Elf64_Symbol null_sym = { };
+    array::Push(dynsym, null_sym);
+    for (s64 i = 0; i < linker->dynamic_symbols.count; i++)
+    {
+        Link_Symbol *symbol = linker->dynamic_symbols[i];
+        Elf64_Symbol sym = { };
+        sym.name = AddElfString(linker->dynstr,
+                symbol->name.str.data, symbol->name.str.size);
+        if (symbol->is_copied)
+        {
+            sym.info = ElfSymbolInfo(ELF_STB_GLOBAL, ELF_STT_OBJECT);
+            sym.shndx = EXE_SECT_Bss;
+            sym.value = GetSymbolAddress(linker, symbol);
+            sym.size = symbol->size;
+        }
+        else
+        {
+            u8 type = symbol->is_routine ? ELF_STT_FUNC : ELF_STT_OBJECT;
+            sym.info = ElfSymbolInfo(ELF_STB_GLOBAL, type);
+            sym.shndx = ELF_SHN_UNDEF;
+        }
+        array::Push(dynsym, sym);
+    }
+    if (linker->dynstr.count == 0)
+        array::Push(linker->dynstr, (u8)0);
+    CopyToFile(file, &shdrs[EXE_SECT_Dynsym], dynsym.data,
+            dynsym.count * sizeof(Elf64_Symbol));
+    CopyToFile(file, &shdrs[EXE_SECT_Dynstr], linker->dynstr.data, linker->dynstr.count);
+    array::Free(dynsym);
+
+    Array<Elf64_Rela> relas = { };
+    Array<u64> got = { };
+    for (s64 i = 0; i < linker->got_symbols.count; i++)
+    {
+        Link_Symbol *symbol = linker->got_symbols[i];
+        if (symbol->is_dynamic && !symbol->is_copied)
+        {
+            Elf64_Rela rela = { };
+            rela.offset = GetGotAddress(linker, symbol);
+            rela.info = ElfRelaInfo(symbol->dynsym_index, ELF_R_X86_64_GLOB_DAT);
+            array::Push(relas, rela);
+            array::Push(got, (u64)0);
+        }
+        else
+        {
+            array::Push(got, GetSymbolAddress(linker, symbol));
+        }
+    }
+    for (s64 i = 0; i < linker->copy_symbols.count; i++)
+    {
+        Link_Symbol *symbol = linker->copy_symbols[i];
+        Elf64_Rela rela = { };
+        rela.offset = GetSymbolAddress(linker, symbol);
+        rela.info = ElfRelaInfo(symbol->dynsym_index, ELF_R_X86_64_COPY);
+        array::Push(relas, rela);
+    }
+    CopyToFile(file, &shdrs[EXE_SECT_RelaDyn], relas.data,
+            relas.count * sizeof(Elf64_Rela));
+    CopyToFile(file, &shdrs[EXE_SECT_Got], got.data, got.count * sizeof(u64));
+
+    Array<Elf64_Dynamic> dynamic = { };
+    for (s64 i = 0; i < linker->needed.count; i++)
+    {
+        Elf64_Dynamic entry = { ELF_DT_NEEDED, linker->needed[i] };
+        array::Push(dynamic, entry);
+    }
+    Elf64_Dynamic entries[] = {
+        { ELF_DT_HASH,      shdrs[EXE_SECT_Hash].addr },
+        { ELF_DT_STRTAB,    shdrs[EXE_SECT_Dynstr].addr },
+        { ELF_DT_SYMTAB,    shdrs[EXE_SECT_Dynsym].addr },
+        { ELF_DT_STRSZ,     shdrs[EXE_SECT_Dynstr].size },
+        { ELF_DT_SYMENT,    sizeof(Elf64_Symbol) },
+        { ELF_DT_RELA,      shdrs[EXE_SECT_RelaDyn].addr },
+        { ELF_DT_RELASZ,    shdrs[EXE_SECT_RelaDyn].size },
+        { ELF_DT_RELAENT,   sizeof(Elf64_Rela) },
+        { ELF_DT_DEBUG,     0 },
+        { ELF_DT_FLAGS,     ELF_DF_BIND_NOW },
+        { ELF_DT_FLAGS_1,   ELF_DF_1_NOW },
+        { ELF_DT_NULL,      0 },
+    };
+    for (s64 i = 0; i < array_length(entries); i++)
+        array::Push(dynamic, entries[i]);
+    ASSERT(dynamic.count == DynamicEntryCount(linker));
+    CopyToFile(file, &shdrs[EXE_SECT_Dynamic], dynamic.data,
+            dynamic.count * sizeof(Elf64_Dynamic));
+
+    array::Free(relas);
+    array::Free(got);
+    array::Free(dynamic);
+}
+
+static b32 WriteExecutable(Linker *linker, u64 entry_address)
+{
+    Array<u8> file = { };
+    array::Resize(file, linker->file_size);
+
+    WriteDynamicSections(linker, file);
+    Array<u8> &text = linker->section_data[OBJ_SECT_Text];
+    CopyToFile(file, &linker->shdrs[EXE_SECT_Text], text.data, linker->plt_offset);
+    CopyToFile(file, &linker->shdrs[EXE_SECT_Plt], text.data + linker->plt_offset,
+            text.count - linker->plt_offset);
+    CopyToFile(file, &linker->shdrs[EXE_SECT_Rodata],
+            linker->section_data[OBJ_SECT_Rodata].data,
+            linker->section_data[OBJ_SECT_Rodata].count);
+    CopyToFile(file, &linker->shdrs[EXE_SECT_Data],
+            linker->section_data[OBJ_SECT_Data].data,
+            linker->section_data[OBJ_SECT_Data].count);
+    const Elf64_Section_Header *shstrtab = &linker->shdrs[EXE_SECT_Shstrtab];
+    CopyToFile(file, shstrtab, linker->shstrtab.data, linker->shstrtab.count);
+
+    s64 shoff = linker->file_size - EXE_SECT_COUNT * sizeof(Elf64_Section_Header);
+    memcpy(file.data + shoff, linker->shdrs, sizeof(linker->shdrs));
+    memcpy(file.data + sizeof(Elf64_Header), linker->phdrs, sizeof(linker->phdrs));
+
+    Elf64_Header header = { };
+    u8 ident[16] = {
+        0x7f, 'E', 'L', 'F',
+        ELF_CLASS_64, ELF_DATA_2LSB, ELF_VERSION_CURRENT, ELF_OSABI_SYSV,
+    };
+    memcpy(header.ident, ident, sizeof(ident));
+    header.type = ELF_ET_EXEC;
+    header.machine = ELF_EM_X86_64;
+    header.version = ELF_VERSION_CURRENT;
+    header.entry = entry_address;
+    header.phoff = sizeof(Elf64_Header);
+    header.shoff = shoff;
+    header.ehsize = sizeof(Elf64_Header);
+    header.phentsize = sizeof(Elf64_Program_Header);
+    header.phnum = EXE_SEG_COUNT;
+    header.shentsize = sizeof(Elf64_Section_Header);
+    header.shnum = EXE_SECT_COUNT;
+    header.shstrndx = EXE_SECT_Shstrtab;
+    memcpy(file.data, &header, sizeof(header));
+
+    const char *filename = linker->options->output_filename;
+    b32 result = false;
+    FILE *out = fopen(filename, "wb");
+    if (out)
+    {
+        result = (fwrite(file.data, 1, file.count, out) == (size_t)file.count);
+        fclose(out);
+#ifdef HP_UNIX
+        chmod(filename, 0755);
+#endif
+    }
+    if (!result)
+    {
+        fprintf((FILE*)linker->err_file, "Could not write the executable '%s'\n", filename);
+    }
+    array::Free(file);
+    return result;
+}
+
+static b32 Link(Linker *linker)
+{
+    const Link_Options *options = linker->options;
+    for (s64 i = 0; i < options->object_count; i++)
+    {
+        const char *filename = options->object_filenames[i];
+        Pointer contents;
+        if (!ReadWholeFile(linker, filename, &contents))
+        {
+            fprintf((FILE*)linker->err_file, "Could not read the object '%s'\n", filename);
+            return false;
+        }
+        if (!AddInput(linker, filename, (const u8*)contents.ptr, contents.size))
+            return false;
+    }
+    for (s64 i = 0; i < options->archive_count; i++)
+    {
+        if (!ReadArchive(linker, options->archive_filenames[i]))
+            return false;
+    }
+    if (!LoadArchiveMembers(linker))
+        return false;
+    for (s64 i = 0; i < options->shared_library_count; i++)
+    {
+        if (!ResolveSharedSymbols(linker, options->shared_libraries[i]))
+            return false;
+    }
+    if (linker->has_errors || !CheckUndefinedSymbols(linker))
+        return false;
+
+    String entry_name;
+    entry_name.data = const_cast<char*>(options->entry_name);
+    entry_name.size = strlen(entry_name.data);
+    Link_Symbol *entry = hashtable::Lookup(linker->symbol_table, MakeName(entry_name));
+    if (!entry || !entry->symbol)
+    {
+        fprintf((FILE*)linker->err_file, "The entry point '%s' is not defined\n",
+                options->entry_name);
+        return false;
+    }
+
+    if (!ScanRelocations(linker))
+        return false;
+    BuildDynamicTables(linker);
+    MergeSections(linker);
+    LayoutExecutable(linker);
+
+    b32 result = true;
+    for (s64 i = 0; i < linker->inputs.count; i++)
+    {
+        result &= ApplyRelocations(linker, linker->inputs[i]);
+    }
+    if (!result)
+        return false;
+    WritePlt(linker);
+
+    return WriteExecutable(linker, GetSymbolAddress(linker, entry));
+}
+
+b32 LinkElfExecutable(const Link_Options *options, IoFile *err_file)
+{
+    Linker linker = { };
+    linker.options = options;
+    linker.err_file = err_file;
+
+    b32 result = Link(&linker);
+
+    for (s64 i = 0; i < linker.inputs.count; i++)
+        FreeObjectCode(&linker.inputs[i]->obj);
+    for (s64 i = 0; i < linker.file_contents.count; i++)
+        Free(linker.file_contents[i]);
+    for (s64 s = 0; s < OBJ_SECT_COUNT; s++)
+        array::Free(linker.section_data[s]);
+    array::Free(linker.file_contents);
+    array::Free(linker.inputs);
+    array::Free(linker.members);
+    array::Free(linker.archive_symbols);
+    array::Free(linker.symbols);
+    array::Free(linker.symbol_table);
+    array::Free(linker.dynamic_symbols);
+    array::Free(linker.got_symbols);
+    array::Free(linker.plt_symbols);
+    array::Free(linker.copy_symbols);
+    array::Free(linker.dynstr);
+    array::Free(linker.shstrtab);
+    array::Free(linker.hash);
+    array::Free(linker.needed);
+    FreeMemoryArena(&linker.arena);
+    return result;
+}
+
+} // hplang
@@ -0,0 +1,31 @@
+#ifndef H_HPLANG_ELF_LINKER_H
+
+#include "types.h"
+#include "io.h"
+
+namespace hplang
+{
+
+struct Link_Options
+{
+    const char *output_filename;
+    const char *entry_name;
+    const char *interpreter;            // The dynamic linker of the executable
+
+    const char **object_filenames;
+    s64 object_count;
+    const char **archive_filenames;     // Static libraries
+    s64 archive_count;
+    const char **shared_libraries;      // Sonames or paths of shared libraries
+    s64 shared_library_count;
+};
+
+// Links the relocatable objects and the needed members of the archives into
+// an x86-64 ELF executable. The symbols left undefined are bound to the
+// shared libraries at load time. Reports the errors to err_file.
+b32 LinkElfExecutable(const Link_Options *options, IoFile *err_file);
+
+} // hplang
+
+#define H_HPLANG_ELF_LINKER_H
+#endif
@@ -0,0 +1,276 @@
+
+#include "elf_reader.h"
+#include "elf_types.h"
+#include "object_code.h"
+#include "memory.h"
+#include "assert.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace hplang
+{
+
+struct Elf_Input_Section
+{
+    Object_Section_Id section;  // OBJ_SECT_Undefined if the section is dropped
+    s64 offset;                 // Offset of the section in the object section
+};
+
+static void ReadError(IoFile *err_file, const char *filename, const char *message)
+{
+    fprintf((FILE*)err_file, "%s: %s\n", filename, message);
+}
+
+static b32 StartsWith(const char *str, const char *prefix)
+{
+    return strncmp(str, prefix, strlen(prefix)) == 0;
+}
+
+static const char* GetElfString(const u8 *data, s64 size,
+        const Elf64_Section_Header *strtab, u32 offset)
+{
+    if (!strtab || offset >= strtab->size || strtab->offset + strtab->size > (u64)size)
+        return "";
+    return (const char*)(data + strtab->offset + offset);
+}
+
+static b32 GetObjectSection(const char *name,
+        const Elf64_Section_Header *shdr, Object_Section_Id *section)
+{
+    *section = OBJ_SECT_Undefined;
+    if (!(shdr->flags & ELF_SHF_ALLOC))
+        return true;
+    if (shdr->type == ELF_SHT_NOTE || StartsWith(name, ".eh_frame"))
+        return true;
+    if (shdr->type != ELF_SHT_PROGBITS && shdr->type != ELF_SHT_NOBITS)
+        return false;
+    if (shdr->flags & ELF_SHF_TLS)
+        return false;
+
+    if (shdr->flags & ELF_SHF_EXECINSTR)
+        *section = OBJ_SECT_Text;
+    else if (shdr->type == ELF_SHT_NOBITS)
+        *section = OBJ_SECT_Bss;
+    else if (shdr->flags & ELF_SHF_WRITE)
+        *section = OBJ_SECT_Data;
+    else
+        *section = OBJ_SECT_Rodata;
+    return true;
+}
+
+static b32 GetRelocType(u32 elf_type, Object_Reloc_Type *type)
+{
+    switch (elf_type)
+    {
+    case ELF_R_X86_64_PC32:             *type = OBJ_RELOC_Pc32; return true;
+    case ELF_R_X86_64_PLT32:            *type = OBJ_RELOC_Plt32; return true;
+    case ELF_R_X86_64_64:               *type = OBJ_RELOC_Abs64; return true;
+    case ELF_R_X86_64_32:               *type = OBJ_RELOC_Abs32; return true;
+    case ELF_R_X86_64_32S:              *type = OBJ_RELOC_Abs32S; return true;
+    case ELF_R_X86_64_GOTPCREL:
+    case ELF_R_X86_64_GOTPCRELX:
+    case ELF_R_X86_64_REX_GOTPCRELX:    *type = OBJ_RELOC_GotPc32; return true;
+    }
+    return false;
+}
+
+b32 ReadElfObject(Object_Code *obj, const u8 *data, s64 size,
+        const char *filename, IoFile *err_file)
+{
+    if (size < (s64)sizeof(Elf64_Header))
+    {
+        ReadError(err_file, filename, "file is too small to be an ELF object");
+        return false;
+    }
+    Elf64_Header header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.ident, "\x7f" "ELF", 4) != 0 ||
+        header.ident[4] != ELF_CLASS_64 ||
+        header.ident[5] != ELF_DATA_2LSB)
+    {
+        ReadError(err_file, filename, "not an ELF64 little endian file");
+        return false;
+    }
+    if (header.type != ELF_ET_REL || header.machine != ELF_EM_X86_64)
+    {
+        ReadError(err_file, filename, "not an x86-64 relocatable object");
+        return false;
+    }
+    if (header.shentsize != sizeof(Elf64_Section_Header) ||
+        header.shoff + (u64)header.shnum * sizeof(Elf64_Section_Header) > (u64)size ||
+        header.shstrndx >= header.shnum)
+    {
+        ReadError(err_file, filename, "invalid section header table");
+        return false;
+    }
+
+    const Elf64_Section_Header *shdrs = (const Elf64_Section_Header*)(data + header.shoff);
+    s64 section_count = header.shnum;
+    const Elf64_Section_Header *shstrtab = &shdrs[header.shstrndx];
+
+    Elf_Input_Section *sections = PushArray<Elf_Input_Section>(&obj->arena, section_count);
+    const Elf64_Section_Header *symtab = nullptr;
+    for (s64 i = 0; i < section_count; i++)
+    {
+        const Elf64_Section_Header *shdr = &shdrs[i];
+        const char *name = GetElfString(data, size, shstrtab, shdr->name);
+        sections[i].section = OBJ_SECT_Undefined;
+        sections[i].offset = 0;
+
+        if (shdr->type == ELF_SHT_SYMTAB)
+        {
+            symtab = shdr;
+            continue;
+        }
+        if (shdr->type == ELF_SHT_REL)
+        {
+            ReadError(err_file, filename, "REL relocations are not supported");
+            return false;
+        }
+
+        Object_Section_Id section;
+        if (!GetObjectSection(name, shdr, &section))
+        {
+            fprintf((FILE*)err_file, "%s: section '%s' is not supported\n",
+                    filename, name);
+            return false;
+        }
+        if (section == OBJ_SECT_Undefined)
+            continue;
+
+        s64 alignment = shdr->addralign ? shdr->addralign : 1;
+        sections[i].section = section;
+        sections[i].offset = AlignSection(obj, section, alignment);
+        if (section == OBJ_SECT_Bss)
+        {
+            ReserveSectionData(obj, section, shdr->size);
+        }
+        else
+        {
+            if (shdr->offset + shdr->size > (u64)size)
+            {
+                ReadError(err_file, filename, "section data out of bounds");
+                return false;
+            }
+            PushSectionData(obj, section, data + shdr->offset, shdr->size);
+        }
+    }
+
+    if (!symtab)
+    {
+        ReadError(err_file, filename, "no symbol table");
+        return false;
+    }
+    if (symtab->entsize != sizeof(Elf64_Symbol) ||
+        symtab->offset + symtab->size > (u64)size ||
+        symtab->link >= section_count)
+    {
+        ReadError(err_file, filename, "invalid symbol table");
+        return false;
+    }
+
+    const Elf64_Section_Header *strtab = &shdrs[symtab->link];
+    const Elf64_Symbol *syms = (const Elf64_Symbol*)(data + symtab->offset);
+    s64 symbol_count = symtab->size / sizeof(Elf64_Symbol);
+    for (s64 i = 0; i < symbol_count; i++)
+    {
+        const Elf64_Symbol *sym = &syms[i];
+        u8 bind = ElfSymbolBind(sym->info);
+        u8 type = ElfSymbolType(sym->info);
+        b32 is_global = (bind == ELF_STB_GLOBAL || bind == ELF_STB_WEAK);
+
+        u32 flags = 0;
+        if (is_global) flags |= OSYM_Global;
+        if (bind == ELF_STB_WEAK) flags |= OSYM_Weak;
+        if (type == ELF_STT_FUNC || type == ELF_STT_GNU_IFUNC) flags |= OSYM_Routine;
+
+        // NOTE(henrik): Only the global symbols are referred to by name; the
+        // local symbols are referred to by the relocations of this object.
+        Name name = { };
+        if (is_global && i > 0)
+        {
+            name = PushName(&obj->arena,
+                    GetElfString(data, size, strtab, sym->name));
+        }
+
+        Object_Section_Id section = OBJ_SECT_Undefined;
+        s64 offset = 0;
+        if (sym->shndx == ELF_SHN_COMMON)
+        {
+            s64 alignment = sym->value ? sym->value : 1;
+            section = OBJ_SECT_Bss;
+            offset = AlignSection(obj, OBJ_SECT_Bss, alignment);
+            ReserveSectionData(obj, OBJ_SECT_Bss, sym->size);
+        }
+        else if (sym->shndx == ELF_SHN_ABS)
+        {
+            if (is_global)
+            {
+                fprintf((FILE*)err_file, "%s: absolute symbol '%.*s' is not supported\n",
+                        filename, (int)name.str.size, name.str.data);
+                return false;
+            }
+        }
+        else if (sym->shndx != ELF_SHN_UNDEF && sym->shndx < section_count)
+        {
+            section = sections[sym->shndx].section;
+            offset = sections[sym->shndx].offset + sym->value;
+            if (section == OBJ_SECT_Undefined && is_global)
+            {
+                fprintf((FILE*)err_file, "%s: symbol '%.*s' is defined in an unsupported section\n",
+                        filename, (int)name.str.size, name.str.data);
+                return false;
+            }
+        }
+
+        Object_Symbol *symbol = AddObjectSymbol(obj, name, section, offset, flags);
+        symbol->size = sym->size;
+    }
+
+    for (s64 i = 0; i < section_count; i++)
+    {
+        const Elf64_Section_Header *shdr = &shdrs[i];
+        if (shdr->type != ELF_SHT_RELA) continue;
+        if (shdr->info >= section_count) continue;
+
+        Elf_Input_Section target = sections[shdr->info];
+        if (target.section == OBJ_SECT_Undefined) continue;
+        if (target.section == OBJ_SECT_Bss ||
+            shdr->entsize != sizeof(Elf64_Rela) ||
+            shdr->offset + shdr->size > (u64)size)
+        {
+            ReadError(err_file, filename, "invalid relocation section");
+            return false;
+        }
+
+        const Elf64_Rela *relas = (const Elf64_Rela*)(data + shdr->offset);
+        s64 rela_count = shdr->size / sizeof(Elf64_Rela);
+        for (s64 ri = 0; ri < rela_count; ri++)
+        {
+            const Elf64_Rela *rela = &relas[ri];
+            u32 elf_type = ElfRelaType(rela->info);
+            u32 symbol_index = ElfRelaSymbol(rela->info);
+            if (elf_type == ELF_R_X86_64_NONE) continue;
+
+            Object_Reloc_Type type;
+            if (!GetRelocType(elf_type, &type))
+            {
+                fprintf((FILE*)err_file, "%s: relocation type %u is not supported\n",
+                        filename, elf_type);
+                return false;
+            }
+            if (symbol_index >= symbol_count)
+            {
+                ReadError(err_file, filename, "relocation symbol out of bounds");
+                return false;
+            }
+            AddRelocation(obj, type, target.section,
+                    target.offset + rela->offset,
+                    obj->symbols[symbol_index], rela->addend);
+        }
+    }
+    return true;
+}
+
+} // hplang
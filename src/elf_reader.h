@@ -0,0 +1,22 @@
+#ifndef H_HPLANG_ELF_READER_H
+
+#include "types.h"
+#include "io.h"
+
+namespace hplang
+{
+
+struct Object_Code;
+
+// Reads an ELF64 x86-64 relocatable object into the object code. The
+// allocated sections are merged into the text, data, rodata and bss sections
+// by their flags; unwind tables and notes are dropped. Each ELF symbol becomes
+// the object symbol with the same index. Reports the errors to err_file and
+// returns false if the object is not supported.
+b32 ReadElfObject(Object_Code *obj, const u8 *data, s64 size,
+        const char *filename, IoFile *err_file);
+
+} // hplang
+
+#define H_HPLANG_ELF_READER_H
+#endif
@@ -0,0 +1,208 @@
+#ifndef H_HPLANG_ELF_TYPES_H
+
+#include "types.h"
+
+namespace hplang
+{
+
+// ELF64 structures and constants used by the object file writer. Only the
+// parts needed for x86-64 are defined.
+
+enum
+{
+    ELF_CLASS_64        = 2,
+    ELF_DATA_2LSB       = 1,
+    ELF_VERSION_CURRENT = 1,
+    ELF_OSABI_SYSV      = 0,
+
+    ELF_ET_REL          = 1,
+    ELF_ET_EXEC         = 2,
+    ELF_ET_DYN          = 3,
+
+    ELF_EM_X86_64       = 62,
+};
+
+enum
+{
+    ELF_SHN_UNDEF       = 0,
+    ELF_SHN_ABS         = 0xfff1,
+    ELF_SHN_COMMON      = 0xfff2,
+};
+
+enum
+{
+    ELF_SHT_NULL        = 0,
+    ELF_SHT_PROGBITS    = 1,
+    ELF_SHT_SYMTAB      = 2,
+    ELF_SHT_STRTAB      = 3,
+    ELF_SHT_RELA        = 4,
+    ELF_SHT_HASH        = 5,
+    ELF_SHT_DYNAMIC     = 6,
+    ELF_SHT_NOTE        = 7,
+    ELF_SHT_NOBITS      = 8,
+    ELF_SHT_REL         = 9,
+    ELF_SHT_DYNSYM      = 11,
+};
+
+enum
+{
+    ELF_SHF_WRITE       = 0x1,
+    ELF_SHF_ALLOC       = 0x2,
+    ELF_SHF_EXECINSTR   = 0x4,
+    ELF_SHF_INFO_LINK   = 0x40,
+    ELF_SHF_TLS         = 0x400,
+};
+
+enum
+{
+    ELF_STB_LOCAL       = 0,
+    ELF_STB_GLOBAL      = 1,
+    ELF_STB_WEAK        = 2,
+
+    ELF_STT_NOTYPE      = 0,
+    ELF_STT_OBJECT      = 1,
+    ELF_STT_FUNC        = 2,
+    ELF_STT_SECTION     = 3,
+    ELF_STT_FILE        = 4,
+    ELF_STT_COMMON      = 5,
+    ELF_STT_GNU_IFUNC   = 10,
+};
+
+enum
+{
+    ELF_R_X86_64_NONE   = 0,
+    ELF_R_X86_64_64     = 1,
+    ELF_R_X86_64_PC32   = 2,
+    ELF_R_X86_64_PLT32  = 4,
+    ELF_R_X86_64_COPY   = 5,
+    ELF_R_X86_64_GLOB_DAT = 6,
+    ELF_R_X86_64_GOTPCREL = 9,
+    ELF_R_X86_64_32     = 10,
+    ELF_R_X86_64_32S    = 11,
+    ELF_R_X86_64_GOTPCRELX = 41,
+    ELF_R_X86_64_REX_GOTPCRELX = 42,
+};
+
+enum
+{
+    ELF_PT_NULL         = 0,
+    ELF_PT_LOAD         = 1,
+    ELF_PT_DYNAMIC      = 2,
+    ELF_PT_INTERP       = 3,
+    ELF_PT_PHDR         = 6,
+    ELF_PT_GNU_STACK    = 0x6474e551,
+
+    ELF_PF_X            = 0x1,
+    ELF_PF_W            = 0x2,
+    ELF_PF_R            = 0x4,
+};
+
+enum
+{
+    ELF_DT_NULL         = 0,
+    ELF_DT_NEEDED       = 1,
+    ELF_DT_HASH         = 4,
+    ELF_DT_STRTAB       = 5,
+    ELF_DT_SYMTAB       = 6,
+    ELF_DT_RELA         = 7,
+    ELF_DT_RELASZ       = 8,
+    ELF_DT_RELAENT      = 9,
+    ELF_DT_STRSZ        = 10,
+    ELF_DT_SYMENT       = 11,
+    ELF_DT_DEBUG        = 21,
+    ELF_DT_FLAGS        = 30,
+    ELF_DT_FLAGS_1      = 0x6ffffffb,
+
+    ELF_DF_BIND_NOW     = 0x8,
+    ELF_DF_1_NOW        = 0x1,
+};
+
+struct Elf64_Header
+{
+    u8  ident[16];
+    u16 type;
+    u16 machine;
+    u32 version;
+    u64 entry;
+    u64 phoff;
+    u64 shoff;
+    u32 flags;
+    u16 ehsize;
+    u16 phentsize;
+    u16 phnum;
+    u16 shentsize;
+    u16 shnum;
+    u16 shstrndx;
+};
+
+struct Elf64_Section_Header
+{
+    u32 name;
+    u32 type;
+    u64 flags;
+    u64 addr;
+    u64 offset;
+    u64 size;
+    u32 link;
+    u32 info;
+    u64 addralign;
+    u64 entsize;
+};
+
+struct Elf64_Symbol
+{
+    u32 name;
+    u8  info;
+    u8  other;
+    u16 shndx;
+    u64 value;
+    u64 size;
+};
+
+struct Elf64_Program_Header
+{
+    u32 type;
+    u32 flags;
+    u64 offset;
+    u64 vaddr;
+    u64 paddr;
+    u64 filesz;
+    u64 memsz;
+    u64 align;
+};
+
+struct Elf64_Dynamic
+{
+    s64 tag;
+    u64 value;
+};
+
+struct Elf64_Rela
+{
+    u64 offset;
+    u64 info;
+    s64 addend;
+};
+
+inline u8 ElfSymbolInfo(u8 bind, u8 type)
+{ return (bind << 4) | (type & 0xf); }
+
+inline u8 ElfSymbolBind(u8 info)
+{ return info >> 4; }
+
+inline u8 ElfSymbolType(u8 info)
+{ return info & 0xf; }
+
+inline u64 ElfRelaInfo(u32 symbol, u32 type)
+{ return ((u64)symbol << 32) | type; }
+
+inline u32 ElfRelaSymbol(u64 info)
+{ return (u32)(info >> 32); }
+
+inline u32 ElfRelaType(u64 info)
+{ return (u32)info; }
+
+} // hplang
+
+#define H_HPLANG_ELF_TYPES_H
+#endif
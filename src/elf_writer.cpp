@@ -0,0 +1,321 @@
+
+#include "elf_writer.h"
+#include "elf_types.h"
+#include "object_code.h"
+#include "assert.h"
+#include "time_profiler.h"
+
+#include <cstdio>
+#include <cstring>
+
+// The ELF writer outputs the object code as an x86-64 relocatable object,
+// that can be linked with the system linker like the objects nasm produces.
+// The whole file is built in memory and written out at once.
+
+namespace hplang
+{
+
+struct Elf_Writer
+{
+    Object_Code *obj;
+
+    Array<u8> buffer;
+    Array<u8> strtab;
+    Array<u8> shstrtab;
+
+    Array<Elf64_Section_Header> section_headers;
+    Array<Elf64_Symbol> symbols;
+
+    // Elf section index of each object section, or 0 if it is not emitted
+    u16 section_index[OBJ_SECT_COUNT];
+    // Elf symbol index of each object symbol
+    u32 *symbol_index;
+    u32 first_global;
+};
+
+s64 PushElfBytes(Array<u8> &buf, const void *data, s64 size)
+{
+    s64 offset = buf.count;
+    array::Resize(buf, offset + size);
+    memcpy(buf.data + offset, data, size);
+    return offset;
+}
+
+s64 AlignElfBuffer(Array<u8> &buf, s64 alignment)
+{
+    s64 padding = (alignment - (buf.count & (alignment - 1))) & (alignment - 1);
+    array::Resize(buf, buf.count + padding);
+    return buf.count;
+}
+
+u32 AddElfString(Array<u8> &strtab, const char *str, s64 size)
+{
+    if (strtab.count == 0)
+        array::Push(strtab, (u8)0);
+    u32 offset = strtab.count;
+    PushElfBytes(strtab, str, size);
+    array::Push(strtab, (u8)0);
+    return offset;
+}
+
+static u16 AddSectionHeader(Elf_Writer *writer, const char *name,
+        u32 type, u64 flags, u64 offset, u64 size, u64 alignment)
+{
+    Elf64_Section_Header shdr = { };
+    if (name)
+        shdr.name = AddElfString(writer->shstrtab, name, strlen(name));
+    shdr.type = type;
+    shdr.flags = flags;
+    shdr.offset = offset;
+    shdr.size = size;
+    shdr.addralign = alignment;
+    array::Push(writer->section_headers, shdr);
+    return writer->section_headers.count - 1;
+}
+
+static u64 GetSectionFlags(Object_Section_Id section)
+{
+    switch (section)
+    {
+    case OBJ_SECT_Text:     return ELF_SHF_ALLOC | ELF_SHF_EXECINSTR;
+    case OBJ_SECT_Data:     return ELF_SHF_ALLOC | ELF_SHF_WRITE;
+    case OBJ_SECT_Rodata:   return ELF_SHF_ALLOC;
+    case OBJ_SECT_Bss:      return ELF_SHF_ALLOC | ELF_SHF_WRITE;
+    default:
+        INVALID_CODE_PATH;
+    }
+    return 0;
+}
+
+static u32 GetRelocType(Object_Reloc_Type type)
+{
+    switch (type)
+    {
+    case OBJ_RELOC_Pc32:    return ELF_R_X86_64_PC32;
+    case OBJ_RELOC_Plt32:   return ELF_R_X86_64_PLT32;
+    case OBJ_RELOC_Abs64:   return ELF_R_X86_64_64;
+    case OBJ_RELOC_Abs32:   return ELF_R_X86_64_32;
+    case OBJ_RELOC_Abs32S:  return ELF_R_X86_64_32S;
+    case OBJ_RELOC_GotPc32: return ELF_R_X86_64_GOTPCREL;
+    }
+    INVALID_CODE_PATH;
+    return ELF_R_X86_64_NONE;
+}
+
+static void WriteSections(Elf_Writer *writer)
+{
+    Object_Code *obj = writer->obj;
+
+    // The null section
+    AddSectionHeader(writer, nullptr, ELF_SHT_NULL, 0, 0, 0, 0);
+
+    for (s64 i = 0; i < OBJ_SECT_COUNT; i++)
+    {
+        Object_Section_Id section_id = (Object_Section_Id)i;
+        Object_Section *section = &obj->sections[i];
+        if (section->size == 0 && section_id != OBJ_SECT_Text)
+            continue;
+
+        const char *name = GetSectionName(section_id);
+        u64 flags = GetSectionFlags(section_id);
+        if (section_id == OBJ_SECT_Bss)
+        {
+            writer->section_index[i] = AddSectionHeader(writer, name,
+                    ELF_SHT_NOBITS, flags, writer->buffer.count,
+                    section->size, section->alignment);
+        }
+        else
+        {
+            ASSERT(section->data.count == section->size);
+            s64 offset = AlignElfBuffer(writer->buffer, section->alignment);
+            PushElfBytes(writer->buffer, section->data.data, section->size);
+            writer->section_index[i] = AddSectionHeader(writer, name,
+                    ELF_SHT_PROGBITS, flags, offset,
+                    section->size, section->alignment);
+        }
+    }
+}
+
+static void WriteSymbols(Elf_Writer *writer)
+{
+    Object_Code *obj = writer->obj;
+
+    // The null symbol
+    Elf64_Symbol null_sym = { };
+    array::Push(writer->symbols, null_sym);
+
+    // Section symbols
+    for (s64 i = 0; i < OBJ_SECT_COUNT; i++)
+    {
+        if (writer->section_index[i] == 0) continue;
+        Elf64_Symbol sym = { };
+        sym.info = ElfSymbolInfo(ELF_STB_LOCAL, ELF_STT_SECTION);
+        sym.shndx = writer->section_index[i];
+        array::Push(writer->symbols, sym);
+    }
+
+    // NOTE(henrik): ELF requires the local symbols to precede the global
+    // symbols, so the symbols are written in two passes.
+    for (s64 pass = 0; pass < 2; pass++)
+    {
+        b32 global_pass = (pass == 1);
+        if (global_pass)
+            writer->first_global = writer->symbols.count;
+
+        for (s64 i = 0; i < obj->symbols.count; i++)
+        {
+            Object_Symbol *symbol = obj->symbols[i];
+            b32 is_global = (symbol->flags & OSYM_Global) ||
+                (symbol->section == OBJ_SECT_Undefined);
+            if (is_global != global_pass) continue;
+
+            Elf64_Symbol sym = { };
+            sym.name = AddElfString(writer->strtab,
+                    symbol->name.str.data, symbol->name.str.size);
+            u8 bind = is_global ? ELF_STB_GLOBAL : ELF_STB_LOCAL;
+            if (symbol->section == OBJ_SECT_Undefined)
+            {
+                sym.info = ElfSymbolInfo(bind, ELF_STT_NOTYPE);
+                sym.shndx = ELF_SHN_UNDEF;
+            }
+            else
+            {
+                u8 type = (symbol->flags & OSYM_Routine) ?
+                    ELF_STT_FUNC : ELF_STT_OBJECT;
+                sym.info = ElfSymbolInfo(bind, type);
+                sym.shndx = writer->section_index[symbol->section];
+                sym.value = symbol->offset;
+                sym.size = symbol->size;
+                ASSERT(sym.shndx != 0);
+            }
+            writer->symbol_index[i] = writer->symbols.count;
+            array::Push(writer->symbols, sym);
+        }
+    }
+}
+
+static void WriteRelocations(Elf_Writer *writer, u16 symtab_index)
+{
+    Object_Code *obj = writer->obj;
+    for (s64 i = 0; i < OBJ_SECT_COUNT; i++)
+    {
+        Object_Section_Id section_id = (Object_Section_Id)i;
+        s64 offset = AlignElfBuffer(writer->buffer, 8);
+        s64 count = 0;
+        for (s64 ri = 0; ri < obj->relocs.count; ri++)
+        {
+            Object_Reloc reloc = obj->relocs[ri];
+            if (reloc.section != section_id) continue;
+
+            Elf64_Rela rela = { };
+            rela.offset = reloc.offset;
+            rela.info = ElfRelaInfo(writer->symbol_index[reloc.symbol_index],
+                    GetRelocType(reloc.type));
+            rela.addend = reloc.addend;
+            PushElfBytes(writer->buffer, &rela, sizeof(rela));
+            count++;
+        }
+        if (count == 0) continue;
+
+        char name[32];
+        snprintf(name, sizeof(name), ".rela%s", GetSectionName(section_id));
+        u16 index = AddSectionHeader(writer, name, ELF_SHT_RELA,
+                ELF_SHF_INFO_LINK, offset, count * sizeof(Elf64_Rela), 8);
+        Elf64_Section_Header *shdr = &writer->section_headers[index];
+        shdr->link = symtab_index;
+        shdr->info = writer->section_index[i];
+        shdr->entsize = sizeof(Elf64_Rela);
+    }
+}
+
+b32 WriteElfObject(Object_Code *obj, IoFile *file)
+{
+    PROFILE_SCOPE("Write elf object");
+
+    Elf_Writer writer = { };
+    writer.obj = obj;
+    writer.symbol_index = PushArray<u32>(&obj->arena, obj->symbols.count);
+
+    Elf64_Header header = { };
+    PushElfBytes(writer.buffer, &header, sizeof(header));
+
+    WriteSections(&writer);
+    WriteSymbols(&writer);
+
+    // NOTE(henrik): The relocation sections refer to the symbol table by its
+    // section index, which is known before the table is written, as it is
+    // added right after the relocation sections.
+    s64 reloc_section_count = 0;
+    for (s64 i = 0; i < OBJ_SECT_COUNT; i++)
+    {
+        for (s64 ri = 0; ri < obj->relocs.count; ri++)
+        {
+            if (obj->relocs[ri].section == i)
+            {
+                reloc_section_count++;
+                break;
+            }
+        }
+    }
+    u16 symtab_index = writer.section_headers.count + reloc_section_count;
+    WriteRelocations(&writer, symtab_index);
+    ASSERT(writer.section_headers.count == symtab_index);
+
+    s64 symtab_offset = AlignElfBuffer(writer.buffer, 8);
+    PushElfBytes(writer.buffer, writer.symbols.data,
+            writer.symbols.count * sizeof(Elf64_Symbol));
+    AddSectionHeader(&writer, ".symtab", ELF_SHT_SYMTAB, 0,
+            symtab_offset, writer.symbols.count * sizeof(Elf64_Symbol), 8);
+    writer.section_headers[symtab_index].link = symtab_index + 1;
+    writer.section_headers[symtab_index].info = writer.first_global;
+    writer.section_headers[symtab_index].entsize = sizeof(Elf64_Symbol);
+
+    if (writer.strtab.count == 0)
+        array::Push(writer.strtab, (u8)0);
+    s64 strtab_offset = writer.buffer.count;
+    PushElfBytes(writer.buffer, writer.strtab.data, writer.strtab.count);
+    AddSectionHeader(&writer, ".strtab", ELF_SHT_STRTAB, 0,
+            strtab_offset, writer.strtab.count, 1);
+
+    // Marks the stack non-executable
+    AddSectionHeader(&writer, ".note.GNU-stack", ELF_SHT_PROGBITS, 0,
+            writer.buffer.count, 0, 1);
+
+    u16 shstrtab_index = AddSectionHeader(&writer, ".shstrtab",
+            ELF_SHT_STRTAB, 0, 0, 0, 1);
+    s64 shstrtab_offset = writer.buffer.count;
+    PushElfBytes(writer.buffer, writer.shstrtab.data, writer.shstrtab.count);
+    writer.section_headers[shstrtab_index].offset = shstrtab_offset;
+    writer.section_headers[shstrtab_index].size = writer.shstrtab.count;
+
+    s64 shdr_offset = AlignElfBuffer(writer.buffer, 8);
+    PushElfBytes(writer.buffer, writer.section_headers.data,
+            writer.section_headers.count * sizeof(Elf64_Section_Header));
+
+    u8 ident[16] = {
+        0x7f, 'E', 'L', 'F',
+        ELF_CLASS_64, ELF_DATA_2LSB, ELF_VERSION_CURRENT, ELF_OSABI_SYSV,
+    };
+    memcpy(header.ident, ident, sizeof(ident));
+    header.type = ELF_ET_REL;
+    header.machine = ELF_EM_X86_64;
+    header.version = ELF_VERSION_CURRENT;
+    header.shoff = shdr_offset;
+    header.ehsize = sizeof(Elf64_Header);
+    header.shentsize = sizeof(Elf64_Section_Header);
+    header.shnum = writer.section_headers.count;
+    header.shstrndx = shstrtab_index;
+    memcpy(writer.buffer.data, &header, sizeof(header));
+
+    s64 written = fwrite(writer.buffer.data, 1, writer.buffer.count, (FILE*)file);
+    b32 result = (written == writer.buffer.count);
+
+    array::Free(writer.buffer);
+    array::Free(writer.strtab);
+    array::Free(writer.shstrtab);
+    array::Free(writer.section_headers);
+    array::Free(writer.symbols);
+    return result;
+}
+
+} // hplang
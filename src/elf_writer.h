@@ -0,0 +1,23 @@
+#ifndef H_HPLANG_ELF_WRITER_H
+
+#include "types.h"
+#include "array.h"
+#include "io.h"
+
+namespace hplang
+{
+
+struct Object_Code;
+
+// Writes the object code as an ELF64 relocatable object file.
+b32 WriteElfObject(Object_Code *obj, IoFile *file);
+
+// Helpers for building ELF files in memory, also used by the linker.
+s64 PushElfBytes(Array<u8> &buf, const void *data, s64 size);
+s64 AlignElfBuffer(Array<u8> &buf, s64 alignment);
+u32 AddElfString(Array<u8> &strtab, const char *str, s64 size);
+
+} // hplang
+
+#define H_HPLANG_ELF_WRITER_H
+#endif
@@ -0,0 +1,542 @@
+
+#include "ir_cfg.h"
+#include "ir_gen.h"
+#include "symbols.h"
+#include "common.h"
+#include "assert.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+
+// The control flow graph splits the instructions of a routine to basic
+// blocks. A block begins at the first instruction, at a label and after a jump
+// or a return. The dominators are computed with the iterative algorithm by
+// Cooper, Harvey and Kennedy [1], and the loops are the natural loops of the
+// back edges, nested by their headers.
+//
+// [1]  Keith D. Cooper, Timothy J. Harvey and Ken Kennedy, 2001.
+//      A Simple, Fast Dominance Algorithm.
+
+namespace hplang
+{
+
+static b32 IsJump(Ir_Opcode opcode)
+{
+    return opcode == IR_Jump || opcode == IR_Jz || opcode == IR_Jnz;
+}
+
+static void AddEdge(Ir_Block *from, Ir_Block *to)
+{
+    for (s64 i = 0; i < from->succs.count; i++)
+    {
+        if (from->succs[i] == to) return;
+    }
+    array::Push(from->succs, to);
+    array::Push(to->preds, from);
+}
+
+static void CollectBlocks(Ir_Cfg *cfg, Ir_Routine *routine)
+{
+    Ir_Instruction_List &instructions = routine->instructions;
+    s64 instr_count = instructions.count;
+
+    cfg->instr_blocks = PushArray<Ir_Block*>(&cfg->arena, instr_count);
+    Ir_Block *block = nullptr;
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Opcode opcode = instructions[i].opcode;
+        if (!block || opcode == IR_Label)
+        {
+            block = PushStruct<Ir_Block>(&cfg->arena);
+            *block = { };
+            block->index = cfg->blocks.count;
+            block->start = i;
+            block->rpo_index = -1;
+            array::Push(cfg->blocks, block);
+        }
+        block->end = i + 1;
+        cfg->instr_blocks[i] = block;
+        if (IsJump(opcode) || opcode == IR_Return)
+            block = nullptr;
+    }
+
+    for (s64 b = 0; b < cfg->blocks.count; b++)
+    {
+        block = cfg->blocks[b];
+        Ir_Instruction *last = &instructions[block->end - 1];
+        if (last->opcode != IR_Jump && last->opcode != IR_Return &&
+            block->end < instr_count)
+        {
+            AddEdge(block, cfg->instr_blocks[block->end]);
+        }
+        if (IsJump(last->opcode))
+        {
+            s64 target = last->target.label->target_loc;
+            ASSERT(target >= 0 && target < instr_count);
+            AddEdge(block, cfg->instr_blocks[target]);
+        }
+    }
+}
+
+static void ComputeRpo(Ir_Cfg *cfg)
+{
+    s64 block_count = cfg->blocks.count;
+    Ir_Block **stack = PushArray<Ir_Block*>(&cfg->arena, block_count);
+    s64 *next_succ = PushArray<s64>(&cfg->arena, block_count);
+    u8 *visited = PushArray<u8>(&cfg->arena, block_count);
+    memset(visited, 0, block_count);
+
+    Array<Ir_Block*> postorder = { };
+    s64 top = 0;
+    stack[top++] = cfg->blocks[0];
+    visited[0] = 1;
+    next_succ[0] = 0;
+    while (top > 0)
+    {
+        Ir_Block *block = stack[top - 1];
+        if (next_succ[block->index] < block->succs.count)
+        {
+            Ir_Block *succ = block->succs[next_succ[block->index]++];
+            if (!visited[succ->index])
+            {
+                visited[succ->index] = 1;
+                next_succ[succ->index] = 0;
+                stack[top++] = succ;
+            }
+        }
+        else
+        {
+            array::Push(postorder, block);
+            top--;
+        }
+    }
+
+    for (s64 i = postorder.count - 1; i >= 0; i--)
+    {
+        Ir_Block *block = postorder[i];
+        block->rpo_index = cfg->rpo.count;
+        array::Push(cfg->rpo, block);
+    }
+    array::Free(postorder);
+}
+
+static Ir_Block* Intersect(Ir_Block *a, Ir_Block *b)
+{
+    while (a != b)
+    {
+        while (a->rpo_index > b->rpo_index)
+            a = a->idom;
+        while (b->rpo_index > a->rpo_index)
+            b = b->idom;
+    }
+    return a;
+}
+
+static void ComputeDominators(Ir_Cfg *cfg)
+{
+    Ir_Block *entry = cfg->rpo[0];
+    entry->idom = entry;
+
+    b32 changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (s64 i = 1; i < cfg->rpo.count; i++)
+        {
+            Ir_Block *block = cfg->rpo[i];
+            Ir_Block *new_idom = nullptr;
+            for (s64 p = 0; p < block->preds.count; p++)
+            {
+                Ir_Block *pred = block->preds[p];
+                if (!pred->idom) continue;
+                new_idom = new_idom ? Intersect(pred, new_idom) : pred;
+            }
+            if (block->idom != new_idom)
+            {
+                block->idom = new_idom;
+                changed = true;
+            }
+        }
+    }
+    entry->idom = nullptr;
+
+    for (s64 i = 1; i < cfg->rpo.count; i++)
+    {
+        Ir_Block *block = cfg->rpo[i];
+        array::Push(block->idom->dom_children, block);
+    }
+
+    // Number the dominator tree, so that dominance can be tested in constant
+    // time.
+    s64 block_count = cfg->blocks.count;
+    Ir_Block **stack = PushArray<Ir_Block*>(&cfg->arena, block_count);
+    s64 *next_child = PushArray<s64>(&cfg->arena, block_count);
+    s64 counter = 0;
+    s64 top = 0;
+    stack[top++] = entry;
+    next_child[entry->index] = 0;
+    entry->dom_pre = counter++;
+    while (top > 0)
+    {
+        Ir_Block *block = stack[top - 1];
+        if (next_child[block->index] < block->dom_children.count)
+        {
+            Ir_Block *child = block->dom_children[next_child[block->index]++];
+            next_child[child->index] = 0;
+            child->dom_pre = counter++;
+            stack[top++] = child;
+        }
+        else
+        {
+            block->dom_post = counter++;
+            top--;
+        }
+    }
+}
+
+static void ComputeLoops(Ir_Cfg *cfg)
+{
+    s64 block_count = cfg->blocks.count;
+    Ir_Loop **in_loop = PushArray<Ir_Loop*>(&cfg->arena, block_count);
+    for (s64 i = 0; i < block_count; i++)
+        in_loop[i] = nullptr;
+
+    Array<Ir_Block*> worklist = { };
+    for (s64 i = 0; i < cfg->rpo.count; i++)
+    {
+        Ir_Block *header = cfg->rpo[i];
+        Ir_Loop *loop = nullptr;
+        for (s64 p = 0; p < header->preds.count; p++)
+        {
+            Ir_Block *pred = header->preds[p];
+            if (!Dominates(header, pred)) continue;
+
+            if (!loop)
+            {
+                loop = PushStruct<Ir_Loop>(&cfg->arena);
+                *loop = { };
+                loop->index = cfg->loops.count;
+                loop->header = header;
+                // NOTE(henrik): The enclosing loops have their headers
+                // earlier in the reverse postorder, so they are already
+                // assigned to the header.
+                loop->parent = header->loop;
+                loop->depth = loop->parent ? loop->parent->depth + 1 : 1;
+                array::Push(cfg->loops, loop);
+
+                in_loop[header->index] = loop;
+                array::Push(loop->blocks, header);
+            }
+            array::Push(loop->latches, pred);
+            array::Push(worklist, pred);
+        }
+        if (!loop) continue;
+
+        // The natural loop is the header and the blocks, that reach a latch
+        // without going through the header.
+        while (worklist.count > 0)
+        {
+            Ir_Block *block = worklist[worklist.count - 1];
+            worklist.count--;
+            if (in_loop[block->index] == loop) continue;
+            in_loop[block->index] = loop;
+            array::Push(loop->blocks, block);
+            for (s64 p = 0; p < block->preds.count; p++)
+            {
+                Ir_Block *pred = block->preds[p];
+                if (pred->rpo_index != -1 && in_loop[pred->index] != loop)
+                    array::Push(worklist, pred);
+            }
+        }
+        for (s64 b = 0; b < loop->blocks.count; b++)
+        {
+            loop->blocks[b]->loop = loop;
+        }
+    }
+    array::Free(worklist);
+}
+
+static void FreeCfg(Ir_Cfg *cfg)
+{
+    for (s64 i = 0; i < cfg->blocks.count; i++)
+    {
+        Ir_Block *block = cfg->blocks[i];
+        array::Free(block->preds);
+        array::Free(block->succs);
+        array::Free(block->dom_children);
+    }
+    for (s64 i = 0; i < cfg->loops.count; i++)
+    {
+        array::Free(cfg->loops[i]->blocks);
+        array::Free(cfg->loops[i]->latches);
+    }
+    array::Free(cfg->blocks);
+    array::Free(cfg->rpo);
+    array::Free(cfg->loops);
+    FreeMemoryArena(&cfg->arena);
+}
+
+Ir_Cfg* BuildCfg(Ir_Routine *routine)
+{
+    InvalidateCfg(routine);
+
+    Ir_Cfg *cfg = (Ir_Cfg*)Alloc(sizeof(Ir_Cfg)).ptr;
+    *cfg = { };
+    routine->cfg = cfg;
+    if (routine->instructions.count == 0)
+        return cfg;
+
+    CollectBlocks(cfg, routine);
+    ComputeRpo(cfg);
+    ComputeDominators(cfg);
+    ComputeLoops(cfg);
+    return cfg;
+}
+
+Ir_Cfg* GetCfg(Ir_Routine *routine)
+{
+    if (routine->cfg)
+        return routine->cfg;
+    return BuildCfg(routine);
+}
+
+void InvalidateCfg(Ir_Routine *routine)
+{
+    if (!routine->cfg) return;
+    FreeCfg(routine->cfg);
+    Pointer ptr = { };
+    ptr.ptr = routine->cfg;
+    ptr.size = sizeof(Ir_Cfg);
+    Free(ptr);
+    routine->cfg = nullptr;
+}
+
+void BuildCfgs(Ir_Gen_Context *ctx)
+{
+    for (s64 i = 0; i < ctx->routines.count; i++)
+    {
+        BuildCfg(ctx->routines[i]);
+    }
+}
+
+b32 Dominates(const Ir_Block *a, const Ir_Block *b)
+{
+    if (a->rpo_index == -1 || b->rpo_index == -1)
+        return false;
+    return a->dom_pre <= b->dom_pre && b->dom_post <= a->dom_post;
+}
+
+s64 GetLoopDepth(const Ir_Block *block)
+{
+    return block->loop ? block->loop->depth : 0;
+}
+
+
+// Rewriting
+
+void BeginRewrite(Ir_Rewrite *rw, Ir_Routine *routine)
+{
+    *rw = { };
+    rw->routine = routine;
+    s64 instr_count = routine->instructions.count;
+    rw->new_index = (s64*)Alloc((instr_count + 1) * sizeof(s64)).ptr;
+    for (s64 i = 0; i < instr_count; i++)
+        rw->new_index[i] = -1;
+    array::Reserve(rw->instructions, instr_count);
+}
+
+static s64 RemapLink(Ir_Rewrite *rw, s64 old_index)
+{
+    if (old_index == -1) return -1;
+    s64 index = rw->new_index[old_index];
+    ASSERT(index != -1);
+    return index;
+}
+
+Ir_Instruction* CopyInstruction(Ir_Rewrite *rw, s64 index)
+{
+    Ir_Instruction instr = rw->routine->instructions[index];
+    switch (instr.opcode)
+    {
+        case IR_Arg:
+            instr.oper1.imm_s64 = RemapLink(rw, instr.oper1.imm_s64);
+            break;
+        case IR_Call:
+        case IR_CallForeign:
+            instr.oper2.imm_s64 = RemapLink(rw, instr.oper2.imm_s64);
+            break;
+        default:
+            break;
+    }
+    rw->new_index[index] = rw->instructions.count;
+    array::Push(rw->instructions, instr);
+    return &rw->instructions[rw->instructions.count - 1];
+}
+
+Ir_Instruction* PushInstruction(Ir_Rewrite *rw, const Ir_Instruction &instr)
+{
+    ASSERT(instr.opcode != IR_Arg &&
+           instr.opcode != IR_Call &&
+           instr.opcode != IR_CallForeign);
+    array::Push(rw->instructions, instr);
+    return &rw->instructions[rw->instructions.count - 1];
+}
+
+Ir_Instruction* PushLinkedInstruction(Ir_Rewrite *rw, const Ir_Instruction &instr)
+{
+    array::Push(rw->instructions, instr);
+    return &rw->instructions[rw->instructions.count - 1];
+}
+
+void EndRewrite(Ir_Rewrite *rw)
+{
+    Ir_Routine *routine = rw->routine;
+    InvalidateCfg(routine);
+    for (s64 i = 0; i < rw->instructions.count; i++)
+    {
+        Ir_Instruction *instr = &rw->instructions[i];
+        if (instr->opcode == IR_Label)
+            instr->target.label->target_loc = i;
+    }
+    Pointer ptr = { };
+    ptr.ptr = rw->new_index;
+    ptr.size = (routine->instructions.count + 1) * sizeof(s64);
+    Free(ptr);
+
+    array::Free(routine->instructions);
+    routine->instructions = rw->instructions;
+    *rw = { };
+}
+
+
+// DOT output
+
+static void PrintDotName(FILE *file, Name name)
+{
+    for (s64 i = 0; i < name.str.size; i++)
+    {
+        char c = name.str.data[i];
+        if (c == '"' || c == '\\')
+            fputc('\\', file);
+        fputc(c, file);
+    }
+}
+
+static void PrintDotOperand(FILE *file, Ir_Cfg *cfg, Ir_Operand oper)
+{
+    switch (oper.oper_type)
+    {
+        case IR_OPER_None:
+            break;
+        case IR_OPER_Variable:
+        case IR_OPER_GlobalVariable:
+        case IR_OPER_Routine:
+        case IR_OPER_ForeignRoutine:
+            fprintf(file, " ");
+            PrintDotName(file, oper.var.name);
+            break;
+        case IR_OPER_Temp:
+            fprintf(file, " ");
+            PrintDotName(file, oper.temp.name);
+            break;
+        case IR_OPER_Immediate:
+            if (oper.type && (oper.type->tag == TYP_f32 || oper.type->tag == TYP_f64))
+                fprintf(file, " %g", (oper.type->tag == TYP_f32) ? oper.imm_f32 : oper.imm_f64);
+            else if (oper.type && oper.type->tag == TYP_string)
+                fprintf(file, " <string>");
+            else
+                fprintf(file, " %" PRId64, oper.imm_s64);
+            break;
+        case IR_OPER_Label:
+            fprintf(file, " B%" PRId64, cfg->instr_blocks[oper.label->target_loc]->index);
+            break;
+        case IR_OPER_Phi:
+            fprintf(file, " [");
+            for (s64 i = 0; i < oper.phi->args.count; i++)
+            {
+                Ir_Phi_Arg arg = oper.phi->args[i];
+                fprintf(file, "%sB%" PRId64 ":", (i > 0) ? ", " : "",
+                        cfg->instr_blocks[arg.pred->target_loc]->index);
+                PrintDotOperand(file, cfg, arg.value);
+            }
+            fprintf(file, " ]");
+            break;
+    }
+}
+
+static void PrintCfg(FILE *file, Ir_Routine *routine, s64 routine_index)
+{
+    Ir_Cfg *cfg = GetCfg(routine);
+
+    fprintf(file, "subgraph cluster_%" PRId64 " {\n", routine_index);
+    fprintf(file, "\tlabel=\"");
+    if (routine->name.str.size > 0)
+        PrintDotName(file, routine->name);
+    else
+        fprintf(file, "<top level>");
+    fprintf(file, "\";\n");
+
+    for (s64 b = 0; b < cfg->blocks.count; b++)
+    {
+        Ir_Block *block = cfg->blocks[b];
+        s64 depth = GetLoopDepth(block);
+        fprintf(file, "\tr%" PRId64 "_b%" PRId64 " [label=\"B%" PRId64,
+                routine_index, block->index, block->index);
+        if (block->loop && block->loop->header == block)
+            fprintf(file, " (loop header)");
+        if (depth > 0)
+            fprintf(file, " depth %" PRId64, depth);
+        if (block->rpo_index == -1)
+            fprintf(file, " (unreachable)");
+        fprintf(file, "\\l");
+        for (s64 i = block->start; i < block->end; i++)
+        {
+            Ir_Instruction *instr = &routine->instructions[i];
+            fprintf(file, "%" PRId64 ": %s", i, GetIrOpcodeName(instr->opcode));
+            PrintDotOperand(file, cfg, instr->target);
+            PrintDotOperand(file, cfg, instr->oper1);
+            PrintDotOperand(file, cfg, instr->oper2);
+            fprintf(file, "\\l");
+        }
+        fprintf(file, "\"");
+        if (depth > 0)
+            fprintf(file, ", penwidth=%" PRId64, depth + 1);
+        fprintf(file, "];\n");
+    }
+
+    for (s64 b = 0; b < cfg->blocks.count; b++)
+    {
+        Ir_Block *block = cfg->blocks[b];
+        for (s64 s = 0; s < block->succs.count; s++)
+        {
+            Ir_Block *succ = block->succs[s];
+            fprintf(file, "\tr%" PRId64 "_b%" PRId64 " -> r%" PRId64 "_b%" PRId64,
+                    routine_index, block->index, routine_index, succ->index);
+            if (Dominates(succ, block))
+                fprintf(file, " [style=bold, color=red]");
+            fprintf(file, ";\n");
+        }
+        if (block->idom)
+        {
+            fprintf(file, "\tr%" PRId64 "_b%" PRId64 " -> r%" PRId64 "_b%" PRId64
+                    " [style=dotted, constraint=false];\n",
+                    routine_index, block->idom->index, routine_index, block->index);
+        }
+    }
+    fprintf(file, "}\n");
+}
+
+void PrintCfgs(IoFile *file, Ir_Gen_Context *ctx)
+{
+    FILE *f = (FILE*)file;
+    fprintf(f, "digraph cfg {\n");
+    fprintf(f, "node [shape=box, fontname=\"monospace\"];\n");
+    for (s64 i = 0; i < ctx->routines.count; i++)
+    {
+        PrintCfg(f, ctx->routines[i], i);
+    }
+    fprintf(f, "}\n");
+}
+
+} // hplang
@@ -0,0 +1,101 @@
+#ifndef H_HPLANG_IR_CFG_H
+
+#include "memory.h"
+#include "ir_types.h"
+#include "io.h"
+
+namespace hplang
+{
+
+struct Ir_Gen_Context;
+struct Ir_Loop;
+
+struct Ir_Block
+{
+    s64 index;              // The index in Ir_Cfg::blocks
+    s64 start, end;         // The instructions [start, end) of the block
+
+    Array<Ir_Block*> preds;
+    Array<Ir_Block*> succs;
+
+    s64 rpo_index;          // -1, if the block is not reachable from the entry
+
+    // The immediate dominator; null for the entry and the unreachable blocks.
+    Ir_Block *idom;
+    Array<Ir_Block*> dom_children;
+    // The pre- and postorder numbers of the block in the dominator tree.
+    s64 dom_pre, dom_post;
+
+    Ir_Loop *loop;          // The innermost loop containing the block, or null
+};
+
+struct Ir_Loop
+{
+    s64 index;              // The index in Ir_Cfg::loops
+    Ir_Block *header;
+    Ir_Loop *parent;        // The enclosing loop, or null
+    s64 depth;              // 1 for the outermost loops
+
+    // The blocks of the loop, including the header and the blocks of the
+    // inner loops.
+    Array<Ir_Block*> blocks;
+    // The blocks with a back edge to the header.
+    Array<Ir_Block*> latches;
+};
+
+struct Ir_Cfg
+{
+    Memory_Arena arena;
+
+    // The blocks in instruction order; blocks[0] is the entry block.
+    Array<Ir_Block*> blocks;
+    // The reachable blocks in reverse postorder.
+    Array<Ir_Block*> rpo;
+    // The loops; an enclosing loop comes before the loops inside it.
+    Array<Ir_Loop*> loops;
+
+    // The block of each instruction.
+    Ir_Block **instr_blocks;
+};
+
+// Builds the control flow graph of the routine and caches it to routine->cfg.
+// A cached graph is rebuilt.
+Ir_Cfg* BuildCfg(Ir_Routine *routine);
+// Returns the cached control flow graph of the routine, building it if needed.
+Ir_Cfg* GetCfg(Ir_Routine *routine);
+// Frees the cached control flow graph. Must be called, when the instructions
+// of the routine are changed.
+void InvalidateCfg(Ir_Routine *routine);
+
+void BuildCfgs(Ir_Gen_Context *ctx);
+
+b32 Dominates(const Ir_Block *a, const Ir_Block *b);
+s64 GetLoopDepth(const Ir_Block *block);
+
+// Rewrites the instructions of a routine. The instructions are copied to a new
+// list one by one, and new instructions can be pushed in between. When the
+// rewrite ends, the links from the calls to their arguments are remapped, the
+// label targets are updated and the cached control flow graph is freed.
+// NOTE(henrik): The argument links always point backwards, so the pushed
+// instructions must not be IR_Arg or calls; PushLinkedInstruction pushes them
+// with the links already referring to the new instruction indices.
+struct Ir_Rewrite
+{
+    Ir_Routine *routine;
+    Ir_Instruction_List instructions;
+    s64 *new_index;         // The new indices of the copied instructions
+};
+
+void BeginRewrite(Ir_Rewrite *rw, Ir_Routine *routine);
+Ir_Instruction* CopyInstruction(Ir_Rewrite *rw, s64 index);
+Ir_Instruction* PushInstruction(Ir_Rewrite *rw, const Ir_Instruction &instr);
+Ir_Instruction* PushLinkedInstruction(Ir_Rewrite *rw, const Ir_Instruction &instr);
+void EndRewrite(Ir_Rewrite *rw);
+
+// Prints the control flow graphs of the routines in DOT format.
+void PrintCfgs(IoFile *file, Ir_Gen_Context *ctx);
+
+} // hplang
+
+#define H_HPLANG_IR_CFG_H
+#endif
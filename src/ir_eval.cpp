@@ -0,0 +1,246 @@
+
+#include "ir_eval.h"
+#include "symbols.h"
+#include "assert.h"
+
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+
+namespace hplang
+{
+
+u64 NormalizeIrValue(Type *type, u64 value)
+{
+    switch (type->tag)
+    {
+        case TYP_bool:
+        case TYP_char:
+        case TYP_u8:    return (u8)value;
+        case TYP_s8:    return (u64)(s64)(s8)value;
+        case TYP_u16:   return (u16)value;
+        case TYP_s16:   return (u64)(s64)(s16)value;
+        case TYP_u32:
+        case TYP_f32:   return (u32)value;
+        case TYP_s32:   return (u64)(s64)(s32)value;
+        default:
+            break;
+    }
+    return value;
+}
+
+f32 IrValueToF32(u64 value)
+{
+    u32 bits = (u32)value;
+    f32 result;
+    memcpy(&result, &bits, 4);
+    return result;
+}
+
+f64 IrValueToF64(u64 value)
+{
+    f64 result;
+    memcpy(&result, &value, 8);
+    return result;
+}
+
+u64 F32ToIrValue(f32 value)
+{
+    u32 bits;
+    memcpy(&bits, &value, 4);
+    return bits;
+}
+
+u64 F64ToIrValue(f64 value)
+{
+    u64 bits;
+    memcpy(&bits, &value, 8);
+    return bits;
+}
+
+// NOTE(henrik): The generated code converts with cvtss2si and cvtsd2si, which
+// round to nearest and give the "integer indefinite" value, when the result
+// does not fit to the target.
+static u64 ConvertToInt(f64 value, u32 size)
+{
+    f64 rounded = nearbyint(value);
+    if (size == 8)
+    {
+        if (!(rounded >= -9223372036854775808.0 && rounded < 9223372036854775808.0))
+            return 0x8000000000000000ull;
+        return (u64)(s64)rounded;
+    }
+    if (!(rounded >= -2147483648.0 && rounded <= 2147483647.0))
+        return (u64)(s64)INT32_MIN;
+    return (u64)(s64)(s32)rounded;
+}
+
+b32 EvalIrArithmetic(Ir_Opcode opcode, Type *type, u64 a, u64 b, u64 *result)
+{
+    if (type->tag == TYP_f32)
+    {
+        f32 x = IrValueToF32(a), y = IrValueToF32(b);
+        switch (opcode)
+        {
+            case IR_Add:    *result = F32ToIrValue(x + y); break;
+            case IR_Sub:    *result = F32ToIrValue(x - y); break;
+            case IR_Mul:    *result = F32ToIrValue(x * y); break;
+            case IR_Div:    *result = F32ToIrValue(x / y); break;
+            case IR_Neg:    *result = F32ToIrValue(0.0f - x); break;
+            case IR_Sqrt:   *result = F32ToIrValue(sqrtf(x)); break;
+            default:        INVALID_CODE_PATH;
+        }
+        return true;
+    }
+    if (type->tag == TYP_f64)
+    {
+        f64 x = IrValueToF64(a), y = IrValueToF64(b);
+        switch (opcode)
+        {
+            case IR_Add:    *result = F64ToIrValue(x + y); break;
+            case IR_Sub:    *result = F64ToIrValue(x - y); break;
+            case IR_Mul:    *result = F64ToIrValue(x * y); break;
+            case IR_Div:    *result = F64ToIrValue(x / y); break;
+            case IR_Neg:    *result = F64ToIrValue(0.0 - x); break;
+            case IR_Sqrt:   *result = F64ToIrValue(sqrt(x)); break;
+            default:        INVALID_CODE_PATH;
+        }
+        return true;
+    }
+
+    b32 is_signed = TypeIsSigned(type);
+    u64 size = GetSize(type);
+    u64 shift_mask = (size == 8) ? 63 : 31;
+    u64 value = 0;
+    switch (opcode)
+    {
+        case IR_Add:    value = a + b; break;
+        case IR_Sub:    value = a - b; break;
+        case IR_Mul:    value = a * b; break;
+        case IR_Div:
+        case IR_Mod:
+            if (b == 0)
+                return false;
+            if (is_signed)
+            {
+                s64 min_value = (s64)NormalizeIrValue(type, 1ull << (size * 8 - 1));
+                if ((s64)a == min_value && (s64)b == -1)
+                    return false;
+                if (opcode == IR_Div)
+                    value = (u64)((s64)a / (s64)b);
+                else
+                    value = (u64)((s64)a % (s64)b);
+            }
+            else
+            {
+                value = (opcode == IR_Div) ? a / b : a % b;
+            }
+            break;
+        case IR_LShift: value = a << (b & shift_mask); break;
+        case IR_RShift:
+            if (is_signed)
+                value = (u64)((s64)a >> (b & shift_mask));
+            else
+                value = a >> (b & shift_mask);
+            break;
+        case IR_And:    value = a & b; break;
+        case IR_Or:     value = a | b; break;
+        case IR_Xor:    value = a ^ b; break;
+        case IR_Neg:    value = 0 - a; break;
+        case IR_Not:    value = ~a & 1; break;
+        case IR_Compl:  value = ~a; break;
+        default:
+            INVALID_CODE_PATH;
+    }
+    *result = NormalizeIrValue(type, value);
+    return true;
+}
+
+b32 EvalIrCompare(Ir_Opcode opcode, Type *type, u64 a, u64 b)
+{
+    if (TypeIsFloat(type))
+    {
+        f64 x = (type->tag == TYP_f32) ? IrValueToF32(a) : IrValueToF64(a);
+        f64 y = (type->tag == TYP_f32) ? IrValueToF32(b) : IrValueToF64(b);
+        switch (opcode)
+        {
+            case IR_Eq:     return x == y;
+            case IR_Neq:    return x != y;
+            case IR_Lt:     return x < y;
+            case IR_Leq:    return x <= y;
+            case IR_Gt:     return x > y;
+            case IR_Geq:    return x >= y;
+            default:        INVALID_CODE_PATH;
+        }
+    }
+    if (TypeIsSigned(type))
+    {
+        s64 x = (s64)a, y = (s64)b;
+        switch (opcode)
+        {
+            case IR_Lt:     return x < y;
+            case IR_Leq:    return x <= y;
+            case IR_Gt:     return x > y;
+            case IR_Geq:    return x >= y;
+            default:        break;
+        }
+    }
+    switch (opcode)
+    {
+        case IR_Eq:     return a == b;
+        case IR_Neq:    return a != b;
+        case IR_Lt:     return a < b;
+        case IR_Leq:    return a <= b;
+        case IR_Gt:     return a > b;
+        case IR_Geq:    return a >= b;
+        default:        INVALID_CODE_PATH;
+    }
+    return false;
+}
+
+u64 EvalIrConversion(Ir_Opcode opcode, Type *target_type, Type *oper_type, u64 value)
+{
+    switch (opcode)
+    {
+        case IR_MovSX:
+            switch (GetSize(oper_type))
+            {
+                case 1: value = (u64)(s64)(s8)value; break;
+                case 2: value = (u64)(s64)(s16)value; break;
+                case 4: value = (u64)(s64)(s32)value; break;
+                default: break;
+            }
+            return value;
+        case IR_MovZX:
+            switch (GetSize(oper_type))
+            {
+                case 1: value = (u8)value; break;
+                case 2: value = (u16)value; break;
+                case 4: value = (u32)value; break;
+                default: break;
+            }
+            return value;
+        case IR_S_TO_F32:
+        case IR_S_TO_F64:
+            {
+                s64 x = (GetSize(oper_type) == 8) ? (s64)value : (s64)(s32)value;
+                return (opcode == IR_S_TO_F32) ? F32ToIrValue((f32)x) : F64ToIrValue((f64)x);
+            }
+        case IR_F32_TO_S:
+        case IR_F64_TO_S:
+            {
+                f64 x = (opcode == IR_F32_TO_S) ? IrValueToF32(value) : IrValueToF64(value);
+                u32 size = (GetSize(target_type) == 8) ? 8 : 4;
+                return ConvertToInt(x, size);
+            }
+        case IR_F32_TO_F64:
+            return F64ToIrValue((f64)IrValueToF32(value));
+        case IR_F64_TO_F32:
+            return F32ToIrValue((f32)IrValueToF64(value));
+        default:
+            INVALID_CODE_PATH;
+    }
+    return 0;
+}
+
+} // hplang
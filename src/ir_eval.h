@@ -0,0 +1,36 @@
+#ifndef H_HPLANG_IR_EVAL_H
+
+#include "ir_types.h"
+
+namespace hplang
+{
+
+// The ir operations on values, that are held like the registers of the
+// generated code hold them: the integers are sign or zero extended to 64 bits
+// by their type, and the floats are the bits of the f32 or f64 in the low
+// bits. Used by the interpreter and the constant folding.
+
+u64 NormalizeIrValue(Type *type, u64 value);
+
+f32 IrValueToF32(u64 value);
+f64 IrValueToF64(u64 value);
+u64 F32ToIrValue(f32 value);
+u64 F64ToIrValue(f64 value);
+
+// Evaluates the arithmetic, bitwise and unary operations, including the
+// square root, on the values of the type. Returns false, if the operation
+// traps in the generated code, i.e. for the integer division by zero and the
+// division of the smallest signed value by -1.
+b32 EvalIrArithmetic(Ir_Opcode opcode, Type *type, u64 a, u64 b, u64 *result);
+
+// Evaluates the comparison of the values of the type.
+b32 EvalIrCompare(Ir_Opcode opcode, Type *type, u64 a, u64 b);
+
+// Evaluates the extensions (IR_MovSX, IR_MovZX) and the conversions between
+// the integers and the floats from the value of oper_type to target_type.
+u64 EvalIrConversion(Ir_Opcode opcode, Type *target_type, Type *oper_type, u64 value);
+
+} // hplang
+
+#define H_HPLANG_IR_EVAL_H
+#endif
@@ -1,5 +1,6 @@
 
 #include "ir_gen.h"
+#include "ir_cfg.h"
 #include "common.h"
 #include "compiler.h"
 #include "symbols.h"
@@ -54,6 +55,8 @@ b32 operator == (Ir_Operand oper1, Ir_Operand oper2)
                 case TYP_string:
                     return oper1.imm_str == oper2.imm_str;
 
+                case TYP_f32x4: case TYP_f64x2: case TYP_s32x4: case TYP_s64x2:
+                case TYP_f32x8: case TYP_f64x4: case TYP_s32x8: case TYP_s64x4:
                 case TYP_Struct:
                 case TYP_Function:
                     INVALID_CODE_PATH;
@@ -62,6 +65,8 @@ b32 operator == (Ir_Operand oper1, Ir_Operand oper2)
             return false;
         case IR_OPER_Label:
             return oper1.label->target_loc == oper2.label->target_loc;
+        case IR_OPER_Phi:
+            return oper1.phi == oper2.phi;
     }
     INVALID_CODE_PATH;
     return false;
@@ -87,8 +92,15 @@ Ir_Gen_Context NewIrGenContext(Compiler_Context *comp_ctx)
     return result;
 }
 
-static void FreeRoutine(Ir_Routine *routine)
+void FreeRoutine(Ir_Routine *routine)
 {
+    InvalidateCfg(routine);
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode == IR_Phi)
+            array::Free(instr->oper1.phi->args);
+    }
     array::Free(routine->instructions);
 }
 
@@ -99,8 +111,16 @@ void FreeIrGenContext(Ir_Gen_Context *ctx)
         FreeRoutine(array::At(ctx->routines, i));
     }
     array::Free(ctx->routines);
+    for (s64 i = 0; i < ctx->exec_routines.count; i++)
+    {
+        FreeRoutine(array::At(ctx->exec_routines, i));
+    }
+    array::Free(ctx->exec_routines);
+    array::Free(ctx->exec_locations);
     array::Free(ctx->foreign_routines);
     array::Free(ctx->global_vars);
+    array::Free(ctx->global_decl_ends);
+    array::Free(ctx->global_data);
 
     array::Free(ctx->breakables);
     array::Free(ctx->continuables);
@@ -108,7 +128,7 @@ void FreeIrGenContext(Ir_Gen_Context *ctx)
     FreeMemoryArena(&ctx->arena);
 }
 
-static Ir_Routine* PushRoutine(Ir_Gen_Context *ctx, Name name, s64 arg_count)
+static Ir_Routine* NewRoutine(Ir_Gen_Context *ctx, Name name, s64 arg_count)
 {
     Ir_Routine *routine = PushStruct<Ir_Routine>(&ctx->arena);
     *routine = { };
@@ -119,6 +139,12 @@ static Ir_Routine* PushRoutine(Ir_Gen_Context *ctx, Name name, s64 arg_count)
         routine->arg_count = arg_count;
         routine->args = PushArray<Ir_Operand>(&ctx->arena, arg_count);
     }
+    return routine;
+}
+
+static Ir_Routine* PushRoutine(Ir_Gen_Context *ctx, Name name, s64 arg_count)
+{
+    Ir_Routine *routine = NewRoutine(ctx, name, arg_count);
     array::Push(ctx->routines, routine);
     return routine;
 }
@@ -266,6 +292,23 @@ static Ir_Operand NewLabel(Ir_Gen_Context *ctx)
     return oper;
 }
 
+Ir_Operand NewIrTemp(Ir_Gen_Context *ctx, Ir_Routine *routine, Type *type)
+{
+    return NewTemp(ctx, routine, type);
+}
+
+Ir_Operand NewIrLabel(Ir_Gen_Context *ctx, Ir_Routine *routine)
+{
+    const s64 buf_size = 40;
+    char buf[buf_size];
+    s64 name_len = snprintf(buf, buf_size, ".LB%" PRId64, routine->label_count++);
+
+    Ir_Operand label_oper = NewLabel(ctx);
+    label_oper.label->target_loc = -1;
+    label_oper.label->name = PushName(&ctx->arena, buf, name_len);
+    return label_oper;
+}
+
 static void ExtractComment(Ir_Gen_Context *ctx, File_Location file_loc)
 {
     Ir_Comment comment = { };
@@ -355,6 +398,20 @@ static Ir_Operand GenTypecastExpr(Ir_Gen_Context *ctx, Ast_Expr *expr, Ir_Routin
     Ir_Operand res = NewTemp(ctx, routine, expr->expr_type);
     Type *oper_type = oper_res.type;
     Type *res_type = res.type;
+    if (TypeIsVector(res_type))
+    {
+        // NOTE(henrik): The semantic check has cast a scalar to the element
+        // type of the vector already.
+        if (!TypeIsVector(oper_type))
+            PushInstruction(ctx, routine, IR_Broadcast, res, oper_res);
+        else if (res_type->tag == TYP_f32x4 && oper_type->tag == TYP_s32x4)
+            PushInstruction(ctx, routine, IR_S_TO_F32, res, oper_res);
+        else if (res_type->tag == TYP_s32x4 && oper_type->tag == TYP_f32x4)
+            PushInstruction(ctx, routine, IR_F32_TO_S, res, oper_res);
+        else
+            PushInstruction(ctx, routine, IR_Mov, res, oper_res);
+        return res;
+    }
     switch (oper_type->tag)
     {
         case TYP_none:
@@ -365,6 +422,10 @@ static Ir_Operand GenTypecastExpr(Ir_Gen_Context *ctx, Ast_Expr *expr, Ir_Routin
         case TYP_string:
             INVALID_CODE_PATH;
             break;
+        case TYP_f32x4: case TYP_f64x2: case TYP_s32x4: case TYP_s64x2:
+        case TYP_f32x8: case TYP_f64x4: case TYP_s32x8: case TYP_s64x4:
+            INVALID_CODE_PATH;
+            break;
         case TYP_Struct:
             INVALID_CODE_PATH;
             break;
@@ -1147,8 +1208,44 @@ static Ir_Operand GenRefVariableRef(Ir_Gen_Context *ctx, Ast_Expr *expr, Ir_Rout
     return GenVariableRef_(ctx, expr, routine, GetPointerType(ctx->env, expr->expr_type));
 }
 
+static b32 IsShuffleCall(Ast_Expr *expr)
+{
+    Ast_Expr *fexpr = expr->function_call.fexpr;
+    if (fexpr->type != AST_VariableRef) return false;
+    Symbol *symbol = fexpr->variable_ref.symbol;
+    return SymbolIsIntrinsic(symbol) && symbol->name == MakeConstName("shuffle");
+}
+
+// Generates the shuffle intrinsic as a single instruction, as the indices are
+// literals. The immediate selects the dwords of the pshufd, two per element
+// for the 64 bit elements.
+static Ir_Operand GenShuffle(Ir_Gen_Context *ctx, Ast_Expr *expr, Ir_Routine *routine)
+{
+    Ir_Operand res = NewTemp(ctx, routine, expr->expr_type);
+    Ir_Operand oper = GenExpression(ctx, expr->function_call.args[0], routine);
+
+    s64 index_count = expr->function_call.args.count - 1;
+    u64 order = 0;
+    for (s64 i = 0; i < index_count; i++)
+    {
+        Ast_Expr *arg = expr->function_call.args[i + 1];
+        ASSERT(arg->type == AST_IntLiteral);
+        u64 index = arg->int_literal.value;
+        if (index_count == 2)
+            order |= ((2 * index) | ((2 * index + 1) << 2)) << (4 * i);
+        else
+            order |= index << (2 * i);
+    }
+    PushInstruction(ctx, routine, IR_Shuffle, res, oper,
+            NewImmediateOffset(ctx->env, routine, order));
+    return res;
+}
+
 static Ir_Operand GenFunctionCall(Ir_Gen_Context *ctx, Ast_Expr *expr, Ir_Routine *routine)
 {
+    if (IsShuffleCall(expr))
+        return GenShuffle(ctx, expr, routine);
+
     // Clear routine leaf flag
     routine->flags &= ~ROUT_Leaf;
 
@@ -1397,6 +1494,10 @@ static void GenFunctionDef(Ir_Gen_Context *ctx, Ast_Node *node)
     Symbol *symbol = node->function_def.symbol;
     s64 arg_count = symbol->type->function_type.parameter_count;
     Ir_Routine *func_routine = PushRoutine(ctx, symbol->unique_name, arg_count);
+    if (node->function_def.inline_hint == INL_Inline)
+        func_routine->flags |= ROUT_Inline;
+    else if (node->function_def.inline_hint == INL_NoInline)
+        func_routine->flags |= ROUT_NoInline;
     for (s64 i = 0; i < arg_count; i++)
     {
         Ast_Node *param_node = array::At(node->function_def.parameters, i);
@@ -1441,6 +1542,17 @@ static void GenVariableDecl(Ir_Gen_Context *ctx, Ast_Node *node, Ir_Routine *rou
 
         names = names->next;
     }
+    if (toplevel)
+        array::Push(ctx->global_decl_ends, routine->instructions.count);
+}
+
+static void GenExecDirective(Ir_Gen_Context *ctx, Ast_Node *node)
+{
+    Ir_Routine *routine = NewRoutine(ctx, MakeConstName("#exec"), 0);
+    ExtractComment(ctx, node->file_loc);
+    GenExpression(ctx, node->exec_directive.expr, routine);
+    array::Push(ctx->exec_routines, routine);
+    array::Push(ctx->exec_locations, node->file_loc);
 }
 
 static void GenForeignBlock(Ir_Gen_Context *ctx, Ast_Node *node)
@@ -1477,6 +1589,10 @@ static void GenIr(Ir_Gen_Context *ctx, Ast_Node *node, Ir_Routine *routine, bool
         case AST_StructDef: break;
         case AST_Typealias: break;
 
+        case AST_ExecDirective:
+            GenExecDirective(ctx, node);
+            break;
+
         case AST_Parameter:
             INVALID_CODE_PATH;
             break;
@@ -1542,28 +1658,34 @@ static void GenIrAst(Ir_Gen_Context *ctx, Ast *ast, Ir_Routine *routine)
     }
 }
 
-static void GenSqrtFunction(Ir_Gen_Context *ctx, Ir_Routine *top_level_routine)
+// Generates a routine for every overload of the intrinsic, that computes the
+// result with the single instruction ir_opcode. The calls to the routines are
+// replaced by the instruction, when they are inlined.
+static void GenIntrinsicFunction(Ir_Gen_Context *ctx, Name name, Ir_Opcode ir_opcode)
 {
-    (void)top_level_routine;
     Environment *env = &ctx->comp_ctx->env;
 
-    Name sqrt_name = MakeConstName("sqrt");
     Name x_name = MakeConstName("x");
-    Symbol *symbol = LookupSymbol(env, sqrt_name);
-    Type *ftype = symbol->type;
-
-    s64 arg_count = ftype->function_type.parameter_count;
-    ASSERT(arg_count == 1);
-    Ir_Routine *routine = PushRoutine(ctx, symbol->unique_name, arg_count);
-    for (s64 i = 0; i < arg_count; i++)
+    Symbol *symbol = LookupSymbol(env, name);
+    for (; symbol; symbol = symbol->next_overload)
     {
-        Type *type = ftype->function_type.parameter_types[i];
-        Name name = x_name;
-        routine->args[i] = NewVariableRef(routine, type, name);
+        Type *ftype = symbol->type;
+
+        s64 arg_count = ftype->function_type.parameter_count;
+        ASSERT(arg_count == 1);
+        Ir_Routine *routine = PushRoutine(ctx, symbol->unique_name, arg_count);
+        for (s64 i = 0; i < arg_count; i++)
+        {
+            Type *type = ftype->function_type.parameter_types[i];
+            routine->args[i] = NewVariableRef(routine, type, x_name);
+        }
+        Ir_Operand arg = routine->args[0];
+        Ir_Operand res = arg;
+        if (!TypesEqual(arg.type, ftype->function_type.return_type))
+            res = NewTemp(ctx, routine, ftype->function_type.return_type);
+        PushInstruction(ctx, routine, ir_opcode, res, arg);
+        PushInstruction(ctx, routine, IR_Return, res);
     }
-    Ir_Operand arg = routine->args[0];
-    PushInstruction(ctx, routine, IR_Sqrt, arg, arg);
-    PushInstruction(ctx, routine, IR_Return, arg);
 }
 
 b32 GenIr(Ir_Gen_Context *ctx)
@@ -1578,7 +1700,8 @@ b32 GenIr(Ir_Gen_Context *ctx)
         GenIrAst(ctx, &module->ast, top_level_routine);
     }
 
-    GenSqrtFunction(ctx, top_level_routine);
+    GenIntrinsicFunction(ctx, MakeConstName("sqrt"), IR_Sqrt);
+    GenIntrinsicFunction(ctx, MakeConstName("movemask"), IR_MoveMask);
 
     // TODO(henrik): Move collecting foreign functions to some better place.
     // For example, add list of foreign functions (as well as types, etc.) to
@@ -1639,10 +1762,15 @@ static void PrintPadding(FILE *file, s64 len, s64 min_len)
     }
 }
 
-static void PrintOpcode(FILE *file, Ir_Opcode opcode)
+const char* GetIrOpcodeName(Ir_Opcode opcode)
 {
     ASSERT((s64)opcode < IR_COUNT);
-    s64 len = fprintf(file, "%s", ir_opcode_names[opcode]);
+    return ir_opcode_names[opcode];
+}
+
+static void PrintOpcode(FILE *file, Ir_Opcode opcode)
+{
+    s64 len = fprintf(file, "%s", GetIrOpcodeName(opcode));
     PrintPadding(file, len, 16);
 }
 
@@ -1695,6 +1823,8 @@ static s64 PrintImmediate(FILE *file, Ir_Operand oper)
             len += fprintf(file, "\"");
             break;
 
+        case TYP_f32x4: case TYP_f64x2: case TYP_s32x4: case TYP_s64x2:
+        case TYP_f32x8: case TYP_f64x4: case TYP_s32x8: case TYP_s64x4:
         case TYP_Struct:
         case TYP_Function:
             INVALID_CODE_PATH;
@@ -1708,6 +1838,36 @@ static s64 PrintLabel(FILE *file, Ir_Operand label_oper)
     return fprintf(file, "L:%" PRId64, label_oper.label->target_loc);
 }
 
+static s64 PrintOperandName(FILE *file, Ir_Operand oper, s64 max_len)
+{
+    switch (oper.oper_type)
+    {
+        case IR_OPER_Variable:
+        case IR_OPER_GlobalVariable:
+            return PrintName(file, oper.var.name, max_len);
+        case IR_OPER_Temp:
+            return PrintName(file, oper.temp.name, max_len);
+        case IR_OPER_Immediate:
+            return PrintImmediate(file, oper);
+        default:
+            return fprintf(file, "_");
+    }
+}
+
+static s64 PrintPhi(FILE *file, Ir_Phi *phi)
+{
+    s64 len = fprintf(file, "[");
+    for (s64 i = 0; i < phi->args.count; i++)
+    {
+        Ir_Phi_Arg arg = phi->args[i];
+        if (i > 0) len += fprintf(file, ", ");
+        len += fprintf(file, "L:%" PRId64 " ", arg.pred->target_loc);
+        len += PrintOperandName(file, arg.value, 17);
+    }
+    len += fprintf(file, "]");
+    return len;
+}
+
 static void PrintOperand(FILE *file, Ir_Operand oper)
 {
     s64 len = 0;
@@ -1735,6 +1895,9 @@ static void PrintOperand(FILE *file, Ir_Operand oper)
             len += PrintName(file, oper.var.name, 15);
             len += fprintf(file, ">");
             break;
+        case IR_OPER_Phi:
+            PrintPhi(file, oper.phi);
+            return;
     }
     if (oper.type)
     {
@@ -1783,6 +1946,10 @@ void PrintIr(IoFile *file, Ir_Gen_Context *ctx)
     {
         PrintRoutine((FILE*)file, array::At(ctx->routines, i));
     }
+    for (s64 i = 0; i < ctx->exec_routines.count; i++)
+    {
+        PrintRoutine((FILE*)file, array::At(ctx->exec_routines, i));
+    }
 }
 
 } // hplang
@@ -10,6 +10,23 @@ namespace hplang
 struct Compiler_Context;
 struct Environment;
 
+// The counts of the changes made by the ir optimizations; printed with
+// the instruction count profiling.
+struct Ir_Opt_Counts
+{
+    s64 folded_instrs;      // The instructions computing a constant
+    s64 folded_branches;    // The conditional jumps with a constant condition
+    s64 unreachable_instrs; // The instructions of the unreachable blocks
+    s64 redundant_instrs;   // The instructions recomputing an earlier value
+    s64 hoisted_instrs;     // The instructions moved out of loops
+    s64 reduced_instrs;     // The element accesses made through a pointer
+    s64 inlined_calls;      // The calls replaced by the body of the callee
+    s64 tail_calls;         // The recursive tail calls replaced by jumps
+    s64 vectorized_loops;   // The loops given a vector loop
+    s64 removed_routines;   // The routines and foreign routines never called
+    s64 removed_globals;    // The global variables never used
+};
+
 struct Ir_Gen_Context
 {
     Memory_Arena arena;
@@ -22,6 +39,22 @@ struct Ir_Gen_Context
     Array<Symbol*> global_vars;
     Ir_Comment comment;
 
+    // Instruction indices in the top level routine, where the initialization
+    // of a global variable declaration ends.
+    Array<s64> global_decl_ends;
+
+    // The initial values of the global variables, parallel to global_vars.
+    // Set by the compile time execution; null if the variable is zero
+    // initialized and set at run time.
+    Array<u8*> global_data;
+
+    // The #exec directives are run only at compile time, so they are not
+    // part of the routines.
+    Ir_Routine_List exec_routines;
+    Array<File_Location> exec_locations;
+
+    Ir_Opt_Counts opt_counts;
+
     Environment *env;
     Compiler_Context *comp_ctx;
 };
@@ -31,6 +64,14 @@ void FreeIrGenContext(Ir_Gen_Context *ctx);
 
 b32 GenIr(Ir_Gen_Context *ctx);
 
+// New temporaries and labels for the passes, that transform the ir.
+Ir_Operand NewIrTemp(Ir_Gen_Context *ctx, Ir_Routine *routine, Type *type);
+Ir_Operand NewIrLabel(Ir_Gen_Context *ctx, Ir_Routine *routine);
+
+// Frees the instructions of a routine, that the passes remove.
+void FreeRoutine(Ir_Routine *routine);
+
+const char* GetIrOpcodeName(Ir_Opcode opcode);
 void PrintIr(IoFile *file, Ir_Gen_Context *ctx);
 
 } // hplang
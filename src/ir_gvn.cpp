@@ -0,0 +1,640 @@
+
+#include "ir_gvn.h"
+#include "ir_ssa.h"
+#include "ir_cfg.h"
+#include "ir_gen.h"
+#include "symbols.h"
+#include "hashtable.h"
+#include "common.h"
+#include "assert.h"
+
+#include <cstdint>
+
+// The dominator based value numbering by Briggs, Cooper and Simpson [1]. The
+// available expressions are kept in a hash table, that is scoped by the
+// dominator tree: the expressions of a block are removed from the table,
+// when the walk leaves the subtree of the block.
+//
+// The instructions reading memory are numbered with a memory generation,
+// which changes at every store and call. A block continues the generation of
+// its immediate dominator only if the dominator is its only predecessor;
+// otherwise a path through the other predecessors might have stored to the
+// memory.
+//
+// [1]  Preston Briggs, Keith D. Cooper and L. Taylor Simpson, 1997.
+//      Value Numbering.
+
+namespace hplang
+{
+
+struct Gvn_Name
+{
+    Name name;
+    s64 def_count;
+    b32 is_arg;
+    b32 addr_taken;
+
+    b32 replaced;
+    Ir_Operand replacement;
+};
+
+struct Gvn_Expr
+{
+    Ir_Opcode opcode;
+    Type *type;
+    Ir_Operand oper1, oper2;
+    s64 mem_gen;            // The memory generation, or 0 for the pure values
+    u32 hash;
+
+    Ir_Operand value;       // The operand holding the value of the expression
+    Gvn_Expr *next;         // The next expression in the same bucket
+};
+
+struct Gvn_Frame
+{
+    Ir_Block *block;
+    s64 scope_mark;
+    s64 next_child;
+    s64 mem_gen;            // The memory generation at the end of the block
+};
+
+struct Gvn
+{
+    Memory_Arena arena;
+    Ir_Gen_Context *ctx;
+    Ir_Routine *routine;
+    Ir_Cfg *cfg;
+
+    Array<Gvn_Name*> name_table;
+    Array<Gvn_Name*> names;
+
+    Array<Gvn_Expr*> buckets;
+    u32 bucket_mask;
+    Array<Gvn_Expr*> scope;     // The expressions in the order of insertion
+
+    s64 mem_gen;
+    s64 mem_gen_count;
+
+    b32 *removed;
+};
+
+static Gvn_Name* LookupName(Gvn *g, const Ir_Operand &oper)
+{
+    if (!IsIrLocal(oper)) return nullptr;
+    return hashtable::Lookup(g->name_table, GetIrLocalName(oper));
+}
+
+static Gvn_Name* AddName(Gvn *g, const Ir_Operand &oper)
+{
+    Gvn_Name *name = LookupName(g, oper);
+    if (name) return name;
+    name = PushStruct<Gvn_Name>(&g->arena);
+    *name = { };
+    name->name = GetIrLocalName(oper);
+    hashtable::Put(g->name_table, name->name, name);
+    array::Push(g->names, name);
+    return name;
+}
+
+static void CollectNames(Gvn *g)
+{
+    Ir_Routine *routine = g->routine;
+    s64 instr_count = routine->instructions.count;
+    array::Resize(g->name_table, 2 * instr_count + routine->arg_count + 31);
+
+    for (s64 i = 0; i < routine->arg_count; i++)
+    {
+        if (IsIrLocal(routine->args[i]))
+            AddName(g, routine->args[i])->is_arg = true;
+    }
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode == IR_Phi || IsIrDefinition(instr))
+        {
+            if (IsIrLocal(instr->target))
+                AddName(g, instr->target)->def_count++;
+        }
+        if (instr->opcode == IR_Addr && IsIrLocal(instr->oper1))
+            AddName(g, instr->oper1)->addr_taken = true;
+    }
+}
+
+// Returns true, if the operand is an SSA name, i.e. a variable or a
+// temporary, that is defined once and lives outside of memory.
+static b32 IsSsaValue(Gvn *g, const Ir_Operand &oper)
+{
+    Gvn_Name *name = LookupName(g, oper);
+    if (!name || name->addr_taken || TypeIsStruct(oper.type))
+        return false;
+    return name->def_count == 1 || (name->def_count == 0 && name->is_arg);
+}
+
+static Ir_Operand GetValue(Gvn *g, const Ir_Operand &oper)
+{
+    Gvn_Name *name = LookupName(g, oper);
+    Ir_Operand result = oper;
+    while (name && name->replaced)
+    {
+        result = name->replacement;
+        name = LookupName(g, result);
+    }
+    return result;
+}
+
+static void ReplaceName(Gvn *g, const Ir_Operand &oper, const Ir_Operand &value)
+{
+    Gvn_Name *name = LookupName(g, oper);
+    ASSERT(name && !name->replaced);
+    name->replaced = true;
+    name->replacement = value;
+}
+
+
+// Expressions
+
+static b32 GetImmediateBits(const Ir_Operand &oper, u64 *bits)
+{
+    switch (oper.type->tag)
+    {
+        case TYP_null:
+        case TYP_pointer:
+            *bits = (u64)(uintptr_t)oper.imm_ptr;
+            return true;
+        case TYP_bool: case TYP_char:
+        case TYP_u8: case TYP_s8:
+        case TYP_u16: case TYP_s16:
+        case TYP_u32: case TYP_s32:
+        case TYP_u64: case TYP_s64:
+        case TYP_f32: case TYP_f64:
+            switch (GetSize(oper.type))
+            {
+                case 1: *bits = oper.imm_u8; break;
+                case 2: *bits = oper.imm_u16; break;
+                case 4: *bits = oper.imm_u32; break;
+                default: *bits = oper.imm_u64; break;
+            }
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+// NOTE(henrik): The immediates are compared by their bits, so that e.g. 0.0
+// and -0.0 are different values.
+static b32 SameOperand(const Ir_Operand &a, const Ir_Operand &b)
+{
+    if (a.oper_type != b.oper_type) return false;
+    switch (a.oper_type)
+    {
+        case IR_OPER_None:
+            return true;
+        case IR_OPER_Immediate:
+            {
+                u64 a_bits, b_bits;
+                return a.type == b.type &&
+                    GetImmediateBits(a, &a_bits) && GetImmediateBits(b, &b_bits) &&
+                    a_bits == b_bits;
+            }
+        default:
+            return a == b;
+    }
+}
+
+static b32 IsNumberable(const Ir_Operand &oper)
+{
+    u64 bits;
+    switch (oper.oper_type)
+    {
+        case IR_OPER_None:
+        case IR_OPER_Variable:
+        case IR_OPER_GlobalVariable:
+        case IR_OPER_Temp:
+        case IR_OPER_Routine:
+        case IR_OPER_ForeignRoutine:
+            return true;
+        case IR_OPER_Immediate:
+            return GetImmediateBits(oper, &bits);
+        default:
+            break;
+    }
+    return false;
+}
+
+static u32 HashOperand(const Ir_Operand &oper)
+{
+    switch (oper.oper_type)
+    {
+        case IR_OPER_None:
+            return 0;
+        case IR_OPER_Immediate:
+            {
+                u64 bits = 0;
+                GetImmediateBits(oper, &bits);
+                bits *= 0x9e3779b97f4a7c15ull;
+                return (u32)(bits >> 32) ^ (u32)bits;
+            }
+        case IR_OPER_Temp:
+            return oper.temp.name.hash;
+        default:
+            return oper.var.name.hash;
+    }
+}
+
+static u32 HashExpr(const Gvn_Expr &expr)
+{
+    u32 hash = (u32)expr.opcode * 31u;
+    hash = (hash ^ (u32)(uintptr_t)expr.type) * 16777619u;
+    hash = (hash ^ HashOperand(expr.oper1)) * 16777619u;
+    hash = (hash ^ HashOperand(expr.oper2)) * 16777619u;
+    hash = (hash ^ (u32)expr.mem_gen) * 16777619u;
+    return hash;
+}
+
+static b32 SameExpr(const Gvn_Expr &a, const Gvn_Expr &b)
+{
+    return a.hash == b.hash &&
+        a.opcode == b.opcode && a.type == b.type && a.mem_gen == b.mem_gen &&
+        SameOperand(a.oper1, b.oper1) && SameOperand(a.oper2, b.oper2);
+}
+
+static Gvn_Expr* FindExpr(Gvn *g, const Gvn_Expr &expr)
+{
+    Gvn_Expr *e = g->buckets[expr.hash & g->bucket_mask];
+    for (; e; e = e->next)
+    {
+        if (SameExpr(*e, expr))
+            return e;
+    }
+    return nullptr;
+}
+
+static void AddExpr(Gvn *g, const Gvn_Expr &expr)
+{
+    Gvn_Expr *e = PushStruct<Gvn_Expr>(&g->arena);
+    *e = expr;
+    Gvn_Expr *&bucket = g->buckets.data[expr.hash & g->bucket_mask];
+    e->next = bucket;
+    bucket = e;
+    array::Push(g->scope, e);
+}
+
+static void PopScope(Gvn *g, s64 scope_mark)
+{
+    while (g->scope.count > scope_mark)
+    {
+        Gvn_Expr *e = array::Back(g->scope);
+        g->scope.count--;
+        Gvn_Expr *&bucket = g->buckets.data[e->hash & g->bucket_mask];
+        ASSERT(bucket == e);
+        bucket = e->next;
+    }
+}
+
+static b32 IsCommutative(Ir_Opcode opcode)
+{
+    switch (opcode)
+    {
+        case IR_Add: case IR_Mul:
+        case IR_And: case IR_Or: case IR_Xor:
+        case IR_Eq: case IR_Neq:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+// Returns true for the instructions, that compute their result from the
+// operands only. The loads read also the memory.
+static b32 IsPureOp(Ir_Opcode opcode)
+{
+    switch (opcode)
+    {
+        case IR_Mov:
+        case IR_MovSX: case IR_MovZX:
+        case IR_LoadMemberAddr: case IR_LoadElementAddr:
+        case IR_Add: case IR_Sub:
+        case IR_Mul: case IR_Div: case IR_Mod:
+        case IR_LShift: case IR_RShift:
+        case IR_Eq: case IR_Neq:
+        case IR_Lt: case IR_Leq:
+        case IR_Gt: case IR_Geq:
+        case IR_And: case IR_Or: case IR_Xor:
+        case IR_Neg: case IR_Not: case IR_Compl:
+        case IR_Addr:
+        case IR_S_TO_F32: case IR_S_TO_F64:
+        case IR_F32_TO_S: case IR_F64_TO_S:
+        case IR_F32_TO_F64: case IR_F64_TO_F32:
+        case IR_Sqrt:
+        case IR_Broadcast: case IR_Shuffle: case IR_MoveMask:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+static b32 IsLoadOp(Ir_Opcode opcode)
+{
+    return opcode == IR_Load || opcode == IR_MovMember || opcode == IR_MovElement;
+}
+
+// Returns true, if only the address of the operand is used, and not the
+// value, which could be changed by a store.
+static b32 IsAddressOperand(Ir_Instruction *instr, const Ir_Operand &oper)
+{
+    if (&oper != &instr->oper1) return false;
+    if (instr->opcode == IR_Addr) return true;
+    return instr->opcode == IR_LoadMemberAddr && TypeIsStruct(oper.type);
+}
+
+// Builds the expression of the value computed by the instruction. Returns
+// false, if the value cannot be numbered.
+static b32 MakeExpr(Gvn *g, Ir_Instruction *instr, Gvn_Expr *expr)
+{
+    b32 is_load = IsLoadOp(instr->opcode);
+    if (!is_load && !IsPureOp(instr->opcode))
+        return false;
+
+    *expr = { };
+    expr->opcode = instr->opcode;
+    expr->type = instr->target.type;
+    expr->oper1 = GetValue(g, instr->oper1);
+    expr->oper2 = GetValue(g, instr->oper2);
+    if (!IsNumberable(expr->oper1) || !IsNumberable(expr->oper2))
+        return false;
+
+    b32 reads_memory = is_load;
+    if (!IsAddressOperand(instr, instr->oper1) &&
+        (instr->oper1.oper_type == IR_OPER_GlobalVariable ||
+         (IsIrLocal(instr->oper1) && !IsSsaValue(g, instr->oper1))))
+    {
+        reads_memory = true;
+    }
+    if (instr->oper2.oper_type == IR_OPER_GlobalVariable ||
+        (IsIrLocal(instr->oper2) && !IsSsaValue(g, instr->oper2)))
+    {
+        reads_memory = true;
+    }
+    expr->mem_gen = reads_memory ? g->mem_gen : 0;
+
+    if (IsCommutative(instr->opcode))
+    {
+        u32 h1 = HashOperand(expr->oper1);
+        u32 h2 = HashOperand(expr->oper2);
+        if (expr->oper1.oper_type > expr->oper2.oper_type ||
+            (expr->oper1.oper_type == expr->oper2.oper_type && h1 > h2))
+        {
+            Ir_Operand temp = expr->oper1;
+            expr->oper1 = expr->oper2;
+            expr->oper2 = temp;
+        }
+    }
+    expr->hash = HashExpr(*expr);
+    return true;
+}
+
+static void NewMemGen(Gvn *g)
+{
+    g->mem_gen = ++g->mem_gen_count;
+}
+
+// Returns true, if the instruction may change the memory.
+static b32 IsStore(Gvn *g, Ir_Instruction *instr)
+{
+    switch (instr->opcode)
+    {
+        case IR_Store:
+        case IR_Call: case IR_CallForeign:
+            return true;
+        case IR_VarDecl:
+            return IsIrLocal(instr->target) && !IsSsaValue(g, instr->target);
+        default:
+            break;
+    }
+    if (!IsIrDefinition(instr)) return false;
+    return instr->target.oper_type == IR_OPER_GlobalVariable ||
+        (IsIrLocal(instr->target) && !IsSsaValue(g, instr->target));
+}
+
+
+// Numbering
+
+static void NumberPhi(Gvn *g, Ir_Instruction *instr, s64 index)
+{
+    if (!IsSsaValue(g, instr->target)) return;
+    // NOTE(henrik): A phi, whose arguments are all the same value (or the
+    // phi itself), is a copy of the value.
+    Ir_Phi *phi = instr->oper1.phi;
+    Ir_Operand value = { };
+    for (s64 a = 0; a < phi->args.count; a++)
+    {
+        Ir_Operand arg = GetValue(g, phi->args[a].value);
+        if (SameOperand(arg, instr->target))
+            continue;
+        if (!IsSsaValue(g, arg) || arg.type != instr->target.type)
+            return;
+        if (value.oper_type == IR_OPER_None)
+            value = arg;
+        else if (!SameOperand(value, arg))
+            return;
+    }
+    if (value.oper_type == IR_OPER_None) return;
+    ReplaceName(g, instr->target, value);
+    g->removed[index] = true;
+}
+
+static void NumberInstruction(Gvn *g, Ir_Instruction *instr, s64 index)
+{
+    if (instr->opcode == IR_Phi)
+    {
+        NumberPhi(g, instr, index);
+        return;
+    }
+    if (IsStore(g, instr))
+    {
+        NewMemGen(g);
+        if (instr->opcode == IR_Store)
+        {
+            // NOTE(henrik): A load right after the store gets the stored
+            // value.
+            Ir_Operand value = GetValue(g, instr->oper1);
+            Ir_Operand addr = GetValue(g, instr->target);
+            if (IsSsaValue(g, value) && IsNumberable(addr) &&
+                (!IsIrLocal(addr) || IsSsaValue(g, addr)))
+            {
+                Gvn_Expr load = { };
+                load.opcode = IR_Load;
+                load.type = value.type;
+                load.oper1 = addr;
+                load.mem_gen = g->mem_gen;
+                load.hash = HashExpr(load);
+                load.value = value;
+                AddExpr(g, load);
+            }
+        }
+        return;
+    }
+    if (!IsIrDefinition(instr) || !IsSsaValue(g, instr->target))
+        return;
+
+    if (instr->opcode == IR_Mov && instr->target.type == instr->oper1.type)
+    {
+        Ir_Operand value = GetValue(g, instr->oper1);
+        if (IsSsaValue(g, value))
+        {
+            ReplaceName(g, instr->target, value);
+            g->removed[index] = true;
+            return;
+        }
+    }
+    // NOTE(henrik): The moves of the constants are cheaper to repeat than to
+    // keep in a register.
+    if (instr->opcode == IR_Mov && instr->oper1.oper_type == IR_OPER_Immediate)
+        return;
+
+    Gvn_Expr expr;
+    if (!MakeExpr(g, instr, &expr))
+        return;
+    Gvn_Expr *found = FindExpr(g, expr);
+    if (found)
+    {
+        ReplaceName(g, instr->target, found->value);
+        g->removed[index] = true;
+        return;
+    }
+    expr.value = instr->target;
+    AddExpr(g, expr);
+}
+
+static void NumberBlock(Gvn *g, Ir_Block *block)
+{
+    for (s64 i = block->start; i < block->end; i++)
+    {
+        NumberInstruction(g, &g->routine->instructions[i], i);
+    }
+}
+
+static void NumberBlocks(Gvn *g)
+{
+    Array<Gvn_Frame> stack = { };
+    Gvn_Frame entry = { };
+    entry.block = g->cfg->blocks[0];
+    entry.scope_mark = g->scope.count;
+    NewMemGen(g);
+    NumberBlock(g, entry.block);
+    entry.mem_gen = g->mem_gen;
+    array::Push(stack, entry);
+
+    while (stack.count > 0)
+    {
+        Gvn_Frame &frame = stack[stack.count - 1];
+        if (frame.next_child < frame.block->dom_children.count)
+        {
+            Gvn_Frame child = { };
+            child.block = frame.block->dom_children[frame.next_child++];
+            child.scope_mark = g->scope.count;
+            if (child.block->preds.count == 1)
+                g->mem_gen = frame.mem_gen;
+            else
+                NewMemGen(g);
+            NumberBlock(g, child.block);
+            child.mem_gen = g->mem_gen;
+            array::Push(stack, child);
+        }
+        else
+        {
+            PopScope(g, frame.scope_mark);
+            stack.count--;
+        }
+    }
+    array::Free(stack);
+}
+
+static void ReplaceOperand(Gvn *g, Ir_Operand *oper)
+{
+    if (!IsIrLocal(*oper)) return;
+    Ir_Operand value = GetValue(g, *oper);
+    if (!SameOperand(value, *oper))
+    {
+        ASSERT(value.type == oper->type);
+        *oper = value;
+    }
+}
+
+static void RewriteRoutine(Gvn *g)
+{
+    Ir_Routine *routine = g->routine;
+    Ir_Rewrite rw;
+    BeginRewrite(&rw, routine);
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        if (g->removed[i])
+        {
+            g->ctx->opt_counts.redundant_instrs++;
+            continue;
+        }
+        Ir_Instruction *instr = CopyInstruction(&rw, i);
+        if (instr->opcode == IR_Phi)
+        {
+            Ir_Phi *phi = instr->oper1.phi;
+            for (s64 a = 0; a < phi->args.count; a++)
+                ReplaceOperand(g, &phi->args.data[a].value);
+            continue;
+        }
+        Ir_Operand *uses[2];
+        s64 use_count = GetIrUses(instr, uses);
+        for (s64 u = 0; u < use_count; u++)
+            ReplaceOperand(g, uses[u]);
+    }
+    EndRewrite(&rw);
+}
+
+static void FreeGvn(Gvn *g)
+{
+    array::Free(g->name_table);
+    array::Free(g->names);
+    array::Free(g->buckets);
+    array::Free(g->scope);
+    FreeMemoryArena(&g->arena);
+}
+
+void NumberValues(Ir_Gen_Context *ctx, Ir_Routine *routine)
+{
+    if (routine->instructions.count == 0)
+        return;
+
+    Gvn gvn = { };
+    Gvn *g = &gvn;
+    g->ctx = ctx;
+    g->routine = routine;
+    g->cfg = GetCfg(routine);
+
+    s64 instr_count = routine->instructions.count;
+    u32 bucket_count = 64;
+    while (bucket_count < instr_count)
+        bucket_count *= 2;
+    array::Resize(g->buckets, bucket_count);
+    g->bucket_mask = bucket_count - 1;
+    g->removed = PushArray<b32>(&g->arena, instr_count);
+    for (s64 i = 0; i < instr_count; i++)
+        g->removed[i] = false;
+
+    CollectNames(g);
+    NumberBlocks(g);
+    RewriteRoutine(g);
+
+    FreeGvn(g);
+}
+
+void NumberValues(Ir_Gen_Context *ctx)
+{
+    for (s64 i = 0; i < ctx->routines.count; i++)
+    {
+        NumberValues(ctx, ctx->routines[i]);
+    }
+}
+
+} // hplang
@@ -0,0 +1,22 @@
+#ifndef H_HPLANG_IR_GVN_H
+
+#include "ir_types.h"
+
+namespace hplang
+{
+
+struct Ir_Gen_Context;
+
+// Removes the redundant computations of the routine in the SSA form. The
+// dominator tree is walked, and an instruction computing the same value as
+// an instruction in a dominating block is removed, and its uses are replaced
+// by the earlier result. The address computations and the copies are
+// numbered as well. The loads are reused, until a store or a call may have
+// changed the memory.
+void NumberValues(Ir_Gen_Context *ctx, Ir_Routine *routine);
+void NumberValues(Ir_Gen_Context *ctx);
+
+} // hplang
+
+#define H_HPLANG_IR_GVN_H
+#endif
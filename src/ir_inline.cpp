@@ -0,0 +1,382 @@
+
+#include "ir_inline.h"
+#include "ir_cfg.h"
+#include "ir_gen.h"
+#include "symbols.h"
+#include "hashtable.h"
+#include "common.h"
+#include "assert.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+
+// The inlining replaces a call with a copy of the callee [1]. The arguments
+// are moved to the parameters, which become locals of the caller, and the
+// returns move the return value to the result of the call and jump to the
+// end of the copy. The locals and the temporaries of the copy are renamed
+// with the prefix @inl<n>, where n is unique for each inlined call.
+//
+// The cost of a routine is the number of its instructions; the labels and
+// the declarations are not counted. A callee is inlined, if its cost is
+// within the size limit, which is larger for the leaf routines, as the call
+// of a leaf costs as much as the leaf itself, and for the calls inside loops.
+//
+// [1]  Keith D. Cooper, Mary W. Hall and Linda Torczon, 1991.
+//      An experiment with inline substitution.
+
+namespace hplang
+{
+
+static const s64 INLINE_SIZE_LIMIT = 12;
+static const s64 INLINE_LEAF_BONUS = 12;
+static const s64 INLINE_MAX_LOOP_DEPTH = 2;
+static const s64 INLINE_CALLER_LIMIT = 2000;
+
+enum Inl_State
+{
+    INL_STATE_Unvisited,
+    INL_STATE_Visiting,
+    INL_STATE_Done,
+};
+
+struct Inl_Routine
+{
+    Name name;
+    Ir_Routine *routine;
+    Inl_State state;
+};
+
+struct Inliner
+{
+    Memory_Arena arena;
+    Ir_Gen_Context *ctx;
+
+    Array<Inl_Routine*> table;
+    s64 site_count;         // The calls inlined so far, numbers the copies
+};
+
+static Inl_Routine* LookupCallee(Inliner *inl, const Ir_Instruction *instr)
+{
+    if (instr->opcode != IR_Call || instr->oper1.oper_type != IR_OPER_Routine)
+        return nullptr;
+    return hashtable::Lookup(inl->table, instr->oper1.var.name);
+}
+
+static s64 GetCost(Ir_Routine *routine)
+{
+    s64 cost = 0;
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        Ir_Opcode opcode = routine->instructions[i].opcode;
+        if (opcode != IR_Label && opcode != IR_VarDecl)
+            cost++;
+    }
+    return cost;
+}
+
+static b32 HasCalls(Ir_Routine *routine)
+{
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        Ir_Opcode opcode = routine->instructions[i].opcode;
+        if (opcode == IR_Call || opcode == IR_CallForeign)
+            return true;
+    }
+    return false;
+}
+
+// Returns true, if the call can be replaced with the body of the callee.
+static b32 CanInline(Ir_Routine *caller, Ir_Routine *callee, Ir_Instruction *call)
+{
+    if (callee == caller || (callee->flags & ROUT_NoInline) != 0)
+        return false;
+    if (callee->instructions.count == 0)
+        return false;
+
+    // NOTE(henrik): The code generator passes a struct value by its address,
+    // which cannot be expressed in the ir, so the calls with struct values as
+    // the arguments or the result are not inlined.
+    if (TypeIsStruct(call->target.type))
+        return false;
+    s64 arg_count = 0;
+    s64 arg_index = call->oper2.imm_s64;
+    while (arg_index != -1)
+    {
+        Ir_Instruction *arg = &caller->instructions[arg_index];
+        if (TypeIsStruct(arg->target.type))
+            return false;
+        arg_index = arg->oper1.imm_s64;
+        arg_count++;
+    }
+    return arg_count == callee->arg_count;
+}
+
+static b32 ShouldInline(Ir_Routine *callee, s64 loop_depth, s64 caller_cost)
+{
+    s64 cost = GetCost(callee);
+    if ((callee->flags & ROUT_Inline) != 0)
+        return true;
+
+    s64 limit = INLINE_SIZE_LIMIT;
+    if ((callee->flags & ROUT_Leaf) != 0)
+        limit += INLINE_LEAF_BONUS;
+    if (loop_depth > INLINE_MAX_LOOP_DEPTH)
+        loop_depth = INLINE_MAX_LOOP_DEPTH;
+    limit *= 1 + loop_depth;
+    return cost <= limit && caller_cost + cost <= INLINE_CALLER_LIMIT;
+}
+
+
+// Copying the callee
+
+struct Inl_Site
+{
+    Ir_Instruction *call;
+    Ir_Routine *callee;
+    s64 number;
+};
+
+static Name InlineName(Inliner *inl, Name name, s64 site_number)
+{
+    const s64 buf_size = 40;
+    char buf[buf_size];
+    s64 prefix_len = snprintf(buf, buf_size, "@inl%" PRId64, site_number);
+
+    String str = { };
+    str.size = prefix_len + name.str.size;
+    str.data = PushArray<char>(&inl->ctx->arena, str.size);
+    memcpy(str.data, buf, prefix_len);
+    memcpy(str.data + prefix_len, name.str.data, name.str.size);
+    return MakeName(str);
+}
+
+static Ir_Operand InlineOperand(Inliner *inl, const Inl_Site &site,
+        Ir_Label **labels, Ir_Operand oper)
+{
+    switch (oper.oper_type)
+    {
+        case IR_OPER_Variable:
+            oper.var.name = InlineName(inl, oper.var.name, site.number);
+            break;
+        case IR_OPER_Temp:
+            oper.temp.name = InlineName(inl, oper.temp.name, site.number);
+            break;
+        case IR_OPER_Label:
+            oper.label = labels[oper.label->target_loc];
+            break;
+        default:
+            break;
+    }
+    return oper;
+}
+
+static void CopyCallee(Inliner *inl, Ir_Rewrite *rw, const Inl_Site &site)
+{
+    Ir_Routine *callee = site.callee;
+    Ir_Routine *caller = rw->routine;
+    s64 instr_count = callee->instructions.count;
+
+    Ir_Label **labels = PushArray<Ir_Label*>(&inl->arena, instr_count);
+    s64 *new_index = PushArray<s64>(&inl->arena, instr_count);
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Instruction *instr = &callee->instructions[i];
+        labels[i] = nullptr;
+        if (instr->opcode == IR_Label)
+            labels[i] = NewIrLabel(inl->ctx, caller).label;
+    }
+
+    Ir_Operand end_label = NewIrLabel(inl->ctx, caller);
+    b32 end_used = false;
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Instruction instr = callee->instructions[i];
+        instr.target = InlineOperand(inl, site, labels, instr.target);
+        instr.oper1 = InlineOperand(inl, site, labels, instr.oper1);
+        instr.oper2 = InlineOperand(inl, site, labels, instr.oper2);
+        new_index[i] = rw->instructions.count;
+        switch (instr.opcode)
+        {
+            case IR_Arg:
+                if (instr.oper1.imm_s64 != -1)
+                    instr.oper1.imm_s64 = new_index[instr.oper1.imm_s64];
+                PushLinkedInstruction(rw, instr);
+                break;
+            case IR_Call:
+            case IR_CallForeign:
+                if (instr.oper2.imm_s64 != -1)
+                    instr.oper2.imm_s64 = new_index[instr.oper2.imm_s64];
+                PushLinkedInstruction(rw, instr);
+                break;
+            case IR_Return:
+                {
+                    Ir_Operand result = site.call->target;
+                    if (result.oper_type != IR_OPER_None &&
+                        instr.target.oper_type != IR_OPER_None)
+                    {
+                        Ir_Instruction mov = { };
+                        mov.opcode = IR_Mov;
+                        mov.target = result;
+                        mov.oper1 = instr.target;
+                        mov.comment = instr.comment;
+                        PushInstruction(rw, mov);
+                    }
+                    if (i + 1 < instr_count)
+                    {
+                        Ir_Instruction jump = { };
+                        jump.opcode = IR_Jump;
+                        jump.target = end_label;
+                        PushInstruction(rw, jump);
+                        end_used = true;
+                    }
+                } break;
+            default:
+                PushInstruction(rw, instr);
+                break;
+        }
+    }
+    if (end_used)
+    {
+        Ir_Instruction label = { };
+        label.opcode = IR_Label;
+        label.target = end_label;
+        PushInstruction(rw, label);
+    }
+}
+
+
+// Inlining the calls of a routine
+
+static void InlineCalls(Inliner *inl, Ir_Routine *caller)
+{
+    s64 instr_count = caller->instructions.count;
+    Ir_Cfg *cfg = GetCfg(caller);
+
+    // The callee of each inlined call, and the parameter of each argument of
+    // an inlined call.
+    Inl_Site *sites = PushArray<Inl_Site>(&inl->arena, instr_count);
+    s64 *arg_call = PushArray<s64>(&inl->arena, instr_count);
+    s64 *arg_param = PushArray<s64>(&inl->arena, instr_count);
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        sites[i] = { };
+        arg_call[i] = -1;
+    }
+
+    s64 caller_cost = GetCost(caller);
+    s64 inlined = 0;
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Instruction *instr = &caller->instructions[i];
+        Inl_Routine *callee = LookupCallee(inl, instr);
+        if (!callee || !CanInline(caller, callee->routine, instr))
+            continue;
+        s64 loop_depth = GetLoopDepth(cfg->instr_blocks[i]);
+        if (!ShouldInline(callee->routine, loop_depth, caller_cost))
+            continue;
+
+        sites[i].call = instr;
+        sites[i].callee = callee->routine;
+        sites[i].number = inl->site_count++;
+        caller_cost += GetCost(callee->routine);
+        inlined++;
+
+        s64 param = 0;
+        s64 arg_index = instr->oper2.imm_s64;
+        while (arg_index != -1)
+        {
+            arg_call[arg_index] = i;
+            arg_param[arg_index] = param++;
+            arg_index = caller->instructions[arg_index].oper1.imm_s64;
+        }
+    }
+    if (inlined == 0)
+        return;
+
+    Ir_Rewrite rw;
+    BeginRewrite(&rw, caller);
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Instruction *instr = &caller->instructions[i];
+        if (arg_call[i] != -1)
+        {
+            // NOTE(henrik): The argument is moved to the parameter, where the
+            // argument was evaluated, as the arguments of the other calls may
+            // be evaluated between it and the call.
+            const Inl_Site &site = sites[arg_call[i]];
+            Ir_Instruction mov = { };
+            mov.opcode = IR_Mov;
+            mov.target = InlineOperand(inl, site, nullptr, site.callee->args[arg_param[i]]);
+            mov.oper1 = instr->target;
+            // NOTE(henrik): A struct parameter is referred to by its address
+            // in the callee, and the argument is the address of a struct.
+            if (TypeIsStruct(mov.target.type))
+                mov.target.type = mov.oper1.type;
+            mov.comment = instr->comment;
+            PushInstruction(&rw, mov);
+        }
+        else if (sites[i].callee)
+        {
+            CopyCallee(inl, &rw, sites[i]);
+        }
+        else
+        {
+            CopyInstruction(&rw, i);
+        }
+    }
+    EndRewrite(&rw);
+
+    if (!HasCalls(caller))
+        caller->flags |= ROUT_Leaf;
+    inl->ctx->opt_counts.inlined_calls += inlined;
+}
+
+static void VisitRoutine(Inliner *inl, Inl_Routine *rout)
+{
+    rout->state = INL_STATE_Visiting;
+    Ir_Routine *routine = rout->routine;
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        Inl_Routine *callee = LookupCallee(inl, &routine->instructions[i]);
+        if (callee && callee->state == INL_STATE_Unvisited)
+            VisitRoutine(inl, callee);
+    }
+
+    // NOTE(henrik): The top level routine is run only once, so the calls
+    // from it are not inlined.
+    if (routine->name.str.size > 0)
+        InlineCalls(inl, routine);
+    rout->state = INL_STATE_Done;
+}
+
+void InlineRoutines(Ir_Gen_Context *ctx)
+{
+    Inliner inliner = { };
+    Inliner *inl = &inliner;
+    inl->ctx = ctx;
+
+    s64 routine_count = ctx->routines.count;
+    array::Resize(inl->table, 2 * routine_count + 31);
+    for (s64 i = 0; i < routine_count; i++)
+    {
+        Inl_Routine *rout = PushStruct<Inl_Routine>(&inl->arena);
+        *rout = { };
+        rout->name = ctx->routines[i]->name;
+        rout->routine = ctx->routines[i];
+        rout->state = INL_STATE_Unvisited;
+        hashtable::Put(inl->table, rout->name, rout);
+    }
+
+    for (s64 i = 0; i < routine_count; i++)
+    {
+        Inl_Routine *rout = hashtable::Lookup(inl->table, ctx->routines[i]->name);
+        if (rout->state == INL_STATE_Unvisited)
+            VisitRoutine(inl, rout);
+    }
+
+    array::Free(inl->table);
+    FreeMemoryArena(&inl->arena);
+}
+
+} // hplang
@@ -0,0 +1,20 @@
+#ifndef H_HPLANG_IR_INLINE_H
+
+#include "ir_types.h"
+
+namespace hplang
+{
+
+struct Ir_Gen_Context;
+
+// Replaces the calls to small routines with copies of their bodies. The
+// routines are processed callees first, so that the bodies copied are
+// already inlined. The size limit of a callee is larger for the leaf
+// routines and for the calls inside loops; #inline and #noinline override
+// the limits. Runs before the SSA construction.
+void InlineRoutines(Ir_Gen_Context *ctx);
+
+} // hplang
+
+#define H_HPLANG_IR_INLINE_H
+#endif
@@ -0,0 +1,1262 @@
+
+#include "hplang.h"
+#include "ir_interpreter.h"
+#include "ir_gen.h"
+#include "ir_cfg.h"
+#include "ir_eval.h"
+#include "compiler.h"
+#include "symbols.h"
+#include "hashtable.h"
+#include "common.h"
+#include "memory.h"
+#include "assert.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#if defined(HP_UNIX)
+#include <dlfcn.h>
+#endif
+
+// The interpreter runs the ir routines directly. Every variable and temporary
+// of a routine has an 8 byte cell in the frame, which holds the value of the
+// operand like a register holds it in the generated code; struct typed
+// operands hold the address of their storage. The frames and the storage of
+// the struct locals live in the interpreter stack. The foreign routines are
+// called through a trampoline, that passes the arguments in the registers of
+// the platform calling convention.
+
+namespace hplang
+{
+
+static const s64 INTERP_STACK_SIZE = 16*1024*1024;
+static const s64 INTERP_MAX_CALL_DEPTH = 10000;
+static const s64 INTERP_MAX_INT_ARGS = 6;
+static const s64 INTERP_MAX_FLOAT_ARGS = 8;
+
+// NOTE(henrik): The initialization of the global variables is evaluated at
+// compile time only up to this many instructions; the rest is run at run time.
+static const s64 INTERP_CONST_STEP_LIMIT = 10000000;
+
+struct Interp_Routine;
+
+struct Interp_Function
+{
+    Name name;
+    Ir_Routine *routine;        // null for foreign routines
+    Interp_Routine *code;       // prepared on the first call
+    void *foreign;              // resolved on the first call
+};
+
+struct Interp_Global
+{
+    Name name;
+    s64 index;
+};
+
+struct Interp_Slot
+{
+    Name name;
+    s64 index;
+};
+
+// The operands of an instruction resolved before running the routine: the
+// cell index of a variable or temporary, the index of a global variable, the
+// target of a label, or the value of an immediate or a routine.
+struct Interp_Refs
+{
+    u64 target, oper1, oper2;
+};
+
+struct Interp_Routine
+{
+    s64 slot_count;
+    s64 *arg_slots;
+    Interp_Refs *refs;
+};
+
+struct Interp_Frame
+{
+    Ir_Routine *routine;
+    Interp_Routine *code;
+    u64 *cells;
+    u8 **storage;
+};
+
+struct Interp_Region
+{
+    u8 *start;
+    s64 size;
+};
+
+struct Interpreter
+{
+    Memory_Arena arena;
+    Ir_Gen_Context *ir_ctx;
+
+    Array<Interp_Function*> functions;
+    Array<Interp_Global*> global_table;
+    s64 *global_offsets;
+    Pointer globals;
+
+    Pointer stack;
+    s64 stack_top;
+    s64 call_depth;
+
+    // The string constants, which may be read, but not written.
+    Array<Interp_Region> const_regions;
+
+    // When evaluating the constant initialization, foreign calls and accesses
+    // outside the memory of the interpreter stop the evaluation quietly.
+    b32 constant_only;
+    s64 steps_left;
+
+    void *library;
+
+    b32 failed;
+    const char *error_message;
+    Ir_Routine *error_routine;
+    Ir_Instruction *error_instr;
+};
+
+static void InterpError(Interpreter *interp, Interp_Frame *frame,
+        Ir_Instruction *instr, const char *message)
+{
+    if (interp->failed) return;
+    interp->failed = true;
+    interp->error_message = message;
+    interp->error_routine = frame ? frame->routine : nullptr;
+    interp->error_instr = instr;
+}
+
+static void PrintInterpError(Interpreter *interp, IoFile *file)
+{
+    FILE *f = (FILE*)file;
+    fprintf(f, "%s", interp->error_message);
+    Ir_Routine *routine = interp->error_routine;
+    if (routine && routine->name.str.size > 0)
+    {
+        // NOTE(henrik): The overloaded routine names are mangled with the
+        // parameter types after '#'; only the source name is printed.
+        String name = routine->name.str;
+        s64 name_size = 0;
+        while (name_size < name.size && name.data[name_size] != '#')
+            name_size++;
+        fprintf(f, " in routine '%.*s'", (int)name_size, name.data);
+    }
+    Ir_Instruction *instr = interp->error_instr;
+    if (instr && instr->comment.start)
+    {
+        fprintf(f, " (near '%.*s')",
+                (int)(instr->comment.end - instr->comment.start), instr->comment.start);
+    }
+    fprintf(f, "\n");
+}
+
+
+// Values
+
+static u64 LoadValue(Type *type, const u8 *address)
+{
+    u64 value = 0;
+    memcpy(&value, address, GetSize(type));
+    return NormalizeIrValue(type, value);
+}
+
+static void StoreValue(Type *type, u8 *address, u64 value)
+{
+    memcpy(address, &value, GetSize(type));
+}
+
+
+// Memory
+
+static u8* PushStack(Interpreter *interp, s64 size, s64 alignment)
+{
+    s64 offset = Align(interp->stack_top, alignment);
+    if (offset + size > interp->stack.size)
+        return nullptr;
+    interp->stack_top = offset + size;
+    return (u8*)interp->stack.ptr + offset;
+}
+
+static b32 InRegion(u8 *start, s64 region_size, u8 *address, s64 size)
+{
+    return start && address >= start && address + size <= start + region_size;
+}
+
+static b32 CheckAddress(Interpreter *interp, Interp_Frame *frame,
+        Ir_Instruction *instr, u64 address, s64 size, b32 write)
+{
+    u8 *ptr = (u8*)address;
+    if (!ptr)
+    {
+        InterpError(interp, frame, instr, "Null pointer access");
+        return false;
+    }
+    if (!interp->constant_only)
+        return true;
+
+    if (InRegion((u8*)interp->stack.ptr, interp->stack.size, ptr, size) ||
+        InRegion((u8*)interp->globals.ptr, interp->globals.size, ptr, size))
+    {
+        return true;
+    }
+    if (!write)
+    {
+        for (s64 i = 0; i < interp->const_regions.count; i++)
+        {
+            Interp_Region region = interp->const_regions[i];
+            if (InRegion(region.start, region.size, ptr, size))
+                return true;
+        }
+    }
+    InterpError(interp, frame, instr, "Invalid memory access");
+    return false;
+}
+
+static u8* GlobalAddress(Interpreter *interp, u64 index)
+{
+    return (u8*)interp->globals.ptr + interp->global_offsets[index];
+}
+
+static u8* GetStorage(Interpreter *interp, Interp_Frame *frame,
+        Ir_Instruction *instr, u64 slot, Type *type)
+{
+    u8 *storage = frame->storage[slot];
+    if (!storage)
+    {
+        s64 size = GetAlignedSize(type);
+        storage = PushStack(interp, size, 16);
+        if (!storage)
+        {
+            InterpError(interp, frame, instr, "Stack overflow");
+            return nullptr;
+        }
+        memset(storage, 0, size);
+        frame->storage[slot] = storage;
+    }
+    return storage;
+}
+
+static b32 GlobalsHaveAddresses(Type *type, const u8 *data)
+{
+    switch (type->tag)
+    {
+        case TYP_null:
+        case TYP_pointer:
+        case TYP_Function:
+            {
+                u64 value;
+                memcpy(&value, data, 8);
+                return value != 0;
+            }
+        case TYP_string:
+        case TYP_Struct:
+            for (s64 i = 0; i < type->struct_type.member_count; i++)
+            {
+                Struct_Member *member = &type->struct_type.members[i];
+                if (GlobalsHaveAddresses(member->type, data + member->offset))
+                    return true;
+            }
+            return false;
+        default:
+            break;
+    }
+    return false;
+}
+
+// NOTE(henrik): The addresses of the interpreter memory are not valid in the
+// program, so the values of the globals can not be baked if they have any.
+static b32 GlobalsHaveAddresses(Interpreter *interp)
+{
+    Array<Symbol*> &global_vars = interp->ir_ctx->global_vars;
+    for (s64 i = 0; i < global_vars.count; i++)
+    {
+        if (GlobalsHaveAddresses(global_vars[i]->type, GlobalAddress(interp, i)))
+            return true;
+    }
+    return false;
+}
+
+
+// Operands
+
+static u64 Read(Interpreter *interp, Interp_Frame *frame, const Ir_Operand &oper, u64 ref)
+{
+    switch (oper.oper_type)
+    {
+        case IR_OPER_Variable:
+        case IR_OPER_Temp:
+            return NormalizeIrValue(oper.type, frame->cells[ref]);
+        case IR_OPER_GlobalVariable:
+            {
+                u8 *address = GlobalAddress(interp, ref);
+                if (TypeIsStruct(oper.type))
+                    return (u64)address;
+                return LoadValue(oper.type, address);
+            }
+        case IR_OPER_Immediate:
+        case IR_OPER_Routine:
+        case IR_OPER_ForeignRoutine:
+            return ref;
+        case IR_OPER_None:
+        case IR_OPER_Label:
+        case IR_OPER_Phi:
+            break;
+    }
+    INVALID_CODE_PATH;
+    return 0;
+}
+
+static void Write(Interpreter *interp, Interp_Frame *frame,
+        const Ir_Operand &oper, u64 ref, u64 value)
+{
+    switch (oper.oper_type)
+    {
+        case IR_OPER_Variable:
+        case IR_OPER_Temp:
+            frame->cells[ref] = NormalizeIrValue(oper.type, value);
+            return;
+        case IR_OPER_GlobalVariable:
+            ASSERT(!TypeIsStruct(oper.type));
+            StoreValue(oper.type, GlobalAddress(interp, ref), value);
+            return;
+        default:
+            break;
+    }
+    INVALID_CODE_PATH;
+}
+
+// Copies the struct from source to the storage of the operand.
+static void AssignStruct(Interpreter *interp, Interp_Frame *frame,
+        Ir_Instruction *instr, const Ir_Operand &oper, u64 ref, u64 source)
+{
+    s64 size = GetSize(oper.type);
+    if (!CheckAddress(interp, frame, instr, source, size, false))
+        return;
+
+    u8 *dest = nullptr;
+    if (oper.oper_type == IR_OPER_GlobalVariable)
+    {
+        dest = GlobalAddress(interp, ref);
+    }
+    else
+    {
+        dest = GetStorage(interp, frame, instr, ref, oper.type);
+        if (!dest) return;
+        frame->cells[ref] = (u64)dest;
+    }
+    memmove(dest, (u8*)source, size);
+}
+
+// NOTE(henrik): Loads and stores access a global variable operand directly,
+// like the generated code does.
+static u64 MemoryAddress(Interpreter *interp, Interp_Frame *frame,
+        const Ir_Operand &oper, u64 ref)
+{
+    if (oper.oper_type == IR_OPER_GlobalVariable)
+        return (u64)GlobalAddress(interp, ref);
+    return Read(interp, frame, oper, ref);
+}
+
+static u64 AddressOf(Interpreter *interp, Interp_Frame *frame,
+        const Ir_Operand &oper, u64 ref)
+{
+    switch (oper.oper_type)
+    {
+        case IR_OPER_Variable:
+        case IR_OPER_Temp:
+            return (u64)&frame->cells[ref];
+        case IR_OPER_GlobalVariable:
+            return (u64)GlobalAddress(interp, ref);
+        default:
+            break;
+    }
+    INVALID_CODE_PATH;
+    return 0;
+}
+
+
+// Preparing routines
+
+static Interp_Function* LookupFunction(Interpreter *interp, Name name)
+{
+    return hashtable::Lookup(interp->functions, name);
+}
+
+static s64 GetSlot(Interpreter *interp, Array<Interp_Slot*> &slots,
+        Interp_Routine *code, Name name)
+{
+    Interp_Slot *slot = hashtable::Lookup(slots, name);
+    if (!slot)
+    {
+        slot = PushStruct<Interp_Slot>(&interp->arena);
+        slot->name = name;
+        slot->index = code->slot_count++;
+        hashtable::Put(slots, name, slot);
+    }
+    return slot->index;
+}
+
+static u64 ImmediateValue(Interpreter *interp, const Ir_Operand &oper)
+{
+    if (TypeIsString(oper.type))
+    {
+        String *str = PushStruct<String>(&interp->arena);
+        *str = oper.imm_str;
+
+        Interp_Region region = { };
+        region.start = (u8*)str;
+        region.size = sizeof(String);
+        array::Push(interp->const_regions, region);
+        region.start = (u8*)str->data;
+        region.size = str->size;
+        array::Push(interp->const_regions, region);
+        return (u64)str;
+    }
+    return NormalizeIrValue(oper.type, oper.imm_u64);
+}
+
+static u64 ResolveOperand(Interpreter *interp, Array<Interp_Slot*> &slots,
+        Interp_Routine *code, const Ir_Operand &oper)
+{
+    switch (oper.oper_type)
+    {
+        case IR_OPER_None:
+            return 0;
+        case IR_OPER_Variable:
+            return GetSlot(interp, slots, code, oper.var.name);
+        case IR_OPER_Temp:
+            return GetSlot(interp, slots, code, oper.temp.name);
+        case IR_OPER_GlobalVariable:
+            {
+                Interp_Global *global = hashtable::Lookup(interp->global_table, oper.var.name);
+                ASSERT(global);
+                return global->index;
+            }
+        case IR_OPER_Immediate:
+            return ImmediateValue(interp, oper);
+        case IR_OPER_Label:
+            return oper.label->target_loc;
+        case IR_OPER_Routine:
+        case IR_OPER_ForeignRoutine:
+            {
+                Interp_Function *function = LookupFunction(interp, oper.var.name);
+                ASSERT(function);
+                return (u64)function;
+            }
+        case IR_OPER_Phi:
+            break;
+    }
+    INVALID_CODE_PATH;
+    return 0;
+}
+
+static Interp_Routine* PrepareRoutine(Interpreter *interp, Ir_Routine *routine)
+{
+    Interp_Routine *code = PushStruct<Interp_Routine>(&interp->arena);
+    *code = { };
+
+    Array<Interp_Slot*> slots = { };
+    code->arg_slots = PushArray<s64>(&interp->arena, routine->arg_count);
+    for (s64 i = 0; i < routine->arg_count; i++)
+    {
+        code->arg_slots[i] = GetSlot(interp, slots, code, routine->args[i].var.name);
+    }
+
+    s64 instr_count = routine->instructions.count;
+    code->refs = PushArray<Interp_Refs>(&interp->arena, instr_count);
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        Interp_Refs *refs = &code->refs[i];
+        refs->target = ResolveOperand(interp, slots, code, instr->target);
+        refs->oper1 = ResolveOperand(interp, slots, code, instr->oper1);
+        refs->oper2 = ResolveOperand(interp, slots, code, instr->oper2);
+    }
+    array::Free(slots);
+    return code;
+}
+
+static b32 NewFrame(Interpreter *interp, Interp_Function *function, Interp_Frame *frame)
+{
+    if (!function->code)
+        function->code = PrepareRoutine(interp, function->routine);
+
+    Interp_Routine *code = function->code;
+    *frame = { };
+    frame->routine = function->routine;
+    frame->code = code;
+    frame->cells = (u64*)PushStack(interp, code->slot_count * sizeof(u64), 16);
+    frame->storage = (u8**)PushStack(interp, code->slot_count * sizeof(u8*), 16);
+    if (!frame->cells || !frame->storage)
+        return false;
+    memset(frame->cells, 0, code->slot_count * sizeof(u64));
+    memset(frame->storage, 0, code->slot_count * sizeof(u8*));
+    return true;
+}
+
+
+// Running
+
+static b32 Run(Interpreter *interp, Interp_Frame *frame,
+        s64 start, s64 end, u64 *return_value);
+
+static b32 CallRoutine(Interpreter *interp, Interp_Frame *caller,
+        Ir_Instruction *instr, Interp_Function *function,
+        u64 *args, s64 arg_count, u64 *result)
+{
+    Ir_Routine *routine = function->routine;
+    ASSERT(arg_count == routine->arg_count);
+    if (interp->call_depth >= INTERP_MAX_CALL_DEPTH)
+    {
+        InterpError(interp, caller, instr, "Call stack overflow");
+        return false;
+    }
+
+    s64 stack_top = interp->stack_top;
+    Interp_Frame frame;
+    if (!NewFrame(interp, function, &frame))
+    {
+        interp->stack_top = stack_top;
+        InterpError(interp, caller, instr, "Stack overflow");
+        return false;
+    }
+    for (s64 i = 0; i < arg_count; i++)
+    {
+        frame.cells[frame.code->arg_slots[i]] = NormalizeIrValue(routine->args[i].type, args[i]);
+    }
+
+    interp->call_depth++;
+    *result = 0;
+    b32 ok = Run(interp, &frame, 0, routine->instructions.count, result);
+    interp->call_depth--;
+    interp->stack_top = stack_top;
+    return ok;
+}
+
+#if defined(HP_UNIX)
+
+typedef u64 (*Int_Trampoline)(u64, u64, u64, u64, u64, u64,
+        f64, f64, f64, f64, f64, f64, f64, f64);
+typedef f64 (*Float_Trampoline)(u64, u64, u64, u64, u64, u64,
+        f64, f64, f64, f64, f64, f64, f64, f64);
+
+static void* ResolveForeign(Interpreter *interp, Name name)
+{
+    if (!interp->library)
+    {
+        interp->library = dlopen("stdlib/libstdlib.so", RTLD_NOW | RTLD_GLOBAL);
+    }
+
+    char sym_name[256];
+    if (name.str.size >= (s64)sizeof(sym_name))
+        return nullptr;
+    memcpy(sym_name, name.str.data, name.str.size);
+    sym_name[name.str.size] = 0;
+
+    void *address = nullptr;
+    if (interp->library)
+        address = dlsym(interp->library, sym_name);
+    if (!address)
+        address = dlsym(RTLD_DEFAULT, sym_name);
+    return address;
+}
+
+// NOTE(henrik): The arguments are passed as six integers and eight doubles,
+// which puts them to the argument registers of the System V calling
+// convention. The f32 values are in the low bits of the doubles, like they
+// are in the xmm registers.
+static b32 CallForeign(Interpreter *interp, Interp_Frame *caller,
+        Ir_Instruction *instr, Interp_Function *function,
+        u64 *args, Type **arg_types, s64 arg_count, Type *return_type, u64 *result)
+{
+    *result = 0;
+    if (interp->constant_only)
+    {
+        interp->failed = true;
+        return false;
+    }
+    if (function->name == MakeConstName("exit"))
+    {
+        InterpError(interp, caller, instr, "Calling exit at compile time");
+        return false;
+    }
+    if (!function->foreign)
+    {
+        function->foreign = ResolveForeign(interp, function->name);
+        if (!function->foreign)
+        {
+            InterpError(interp, caller, instr, "Could not find the foreign routine");
+            return false;
+        }
+    }
+
+    u64 int_args[INTERP_MAX_INT_ARGS] = { };
+    f64 float_args[INTERP_MAX_FLOAT_ARGS] = { };
+    s64 int_count = 0;
+    s64 float_count = 0;
+    for (s64 i = 0; i < arg_count; i++)
+    {
+        if (TypeIsFloat(arg_types[i]))
+        {
+            if (float_count >= INTERP_MAX_FLOAT_ARGS)
+            {
+                InterpError(interp, caller, instr, "Too many arguments to a foreign routine");
+                return false;
+            }
+            float_args[float_count++] = IrValueToF64(args[i]);
+        }
+        else
+        {
+            if (int_count >= INTERP_MAX_INT_ARGS)
+            {
+                InterpError(interp, caller, instr, "Too many arguments to a foreign routine");
+                return false;
+            }
+            int_args[int_count++] = args[i];
+        }
+    }
+
+    u64 *ia = int_args;
+    f64 *fa = float_args;
+    if (return_type && TypeIsFloat(return_type))
+    {
+        Float_Trampoline trampoline = (Float_Trampoline)function->foreign;
+        f64 value = trampoline(ia[0], ia[1], ia[2], ia[3], ia[4], ia[5],
+                fa[0], fa[1], fa[2], fa[3], fa[4], fa[5], fa[6], fa[7]);
+        *result = F64ToIrValue(value);
+    }
+    else
+    {
+        Int_Trampoline trampoline = (Int_Trampoline)function->foreign;
+        *result = trampoline(ia[0], ia[1], ia[2], ia[3], ia[4], ia[5],
+                fa[0], fa[1], fa[2], fa[3], fa[4], fa[5], fa[6], fa[7]);
+    }
+    return true;
+}
+
+#else
+
+static b32 CallForeign(Interpreter *interp, Interp_Frame *caller,
+        Ir_Instruction *instr, Interp_Function *function,
+        u64 *args, Type **arg_types, s64 arg_count, Type *return_type, u64 *result)
+{
+    (void)function;
+    (void)args;
+    (void)arg_types;
+    (void)arg_count;
+    (void)return_type;
+    *result = 0;
+    if (interp->constant_only)
+    {
+        interp->failed = true;
+        return false;
+    }
+    InterpError(interp, caller, instr,
+            "Calling foreign routines at compile time is not supported on this platform");
+    return false;
+}
+
+#endif
+
+static void Call(Interpreter *interp, Interp_Frame *frame, Ir_Instruction *instr)
+{
+    Ir_Routine *routine = frame->routine;
+    Interp_Refs *refs = &frame->code->refs[instr - routine->instructions.data];
+    Interp_Function *function = (Interp_Function*)Read(interp, frame, instr->oper1, refs->oper1);
+    if (!function)
+    {
+        InterpError(interp, frame, instr, "Calling a null routine");
+        return;
+    }
+
+    // NOTE(henrik): The storage of a struct result is reserved before the
+    // call, so that it does not overlap the frame of the callee, where the
+    // returned struct is.
+    b32 has_result = (instr->target.oper_type != IR_OPER_None);
+    b32 struct_result = has_result && TypeIsStruct(instr->target.type);
+    if (struct_result)
+    {
+        if (!GetStorage(interp, frame, instr, refs->target, instr->target.type))
+            return;
+    }
+
+    s64 arg_count = 0;
+    for (s64 arg_idx = instr->oper2.imm_s64; arg_idx != -1; )
+    {
+        Ir_Instruction *arg_instr = &routine->instructions[arg_idx];
+        ASSERT(arg_instr->opcode == IR_Arg);
+        arg_idx = arg_instr->oper1.imm_s64;
+        arg_count++;
+    }
+
+    s64 stack_top = interp->stack_top;
+    u64 *args = (u64*)PushStack(interp, arg_count * sizeof(u64), 16);
+    Type **arg_types = (Type**)PushStack(interp, arg_count * sizeof(Type*), 16);
+    if (arg_count > 0 && (!args || !arg_types))
+    {
+        interp->stack_top = stack_top;
+        InterpError(interp, frame, instr, "Stack overflow");
+        return;
+    }
+
+    s64 arg_index = 0;
+    for (s64 arg_idx = instr->oper2.imm_s64; arg_idx != -1; )
+    {
+        Ir_Instruction *arg_instr = &routine->instructions[arg_idx];
+        Interp_Refs *arg_refs = &frame->code->refs[arg_idx];
+        args[arg_index] = Read(interp, frame, arg_instr->target, arg_refs->target);
+        arg_types[arg_index] = arg_instr->target.type;
+        arg_index++;
+        arg_idx = arg_instr->oper1.imm_s64;
+    }
+
+    u64 result = 0;
+    b32 ok = false;
+    if (function->routine)
+    {
+        ok = CallRoutine(interp, frame, instr, function, args, arg_count, &result);
+    }
+    else
+    {
+        Type *return_type = has_result ? instr->target.type : nullptr;
+        ok = CallForeign(interp, frame, instr, function,
+                args, arg_types, arg_count, return_type, &result);
+    }
+    interp->stack_top = stack_top;
+
+    if (ok && has_result)
+    {
+        if (struct_result)
+            AssignStruct(interp, frame, instr, instr->target, refs->target, result);
+        else
+            Write(interp, frame, instr->target, refs->target, result);
+    }
+}
+
+static u64 Arithmetic(Interpreter *interp, Interp_Frame *frame,
+        Ir_Instruction *instr, u64 a, u64 b)
+{
+    u64 result = 0;
+    if (!EvalIrArithmetic(instr->opcode, instr->oper1.type, a, b, &result))
+    {
+        InterpError(interp, frame, instr,
+                (b == 0) ? "Division by zero" : "Division overflow");
+    }
+    return result;
+}
+
+// Runs the instructions of the frame from start, until end is reached or the
+// routine returns.
+static b32 Run(Interpreter *interp, Interp_Frame *frame,
+        s64 start, s64 end, u64 *return_value)
+{
+    Ir_Instruction *instructions = frame->routine->instructions.data;
+    Interp_Refs *all_refs = frame->code->refs;
+    s64 pc = start;
+    while (pc < end && !interp->failed)
+    {
+        if (interp->constant_only && --interp->steps_left < 0)
+        {
+            interp->failed = true;
+            break;
+        }
+
+        Ir_Instruction *instr = &instructions[pc];
+        Interp_Refs *refs = &all_refs[pc];
+        const Ir_Operand &target = instr->target;
+        const Ir_Operand &oper1 = instr->oper1;
+        const Ir_Operand &oper2 = instr->oper2;
+        pc++;
+
+        if (instr->opcode != IR_VarDecl &&
+            (TypeIsVector(target.type) || TypeIsVector(oper1.type)))
+        {
+            InterpError(interp, frame, instr, "Vector operations are not supported at compile time");
+            break;
+        }
+
+        switch (instr->opcode)
+        {
+        case IR_Label:
+        case IR_Arg:
+            break;
+
+        case IR_VarDecl:
+            if (TypeIsStruct(target.type) && target.oper_type != IR_OPER_GlobalVariable)
+            {
+                u8 *storage = GetStorage(interp, frame, instr, refs->target, target.type);
+                frame->cells[refs->target] = (u64)storage;
+            }
+            break;
+
+        case IR_Mov:
+        case IR_Deref:
+            {
+                u64 value = Read(interp, frame, oper1, refs->oper1);
+                if (instr->opcode == IR_Mov && TypeIsStruct(target.type))
+                    AssignStruct(interp, frame, instr, target, refs->target, value);
+                else
+                    Write(interp, frame, target, refs->target, value);
+            } break;
+        case IR_Load:
+            {
+                u64 address = MemoryAddress(interp, frame, oper1, refs->oper1);
+                if (!CheckAddress(interp, frame, instr, address, GetSize(target.type), false))
+                    break;
+                u64 value = TypeIsStruct(target.type) ?
+                    address : LoadValue(target.type, (u8*)address);
+                Write(interp, frame, target, refs->target, value);
+            } break;
+        case IR_Store:
+            {
+                u64 address = MemoryAddress(interp, frame, target, refs->target);
+                u64 value = Read(interp, frame, oper1, refs->oper1);
+                s64 size = GetSize(oper1.type);
+                if (!CheckAddress(interp, frame, instr, address, size, true))
+                    break;
+                if (TypeIsStruct(oper1.type))
+                {
+                    if (CheckAddress(interp, frame, instr, value, size, false))
+                        memmove((u8*)address, (u8*)value, size);
+                }
+                else
+                {
+                    StoreValue(oper1.type, (u8*)address, value);
+                }
+            } break;
+        case IR_MovSX:
+        case IR_MovZX:
+            {
+                u64 value = Read(interp, frame, oper1, refs->oper1);
+                value = EvalIrConversion(instr->opcode, target.type, oper1.type, value);
+                Write(interp, frame, target, refs->target, value);
+            } break;
+        case IR_MovMember:
+        case IR_LoadMemberAddr:
+            {
+                Type *struct_type = oper1.type;
+                if (TypeIsPointer(struct_type))
+                    struct_type = struct_type->base_type;
+                ASSERT(TypeIsStruct(struct_type));
+
+                u64 base = Read(interp, frame, oper1, refs->oper1);
+                u64 address = base + GetStructMemberOffset(struct_type, oper2.imm_s64);
+                if (instr->opcode == IR_LoadMemberAddr || TypeIsStruct(target.type))
+                {
+                    Write(interp, frame, target, refs->target, address);
+                }
+                else if (CheckAddress(interp, frame, instr, address, GetSize(target.type), false))
+                {
+                    Write(interp, frame, target, refs->target,
+                            LoadValue(target.type, (u8*)address));
+                }
+            } break;
+        case IR_MovElement:
+        case IR_LoadElementAddr:
+            {
+                u64 base = Read(interp, frame, oper1, refs->oper1);
+                s64 index = (s64)Read(interp, frame, oper2, refs->oper2);
+                u64 address = base + index * GetAlignedElementSize(oper1.type);
+                if (instr->opcode == IR_LoadElementAddr || TypeIsStruct(target.type))
+                {
+                    Write(interp, frame, target, refs->target, address);
+                }
+                else if (CheckAddress(interp, frame, instr, address, GetSize(target.type), false))
+                {
+                    Write(interp, frame, target, refs->target,
+                            LoadValue(target.type, (u8*)address));
+                }
+            } break;
+
+        case IR_Add: case IR_Sub:
+        case IR_Mul: case IR_Div: case IR_Mod:
+        case IR_LShift: case IR_RShift:
+        case IR_And: case IR_Or: case IR_Xor:
+            {
+                u64 a = Read(interp, frame, oper1, refs->oper1);
+                u64 b = Read(interp, frame, oper2, refs->oper2);
+                u64 value = Arithmetic(interp, frame, instr, a, b);
+                Write(interp, frame, target, refs->target, value);
+            } break;
+        case IR_Neg: case IR_Not: case IR_Compl:
+        case IR_Sqrt:
+            {
+                u64 a = Read(interp, frame, oper1, refs->oper1);
+                u64 value = Arithmetic(interp, frame, instr, a, 0);
+                Write(interp, frame, target, refs->target, value);
+            } break;
+
+        case IR_Eq: case IR_Neq:
+        case IR_Lt: case IR_Leq:
+        case IR_Gt: case IR_Geq:
+            {
+                u64 a = Read(interp, frame, oper1, refs->oper1);
+                u64 b = Read(interp, frame, oper2, refs->oper2);
+                Write(interp, frame, target, refs->target,
+                        EvalIrCompare(instr->opcode, oper1.type, a, b));
+            } break;
+
+        case IR_Addr:
+            {
+                u64 value = TypeIsStruct(oper1.type) ?
+                    Read(interp, frame, oper1, refs->oper1) :
+                    AddressOf(interp, frame, oper1, refs->oper1);
+                Write(interp, frame, target, refs->target, value);
+            } break;
+
+        case IR_Call:
+        case IR_CallForeign:
+            Call(interp, frame, instr);
+            break;
+        case IR_Return:
+            if (target.oper_type != IR_OPER_None)
+                *return_value = Read(interp, frame, target, refs->target);
+            return !interp->failed;
+        case IR_Jump:
+            pc = refs->target;
+            break;
+        case IR_Jz:
+            if (Read(interp, frame, oper1, refs->oper1) == 0)
+                pc = refs->target;
+            break;
+        case IR_Jnz:
+            if (Read(interp, frame, oper1, refs->oper1) != 0)
+                pc = refs->target;
+            break;
+
+        case IR_S_TO_F32:
+        case IR_S_TO_F64:
+        case IR_F32_TO_S:
+        case IR_F64_TO_S:
+        case IR_F32_TO_F64:
+        case IR_F64_TO_F32:
+            {
+                u64 value = Read(interp, frame, oper1, refs->oper1);
+                value = EvalIrConversion(instr->opcode, target.type, oper1.type, value);
+                Write(interp, frame, target, refs->target, value);
+            } break;
+
+        // NOTE(henrik): The vector instructions were refused above.
+        case IR_Broadcast:
+        case IR_Shuffle:
+        case IR_MoveMask:
+        case IR_Phi:
+        case IR_COUNT:
+            INVALID_CODE_PATH;
+            break;
+        }
+    }
+    return !interp->failed;
+}
+
+
+// Compile time execution
+
+static Interpreter NewInterpreter(Ir_Gen_Context *ir_ctx)
+{
+    Interpreter interp = { };
+    interp.ir_ctx = ir_ctx;
+
+    for (s64 i = 0; i < ir_ctx->routines.count; i++)
+    {
+        Ir_Routine *routine = ir_ctx->routines[i];
+        Interp_Function *function = PushStruct<Interp_Function>(&interp.arena);
+        *function = { };
+        function->name = routine->name;
+        function->routine = routine;
+        hashtable::Put(interp.functions, routine->name, function);
+    }
+    for (s64 i = 0; i < ir_ctx->foreign_routines.count; i++)
+    {
+        Name name = ir_ctx->foreign_routines[i];
+        if (LookupFunction(&interp, name)) continue;
+        Interp_Function *function = PushStruct<Interp_Function>(&interp.arena);
+        *function = { };
+        function->name = name;
+        hashtable::Put(interp.functions, name, function);
+    }
+
+    Array<Symbol*> &global_vars = ir_ctx->global_vars;
+    interp.global_offsets = PushArray<s64>(&interp.arena, global_vars.count);
+    s64 globals_size = 0;
+    for (s64 i = 0; i < global_vars.count; i++)
+    {
+        Symbol *symbol = global_vars[i];
+        s64 offset = Align(globals_size, GetAlign(symbol->type));
+        interp.global_offsets[i] = offset;
+        globals_size = offset + GetAlignedSize(symbol->type);
+
+        Interp_Global *global = PushStruct<Interp_Global>(&interp.arena);
+        global->name = symbol->unique_name;
+        global->index = i;
+        hashtable::Put(interp.global_table, global->name, global);
+    }
+    interp.globals = Alloc(globals_size > 0 ? globals_size : 1);
+    memset(interp.globals.ptr, 0, interp.globals.size);
+
+    interp.stack = Alloc(INTERP_STACK_SIZE);
+    return interp;
+}
+
+static void FreeInterpreter(Interpreter *interp)
+{
+#if defined(HP_UNIX)
+    if (interp->library)
+        dlclose(interp->library);
+#endif
+    Free(interp->stack);
+    Free(interp->globals);
+    array::Free(interp->functions);
+    array::Free(interp->global_table);
+    array::Free(interp->const_regions);
+    FreeMemoryArena(&interp->arena);
+}
+
+// Removes the first count instructions of the routine. The labels and the
+// argument lists refer to the instructions by index, so they are moved too.
+static void RemoveInstructions(Ir_Routine *routine, s64 count)
+{
+    if (count == 0) return;
+    InvalidateCfg(routine);
+    Ir_Instruction_List &instructions = routine->instructions;
+    memmove(instructions.data, instructions.data + count,
+            (instructions.count - count) * sizeof(Ir_Instruction));
+    instructions.count -= count;
+
+    for (s64 i = 0; i < instructions.count; i++)
+    {
+        Ir_Instruction *instr = &instructions[i];
+        switch (instr->opcode)
+        {
+            case IR_Label:
+                instr->target.label->target_loc -= count;
+                break;
+            case IR_Arg:
+                if (instr->oper1.imm_s64 != -1)
+                    instr->oper1.imm_s64 -= count;
+                break;
+            case IR_Call:
+            case IR_CallForeign:
+                if (instr->oper2.imm_s64 != -1)
+                    instr->oper2.imm_s64 -= count;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Returns the number of the global variables declared by the first
+// instr_count instructions of the top level routine.
+static s64 CountGlobalDecls(Ir_Routine *top_level, s64 instr_count)
+{
+    s64 count = 0;
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        const Ir_Instruction &instr = top_level->instructions[i];
+        if (instr.opcode == IR_VarDecl && instr.target.oper_type == IR_OPER_GlobalVariable)
+            count++;
+    }
+    return count;
+}
+
+static b32 GlobalChanged(Ir_Gen_Context *ctx, Interpreter *interp, s64 index,
+        const u8 *globals_a, const u8 *globals_b)
+{
+    s64 size = GetAlignedSize(ctx->global_vars[index]->type);
+    s64 offset = interp->global_offsets[index];
+    return memcmp(globals_a + offset, globals_b + offset, size) != 0;
+}
+
+// Stores the values of the first const_count global variables, which were
+// initialized at compile time. The globals changed by the #exec directives
+// get the values left by them; the others get their initial values, as the
+// initialization run at run time may change them again.
+static void BakeGlobals(Ir_Gen_Context *ctx, Interpreter *interp, s64 const_count,
+        const u8 *const_globals, const u8 *init_globals)
+{
+    const u8 *exec_globals = (const u8*)interp->globals.ptr;
+    for (s64 i = 0; i < ctx->global_vars.count; i++)
+    {
+        u8 *data = nullptr;
+        if (i < const_count)
+        {
+            Symbol *symbol = ctx->global_vars[i];
+            s64 size = GetAlignedSize(symbol->type);
+            const u8 *globals = GlobalChanged(ctx, interp, i, init_globals, exec_globals)
+                ? exec_globals : const_globals;
+            const u8 *value = globals + interp->global_offsets[i];
+            for (s64 b = 0; b < size; b++)
+            {
+                if (value[b] != 0)
+                {
+                    data = PushArray<u8>(&ctx->arena, size);
+                    memcpy(data, value, size);
+                    break;
+                }
+            }
+        }
+        array::Push(ctx->global_data, data);
+    }
+}
+
+static void ErrorExec(Ir_Gen_Context *ctx, Interpreter *interp, File_Location file_loc)
+{
+    Compiler_Context *comp_ctx = ctx->comp_ctx;
+    Error_Context *err_ctx = &comp_ctx->error_ctx;
+    AddError(err_ctx, file_loc);
+    PrintFileLocation(err_ctx->file, file_loc);
+    fprintf((FILE*)err_ctx->file, "Compile time execution failed: ");
+    PrintInterpError(interp, err_ctx->file);
+    PrintSourceLineAndArrow(comp_ctx, file_loc);
+}
+
+static void ErrorExecGlobal(Ir_Gen_Context *ctx, File_Location file_loc,
+        Symbol *symbol, const char *message)
+{
+    Compiler_Context *comp_ctx = ctx->comp_ctx;
+    Error_Context *err_ctx = &comp_ctx->error_ctx;
+    AddError(err_ctx, file_loc);
+    PrintFileLocation(err_ctx->file, file_loc);
+    fprintf((FILE*)err_ctx->file, "Compile time execution failed: #exec changes the global '");
+    PrintName(err_ctx->file, symbol->name);
+    fprintf((FILE*)err_ctx->file, "'%s\n", message);
+    PrintSourceLineAndArrow(comp_ctx, file_loc);
+}
+
+// Checks that the changes, made by the #exec directive to the global
+// variables, can be kept in the program. The globals initialized at run time
+// would be overwritten by their initialization, as would the globals changed
+// by the run time initialization of the others.
+static b32 CheckExecGlobals(Ir_Gen_Context *ctx, Interpreter *interp,
+        File_Location file_loc, s64 const_count,
+        const u8 *const_globals, const u8 *init_globals, const u8 *before_globals)
+{
+    const u8 *globals = (const u8*)interp->globals.ptr;
+    for (s64 i = 0; i < ctx->global_vars.count; i++)
+    {
+        if (!GlobalChanged(ctx, interp, i, before_globals, globals))
+            continue;
+        Symbol *symbol = ctx->global_vars[i];
+        if (i >= const_count)
+        {
+            ErrorExecGlobal(ctx, file_loc, symbol,
+                    ", which is initialized at run time");
+            return false;
+        }
+        if (GlobalChanged(ctx, interp, i, const_globals, init_globals))
+        {
+            ErrorExecGlobal(ctx, file_loc, symbol,
+                    ", which is changed by the initialization at run time");
+            return false;
+        }
+        if (GlobalsHaveAddresses(symbol->type, GlobalAddress(interp, i)))
+        {
+            ErrorExecGlobal(ctx, file_loc, symbol,
+                    " to an address, which is not valid at run time");
+            return false;
+        }
+    }
+    return true;
+}
+
+b32 ExecuteCompileTimeCode(Ir_Gen_Context *ctx)
+{
+    // NOTE(henrik): The top level routine is the first routine.
+    Ir_Routine *top_level = ctx->routines[0];
+    ASSERT(top_level->name.str.size == 0);
+
+    Interpreter interp = NewInterpreter(ctx);
+    Interp_Function *top_level_function = LookupFunction(&interp, top_level->name);
+    Interp_Frame frame;
+    if (!NewFrame(&interp, top_level_function, &frame))
+    {
+        FreeInterpreter(&interp);
+        return true;
+    }
+
+    // The global variable declarations are evaluated in order, until one
+    // calls a foreign routine or can not be evaluated otherwise. The
+    // declarations after it are initialized at run time.
+    interp.constant_only = true;
+    interp.steps_left = INTERP_CONST_STEP_LIMIT;
+    Pointer const_globals = Alloc(interp.globals.size);
+    s64 const_end = 0;
+    for (s64 i = 0; i < ctx->global_decl_ends.count; i++)
+    {
+        s64 decl_end = ctx->global_decl_ends[i];
+        memcpy(const_globals.ptr, interp.globals.ptr, interp.globals.size);
+        u64 unused;
+        if (!Run(&interp, &frame, const_end, decl_end, &unused) ||
+            GlobalsHaveAddresses(&interp))
+        {
+            memcpy(interp.globals.ptr, const_globals.ptr, interp.globals.size);
+            interp.failed = false;
+            break;
+        }
+        const_end = decl_end;
+    }
+    memcpy(const_globals.ptr, interp.globals.ptr, interp.globals.size);
+    interp.constant_only = false;
+    s64 const_count = CountGlobalDecls(top_level, const_end);
+
+    b32 result = true;
+    Pointer init_globals = Alloc(interp.globals.size);
+    Pointer before_globals = Alloc(interp.globals.size);
+    memcpy(init_globals.ptr, interp.globals.ptr, interp.globals.size);
+    if (ctx->exec_routines.count > 0)
+    {
+        // The #exec directives see the globals initialized, so the rest of
+        // the initialization is run first, with the foreign calls.
+        u64 unused;
+        if (!Run(&interp, &frame, const_end, top_level->instructions.count, &unused))
+        {
+            ErrorExec(ctx, &interp, ctx->exec_locations[0]);
+            result = false;
+        }
+        memcpy(init_globals.ptr, interp.globals.ptr, interp.globals.size);
+        for (s64 i = 0; i < ctx->exec_routines.count && result; i++)
+        {
+            Interp_Function exec_function = { };
+            exec_function.name = ctx->exec_routines[i]->name;
+            exec_function.routine = ctx->exec_routines[i];
+            memcpy(before_globals.ptr, interp.globals.ptr, interp.globals.size);
+            if (!CallRoutine(&interp, nullptr, nullptr, &exec_function, nullptr, 0, &unused))
+            {
+                ErrorExec(ctx, &interp, ctx->exec_locations[i]);
+                result = false;
+            }
+            else
+            {
+                result = CheckExecGlobals(ctx, &interp, ctx->exec_locations[i],
+                        const_count, (const u8*)const_globals.ptr,
+                        (const u8*)init_globals.ptr, (const u8*)before_globals.ptr);
+            }
+        }
+        // NOTE(henrik): Flush the output of the foreign routines, so that it
+        // is not mixed with the output of the compiler.
+        fflush(nullptr);
+    }
+
+    if (result && const_end > 0)
+    {
+        // NOTE(henrik): The changes made by the #exec directives to the
+        // globals initialized at compile time are kept; the rest of the
+        // initialization is run at run time.
+        BakeGlobals(ctx, &interp, const_count,
+                (const u8*)const_globals.ptr, (const u8*)init_globals.ptr);
+        RemoveInstructions(top_level, const_end);
+    }
+
+    Free(before_globals);
+    Free(init_globals);
+    Free(const_globals);
+    FreeInterpreter(&interp);
+    return result;
+}
+
+} // hplang
@@ -0,0 +1,22 @@
+#ifndef H_HPLANG_IR_INTERPRETER_H
+
+#include "types.h"
+
+namespace hplang
+{
+
+struct Ir_Gen_Context;
+
+// Runs the initialization of the global variables and the #exec directives of
+// the program in the compiler. The global variable declarations, that are
+// initialized without calling foreign routines, are evaluated at compile
+// time; their values are stored to ctx->global_data and their initialization
+// is removed from the top level routine, with the changes made to them by the
+// #exec directives. Returns false and reports the errors, if an #exec
+// directive fails or changes a global, that is initialized at run time.
+b32 ExecuteCompileTimeCode(Ir_Gen_Context *ctx);
+
+} // hplang
+
+#define H_HPLANG_IR_INTERPRETER_H
+#endif
@@ -0,0 +1,568 @@
+
+#include "ir_licm.h"
+#include "ir_ssa.h"
+#include "ir_cfg.h"
+#include "ir_gen.h"
+#include "symbols.h"
+#include "hashtable.h"
+#include "common.h"
+#include "assert.h"
+
+// The loop invariant code motion [1] on the SSA form. The instructions are
+// visited in the reverse postorder, so the definitions of the operands are
+// visited before their uses. Each instruction is moved out of the loops
+// containing it, from the innermost outwards, as long as its operands are
+// defined outside the loop.
+//
+// A loop gets a preheader, if its header has only one predecessor outside
+// the loop. If the predecessor jumps only to the header, the instructions are
+// moved to the end of the predecessor; if it falls through to the header, and
+// jumps elsewhere too, a new block is made between it and the header.
+//
+// [1]  Alfred V. Aho, Ravi Sethi and Jeffrey D. Ullman, 1986.
+//      Compilers: Principles, Techniques, and Tools. Section 10.7.
+
+namespace hplang
+{
+
+struct Licm_Name
+{
+    Name name;
+    s64 def_count;
+    s64 def_index;          // The instruction defining the name
+    b32 is_arg;
+    b32 addr_taken;         // The address of the variable may be stored
+};
+
+struct Licm_Loop
+{
+    Ir_Loop *loop;
+
+    // The block before the header, to which the instructions are moved, or
+    // null, if the loop does not have one.
+    Ir_Block *preheader;
+    b32 new_block;          // The instructions are moved to a new block
+    s64 insert_at;          // The instruction before which they are inserted
+    // The block, that is executed when the moved instructions are.
+    Ir_Block *exec_block;
+
+    Array<Ir_Block*> exits;     // The blocks jumping out of the loop
+
+    b32 has_call;
+    b32 has_store;
+    Array<Name> written_vars;   // The variables in memory written in the loop
+    Array<Name> written_globals;
+
+    Array<s64> hoisted;         // The moved instructions in order
+};
+
+struct Licm
+{
+    Memory_Arena arena;
+    Ir_Gen_Context *ctx;
+    Ir_Routine *routine;
+    Ir_Cfg *cfg;
+
+    Array<Licm_Name*> name_table;
+    Array<Licm_Name*> names;
+
+    Array<Licm_Loop> loops;     // Indexed by Ir_Loop::index
+    s64 *hoisted_to;            // The loop index of each moved instruction, or -1
+};
+
+static Licm_Name* LookupName(Licm *l, const Ir_Operand &oper)
+{
+    if (!IsIrLocal(oper)) return nullptr;
+    return hashtable::Lookup(l->name_table, GetIrLocalName(oper));
+}
+
+static Licm_Name* AddName(Licm *l, const Ir_Operand &oper)
+{
+    Licm_Name *name = LookupName(l, oper);
+    if (name) return name;
+    name = PushStruct<Licm_Name>(&l->arena);
+    *name = { };
+    name->name = GetIrLocalName(oper);
+    name->def_index = -1;
+    hashtable::Put(l->name_table, name->name, name);
+    array::Push(l->names, name);
+    return name;
+}
+
+static void CollectNames(Licm *l)
+{
+    Ir_Routine *routine = l->routine;
+    s64 instr_count = routine->instructions.count;
+    array::Resize(l->name_table, 2 * instr_count + routine->arg_count + 31);
+
+    for (s64 i = 0; i < routine->arg_count; i++)
+    {
+        if (IsIrLocal(routine->args[i]))
+            AddName(l, routine->args[i])->is_arg = true;
+    }
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode == IR_Phi || IsIrDefinition(instr))
+        {
+            if (IsIrLocal(instr->target))
+            {
+                Licm_Name *name = AddName(l, instr->target);
+                name->def_count++;
+                name->def_index = i;
+            }
+        }
+        // NOTE(henrik): The address of a struct member points into the
+        // variable as well.
+        if ((instr->opcode == IR_Addr ||
+             (instr->opcode == IR_LoadMemberAddr && TypeIsStruct(instr->oper1.type))) &&
+            IsIrLocal(instr->oper1))
+        {
+            AddName(l, instr->oper1)->addr_taken = true;
+        }
+    }
+}
+
+static b32 IsSsaValue(Licm *l, const Ir_Operand &oper)
+{
+    Licm_Name *name = LookupName(l, oper);
+    if (!name || name->addr_taken || TypeIsStruct(oper.type))
+        return false;
+    return name->def_count == 1 || (name->def_count == 0 && name->is_arg);
+}
+
+static b32 InLoop(const Ir_Block *block, const Ir_Loop *loop)
+{
+    for (Ir_Loop *l = block->loop; l; l = l->parent)
+    {
+        if (l == loop) return true;
+    }
+    return false;
+}
+
+static b32 IsJump(Ir_Opcode opcode)
+{
+    return opcode == IR_Jump || opcode == IR_Jz || opcode == IR_Jnz;
+}
+
+
+// Loops
+
+static void FindPreheader(Licm *l, Licm_Loop *ll)
+{
+    Ir_Block *header = ll->loop->header;
+    Ir_Block *pred = nullptr;
+    for (s64 p = 0; p < header->preds.count; p++)
+    {
+        Ir_Block *block = header->preds[p];
+        if (block->rpo_index == -1 || InLoop(block, ll->loop)) continue;
+        if (pred) return;
+        pred = block;
+    }
+    if (!pred) return;
+
+    Ir_Instruction *last = &l->routine->instructions[pred->end - 1];
+    if (pred->succs.count == 1)
+    {
+        ll->preheader = pred;
+        ll->insert_at = IsJump(last->opcode) ? pred->end - 1 : pred->end;
+        ll->exec_block = pred;
+    }
+    else if (pred->end == header->start)
+    {
+        ll->preheader = pred;
+        ll->new_block = true;
+        ll->insert_at = header->start;
+        ll->exec_block = header;
+    }
+}
+
+static void AddWrittenName(Array<Name> &names, Name name)
+{
+    for (s64 i = 0; i < names.count; i++)
+    {
+        if (names[i] == name) return;
+    }
+    array::Push(names, name);
+}
+
+static b32 IsWrittenName(const Array<Name> &names, Name name)
+{
+    for (s64 i = 0; i < names.count; i++)
+    {
+        if (names.data[i] == name) return true;
+    }
+    return false;
+}
+
+static void AddWrite(Licm *l, Licm_Loop *ll, Ir_Instruction *instr)
+{
+    switch (instr->opcode)
+    {
+        case IR_Store:
+            ll->has_store = true;
+            return;
+        case IR_Call: case IR_CallForeign:
+            ll->has_call = true;
+            return;
+        case IR_VarDecl:
+            break;
+        default:
+            if (!IsIrDefinition(instr)) return;
+            break;
+    }
+    if (instr->target.oper_type == IR_OPER_GlobalVariable)
+        AddWrittenName(ll->written_globals, instr->target.var.name);
+    else if (IsIrLocal(instr->target) && !IsSsaValue(l, instr->target))
+        AddWrittenName(ll->written_vars, GetIrLocalName(instr->target));
+}
+
+static void SummarizeLoops(Licm *l)
+{
+    Ir_Cfg *cfg = l->cfg;
+    array::Resize(l->loops, cfg->loops.count);
+    for (s64 i = 0; i < cfg->loops.count; i++)
+    {
+        Licm_Loop *ll = &l->loops[i];
+        ll->loop = cfg->loops[i];
+        FindPreheader(l, ll);
+
+        Array<Ir_Block*> &blocks = ll->loop->blocks;
+        for (s64 b = 0; b < blocks.count; b++)
+        {
+            Ir_Block *block = blocks[b];
+            for (s64 s = 0; s < block->succs.count; s++)
+            {
+                if (!InLoop(block->succs[s], ll->loop))
+                {
+                    array::Push(ll->exits, block);
+                    break;
+                }
+            }
+        }
+    }
+
+    for (s64 b = 0; b < cfg->rpo.count; b++)
+    {
+        Ir_Block *block = cfg->rpo[b];
+        if (!block->loop) continue;
+        for (s64 i = block->start; i < block->end; i++)
+        {
+            Ir_Instruction *instr = &l->routine->instructions[i];
+            for (Ir_Loop *loop = block->loop; loop; loop = loop->parent)
+                AddWrite(l, &l->loops[loop->index], instr);
+        }
+    }
+}
+
+static void FreeLoop(Licm_Loop *ll)
+{
+    array::Free(ll->exits);
+    array::Free(ll->written_vars);
+    array::Free(ll->written_globals);
+    array::Free(ll->hoisted);
+}
+
+
+// Hoisting
+
+// Returns true, if the block is executed every time the loop is entered,
+// i.e. the loop cannot be left without executing the block.
+static b32 IsAlwaysExecuted(Licm_Loop *ll, Ir_Block *block)
+{
+    if (ll->exits.count == 0) return false;
+    for (s64 i = 0; i < ll->exits.count; i++)
+    {
+        if (!Dominates(block, ll->exits[i]))
+            return false;
+    }
+    return true;
+}
+
+// Returns true, if the instruction defining the name is in the loop.
+static b32 IsDefinedInLoop(Licm *l, s64 def_index, Ir_Loop *loop)
+{
+    s64 hoisted_to = l->hoisted_to[def_index];
+    if (hoisted_to == -1)
+        return InLoop(l->cfg->instr_blocks[def_index], loop);
+    // NOTE(henrik): The preheader of an inner loop is inside the loop.
+    Ir_Loop *inner = l->loops[hoisted_to].loop;
+    return inner != loop && InLoop(inner->header, loop);
+}
+
+static b32 IsAddressOperand(Ir_Instruction *instr, const Ir_Operand &oper)
+{
+    if (&oper != &instr->oper1) return false;
+    if (instr->opcode == IR_Addr) return true;
+    return instr->opcode == IR_LoadMemberAddr && TypeIsStruct(oper.type);
+}
+
+static b32 IsInvariantOperand(Licm *l, Licm_Loop *ll,
+        Ir_Instruction *instr, const Ir_Operand &oper)
+{
+    switch (oper.oper_type)
+    {
+        case IR_OPER_None:
+        case IR_OPER_Immediate:
+        case IR_OPER_Routine:
+        case IR_OPER_ForeignRoutine:
+            return true;
+        case IR_OPER_GlobalVariable:
+            if (IsAddressOperand(instr, oper))
+                return true;
+            return !ll->has_call && !ll->has_store &&
+                !IsWrittenName(ll->written_globals, oper.var.name);
+        case IR_OPER_Variable:
+        case IR_OPER_Temp:
+            break;
+        default:
+            return false;
+    }
+    if (IsAddressOperand(instr, oper))
+        return true;
+
+    Licm_Name *name = LookupName(l, oper);
+    ASSERT(name);
+    if (IsSsaValue(l, oper))
+    {
+        if (name->def_count == 0) return true;
+        return !IsDefinedInLoop(l, name->def_index, ll->loop);
+    }
+    // NOTE(henrik): Only a store or a call can change a variable, whose
+    // address is taken, without naming it.
+    if (name->addr_taken && (ll->has_call || ll->has_store))
+        return false;
+    return !IsWrittenName(ll->written_vars, name->name);
+}
+
+static b32 IsHoistableOp(Ir_Instruction *instr)
+{
+    switch (instr->opcode)
+    {
+        // NOTE(henrik): The moves of the constants are cheaper to repeat than
+        // to keep in a register.
+        case IR_Mov:
+            return instr->oper1.oper_type != IR_OPER_Immediate;
+        // NOTE(henrik): The code generator stores a variable in a register
+        // back to memory, when its address is taken, so the address of a
+        // variable must stay after the preceding writes to the variable.
+        case IR_Addr:
+            return instr->oper1.oper_type == IR_OPER_GlobalVariable ||
+                TypeIsStruct(instr->oper1.type);
+        case IR_MovSX: case IR_MovZX:
+        case IR_LoadMemberAddr: case IR_LoadElementAddr:
+        case IR_Add: case IR_Sub:
+        case IR_Mul: case IR_Div: case IR_Mod:
+        case IR_LShift: case IR_RShift:
+        case IR_Eq: case IR_Neq:
+        case IR_Lt: case IR_Leq:
+        case IR_Gt: case IR_Geq:
+        case IR_And: case IR_Or: case IR_Xor:
+        case IR_Neg: case IR_Not: case IR_Compl:
+        case IR_S_TO_F32: case IR_S_TO_F64:
+        case IR_F32_TO_S: case IR_F64_TO_S:
+        case IR_F32_TO_F64: case IR_F64_TO_F32:
+        case IR_Sqrt:
+        case IR_Broadcast: case IR_Shuffle: case IR_MoveMask:
+        case IR_Load: case IR_MovMember: case IR_MovElement:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+static b32 LoadsThroughPointer(Ir_Instruction *instr)
+{
+    switch (instr->opcode)
+    {
+        case IR_Load: case IR_MovElement:
+            return true;
+        case IR_MovMember:
+            return TypeIsPointer(instr->oper1.type);
+        default:
+            break;
+    }
+    return false;
+}
+
+static b32 CanTrap(Ir_Instruction *instr)
+{
+    if (instr->opcode == IR_Div || instr->opcode == IR_Mod)
+        return !TypeIsFloat(instr->target.type);
+    return LoadsThroughPointer(instr);
+}
+
+static b32 CanHoist(Licm *l, Licm_Loop *ll, Ir_Instruction *instr, Ir_Block *exec_block)
+{
+    if (!IsInvariantOperand(l, ll, instr, instr->oper1) ||
+        !IsInvariantOperand(l, ll, instr, instr->oper2))
+    {
+        return false;
+    }
+    // NOTE(henrik): The pointer may be valid only, when the loop is entered,
+    // and the memory must not change in the loop.
+    if (LoadsThroughPointer(instr))
+    {
+        if (ll->has_call || ll->has_store ||
+            ll->written_vars.count > 0 || ll->written_globals.count > 0)
+        {
+            return false;
+        }
+    }
+    // NOTE(henrik): A faulting instruction can be moved, only if it would be
+    // executed anyway, and nothing observable happens in the loop before it.
+    if (CanTrap(instr))
+    {
+        if (ll->has_call || !IsAlwaysExecuted(ll, exec_block))
+            return false;
+    }
+    return true;
+}
+
+static void HoistInstruction(Licm *l, Ir_Block *block, s64 index)
+{
+    Ir_Instruction *instr = &l->routine->instructions[index];
+    if (!IsHoistableOp(instr) || !IsIrDefinition(instr) ||
+        !IsSsaValue(l, instr->target))
+    {
+        return;
+    }
+
+    Ir_Block *exec_block = block;
+    for (Ir_Loop *loop = block->loop; loop; loop = loop->parent)
+    {
+        Licm_Loop *ll = &l->loops[loop->index];
+        if (!ll->preheader) continue;
+        if (!CanHoist(l, ll, instr, exec_block)) break;
+        l->hoisted_to[index] = loop->index;
+        exec_block = ll->exec_block;
+    }
+    if (l->hoisted_to[index] != -1)
+        array::Push(l->loops[l->hoisted_to[index]].hoisted, index);
+}
+
+static void HoistInstructions(Licm *l)
+{
+    Ir_Cfg *cfg = l->cfg;
+    for (s64 b = 0; b < cfg->rpo.count; b++)
+    {
+        Ir_Block *block = cfg->rpo[b];
+        if (!block->loop) continue;
+        for (s64 i = block->start; i < block->end; i++)
+            HoistInstruction(l, block, i);
+    }
+}
+
+static Ir_Instruction LabelInstruction(Ir_Operand label)
+{
+    Ir_Instruction instr = { };
+    instr.opcode = IR_Label;
+    instr.target = label;
+    return instr;
+}
+
+static void RewriteRoutine(Licm *l)
+{
+    Ir_Routine *routine = l->routine;
+    s64 instr_count = routine->instructions.count;
+    s64 *insert_loop = PushArray<s64>(&l->arena, instr_count);
+    for (s64 i = 0; i < instr_count; i++)
+        insert_loop[i] = -1;
+
+    b32 changed = false;
+    for (s64 i = 0; i < l->loops.count; i++)
+    {
+        Licm_Loop *ll = &l->loops[i];
+        if (ll->hoisted.count == 0) continue;
+        ASSERT(insert_loop[ll->insert_at] == -1);
+        insert_loop[ll->insert_at] = i;
+        changed = true;
+    }
+    if (!changed) return;
+
+    Ir_Rewrite rw;
+    BeginRewrite(&rw, routine);
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        if (insert_loop[i] != -1)
+        {
+            Licm_Loop *ll = &l->loops[insert_loop[i]];
+            if (ll->new_block)
+            {
+                // NOTE(henrik): The phis of the header get their values from
+                // the new block instead of the old predecessor.
+                Ir_Operand label = NewIrLabel(l->ctx, routine);
+                Ir_Label *pred_label = routine->instructions[ll->preheader->start].target.label;
+                Ir_Block *header = ll->loop->header;
+                for (s64 p = header->start; p < header->end; p++)
+                {
+                    Ir_Instruction *phi_instr = &routine->instructions[p];
+                    if (phi_instr->opcode != IR_Phi) continue;
+                    Ir_Phi *phi = phi_instr->oper1.phi;
+                    for (s64 a = 0; a < phi->args.count; a++)
+                    {
+                        if (phi->args[a].pred == pred_label)
+                            phi->args.data[a].pred = label.label;
+                    }
+                }
+                PushInstruction(&rw, LabelInstruction(label));
+            }
+            for (s64 h = 0; h < ll->hoisted.count; h++)
+            {
+                PushInstruction(&rw, routine->instructions[ll->hoisted[h]]);
+                l->ctx->opt_counts.hoisted_instrs++;
+            }
+        }
+        if (l->hoisted_to[i] != -1)
+            continue;
+        CopyInstruction(&rw, i);
+    }
+    EndRewrite(&rw);
+}
+
+static void FreeLicm(Licm *l)
+{
+    for (s64 i = 0; i < l->loops.count; i++)
+        FreeLoop(&l->loops[i]);
+    array::Free(l->loops);
+    array::Free(l->name_table);
+    array::Free(l->names);
+    FreeMemoryArena(&l->arena);
+}
+
+void HoistLoopInvariants(Ir_Gen_Context *ctx, Ir_Routine *routine)
+{
+    if (routine->instructions.count == 0)
+        return;
+
+    Licm licm = { };
+    Licm *l = &licm;
+    l->ctx = ctx;
+    l->routine = routine;
+    l->cfg = GetCfg(routine);
+    if (l->cfg->loops.count == 0)
+        return;
+
+    s64 instr_count = routine->instructions.count;
+    l->hoisted_to = PushArray<s64>(&l->arena, instr_count);
+    for (s64 i = 0; i < instr_count; i++)
+        l->hoisted_to[i] = -1;
+
+    CollectNames(l);
+    SummarizeLoops(l);
+    HoistInstructions(l);
+    RewriteRoutine(l);
+
+    FreeLicm(l);
+}
+
+void HoistLoopInvariants(Ir_Gen_Context *ctx)
+{
+    for (s64 i = 0; i < ctx->routines.count; i++)
+    {
+        HoistLoopInvariants(ctx, ctx->routines[i]);
+    }
+}
+
+} // hplang
@@ -0,0 +1,23 @@
+#ifndef H_HPLANG_IR_LICM_H
+
+#include "ir_types.h"
+
+namespace hplang
+{
+
+struct Ir_Gen_Context;
+
+// Moves the loop invariant computations of the routine in the SSA form to
+// the preheaders of the loops, starting from the innermost loops. The pure
+// instructions, whose operands are defined outside the loop, are moved, as
+// are the loads, when the loop cannot store to the loaded memory. The loads
+// through pointers and the integer divisions are moved only from the blocks,
+// that are executed on every iteration, so that they do not fault where the
+// original program did not.
+void HoistLoopInvariants(Ir_Gen_Context *ctx, Ir_Routine *routine);
+void HoistLoopInvariants(Ir_Gen_Context *ctx);
+
+} // hplang
+
+#define H_HPLANG_IR_LICM_H
+#endif
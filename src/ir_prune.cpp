@@ -0,0 +1,218 @@
+#include "ir_prune.h"
+#include "ir_cfg.h"
+#include "ir_gen.h"
+#include "symbols.h"
+#include "hashtable.h"
+#include "common.h"
+#include "assert.h"
+
+// The dead routine and global variable elimination walks the call graph [1]
+// from the program entry: the top level routine, which initializes the
+// global variables, and main. Every routine, foreign routine and global
+// variable referenced by an operand of a reached routine is reached. A global
+// variable that the top level routine only declares and assigns is not
+// reached by the declaration and the assignment.
+//
+// [1]  Barbara G. Ryder, 1979.
+//      Constructing the Call Graph of a Program.
+
+namespace hplang
+{
+
+struct Prune_Entry
+{
+    Name name;
+    s64 index;              // The index in the list of the context
+    b32 reached;
+};
+
+struct Pruner
+{
+    Memory_Arena arena;
+    Ir_Gen_Context *ctx;
+
+    Array<Prune_Entry*> routines;
+    Array<Prune_Entry*> foreign_routines;
+    Array<Prune_Entry*> globals;
+
+    Array<s64> worklist;    // The reached routines not scanned yet
+};
+
+static void PutEntry(Pruner *pr, Array<Prune_Entry*> &table, Name name, s64 index)
+{
+    Prune_Entry *entry = PushStruct<Prune_Entry>(&pr->arena);
+    *entry = { };
+    entry->name = name;
+    entry->index = index;
+    entry->reached = false;
+    hashtable::Put(table, name, entry);
+}
+
+static void ReachRoutine(Pruner *pr, Name name)
+{
+    Prune_Entry *entry = hashtable::Lookup(pr->routines, name);
+    if (entry && !entry->reached)
+    {
+        entry->reached = true;
+        array::Push(pr->worklist, entry->index);
+    }
+}
+
+static void ReachEntry(Array<Prune_Entry*> &table, Name name)
+{
+    Prune_Entry *entry = hashtable::Lookup(table, name);
+    if (entry)
+        entry->reached = true;
+}
+
+static void ReachOperand(Pruner *pr, const Ir_Operand &oper)
+{
+    switch (oper.oper_type)
+    {
+        case IR_OPER_Routine:
+            ReachRoutine(pr, oper.var.name);
+            break;
+        case IR_OPER_ForeignRoutine:
+            ReachEntry(pr->foreign_routines, oper.var.name);
+            break;
+        case IR_OPER_GlobalVariable:
+            ReachEntry(pr->globals, oper.var.name);
+            break;
+        default:
+            break;
+    }
+}
+
+// Returns true, if the instruction of the top level routine only declares
+// or assigns a global variable, so that it is removed with the variable.
+static b32 IsGlobalInit(const Ir_Instruction *instr)
+{
+    if (instr->target.oper_type != IR_OPER_GlobalVariable)
+        return false;
+    return instr->opcode == IR_VarDecl || instr->opcode == IR_Mov;
+}
+
+static void ScanRoutine(Pruner *pr, Ir_Routine *routine, b32 toplevel)
+{
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        const Ir_Instruction *instr = &routine->instructions[i];
+        if (!(toplevel && IsGlobalInit(instr)))
+            ReachOperand(pr, instr->target);
+        ReachOperand(pr, instr->oper1);
+        ReachOperand(pr, instr->oper2);
+    }
+}
+
+static b32 IsReached(Array<Prune_Entry*> &table, Name name)
+{
+    Prune_Entry *entry = hashtable::Lookup(table, name);
+    return !entry || entry->reached;
+}
+
+static void RemoveGlobalInits(Pruner *pr, Ir_Routine *routine)
+{
+    b32 has_dead_inits = false;
+    for (s64 i = 0; i < routine->instructions.count && !has_dead_inits; i++)
+    {
+        const Ir_Instruction *instr = &routine->instructions[i];
+        if (IsGlobalInit(instr) && !IsReached(pr->globals, instr->target.var.name))
+            has_dead_inits = true;
+    }
+    if (!has_dead_inits) return;
+
+    Ir_Rewrite rw;
+    BeginRewrite(&rw, routine);
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        const Ir_Instruction *instr = &routine->instructions[i];
+        if (IsGlobalInit(instr) && !IsReached(pr->globals, instr->target.var.name))
+            continue;
+        CopyInstruction(&rw, i);
+    }
+    EndRewrite(&rw);
+}
+
+void PruneProgram(Ir_Gen_Context *ctx)
+{
+    // NOTE(henrik): The top level routine is the first routine.
+    Ir_Routine_List &routines = ctx->routines;
+    if (routines.count == 0) return;
+    ASSERT(routines[0]->name.str.size == 0);
+
+    Pruner pruner = { };
+    Pruner *pr = &pruner;
+    pr->ctx = ctx;
+
+    array::Resize(pr->routines, 2 * routines.count + 31);
+    for (s64 i = 0; i < routines.count; i++)
+        PutEntry(pr, pr->routines, routines[i]->name, i);
+    array::Resize(pr->foreign_routines, 2 * ctx->foreign_routines.count + 31);
+    for (s64 i = 0; i < ctx->foreign_routines.count; i++)
+        PutEntry(pr, pr->foreign_routines, ctx->foreign_routines[i], i);
+    array::Resize(pr->globals, 2 * ctx->global_vars.count + 31);
+    for (s64 i = 0; i < ctx->global_vars.count; i++)
+        PutEntry(pr, pr->globals, ctx->global_vars[i]->unique_name, i);
+
+    // NOTE(henrik): The entry routine calls exit after main returns.
+    ReachRoutine(pr, routines[0]->name);
+    ReachRoutine(pr, ctx->env->main_func_name);
+    ReachEntry(pr->foreign_routines, MakeConstName("exit"));
+
+    while (pr->worklist.count > 0)
+    {
+        s64 index = array::Back(pr->worklist);
+        array::Pop(pr->worklist);
+        ScanRoutine(pr, routines[index], index == 0);
+    }
+
+    RemoveGlobalInits(pr, routines[0]);
+
+    s64 count = 0;
+    for (s64 i = 0; i < routines.count; i++)
+    {
+        Ir_Routine *routine = routines[i];
+        if (IsReached(pr->routines, routine->name))
+            routines[count++] = routine;
+        else
+            FreeRoutine(routine);
+    }
+    ctx->opt_counts.removed_routines += routines.count - count;
+    routines.count = count;
+
+    count = 0;
+    for (s64 i = 0; i < ctx->foreign_routines.count; i++)
+    {
+        Name name = ctx->foreign_routines[i];
+        if (IsReached(pr->foreign_routines, name))
+            ctx->foreign_routines[count++] = name;
+    }
+    ctx->opt_counts.removed_routines += ctx->foreign_routines.count - count;
+    ctx->foreign_routines.count = count;
+
+    // NOTE(henrik): The initial values are parallel to the global variables,
+    // if the compile time execution has set them.
+    b32 has_data = (ctx->global_data.count == ctx->global_vars.count);
+    count = 0;
+    for (s64 i = 0; i < ctx->global_vars.count; i++)
+    {
+        Symbol *symbol = ctx->global_vars[i];
+        if (!IsReached(pr->globals, symbol->unique_name))
+            continue;
+        if (has_data)
+            ctx->global_data[count] = ctx->global_data[i];
+        ctx->global_vars[count++] = symbol;
+    }
+    ctx->opt_counts.removed_globals += ctx->global_vars.count - count;
+    ctx->global_vars.count = count;
+    if (has_data)
+        ctx->global_data.count = count;
+
+    array::Free(pr->routines);
+    array::Free(pr->foreign_routines);
+    array::Free(pr->globals);
+    array::Free(pr->worklist);
+    FreeMemoryArena(&pr->arena);
+}
+
+} // hplang
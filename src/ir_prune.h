@@ -0,0 +1,20 @@
+#ifndef H_HPLANG_IR_PRUNE_H
+
+#include "ir_types.h"
+
+namespace hplang
+{
+
+struct Ir_Gen_Context;
+
+// Removes the routines, the foreign routines and the global variables, that
+// are not referenced by the code reachable from the program entry, i.e. the
+// top level routine and main. The initialization of a removed global variable
+// is removed from the top level routine, but the calls made to compute the
+// initial value are kept. Runs after the SSA destruction.
+void PruneProgram(Ir_Gen_Context *ctx);
+
+} // hplang
+
+#define H_HPLANG_IR_PRUNE_H
+#endif
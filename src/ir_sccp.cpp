@@ -0,0 +1,760 @@
+
+#include "ir_sccp.h"
+#include "ir_ssa.h"
+#include "ir_cfg.h"
+#include "ir_gen.h"
+#include "ir_eval.h"
+#include "symbols.h"
+#include "hashtable.h"
+#include "common.h"
+#include "assert.h"
+
+#include <cstdint>
+
+// The sparse conditional constant propagation by Wegman and Zadeck [1]. The
+// values of the SSA names are found optimistically: a name is undefined
+// until an executable definition gives it a value, and only the blocks
+// reached through the executable edges are evaluated. The values are
+// computed with the same operations as the interpreter uses, so they follow
+// the width and the signedness of the operand types.
+//
+// [1]  Mark N. Wegman and F. Kenneth Zadeck, 1991.
+//      Constant Propagation with Conditional Branches.
+
+namespace hplang
+{
+
+enum Sccp_State
+{
+    SCCP_Undefined,
+    SCCP_Const,
+    SCCP_Varying,
+};
+
+struct Sccp_Lattice
+{
+    Sccp_State state;
+    u64 value;
+};
+
+struct Sccp_Value
+{
+    Name name;
+    Type *type;
+    s64 def_count;
+    Sccp_Lattice lattice;
+
+    Array<s64> uses;        // The instructions using the value
+    b32 keep_def;           // The value has uses, that cannot be replaced
+};
+
+struct Sccp_Block
+{
+    b32 visited;
+    Ir_Block *jump_target;  // The block jumped to from the end of the block
+    Ir_Block *fall;         // The block falling through from the block
+    b32 jump_executable;
+    b32 fall_executable;
+};
+
+struct Sccp
+{
+    Memory_Arena arena;
+    Ir_Gen_Context *ctx;
+    Ir_Routine *routine;
+    Ir_Cfg *cfg;
+
+    Array<Sccp_Value*> value_table;
+    Array<Sccp_Value*> values;
+    Sccp_Block *blocks;
+
+    Array<Ir_Block*> flow_worklist;
+    Array<Sccp_Value*> ssa_worklist;
+};
+
+static const Sccp_Lattice sccp_varying = { SCCP_Varying, 0 };
+
+static Sccp_Lattice ConstLattice(u64 value)
+{
+    Sccp_Lattice lattice = { SCCP_Const, value };
+    return lattice;
+}
+
+// The constants are tracked only for the scalar types, whose values the
+// ir_eval operations know.
+static b32 IsConstType(Type *type)
+{
+    if (!type) return false;
+    switch (type->tag)
+    {
+        case TYP_bool: case TYP_char:
+        case TYP_u8: case TYP_s8:
+        case TYP_u16: case TYP_s16:
+        case TYP_u32: case TYP_s32:
+        case TYP_u64: case TYP_s64:
+        case TYP_f32: case TYP_f64:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// NOTE(henrik): The generated code encodes the integer immediates of the
+// arithmetic and the stores in 32 bits, sign extended for the 64 bit
+// operations; the 64 bit constants, that do not fit, are left in registers.
+static b32 IsImmediateValue(Type *type, u64 value)
+{
+    if (TypeIsFloat(type) || GetSize(type) < 8)
+        return true;
+    return (s64)value >= INT32_MIN && (s64)value <= INT32_MAX;
+}
+
+static Ir_Operand ImmediateOperand(Type *type, u64 value)
+{
+    Ir_Operand oper = { };
+    oper.oper_type = IR_OPER_Immediate;
+    oper.type = type;
+    oper.imm_u64 = value;
+    return oper;
+}
+
+static Sccp_Value* LookupValue(Sccp *s, const Ir_Operand &oper)
+{
+    if (!IsIrLocal(oper)) return nullptr;
+    return hashtable::Lookup(s->value_table, GetIrLocalName(oper));
+}
+
+static Sccp_Value* AddValue(Sccp *s, const Ir_Operand &oper)
+{
+    Sccp_Value *value = LookupValue(s, oper);
+    if (value) return value;
+    value = PushStruct<Sccp_Value>(&s->arena);
+    *value = { };
+    value->name = GetIrLocalName(oper);
+    value->type = oper.type;
+    value->lattice.state = SCCP_Undefined;
+    hashtable::Put(s->value_table, value->name, value);
+    array::Push(s->values, value);
+    return value;
+}
+
+static Sccp_Lattice GetLattice(Sccp *s, const Ir_Operand &oper)
+{
+    if (oper.oper_type == IR_OPER_Immediate && IsConstType(oper.type))
+        return ConstLattice(NormalizeIrValue(oper.type, oper.imm_u64));
+    Sccp_Value *value = LookupValue(s, oper);
+    if (value) return value->lattice;
+    return sccp_varying;
+}
+
+static b32 IsConstValue(Sccp_Value *value)
+{
+    return value && value->lattice.state == SCCP_Const;
+}
+
+
+// Collecting the values
+
+// Collects the SSA names, that can be constants. The names with other than
+// exactly one definition, e.g. the arguments and the variables, whose address
+// is taken, are varying.
+static void CollectValues(Sccp *s)
+{
+    Ir_Routine *routine = s->routine;
+    s64 instr_count = routine->instructions.count;
+    array::Resize(s->value_table, 2 * instr_count + routine->arg_count + 31);
+
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode == IR_Phi || IsIrDefinition(instr))
+        {
+            if (IsIrLocal(instr->target))
+                AddValue(s, instr->target)->def_count++;
+        }
+        if (instr->opcode == IR_Addr && IsIrLocal(instr->oper1))
+            AddValue(s, instr->oper1)->def_count = -1;
+    }
+    for (s64 i = 0; i < routine->arg_count; i++)
+    {
+        if (IsIrLocal(routine->args[i]))
+            AddValue(s, routine->args[i])->def_count = -1;
+    }
+    for (s64 i = 0; i < s->values.count; i++)
+    {
+        Sccp_Value *value = s->values[i];
+        if (value->def_count != 1 || !IsConstType(value->type))
+            value->lattice = sccp_varying;
+    }
+
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode == IR_Phi)
+        {
+            Ir_Phi *phi = instr->oper1.phi;
+            for (s64 a = 0; a < phi->args.count; a++)
+            {
+                Sccp_Value *value = LookupValue(s, phi->args[a].value);
+                if (value && value->lattice.state != SCCP_Varying)
+                    array::Push(value->uses, i);
+            }
+            continue;
+        }
+        Ir_Operand *uses[2];
+        s64 use_count = GetIrUses(instr, uses);
+        for (s64 u = 0; u < use_count; u++)
+        {
+            Sccp_Value *value = LookupValue(s, *uses[u]);
+            if (value && value->lattice.state != SCCP_Varying &&
+                (value->uses.count == 0 || array::Back(value->uses) != i))
+            {
+                array::Push(value->uses, i);
+            }
+        }
+    }
+}
+
+static void InitBlocks(Sccp *s)
+{
+    Ir_Routine *routine = s->routine;
+    Ir_Cfg *cfg = s->cfg;
+    s->blocks = PushArray<Sccp_Block>(&s->arena, cfg->blocks.count);
+    for (s64 blk = 0; blk < cfg->blocks.count; blk++)
+    {
+        Ir_Block *block = cfg->blocks[blk];
+        Sccp_Block *sb = &s->blocks[blk];
+        *sb = { };
+        Ir_Instruction *last = &routine->instructions[block->end - 1];
+        switch (last->opcode)
+        {
+            case IR_Jump:
+                sb->jump_target = cfg->instr_blocks[last->target.label->target_loc];
+                break;
+            case IR_Jz:
+            case IR_Jnz:
+                sb->jump_target = cfg->instr_blocks[last->target.label->target_loc];
+                if (blk + 1 < cfg->blocks.count)
+                    sb->fall = cfg->blocks[blk + 1];
+                break;
+            case IR_Return:
+                break;
+            default:
+                if (blk + 1 < cfg->blocks.count)
+                    sb->fall = cfg->blocks[blk + 1];
+                break;
+        }
+    }
+}
+
+
+// Propagation
+
+static void SetJumpExecutable(Sccp *s, Ir_Block *block)
+{
+    Sccp_Block *sb = &s->blocks[block->index];
+    if (!sb->jump_target || sb->jump_executable) return;
+    sb->jump_executable = true;
+    array::Push(s->flow_worklist, sb->jump_target);
+}
+
+static void SetFallExecutable(Sccp *s, Ir_Block *block)
+{
+    Sccp_Block *sb = &s->blocks[block->index];
+    if (!sb->fall || sb->fall_executable) return;
+    sb->fall_executable = true;
+    array::Push(s->flow_worklist, sb->fall);
+}
+
+static b32 IsEdgeExecutable(Sccp *s, Ir_Block *from, Ir_Block *to)
+{
+    Sccp_Block *sb = &s->blocks[from->index];
+    return (sb->jump_executable && sb->jump_target == to) ||
+        (sb->fall_executable && sb->fall == to);
+}
+
+static Ir_Block* GetPredBlock(Sccp *s, const Ir_Phi_Arg &arg)
+{
+    return s->cfg->instr_blocks[arg.pred->target_loc];
+}
+
+static Sccp_Lattice Meet(Sccp_Lattice a, Sccp_Lattice b)
+{
+    if (a.state == SCCP_Undefined) return b;
+    if (b.state == SCCP_Undefined) return a;
+    if (a.state == SCCP_Varying || b.state == SCCP_Varying) return sccp_varying;
+    if (a.value != b.value) return sccp_varying;
+    return a;
+}
+
+static b32 IsZero(Sccp_Lattice lattice)
+{
+    return lattice.state == SCCP_Const && lattice.value == 0;
+}
+
+// Evaluates the value of the target of the instruction from the values of
+// the operands.
+static Sccp_Lattice EvaluateInstruction(Sccp *s, Ir_Instruction *instr)
+{
+    switch (instr->opcode)
+    {
+        case IR_Mov:
+        case IR_MovSX: case IR_MovZX:
+        case IR_S_TO_F32: case IR_S_TO_F64:
+        case IR_F32_TO_S: case IR_F64_TO_S:
+        case IR_F32_TO_F64: case IR_F64_TO_F32:
+            {
+                if (!IsConstType(instr->oper1.type)) return sccp_varying;
+                Sccp_Lattice a = GetLattice(s, instr->oper1);
+                if (a.state != SCCP_Const) return a;
+                u64 value = a.value;
+                if (instr->opcode != IR_Mov)
+                {
+                    value = EvalIrConversion(instr->opcode,
+                            instr->target.type, instr->oper1.type, value);
+                }
+                return ConstLattice(NormalizeIrValue(instr->target.type, value));
+            }
+
+        case IR_Add: case IR_Sub:
+        case IR_Mul: case IR_Div: case IR_Mod:
+        case IR_LShift: case IR_RShift:
+        case IR_And: case IR_Or: case IR_Xor:
+        case IR_Neg: case IR_Not: case IR_Compl:
+        case IR_Sqrt:
+            {
+                Type *type = instr->oper1.type;
+                if (!IsConstType(type)) return sccp_varying;
+                b32 unary = (instr->opcode == IR_Neg || instr->opcode == IR_Not ||
+                        instr->opcode == IR_Compl || instr->opcode == IR_Sqrt);
+                Sccp_Lattice a = GetLattice(s, instr->oper1);
+                Sccp_Lattice b = unary ? ConstLattice(0) : GetLattice(s, instr->oper2);
+                // NOTE(henrik): An integer multiplied by or masked with zero
+                // is zero, whatever the other operand is.
+                if ((instr->opcode == IR_Mul || instr->opcode == IR_And) &&
+                    !TypeIsFloat(type) && (IsZero(a) || IsZero(b)))
+                {
+                    return ConstLattice(0);
+                }
+                if (a.state == SCCP_Varying || b.state == SCCP_Varying)
+                    return sccp_varying;
+                if (a.state == SCCP_Undefined || b.state == SCCP_Undefined)
+                    return a.state == SCCP_Undefined ? a : b;
+                u64 value;
+                if (!EvalIrArithmetic(instr->opcode, type, a.value, b.value, &value))
+                    return sccp_varying;
+                return ConstLattice(NormalizeIrValue(instr->target.type, value));
+            }
+
+        case IR_Eq: case IR_Neq:
+        case IR_Lt: case IR_Leq:
+        case IR_Gt: case IR_Geq:
+            {
+                Type *type = instr->oper1.type;
+                if (!IsConstType(type)) return sccp_varying;
+                Sccp_Lattice a = GetLattice(s, instr->oper1);
+                Sccp_Lattice b = GetLattice(s, instr->oper2);
+                if (a.state == SCCP_Varying || b.state == SCCP_Varying)
+                    return sccp_varying;
+                if (a.state == SCCP_Undefined || b.state == SCCP_Undefined)
+                    return a.state == SCCP_Undefined ? a : b;
+                // NOTE(henrik): The generated code compares the floats with
+                // comiss and comisd, which treat the unordered results
+                // differently from C, so the NaNs are not folded.
+                if (type->tag == TYP_f32 &&
+                    (IrValueToF32(a.value) != IrValueToF32(a.value) ||
+                     IrValueToF32(b.value) != IrValueToF32(b.value)))
+                {
+                    return sccp_varying;
+                }
+                if (type->tag == TYP_f64 &&
+                    (IrValueToF64(a.value) != IrValueToF64(a.value) ||
+                     IrValueToF64(b.value) != IrValueToF64(b.value)))
+                {
+                    return sccp_varying;
+                }
+                return ConstLattice(EvalIrCompare(instr->opcode, type, a.value, b.value));
+            }
+
+        default:
+            break;
+    }
+    return sccp_varying;
+}
+
+static void SetLattice(Sccp *s, Sccp_Value *value, Sccp_Lattice lattice)
+{
+    Sccp_Lattice old = value->lattice;
+    if (old.state == SCCP_Varying) return;
+    if (old.state == SCCP_Const)
+    {
+        if (lattice.state == SCCP_Undefined) return;
+        if (lattice.state == SCCP_Const && lattice.value == old.value) return;
+        lattice = sccp_varying;
+    }
+    else if (lattice.state == SCCP_Undefined)
+    {
+        return;
+    }
+    value->lattice = lattice;
+    array::Push(s->ssa_worklist, value);
+}
+
+static void VisitPhi(Sccp *s, Ir_Instruction *instr, Ir_Block *block)
+{
+    Sccp_Value *target = LookupValue(s, instr->target);
+    if (!target || target->lattice.state == SCCP_Varying) return;
+    Sccp_Lattice lattice = { };
+    lattice.state = SCCP_Undefined;
+    Ir_Phi *phi = instr->oper1.phi;
+    for (s64 a = 0; a < phi->args.count; a++)
+    {
+        if (!IsEdgeExecutable(s, GetPredBlock(s, phi->args[a]), block))
+            continue;
+        lattice = Meet(lattice, GetLattice(s, phi->args[a].value));
+    }
+    SetLattice(s, target, lattice);
+}
+
+static void VisitInstruction(Sccp *s, s64 index)
+{
+    Ir_Instruction *instr = &s->routine->instructions[index];
+    Ir_Block *block = s->cfg->instr_blocks[index];
+    switch (instr->opcode)
+    {
+        case IR_Phi:
+            VisitPhi(s, instr, block);
+            break;
+        case IR_Jz:
+        case IR_Jnz:
+            {
+                Sccp_Lattice cond = GetLattice(s, instr->oper1);
+                if (cond.state == SCCP_Const)
+                {
+                    b32 taken = (instr->opcode == IR_Jz) ? (cond.value == 0) : (cond.value != 0);
+                    if (taken)
+                        SetJumpExecutable(s, block);
+                    else
+                        SetFallExecutable(s, block);
+                }
+                else if (cond.state == SCCP_Varying)
+                {
+                    SetJumpExecutable(s, block);
+                    SetFallExecutable(s, block);
+                }
+            } break;
+        default:
+            if (IsIrDefinition(instr))
+            {
+                Sccp_Value *target = LookupValue(s, instr->target);
+                if (target && target->lattice.state != SCCP_Varying)
+                    SetLattice(s, target, EvaluateInstruction(s, instr));
+            }
+            break;
+    }
+}
+
+static void VisitBlock(Sccp *s, Ir_Block *block)
+{
+    Sccp_Block *sb = &s->blocks[block->index];
+    if (sb->visited)
+    {
+        // A new edge to a visited block can change only its phis.
+        for (s64 i = block->start; i < block->end; i++)
+        {
+            Ir_Instruction *instr = &s->routine->instructions[i];
+            if (instr->opcode == IR_Phi)
+                VisitPhi(s, instr, block);
+            else if (instr->opcode != IR_Label)
+                break;
+        }
+        return;
+    }
+    sb->visited = true;
+    for (s64 i = block->start; i < block->end; i++)
+    {
+        VisitInstruction(s, i);
+    }
+    Ir_Opcode last = s->routine->instructions[block->end - 1].opcode;
+    if (last == IR_Jump)
+        SetJumpExecutable(s, block);
+    else if (last != IR_Jz && last != IR_Jnz && last != IR_Return)
+        SetFallExecutable(s, block);
+}
+
+static void Propagate(Sccp *s)
+{
+    array::Push(s->flow_worklist, s->cfg->blocks[0]);
+    while (s->flow_worklist.count > 0 || s->ssa_worklist.count > 0)
+    {
+        if (s->flow_worklist.count > 0)
+        {
+            Ir_Block *block = array::Back(s->flow_worklist);
+            s->flow_worklist.count--;
+            VisitBlock(s, block);
+            continue;
+        }
+        Sccp_Value *value = array::Back(s->ssa_worklist);
+        s->ssa_worklist.count--;
+        for (s64 u = 0; u < value->uses.count; u++)
+        {
+            s64 index = value->uses[u];
+            if (s->blocks[s->cfg->instr_blocks[index]->index].visited)
+                VisitInstruction(s, index);
+        }
+    }
+}
+
+
+// Rewriting
+
+// Returns true, if the generated code takes an immediate in the operand slot
+// of the instruction. These are the slots, where the ir generation puts the
+// literals.
+static b32 TakesImmediate(Ir_Instruction *instr, Ir_Operand *oper)
+{
+    switch (instr->opcode)
+    {
+        case IR_Mov:
+        case IR_Store:
+            return oper == &instr->oper1;
+        case IR_Arg:
+        case IR_Return:
+            return oper == &instr->target;
+        case IR_Add: case IR_Sub:
+        case IR_Mul: case IR_Div: case IR_Mod:
+        case IR_LShift: case IR_RShift:
+        case IR_And: case IR_Or: case IR_Xor:
+        case IR_Eq: case IR_Neq:
+        case IR_Lt: case IR_Leq:
+        case IR_Gt: case IR_Geq:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+// Returns true, if the instruction is replaced by a move of the constant or
+// removed.
+static b32 IsFoldedDefinition(Sccp *s, Ir_Instruction *instr)
+{
+    if (instr->opcode != IR_Phi && !IsIrDefinition(instr))
+        return false;
+    Sccp_Value *target = LookupValue(s, instr->target);
+    return IsConstValue(target) &&
+        IsImmediateValue(target->type, target->lattice.value);
+}
+
+static b32 IsConstBranch(Sccp *s, Ir_Instruction *instr)
+{
+    return (instr->opcode == IR_Jz || instr->opcode == IR_Jnz) &&
+        GetLattice(s, instr->oper1).state == SCCP_Const;
+}
+
+static b32 CanReplaceUse(Sccp *s, Ir_Instruction *instr, Ir_Operand *oper)
+{
+    Sccp_Value *value = LookupValue(s, *oper);
+    return TakesImmediate(instr, oper) &&
+        IsImmediateValue(value->type, value->lattice.value);
+}
+
+// Finds the constants, whose definitions must be kept, because some of their
+// uses cannot be replaced by the constant.
+static void FindKeptDefinitions(Sccp *s)
+{
+    Ir_Routine *routine = s->routine;
+    Ir_Cfg *cfg = s->cfg;
+    for (s64 blk = 0; blk < cfg->blocks.count; blk++)
+    {
+        Ir_Block *block = cfg->blocks[blk];
+        if (!s->blocks[blk].visited) continue;
+        for (s64 i = block->start; i < block->end; i++)
+        {
+            Ir_Instruction *instr = &routine->instructions[i];
+            if (IsFoldedDefinition(s, instr) || IsConstBranch(s, instr))
+                continue;
+            if (instr->opcode == IR_Phi)
+            {
+                Ir_Phi *phi = instr->oper1.phi;
+                for (s64 a = 0; a < phi->args.count; a++)
+                {
+                    Sccp_Value *value = LookupValue(s, phi->args[a].value);
+                    if (IsConstValue(value) &&
+                        !IsImmediateValue(value->type, value->lattice.value))
+                    {
+                        value->keep_def = true;
+                    }
+                }
+                continue;
+            }
+            Ir_Operand *uses[2];
+            s64 use_count = GetIrUses(instr, uses);
+            for (s64 u = 0; u < use_count; u++)
+            {
+                Sccp_Value *value = LookupValue(s, *uses[u]);
+                if (IsConstValue(value) && !CanReplaceUse(s, instr, uses[u]))
+                    value->keep_def = true;
+            }
+        }
+    }
+}
+
+static void ReplaceUses(Sccp *s, Ir_Instruction *instr)
+{
+    if (instr->opcode == IR_Phi)
+    {
+        Ir_Phi *phi = instr->oper1.phi;
+        for (s64 a = 0; a < phi->args.count; a++)
+        {
+            Sccp_Value *value = LookupValue(s, phi->args[a].value);
+            if (IsConstValue(value) &&
+                IsImmediateValue(value->type, value->lattice.value))
+            {
+                phi->args[a].value = ImmediateOperand(value->type, value->lattice.value);
+            }
+        }
+        return;
+    }
+    Ir_Operand *uses[2];
+    s64 use_count = GetIrUses(instr, uses);
+    for (s64 u = 0; u < use_count; u++)
+    {
+        Sccp_Value *value = LookupValue(s, *uses[u]);
+        if (IsConstValue(value) && CanReplaceUse(s, instr, uses[u]))
+            *uses[u] = ImmediateOperand(uses[u]->type, value->lattice.value);
+    }
+}
+
+static void RemoveDeadPhiArgs(Sccp *s, Ir_Instruction *instr, Ir_Block *block)
+{
+    Ir_Phi *phi = instr->oper1.phi;
+    s64 count = 0;
+    for (s64 a = 0; a < phi->args.count; a++)
+    {
+        if (IsEdgeExecutable(s, GetPredBlock(s, phi->args[a]), block))
+            phi->args.data[count++] = phi->args[a];
+    }
+    phi->args.count = count;
+}
+
+static void RewriteRoutine(Sccp *s)
+{
+    Ir_Routine *routine = s->routine;
+    Ir_Cfg *cfg = s->cfg;
+    Ir_Opt_Counts *counts = &s->ctx->opt_counts;
+
+    // NOTE(henrik): The phis are kept together at the beginning of the
+    // block, so the moves of the folded phis are pushed after them.
+    Array<Ir_Instruction> phi_movs = { };
+
+    Ir_Rewrite rw;
+    BeginRewrite(&rw, routine);
+    for (s64 blk = 0; blk < cfg->blocks.count; blk++)
+    {
+        Ir_Block *block = cfg->blocks[blk];
+        if (!s->blocks[blk].visited)
+        {
+            counts->unreachable_instrs += block->end - block->start;
+            continue;
+        }
+        for (s64 i = block->start; i < block->end; i++)
+        {
+            Ir_Instruction *instr = &routine->instructions[i];
+            if (instr->opcode != IR_Label && instr->opcode != IR_Phi)
+            {
+                for (s64 m = 0; m < phi_movs.count; m++)
+                    PushInstruction(&rw, phi_movs[m]);
+                array::Clear(phi_movs);
+            }
+
+            if (instr->opcode == IR_Phi)
+                RemoveDeadPhiArgs(s, instr, block);
+
+            if (IsConstBranch(s, instr))
+            {
+                Sccp_Lattice cond = GetLattice(s, instr->oper1);
+                b32 taken = (instr->opcode == IR_Jz) ? (cond.value == 0) : (cond.value != 0);
+                if (taken)
+                {
+                    Ir_Instruction jump = { };
+                    jump.opcode = IR_Jump;
+                    jump.target = instr->target;
+                    jump.comment = instr->comment;
+                    PushInstruction(&rw, jump);
+                }
+                counts->folded_branches++;
+                continue;
+            }
+            if (IsFoldedDefinition(s, instr))
+            {
+                Sccp_Value *target = LookupValue(s, instr->target);
+                Ir_Operand imm = ImmediateOperand(target->type, target->lattice.value);
+                b32 is_const_mov = (instr->opcode == IR_Mov &&
+                        instr->oper1.oper_type == IR_OPER_Immediate);
+                if (!is_const_mov)
+                    counts->folded_instrs++;
+                if (!target->keep_def)
+                    continue;
+                Ir_Instruction mov = { };
+                mov.opcode = IR_Mov;
+                mov.target = instr->target;
+                mov.oper1 = imm;
+                mov.comment = instr->comment;
+                if (instr->opcode == IR_Phi)
+                    array::Push(phi_movs, mov);
+                else
+                    PushInstruction(&rw, mov);
+                continue;
+            }
+            Ir_Instruction *copy = CopyInstruction(&rw, i);
+            ReplaceUses(s, copy);
+        }
+        for (s64 m = 0; m < phi_movs.count; m++)
+            PushInstruction(&rw, phi_movs[m]);
+        array::Clear(phi_movs);
+    }
+    EndRewrite(&rw);
+    array::Free(phi_movs);
+}
+
+static void FreeSccp(Sccp *s)
+{
+    for (s64 i = 0; i < s->values.count; i++)
+        array::Free(s->values[i]->uses);
+    array::Free(s->value_table);
+    array::Free(s->values);
+    array::Free(s->flow_worklist);
+    array::Free(s->ssa_worklist);
+    FreeMemoryArena(&s->arena);
+}
+
+void PropagateConstants(Ir_Gen_Context *ctx, Ir_Routine *routine)
+{
+    if (routine->instructions.count == 0)
+        return;
+
+    Sccp sccp = { };
+    Sccp *s = &sccp;
+    s->ctx = ctx;
+    s->routine = routine;
+    s->cfg = GetCfg(routine);
+
+    CollectValues(s);
+    InitBlocks(s);
+    Propagate(s);
+    FindKeptDefinitions(s);
+    RewriteRoutine(s);
+
+    FreeSccp(s);
+}
+
+void PropagateConstants(Ir_Gen_Context *ctx)
+{
+    for (s64 i = 0; i < ctx->routines.count; i++)
+    {
+        PropagateConstants(ctx, ctx->routines[i]);
+    }
+}
+
+} // hplang
@@ -0,0 +1,21 @@
+#ifndef H_HPLANG_IR_SCCP_H
+
+#include "ir_types.h"
+
+namespace hplang
+{
+
+struct Ir_Gen_Context;
+
+// Propagates and folds the constants of the routine in the SSA form. The
+// variables and temporaries, that get a constant value on every executable
+// path, are replaced by the constant, and their definitions are removed. The
+// conditional jumps with a constant condition are replaced by jumps or
+// removed, and the blocks, that become unreachable, are removed.
+void PropagateConstants(Ir_Gen_Context *ctx, Ir_Routine *routine);
+void PropagateConstants(Ir_Gen_Context *ctx);
+
+} // hplang
+
+#define H_HPLANG_IR_SCCP_H
+#endif
@@ -0,0 +1,1482 @@
+#include "ir_ssa.h"
+#include "ir_cfg.h"
+#include "ir_gen.h"
+#include "symbols.h"
+#include "hashtable.h"
+#include "common.h"
+#include "assert.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+
+// The SSA construction follows Cytron et al. [1]: the phis are placed on the
+// iterated dominance frontiers of the definitions and the names are given by
+// walking the dominator tree. Only the variables, that are live into a block,
+// get phis there. The destruction coalesces the names connected by the phis,
+// when their live ranges do not interfere, as described by Sreedhar et al.
+// [2] and Boissinot et al. [3], and inserts sequentialized parallel copies
+// for the rest.
+//
+// [1]  Ron Cytron, Jeanne Ferrante, Barry K. Rosen, Mark N. Wegman and
+//      F. Kenneth Zadeck, 1991.
+//      Efficiently Computing Static Single Assignment Form and the Control
+//      Dependence Graph.
+//
+// [2]  Vugranam C. Sreedhar, Roy Dz-Ching Ju, David M. Gillies and Vatsa
+//      Santhanam, 1999.
+//      Translating Out of Static Single Assignment Form.
+//
+// [3]  Benoit Boissinot, Alain Darte, Fabrice Rastello, Benoît Dupont de
+//      Dinechin and Christophe Guillon, 2009.
+//      Revisiting Out-of-SSA Translation for Correctness, Code Quality, and
+//      Efficiency.
+
+namespace hplang
+{
+
+b32 IsIrDefinition(const Ir_Instruction *instr)
+{
+    switch (instr->opcode)
+    {
+        case IR_Label: case IR_VarDecl:
+        case IR_Store: case IR_Arg: case IR_Return:
+        case IR_Jump: case IR_Jz: case IR_Jnz:
+        case IR_COUNT:
+            return false;
+        default:
+            return instr->target.oper_type != IR_OPER_None;
+    }
+}
+
+s64 GetIrUses(Ir_Instruction *instr, Ir_Operand **uses)
+{
+    s64 count = 0;
+    switch (instr->opcode)
+    {
+        case IR_Label: case IR_VarDecl:
+        case IR_Phi: case IR_Jump:
+        case IR_COUNT:
+            break;
+        // NOTE(henrik): Taking the address is not a use of the value.
+        case IR_Addr:
+            break;
+        case IR_Arg: case IR_Return:
+            uses[count++] = &instr->target;
+            break;
+        case IR_Store:
+            uses[count++] = &instr->target;
+            uses[count++] = &instr->oper1;
+            break;
+        case IR_Jz: case IR_Jnz:
+        case IR_Call: case IR_CallForeign:
+            uses[count++] = &instr->oper1;
+            break;
+        default:
+            uses[count++] = &instr->oper1;
+            uses[count++] = &instr->oper2;
+            break;
+    }
+    return count;
+}
+
+b32 IsIrLocal(const Ir_Operand &oper)
+{
+    return oper.oper_type == IR_OPER_Variable || oper.oper_type == IR_OPER_Temp;
+}
+
+Name GetIrLocalName(const Ir_Operand &oper)
+{
+    ASSERT(IsIrLocal(oper));
+    return (oper.oper_type == IR_OPER_Variable) ? oper.var.name : oper.temp.name;
+}
+
+static void SetIrLocalName(Ir_Operand *oper, Name name)
+{
+    if (oper->oper_type == IR_OPER_Variable)
+        oper->var.name = name;
+    else
+        oper->temp.name = name;
+}
+
+static Ir_Instruction LabelInstruction(Ir_Operand label)
+{
+    Ir_Instruction instr = { };
+    instr.opcode = IR_Label;
+    instr.target = label;
+    return instr;
+}
+
+static Ir_Instruction MovInstruction(Ir_Operand target, Ir_Operand source)
+{
+    Ir_Instruction instr = { };
+    instr.opcode = IR_Mov;
+    instr.target = target;
+    instr.oper1 = source;
+    return instr;
+}
+
+static b32 IsConditionalJump(Ir_Opcode opcode)
+{
+    return opcode == IR_Jz || opcode == IR_Jnz;
+}
+
+static Ir_Label* GetBlockLabel(Ir_Routine *routine, Ir_Block *block)
+{
+    Ir_Instruction *instr = &routine->instructions[block->start];
+    ASSERT(instr->opcode == IR_Label);
+    return instr->target.label;
+}
+
+static Ir_Block* GetLabelBlock(Ir_Cfg *cfg, Ir_Label *label)
+{
+    return cfg->instr_blocks[label->target_loc];
+}
+
+
+// Bit sets
+
+static s64 BitSetWords(s64 bit_count)
+{
+    return (bit_count + 63) / 64;
+}
+
+static u64* PushBitSet(Memory_Arena *arena, s64 words)
+{
+    u64 *set = PushArray<u64>(arena, words > 0 ? words : 1);
+    memset(set, 0, (words > 0 ? words : 1) * sizeof(u64));
+    return set;
+}
+
+static inline void BitSet(u64 *set, s64 bit)
+{
+    set[bit >> 6] |= (u64)1 << (bit & 63);
+}
+
+static inline b32 BitTest(const u64 *set, s64 bit)
+{
+    return (set[bit >> 6] >> (bit & 63)) & 1;
+}
+
+
+// Liveness of the blocks, computed for the names that have an index.
+
+struct Block_Liveness
+{
+    s64 words;
+    u64 **gen;          // The upward exposed uses
+    u64 **kill;         // The definitions
+    u64 **live_in;
+    u64 **live_out;
+};
+
+static void InitBlockLiveness(Block_Liveness *live, Memory_Arena *arena,
+        s64 block_count, s64 name_count)
+{
+    live->words = BitSetWords(name_count);
+    live->gen = PushArray<u64*>(arena, block_count);
+    live->kill = PushArray<u64*>(arena, block_count);
+    live->live_in = PushArray<u64*>(arena, block_count);
+    live->live_out = PushArray<u64*>(arena, block_count);
+    for (s64 b = 0; b < block_count; b++)
+    {
+        live->gen[b] = PushBitSet(arena, live->words);
+        live->kill[b] = PushBitSet(arena, live->words);
+        live->live_in[b] = PushBitSet(arena, live->words);
+        live->live_out[b] = PushBitSet(arena, live->words);
+    }
+}
+
+// Solves the liveness. The live_out sets may be seeded with the names, that
+// are read by the phis of the successors.
+static void SolveBlockLiveness(Block_Liveness *live, Ir_Cfg *cfg)
+{
+    s64 words = live->words;
+    b32 changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (s64 i = cfg->rpo.count - 1; i >= 0; i--)
+        {
+            Ir_Block *block = cfg->rpo[i];
+            u64 *out = live->live_out[block->index];
+            for (s64 s = 0; s < block->succs.count; s++)
+            {
+                u64 *succ_in = live->live_in[block->succs[s]->index];
+                for (s64 w = 0; w < words; w++)
+                    out[w] |= succ_in[w];
+            }
+            u64 *in = live->live_in[block->index];
+            u64 *gen = live->gen[block->index];
+            u64 *kill = live->kill[block->index];
+            for (s64 w = 0; w < words; w++)
+            {
+                u64 new_in = gen[w] | (out[w] & ~kill[w]);
+                if (new_in != in[w])
+                {
+                    in[w] = new_in;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+
+// SSA construction
+
+struct Ssa_Var
+{
+    Name name;              // The original name
+    Ir_Operand oper;
+    b32 promoted;
+    s64 index;              // The index of a promoted variable, or -1
+    s64 live_index;         // The liveness index, if the variable is live
+                            // across blocks, or -1
+
+    Name current;           // The current name during the renaming
+    s64 version_count;
+
+    Array<s64> def_blocks;
+};
+
+struct Rename_Undo
+{
+    Ssa_Var *var;
+    Name prev;
+};
+
+struct Rename_Frame
+{
+    Ir_Block *block;
+    s64 undo_mark;
+    s64 next_child;
+};
+
+struct Ssa_Builder
+{
+    Memory_Arena arena;
+    Ir_Gen_Context *ctx;
+    Ir_Routine *routine;
+
+    Array<Ssa_Var*> var_table;
+    Array<Ssa_Var*> vars;           // The promoted variables
+    Array<Ssa_Var*> live_vars;      // The variables live across blocks
+
+    // The variables of the phis of each block in the order of the phis.
+    Array<s64> *block_phis;
+
+    Array<Rename_Undo> undo;
+};
+
+static Ssa_Var* GetVar(Ssa_Builder *b, const Ir_Operand &oper)
+{
+    Name name = GetIrLocalName(oper);
+    Ssa_Var *var = hashtable::Lookup(b->var_table, name);
+    if (!var)
+    {
+        var = PushStruct<Ssa_Var>(&b->arena);
+        *var = { };
+        var->name = name;
+        var->oper = oper;
+        var->promoted = !TypeIsStruct(oper.type);
+        var->index = -1;
+        var->live_index = -1;
+        var->current = name;
+        hashtable::Put(b->var_table, name, var);
+    }
+    return var;
+}
+
+static Ssa_Var* GetPromotedVar(Ssa_Builder *b, const Ir_Operand &oper)
+{
+    if (!IsIrLocal(oper)) return nullptr;
+    Ssa_Var *var = hashtable::Lookup(b->var_table, GetIrLocalName(oper));
+    return (var && var->promoted) ? var : nullptr;
+}
+
+// Makes every block to begin with a label and removes the unreachable
+// blocks. The entry block gets an own label, if it is the target of a jump,
+// so that the entry has no predecessors.
+static void NormalizeBlocks(Ir_Gen_Context *ctx, Ir_Routine *routine)
+{
+    Ir_Cfg *cfg = BuildCfg(routine);
+
+    b32 rewrite = (cfg->blocks[0]->preds.count > 0);
+    for (s64 i = 0; i < cfg->blocks.count && !rewrite; i++)
+    {
+        Ir_Block *block = cfg->blocks[i];
+        rewrite = (block->rpo_index == -1) ||
+            (routine->instructions[block->start].opcode != IR_Label);
+    }
+    if (!rewrite) return;
+
+    Ir_Rewrite rw;
+    BeginRewrite(&rw, routine);
+    if (cfg->blocks[0]->preds.count > 0)
+        PushInstruction(&rw, LabelInstruction(NewIrLabel(ctx, routine)));
+    for (s64 i = 0; i < cfg->blocks.count; i++)
+    {
+        Ir_Block *block = cfg->blocks[i];
+        if (block->rpo_index == -1) continue;
+        if (routine->instructions[block->start].opcode != IR_Label)
+            PushInstruction(&rw, LabelInstruction(NewIrLabel(ctx, routine)));
+        for (s64 instr_i = block->start; instr_i < block->end; instr_i++)
+            CopyInstruction(&rw, instr_i);
+    }
+    EndRewrite(&rw);
+}
+
+static void CollectVars(Ssa_Builder *b)
+{
+    Ir_Routine *routine = b->routine;
+    s64 instr_count = routine->instructions.count;
+    array::Resize(b->var_table, instr_count + routine->arg_count + 31);
+
+    for (s64 i = 0; i < routine->arg_count; i++)
+        GetVar(b, routine->args[i]);
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (IsIrLocal(instr->target)) GetVar(b, instr->target);
+        if (IsIrLocal(instr->oper1))
+        {
+            Ssa_Var *var = GetVar(b, instr->oper1);
+            if (instr->opcode == IR_Addr)
+                var->promoted = false;
+        }
+        if (IsIrLocal(instr->oper2)) GetVar(b, instr->oper2);
+    }
+    for (s64 i = 0; i < b->var_table.count; i++)
+    {
+        Ssa_Var *var = b->var_table[i];
+        if (var && var->promoted)
+        {
+            var->index = b->vars.count;
+            array::Push(b->vars, var);
+        }
+    }
+}
+
+// Finds the variables, that are used in a block before they are defined in
+// the block. Only these need phis. Computes the liveness of the variables and
+// collects the blocks, where the variables are defined.
+static void ComputeVarLiveness(Ssa_Builder *b, Ir_Cfg *cfg, Block_Liveness *live)
+{
+    Ir_Routine *routine = b->routine;
+    s64 var_count = b->vars.count;
+    s64 *def_stamp = PushArray<s64>(&b->arena, var_count);
+    for (s64 i = 0; i < var_count; i++)
+        def_stamp[i] = -1;
+
+    for (s64 blk = 0; blk < cfg->blocks.count; blk++)
+    {
+        Ir_Block *block = cfg->blocks[blk];
+        for (s64 i = block->start; i < block->end; i++)
+        {
+            Ir_Instruction *instr = &routine->instructions[i];
+            Ir_Operand *uses[2];
+            s64 use_count = GetIrUses(instr, uses);
+            for (s64 u = 0; u < use_count; u++)
+            {
+                Ssa_Var *var = GetPromotedVar(b, *uses[u]);
+                if (var && def_stamp[var->index] != blk && var->live_index == -1)
+                {
+                    var->live_index = b->live_vars.count;
+                    array::Push(b->live_vars, var);
+                }
+            }
+            if (IsIrDefinition(instr))
+            {
+                Ssa_Var *var = GetPromotedVar(b, instr->target);
+                if (var && def_stamp[var->index] != blk)
+                {
+                    def_stamp[var->index] = blk;
+                    array::Push(var->def_blocks, blk);
+                }
+            }
+        }
+    }
+
+    InitBlockLiveness(live, &b->arena, cfg->blocks.count, b->live_vars.count);
+    for (s64 blk = 0; blk < cfg->blocks.count; blk++)
+    {
+        Ir_Block *block = cfg->blocks[blk];
+        u64 *gen = live->gen[blk];
+        u64 *kill = live->kill[blk];
+        for (s64 i = block->start; i < block->end; i++)
+        {
+            Ir_Instruction *instr = &routine->instructions[i];
+            Ir_Operand *uses[2];
+            s64 use_count = GetIrUses(instr, uses);
+            for (s64 u = 0; u < use_count; u++)
+            {
+                Ssa_Var *var = GetPromotedVar(b, *uses[u]);
+                if (var && var->live_index != -1 && !BitTest(kill, var->live_index))
+                    BitSet(gen, var->live_index);
+            }
+            if (IsIrDefinition(instr))
+            {
+                Ssa_Var *var = GetPromotedVar(b, instr->target);
+                if (var && var->live_index != -1)
+                    BitSet(kill, var->live_index);
+            }
+        }
+    }
+    SolveBlockLiveness(live, cfg);
+}
+
+static Array<Ir_Block*>* ComputeDominanceFrontiers(Ssa_Builder *b, Ir_Cfg *cfg)
+{
+    s64 block_count = cfg->blocks.count;
+    Array<Ir_Block*> *df = PushArray<Array<Ir_Block*>>(&b->arena, block_count);
+    for (s64 i = 0; i < block_count; i++)
+        df[i] = { };
+
+    for (s64 i = 0; i < cfg->rpo.count; i++)
+    {
+        Ir_Block *block = cfg->rpo[i];
+        if (block->preds.count < 2) continue;
+        for (s64 p = 0; p < block->preds.count; p++)
+        {
+            Ir_Block *runner = block->preds[p];
+            while (runner != block->idom)
+            {
+                Array<Ir_Block*> &runner_df = df[runner->index];
+                if (runner_df.count > 0 && array::Back(runner_df) == block)
+                    break;
+                array::Push(runner_df, block);
+                runner = runner->idom;
+            }
+        }
+    }
+    return df;
+}
+
+static void PlacePhis(Ssa_Builder *b, Ir_Cfg *cfg, Block_Liveness *live)
+{
+    s64 block_count = cfg->blocks.count;
+    Array<Ir_Block*> *df = ComputeDominanceFrontiers(b, cfg);
+
+    b->block_phis = PushArray<Array<s64>>(&b->arena, block_count);
+    s64 *phi_stamp = PushArray<s64>(&b->arena, block_count);
+    s64 *work_stamp = PushArray<s64>(&b->arena, block_count);
+    for (s64 i = 0; i < block_count; i++)
+    {
+        b->block_phis[i] = { };
+        phi_stamp[i] = -1;
+        work_stamp[i] = -1;
+    }
+
+    Array<s64> worklist = { };
+    for (s64 v = 0; v < b->live_vars.count; v++)
+    {
+        Ssa_Var *var = b->live_vars[v];
+        array::Clear(worklist);
+        for (s64 i = 0; i < var->def_blocks.count; i++)
+        {
+            s64 blk = var->def_blocks[i];
+            work_stamp[blk] = v;
+            array::Push(worklist, blk);
+        }
+        while (worklist.count > 0)
+        {
+            s64 blk = array::Back(worklist);
+            worklist.count--;
+            for (s64 i = 0; i < df[blk].count; i++)
+            {
+                Ir_Block *frontier = df[blk][i];
+                s64 f = frontier->index;
+                if (phi_stamp[f] == v) continue;
+                if (!BitTest(live->live_in[f], v)) continue;
+                phi_stamp[f] = v;
+                array::Push(b->block_phis[f], var->index);
+                if (work_stamp[f] != v)
+                {
+                    work_stamp[f] = v;
+                    array::Push(worklist, f);
+                }
+            }
+        }
+    }
+    array::Free(worklist);
+    for (s64 i = 0; i < block_count; i++)
+        array::Free(df[i]);
+}
+
+static void InsertPhis(Ssa_Builder *b, Ir_Cfg *cfg)
+{
+    Ir_Routine *routine = b->routine;
+    s64 phi_count = 0;
+    for (s64 i = 0; i < cfg->blocks.count; i++)
+        phi_count += b->block_phis[i].count;
+    if (phi_count == 0) return;
+
+    Ir_Rewrite rw;
+    BeginRewrite(&rw, routine);
+    for (s64 blk = 0; blk < cfg->blocks.count; blk++)
+    {
+        Ir_Block *block = cfg->blocks[blk];
+        CopyInstruction(&rw, block->start);
+        for (s64 i = 0; i < b->block_phis[blk].count; i++)
+        {
+            Ssa_Var *var = b->vars[b->block_phis[blk][i]];
+            Ir_Phi *phi = PushStruct<Ir_Phi>(&b->ctx->arena);
+            *phi = { };
+
+            Ir_Instruction instr = { };
+            instr.opcode = IR_Phi;
+            instr.target = var->oper;
+            instr.oper1.oper_type = IR_OPER_Phi;
+            instr.oper1.type = var->oper.type;
+            instr.oper1.phi = phi;
+            PushInstruction(&rw, instr);
+        }
+        for (s64 i = block->start + 1; i < block->end; i++)
+            CopyInstruction(&rw, i);
+    }
+    EndRewrite(&rw);
+}
+
+static Name NewVersion(Ssa_Builder *b, Ssa_Var *var)
+{
+    Rename_Undo undo = { };
+    undo.var = var;
+    undo.prev = var->current;
+    array::Push(b->undo, undo);
+
+    const s64 buf_size = 256;
+    char buf[buf_size];
+    s64 len = snprintf(buf, buf_size, "%.*s.%" PRId64,
+            (int)var->name.str.size, var->name.str.data, ++var->version_count);
+    if (len >= buf_size) len = buf_size - 1;
+    var->current = PushName(&b->ctx->arena, buf, len);
+    return var->current;
+}
+
+static void RenameBlock(Ssa_Builder *b, Ir_Block *block)
+{
+    Ir_Routine *routine = b->routine;
+    for (s64 i = block->start; i < block->end; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode == IR_Phi)
+        {
+            Ssa_Var *var = GetPromotedVar(b, instr->target);
+            SetIrLocalName(&instr->target, NewVersion(b, var));
+            continue;
+        }
+        Ir_Operand *uses[2];
+        s64 use_count = GetIrUses(instr, uses);
+        for (s64 u = 0; u < use_count; u++)
+        {
+            Ssa_Var *var = GetPromotedVar(b, *uses[u]);
+            if (var) SetIrLocalName(uses[u], var->current);
+        }
+        if (IsIrDefinition(instr))
+        {
+            Ssa_Var *var = GetPromotedVar(b, instr->target);
+            if (var) SetIrLocalName(&instr->target, NewVersion(b, var));
+        }
+    }
+
+    Ir_Label *pred_label = GetBlockLabel(routine, block);
+    for (s64 s = 0; s < block->succs.count; s++)
+    {
+        Ir_Block *succ = block->succs[s];
+        Array<s64> &phis = b->block_phis[succ->index];
+        for (s64 p = 0; p < phis.count; p++)
+        {
+            Ir_Instruction *instr = &routine->instructions[succ->start + 1 + p];
+            ASSERT(instr->opcode == IR_Phi);
+            Ssa_Var *var = b->vars[phis[p]];
+
+            Ir_Phi_Arg arg = { };
+            arg.pred = pred_label;
+            arg.value = var->oper;
+            SetIrLocalName(&arg.value, var->current);
+            array::Push(instr->oper1.phi->args, arg);
+        }
+    }
+}
+
+static void RenameVars(Ssa_Builder *b, Ir_Cfg *cfg)
+{
+    Array<Rename_Frame> stack = { };
+    Rename_Frame entry = { };
+    entry.block = cfg->blocks[0];
+    entry.undo_mark = b->undo.count;
+    RenameBlock(b, entry.block);
+    array::Push(stack, entry);
+
+    while (stack.count > 0)
+    {
+        Rename_Frame &frame = stack[stack.count - 1];
+        if (frame.next_child < frame.block->dom_children.count)
+        {
+            Rename_Frame child = { };
+            child.block = frame.block->dom_children[frame.next_child++];
+            child.undo_mark = b->undo.count;
+            RenameBlock(b, child.block);
+            array::Push(stack, child);
+        }
+        else
+        {
+            while (b->undo.count > frame.undo_mark)
+            {
+                Rename_Undo undo = array::Back(b->undo);
+                b->undo.count--;
+                undo.var->current = undo.prev;
+            }
+            stack.count--;
+        }
+    }
+    array::Free(stack);
+}
+
+static void FreeSsaBuilder(Ssa_Builder *b, s64 block_count)
+{
+    for (s64 i = 0; i < b->vars.count; i++)
+        array::Free(b->vars[i]->def_blocks);
+    if (b->block_phis)
+    {
+        for (s64 i = 0; i < block_count; i++)
+            array::Free(b->block_phis[i]);
+    }
+    array::Free(b->var_table);
+    array::Free(b->vars);
+    array::Free(b->live_vars);
+    array::Free(b->undo);
+    FreeMemoryArena(&b->arena);
+}
+
+void ConstructSsa(Ir_Gen_Context *ctx, Ir_Routine *routine)
+{
+    if (routine->instructions.count == 0)
+        return;
+
+    NormalizeBlocks(ctx, routine);
+
+    Ssa_Builder builder = { };
+    Ssa_Builder *b = &builder;
+    b->ctx = ctx;
+    b->routine = routine;
+
+    Ir_Cfg *cfg = GetCfg(routine);
+    s64 block_count = cfg->blocks.count;
+    CollectVars(b);
+
+    Block_Liveness live = { };
+    ComputeVarLiveness(b, cfg, &live);
+    PlacePhis(b, cfg, &live);
+    InsertPhis(b, cfg);
+
+    // NOTE(henrik): Inserting the phis does not change the blocks, so the
+    // block indices of the rebuilt graph match block_phis.
+    cfg = GetCfg(routine);
+    ASSERT(cfg->blocks.count == block_count);
+    RenameVars(b, cfg);
+
+    FreeSsaBuilder(b, block_count);
+}
+
+void ConvertToSsa(Ir_Gen_Context *ctx)
+{
+    for (s64 i = 0; i < ctx->routines.count; i++)
+    {
+        ConstructSsa(ctx, ctx->routines[i]);
+    }
+}
+
+
+// SSA destruction
+
+struct Ssa_Use_Block
+{
+    s64 block;
+    s64 last_use;           // The last instruction in the block using the name
+};
+
+struct Ssa_Name
+{
+    Name name;
+    s64 index;
+
+    s64 def_block;
+    s64 def_pos;            // -1 for the names defined at the routine entry
+    b32 phi_def;
+
+    Array<Ssa_Use_Block> uses;
+
+    s64 parent;             // The union-find parent
+    Array<s64> members;     // The names of the web in the dominance order, if the root
+    s64 dom_parent;         // The closest dominating name in the web, or -1
+    Name web_name;
+};
+
+struct Dom_Parent_Undo
+{
+    Ssa_Name *name;
+    s64 prev;
+};
+
+struct Copy_Pair
+{
+    Ir_Operand dst;
+    Ir_Operand src;
+};
+
+struct Split_Edge
+{
+    Ir_Operand label;
+    Ir_Label *target;
+    Array<Ir_Instruction> copies;
+};
+
+struct Ssa_Destructor
+{
+    Memory_Arena arena;
+    Ir_Gen_Context *ctx;
+    Ir_Routine *routine;
+    Ir_Cfg *cfg;
+
+    Array<Ssa_Name*> name_table;
+    Array<Ssa_Name*> names;
+    Block_Liveness live;
+
+    // The target and the first operand of the instructions, that define a new
+    // version of the variable they read, e.g. x.2 = x.1 + y.
+    Array<Copy_Pair> ties;
+
+    Array<Dom_Parent_Undo> dom_undo;
+};
+
+static Ssa_Name* LookupName(Ssa_Destructor *d, const Ir_Operand &oper)
+{
+    if (!IsIrLocal(oper)) return nullptr;
+    return hashtable::Lookup(d->name_table, GetIrLocalName(oper));
+}
+
+static void AddName(Ssa_Destructor *d, const Ir_Operand &oper)
+{
+    if (!IsIrLocal(oper) || LookupName(d, oper)) return;
+    Ssa_Name *name = PushStruct<Ssa_Name>(&d->arena);
+    *name = { };
+    name->name = GetIrLocalName(oper);
+    name->index = d->names.count;
+    name->def_block = 0;
+    name->def_pos = -1;
+    name->parent = name->index;
+    name->dom_parent = -1;
+    array::Push(name->members, name->index);
+    hashtable::Put(d->name_table, name->name, name);
+    array::Push(d->names, name);
+}
+
+// Returns the length of the original variable name, that the SSA version
+// was renamed from.
+static s64 GetOriginalNameLength(Name name)
+{
+    s64 len = name.str.size;
+    while (len > 0 && name.str.data[len - 1] >= '0' && name.str.data[len - 1] <= '9')
+        len--;
+    if (len > 0 && len < name.str.size && name.str.data[len - 1] == '.')
+        return len - 1;
+    return name.str.size;
+}
+
+static b32 IsSameVariable(const Ir_Operand &a, const Ir_Operand &b)
+{
+    if (!IsIrLocal(a) || !IsIrLocal(b)) return false;
+    Name name_a = GetIrLocalName(a);
+    Name name_b = GetIrLocalName(b);
+    s64 len = GetOriginalNameLength(name_a);
+    if (len != GetOriginalNameLength(name_b)) return false;
+    return strncmp(name_a.str.data, name_b.str.data, len) == 0;
+}
+
+static b32 IsPhiArgOf(Ir_Cfg *cfg, Ir_Phi_Arg arg, Ir_Block *block)
+{
+    Ir_Block *pred = GetLabelBlock(cfg, arg.pred);
+    for (s64 p = 0; p < block->preds.count; p++)
+    {
+        if (block->preds[p] == pred) return true;
+    }
+    return false;
+}
+
+// Collects the names connected by the phis and the ties, as only they can be
+// coalesced, and their definitions and uses.
+static void CollectPhiNames(Ssa_Destructor *d)
+{
+    Ir_Routine *routine = d->routine;
+    Ir_Cfg *cfg = d->cfg;
+    // NOTE(henrik): The backend has no move coalescing, so the versions of
+    // a variable in the two address instructions are coalesced here too, to
+    // avoid the extra moves between them.
+    s64 max_names = 0;
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode == IR_Phi)
+        {
+            max_names += 1 + instr->oper1.phi->args.count;
+        }
+        else if (IsIrDefinition(instr) &&
+                IsSameVariable(instr->target, instr->oper1) &&
+                instr->target != instr->oper1)
+        {
+            Copy_Pair tie = { };
+            tie.dst = instr->target;
+            tie.src = instr->oper1;
+            array::Push(d->ties, tie);
+            max_names += 2;
+        }
+    }
+    if (max_names == 0) return;
+
+    // NOTE(henrik): The table grows only when full, so it is sized up front to
+    // keep the probe sequences short.
+    array::Resize(d->name_table, max_names * 2 + 1);
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode != IR_Phi) continue;
+        AddName(d, instr->target);
+        Ir_Phi *phi = instr->oper1.phi;
+        for (s64 a = 0; a < phi->args.count; a++)
+            AddName(d, phi->args[a].value);
+    }
+    for (s64 i = 0; i < d->ties.count; i++)
+    {
+        AddName(d, d->ties[i].dst);
+        AddName(d, d->ties[i].src);
+    }
+    if (d->names.count == 0) return;
+
+    for (s64 blk = 0; blk < cfg->blocks.count; blk++)
+    {
+        Ir_Block *block = cfg->blocks[blk];
+        for (s64 i = block->start; i < block->end; i++)
+        {
+            Ir_Instruction *instr = &routine->instructions[i];
+            Ir_Operand *uses[2];
+            s64 use_count = GetIrUses(instr, uses);
+            for (s64 u = 0; u < use_count; u++)
+            {
+                Ssa_Name *name = LookupName(d, *uses[u]);
+                if (!name) continue;
+                if (name->uses.count > 0 && array::Back(name->uses).block == blk)
+                {
+                    array::Back(name->uses).last_use = i;
+                }
+                else
+                {
+                    Ssa_Use_Block use = { };
+                    use.block = blk;
+                    use.last_use = i;
+                    array::Push(name->uses, use);
+                }
+            }
+            if (instr->opcode == IR_Phi || IsIrDefinition(instr))
+            {
+                Ssa_Name *name = LookupName(d, instr->target);
+                if (!name) continue;
+                name->def_block = blk;
+                name->def_pos = i;
+                name->phi_def = (instr->opcode == IR_Phi);
+            }
+        }
+    }
+}
+
+static void ComputeNameLiveness(Ssa_Destructor *d)
+{
+    Ir_Routine *routine = d->routine;
+    Ir_Cfg *cfg = d->cfg;
+    Block_Liveness *live = &d->live;
+    InitBlockLiveness(live, &d->arena, cfg->blocks.count, d->names.count);
+
+    for (s64 i = 0; i < d->names.count; i++)
+    {
+        Ssa_Name *name = d->names[i];
+        if (name->def_pos != -1)
+            BitSet(live->kill[name->def_block], name->index);
+        for (s64 u = 0; u < name->uses.count; u++)
+        {
+            Ssa_Use_Block use = name->uses[u];
+            if (name->def_block != use.block || name->def_pos == -1)
+                BitSet(live->gen[use.block], name->index);
+        }
+    }
+    // The arguments of the phis are live at the end of the predecessors.
+    for (s64 blk = 0; blk < cfg->blocks.count; blk++)
+    {
+        Ir_Block *block = cfg->blocks[blk];
+        for (s64 i = block->start; i < block->end; i++)
+        {
+            Ir_Instruction *instr = &routine->instructions[i];
+            if (instr->opcode != IR_Phi) continue;
+            Ir_Phi *phi = instr->oper1.phi;
+            for (s64 a = 0; a < phi->args.count; a++)
+            {
+                Ir_Phi_Arg arg = phi->args[a];
+                Ssa_Name *name = LookupName(d, arg.value);
+                if (!name || !IsPhiArgOf(cfg, arg, block)) continue;
+                s64 pred = GetLabelBlock(cfg, arg.pred)->index;
+                BitSet(live->live_out[pred], name->index);
+            }
+        }
+    }
+    SolveBlockLiveness(live, cfg);
+}
+
+// Returns true, if the name is live right after the instruction pos in the
+// block. In the SSA form the definition of a name dominates its uses, so the
+// name is not live before its definition in the same block.
+static b32 IsLiveAfter(Ssa_Destructor *d, Ssa_Name *name, s64 block, s64 pos)
+{
+    if (name->def_block == block && name->def_pos > pos)
+        return false;
+    if (BitTest(d->live.live_out[block], name->index))
+        return true;
+    for (s64 u = 0; u < name->uses.count; u++)
+    {
+        if (name->uses[u].block == block)
+            return name->uses[u].last_use > pos;
+    }
+    return false;
+}
+
+// Returns true, if the name is read by the second operand of the instruction
+// defining def. The backend moves the first operand to the target before
+// reading the second one, so the second operand must not share the name of
+// the target, even if its live range ends there.
+static b32 IsReadByDefinition(Ssa_Destructor *d, Ssa_Name *name, Ssa_Name *def)
+{
+    if (def->def_pos == -1 || def->phi_def)
+        return false;
+    Ir_Instruction *instr = &d->routine->instructions[def->def_pos];
+    return IsIrLocal(instr->oper2) && GetIrLocalName(instr->oper2) == name->name;
+}
+
+static b32 Interfere(Ssa_Destructor *d, Ssa_Name *a, Ssa_Name *b)
+{
+    if (a->def_pos == -1 && b->def_pos == -1)
+        return true;
+    // NOTE(henrik): The phis of a block are copied in parallel, so their
+    // targets must be kept separate.
+    if (a->phi_def && b->phi_def && a->def_block == b->def_block)
+        return true;
+    if (IsReadByDefinition(d, a, b) || IsReadByDefinition(d, b, a))
+        return true;
+    return IsLiveAfter(d, a, b->def_block, b->def_pos) ||
+        IsLiveAfter(d, b, a->def_block, a->def_pos);
+}
+
+static s64 FindWeb(Ssa_Destructor *d, s64 index)
+{
+    while (d->names[index]->parent != index)
+    {
+        Ssa_Name *name = d->names[index];
+        name->parent = d->names[name->parent]->parent;
+        index = name->parent;
+    }
+    return index;
+}
+
+// Returns true, if the definition of a dominates the definition of b. The
+// names defined at the routine entry dominate everything.
+static b32 NameDominates(Ssa_Destructor *d, Ssa_Name *a, Ssa_Name *b)
+{
+    if (a->def_block == b->def_block)
+        return a->def_pos <= b->def_pos;
+    return Dominates(d->cfg->blocks[a->def_block], d->cfg->blocks[b->def_block]);
+}
+
+// The order of the names in a preorder walk of the dominator tree.
+static b32 DomOrderLess(Ssa_Destructor *d, Ssa_Name *a, Ssa_Name *b)
+{
+    if (a->def_block == b->def_block)
+        return a->def_pos < b->def_pos;
+    return d->cfg->blocks[a->def_block]->dom_pre <
+        d->cfg->blocks[b->def_block]->dom_pre;
+}
+
+static void SetDomParent(Ssa_Destructor *d, Ssa_Name *name, s64 dom_parent)
+{
+    Dom_Parent_Undo undo = { };
+    undo.name = name;
+    undo.prev = name->dom_parent;
+    array::Push(d->dom_undo, undo);
+    name->dom_parent = dom_parent;
+}
+
+static b32 InterfereAcross(Ssa_Destructor *d, Ssa_Name *a, Ssa_Name *b)
+{
+    return FindWeb(d, a->index) != FindWeb(d, b->index) && Interfere(d, a, b);
+}
+
+// Inserts a name of another web to the members of a web, and links it to the
+// dominance forest of the members. Returns true, if the name interferes with
+// the web.
+static b32 InsertToWeb(Ssa_Destructor *d, Array<s64> &members, Ssa_Name *name)
+{
+    s64 lo = 0, hi = members.count;
+    while (lo < hi)
+    {
+        s64 mid = (lo + hi) / 2;
+        if (DomOrderLess(d, name, d->names[members[mid]]))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    s64 pos = lo;
+
+    // The closest dominator of the name is an ancestor of the member, that
+    // precedes it in the dominance order.
+    s64 dom_parent = (pos > 0) ? members[pos - 1] : -1;
+    while (dom_parent != -1 && !NameDominates(d, d->names[dom_parent], name))
+        dom_parent = d->names[dom_parent]->dom_parent;
+    SetDomParent(d, name, dom_parent);
+    b32 interfere = (dom_parent != -1 &&
+            InterfereAcross(d, d->names[dom_parent], name));
+
+    // The members dominated by the name follow it in the order. The ones,
+    // whose closest dominator was above the name, become its children.
+    for (s64 i = pos; i < members.count && !interfere; i++)
+    {
+        Ssa_Name *child = d->names[members[i]];
+        if (!NameDominates(d, name, child)) break;
+        if (child->dom_parent == -1 ||
+            !NameDominates(d, name, d->names[child->dom_parent]))
+        {
+            SetDomParent(d, child, name->index);
+            interfere = InterfereAcross(d, name, child);
+        }
+    }
+    array::Insert(members, pos, name->index);
+    return interfere;
+}
+
+// Coalesces the webs of the names, if the webs do not interfere. The members
+// of a web are kept in the dominance order with their dominance forest, so
+// only the edges of the forest, that connect the two webs, need to be checked
+// [3]: if names from the two webs interfere, one of those edges interferes
+// too. The smaller web is inserted to the bigger one, and the insertion is
+// undone, if they interfere.
+static void TryCoalesce(Ssa_Destructor *d, Ssa_Name *a, Ssa_Name *b)
+{
+    Ssa_Name *web1 = d->names[FindWeb(d, a->index)];
+    Ssa_Name *web2 = d->names[FindWeb(d, b->index)];
+    if (web1 == web2)
+        return;
+    if (web1->members.count < web2->members.count)
+    {
+        Ssa_Name *t = web1;
+        web1 = web2;
+        web2 = t;
+    }
+
+    array::Clear(d->dom_undo);
+    b32 interfere = false;
+    for (s64 m = 0; m < web2->members.count && !interfere; m++)
+    {
+        interfere = InsertToWeb(d, web1->members, d->names[web2->members[m]]);
+    }
+    if (interfere)
+    {
+        for (s64 i = d->dom_undo.count - 1; i >= 0; i--)
+            d->dom_undo[i].name->dom_parent = d->dom_undo[i].prev;
+        s64 count = 0;
+        for (s64 i = 0; i < web1->members.count; i++)
+        {
+            s64 member = web1->members[i];
+            if (FindWeb(d, member) == web1->index)
+                web1->members.data[count++] = member;
+        }
+        web1->members.count = count;
+        return;
+    }
+    array::Free(web2->members);
+    web2->parent = web1->index;
+}
+
+static void CoalesceWebs(Ssa_Destructor *d)
+{
+    Ir_Routine *routine = d->routine;
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode != IR_Phi) continue;
+        Ssa_Name *target = LookupName(d, instr->target);
+        Ir_Phi *phi = instr->oper1.phi;
+        for (s64 a = 0; a < phi->args.count; a++)
+        {
+            Ssa_Name *arg = LookupName(d, phi->args[a].value);
+            if (!arg) continue;
+            TryCoalesce(d, target, arg);
+        }
+    }
+    for (s64 i = 0; i < d->ties.count; i++)
+    {
+        TryCoalesce(d, LookupName(d, d->ties[i].dst), LookupName(d, d->ties[i].src));
+    }
+
+    // The web gets the name of the value at the routine entry, if it is in
+    // the web, so that the routine arguments keep their names.
+    for (s64 i = 0; i < d->names.count; i++)
+    {
+        Ssa_Name *web = d->names[i];
+        if (web->parent != web->index) continue;
+        web->web_name = web->name;
+        for (s64 m = 0; m < web->members.count; m++)
+        {
+            Ssa_Name *member = d->names[web->members[m]];
+            if (member->def_pos == -1)
+                web->web_name = member->name;
+        }
+    }
+}
+
+static void RenameToWeb(Ssa_Destructor *d, Ir_Operand *oper)
+{
+    Ssa_Name *name = LookupName(d, *oper);
+    if (!name) return;
+    Ssa_Name *web = d->names[FindWeb(d, name->index)];
+    SetIrLocalName(oper, web->web_name);
+}
+
+static void RenameWebs(Ssa_Destructor *d)
+{
+    Ir_Routine *routine = d->routine;
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        RenameToWeb(d, &instr->target);
+        if (instr->opcode == IR_Phi)
+        {
+            Ir_Phi *phi = instr->oper1.phi;
+            for (s64 a = 0; a < phi->args.count; a++)
+                RenameToWeb(d, &phi->args[a].value);
+        }
+        else
+        {
+            RenameToWeb(d, &instr->oper1);
+            RenameToWeb(d, &instr->oper2);
+        }
+    }
+}
+
+static b32 SameLocal(const Ir_Operand &a, const Ir_Operand &b)
+{
+    return IsIrLocal(a) && IsIrLocal(b) && GetIrLocalName(a) == GetIrLocalName(b);
+}
+
+// Sequentializes the parallel copies of the phis of a block for one
+// predecessor. A cycle of copies is broken with a temporary.
+static void SequentializeCopies(Ssa_Destructor *d,
+        Array<Copy_Pair> &pending, Array<Ir_Instruction> &copies)
+{
+    while (pending.count > 0)
+    {
+        b32 progress = false;
+        for (s64 i = 0; i < pending.count; )
+        {
+            b32 dst_read = false;
+            for (s64 j = 0; j < pending.count && !dst_read; j++)
+            {
+                dst_read = (j != i) && SameLocal(pending[j].src, pending[i].dst);
+            }
+            if (dst_read)
+            {
+                i++;
+                continue;
+            }
+            array::Push(copies, MovInstruction(pending[i].dst, pending[i].src));
+            for (s64 j = i + 1; j < pending.count; j++)
+                pending[j - 1] = pending[j];
+            pending.count--;
+            progress = true;
+        }
+        if (!progress)
+        {
+            Copy_Pair copy = pending[0];
+            Ir_Operand temp = NewIrTemp(d->ctx, d->routine, copy.dst.type);
+            array::Push(copies, MovInstruction(temp, copy.dst));
+            for (s64 j = 0; j < pending.count; j++)
+            {
+                if (SameLocal(pending[j].src, copy.dst))
+                    pending[j].src = temp;
+            }
+        }
+    }
+}
+
+// Collects the copies for the edge from pred to block.
+static void CollectEdgeCopies(Ssa_Destructor *d, Ir_Block *pred, Ir_Block *block,
+        Array<Ir_Instruction> &copies)
+{
+    Ir_Routine *routine = d->routine;
+    Ir_Label *pred_label = GetBlockLabel(routine, pred);
+    Array<Copy_Pair> pending = { };
+    for (s64 i = block->start; i < block->end; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode != IR_Phi) continue;
+        Ir_Phi *phi = instr->oper1.phi;
+        for (s64 a = 0; a < phi->args.count; a++)
+        {
+            Ir_Phi_Arg arg = phi->args[a];
+            if (arg.pred != pred_label) continue;
+            if (!SameLocal(instr->target, arg.value))
+            {
+                Copy_Pair copy = { };
+                copy.dst = instr->target;
+                copy.src = arg.value;
+                array::Push(pending, copy);
+            }
+            break;
+        }
+    }
+    SequentializeCopies(d, pending, copies);
+    array::Free(pending);
+}
+
+static void PushCopies(Ir_Rewrite *rw, Array<Ir_Instruction> &copies)
+{
+    for (s64 i = 0; i < copies.count; i++)
+        PushInstruction(rw, copies[i]);
+}
+
+// Replaces the phis with copies at the ends of the predecessors. The copies
+// of an edge from a conditional jump are placed to a new block; after the
+// jump for the fall through edge, and to the end of the routine for the
+// taken edge.
+static void InsertCopies(Ssa_Destructor *d)
+{
+    Ir_Routine *routine = d->routine;
+    Ir_Cfg *cfg = d->cfg;
+    s64 instr_count = routine->instructions.count;
+
+    Array<Split_Edge> split_edges = { };
+    Array<Ir_Instruction> copies = { };
+    Array<Ir_Instruction> fall_copies = { };
+
+    Ir_Rewrite rw;
+    BeginRewrite(&rw, routine);
+    for (s64 blk = 0; blk < cfg->blocks.count; blk++)
+    {
+        Ir_Block *block = cfg->blocks[blk];
+        for (s64 i = block->start; i < block->end - 1; i++)
+        {
+            if (routine->instructions[i].opcode != IR_Phi)
+                CopyInstruction(&rw, i);
+        }
+
+        s64 last_i = block->end - 1;
+        Ir_Instruction *last = &routine->instructions[last_i];
+        Ir_Block *fall_succ = (block->end < instr_count)
+            ? cfg->instr_blocks[block->end] : nullptr;
+        if (last->opcode == IR_Phi)
+        {
+            last = nullptr;
+        }
+        else if (last->opcode == IR_Return)
+        {
+            fall_succ = nullptr;
+        }
+        else if (last->opcode == IR_Jump)
+        {
+            array::Clear(copies);
+            CollectEdgeCopies(d, block, GetLabelBlock(cfg, last->target.label), copies);
+            PushCopies(&rw, copies);
+            fall_succ = nullptr;
+        }
+        else if (IsConditionalJump(last->opcode))
+        {
+            Ir_Block *jump_succ = GetLabelBlock(cfg, last->target.label);
+            array::Clear(copies);
+            CollectEdgeCopies(d, block, jump_succ, copies);
+            array::Clear(fall_copies);
+            if (fall_succ)
+                CollectEdgeCopies(d, block, fall_succ, fall_copies);
+
+            Ir_Instruction *jump = CopyInstruction(&rw, last_i);
+            last = nullptr;
+            if (jump_succ == fall_succ)
+            {
+                // NOTE(henrik): Both edges go to the same block, so the
+                // jump goes to the copies after it.
+                if (copies.count > 0)
+                {
+                    Ir_Operand label = NewIrLabel(d->ctx, routine);
+                    jump->target = label;
+                    PushInstruction(&rw, LabelInstruction(label));
+                    PushCopies(&rw, copies);
+                }
+                fall_succ = nullptr;
+            }
+            else
+            {
+                if (copies.count > 0)
+                {
+                    Split_Edge edge = { };
+                    edge.label = NewIrLabel(d->ctx, routine);
+                    edge.target = jump->target.label;
+                    edge.copies = copies;
+                    copies = { };
+                    jump->target = edge.label;
+                    array::Push(split_edges, edge);
+                }
+                if (fall_copies.count > 0)
+                {
+                    PushInstruction(&rw, LabelInstruction(NewIrLabel(d->ctx, routine)));
+                    PushCopies(&rw, fall_copies);
+                }
+                fall_succ = nullptr;
+            }
+        }
+        else
+        {
+            CopyInstruction(&rw, last_i);
+            last = nullptr;
+        }
+
+        if (last)
+            CopyInstruction(&rw, last_i);
+        if (fall_succ)
+        {
+            array::Clear(copies);
+            CollectEdgeCopies(d, block, fall_succ, copies);
+            PushCopies(&rw, copies);
+        }
+    }
+
+    if (split_edges.count > 0)
+    {
+        // NOTE(henrik): The routine must not fall through to the split
+        // edges.
+        Ir_Instruction *last = &array::Back(rw.instructions);
+        if (last->opcode != IR_Jump && last->opcode != IR_Return)
+        {
+            Ir_Instruction ret = { };
+            ret.opcode = IR_Return;
+            PushInstruction(&rw, ret);
+        }
+        for (s64 i = 0; i < split_edges.count; i++)
+        {
+            Split_Edge &edge = split_edges[i];
+            PushInstruction(&rw, LabelInstruction(edge.label));
+            PushCopies(&rw, edge.copies);
+
+            Ir_Instruction jump = { };
+            jump.opcode = IR_Jump;
+            jump.target.oper_type = IR_OPER_Label;
+            jump.target.label = edge.target;
+            PushInstruction(&rw, jump);
+            array::Free(edge.copies);
+        }
+    }
+    EndRewrite(&rw);
+
+    array::Free(split_edges);
+    array::Free(copies);
+    array::Free(fall_copies);
+}
+
+// Removes the labels, that no jump targets. The SSA form adds labels to all
+// blocks.
+static void RemoveUnusedLabels(Ir_Routine *routine)
+{
+    s64 instr_count = routine->instructions.count;
+    Pointer targeted_ptr = Alloc(instr_count + 1);
+    u8 *targeted = (u8*)targeted_ptr.ptr;
+    memset(targeted, 0, instr_count);
+
+    b32 any_unused = false;
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode == IR_Jump || IsConditionalJump(instr->opcode))
+            targeted[instr->target.label->target_loc] = 1;
+    }
+    for (s64 i = 0; i < instr_count && !any_unused; i++)
+    {
+        any_unused = (routine->instructions[i].opcode == IR_Label && !targeted[i]);
+    }
+    if (any_unused)
+    {
+        Ir_Rewrite rw;
+        BeginRewrite(&rw, routine);
+        for (s64 i = 0; i < instr_count; i++)
+        {
+            if (routine->instructions[i].opcode == IR_Label && !targeted[i])
+                continue;
+            CopyInstruction(&rw, i);
+        }
+        EndRewrite(&rw);
+    }
+    Free(targeted_ptr);
+}
+
+static void FreeSsaDestructor(Ssa_Destructor *d)
+{
+    for (s64 i = 0; i < d->names.count; i++)
+    {
+        array::Free(d->names[i]->uses);
+        array::Free(d->names[i]->members);
+    }
+    array::Free(d->name_table);
+    array::Free(d->names);
+    array::Free(d->ties);
+    array::Free(d->dom_undo);
+    FreeMemoryArena(&d->arena);
+}
+
+void DestructSsa(Ir_Gen_Context *ctx, Ir_Routine *routine)
+{
+    if (routine->instructions.count == 0)
+        return;
+
+    Ssa_Destructor destructor = { };
+    Ssa_Destructor *d = &destructor;
+    d->ctx = ctx;
+    d->routine = routine;
+    d->cfg = GetCfg(routine);
+
+    CollectPhiNames(d);
+    if (d->names.count > 0)
+    {
+        ComputeNameLiveness(d);
+        CoalesceWebs(d);
+        RenameWebs(d);
+
+        // NOTE(henrik): The phis are freed after the rewrite, as the copies
+        // are collected from them during it.
+        Array<Ir_Phi*> phis = { };
+        for (s64 i = 0; i < routine->instructions.count; i++)
+        {
+            Ir_Instruction *instr = &routine->instructions[i];
+            if (instr->opcode == IR_Phi)
+                array::Push(phis, instr->oper1.phi);
+        }
+        InsertCopies(d);
+        for (s64 i = 0; i < phis.count; i++)
+            array::Free(phis[i]->args);
+        array::Free(phis);
+    }
+    FreeSsaDestructor(d);
+
+    RemoveUnusedLabels(routine);
+}
+
+void ConvertFromSsa(Ir_Gen_Context *ctx)
+{
+    for (s64 i = 0; i < ctx->routines.count; i++)
+    {
+        DestructSsa(ctx, ctx->routines[i]);
+    }
+}
+
+} // hplang
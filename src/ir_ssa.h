@@ -0,0 +1,43 @@
+#ifndef H_HPLANG_IR_SSA_H
+
+#include "ir_types.h"
+
+namespace hplang
+{
+
+struct Ir_Gen_Context;
+
+// Returns true, if the instruction defines its target operand.
+b32 IsIrDefinition(const Ir_Instruction *instr);
+
+// Collects the operand slots, that the instruction reads, to uses. Returns the
+// number of the slots (max 2). The slots may hold other than variables or
+// temporaries. The arguments of a phi are not included, as they are read at
+// the end of the predecessors.
+s64 GetIrUses(Ir_Instruction *instr, Ir_Operand **uses);
+
+// Returns true for the variables and temporaries, that are local to the
+// routine.
+b32 IsIrLocal(const Ir_Operand &oper);
+Name GetIrLocalName(const Ir_Operand &oper);
+
+// Converts the routine to the SSA form. The variables and temporaries, that
+// are not structs and whose address is not taken, are renamed so that each
+// definition has its own name, and phis are inserted to the blocks where the
+// definitions meet. The value of a variable at the routine entry keeps the
+// original name. Every block of the SSA form begins with a label, and the
+// unreachable blocks are removed.
+void ConstructSsa(Ir_Gen_Context *ctx, Ir_Routine *routine);
+void ConvertToSsa(Ir_Gen_Context *ctx);
+
+// Converts the routine back from the SSA form. The names connected by a phi
+// are coalesced to one name, when their live ranges do not interfere.
+// Copies are inserted to the ends of the predecessors for the rest, splitting
+// the critical edges.
+void DestructSsa(Ir_Gen_Context *ctx, Ir_Routine *routine);
+void ConvertFromSsa(Ir_Gen_Context *ctx);
+
+} // hplang
+
+#define H_HPLANG_IR_SSA_H
+#endif
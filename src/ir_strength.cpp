@@ -0,0 +1,439 @@
+
+#include "ir_strength.h"
+#include "ir_ssa.h"
+#include "ir_cfg.h"
+#include "ir_gen.h"
+#include "ir_eval.h"
+#include "symbols.h"
+#include "hashtable.h"
+#include "common.h"
+#include "assert.h"
+
+// The strength reduction of the element addressing [1] on the SSA form. A
+// basic induction variable is a phi in the loop header, that gets its
+// initial value from the preheader and the value i + c from the latch, where
+// c is a constant. An element access base[i], where base is defined outside
+// the loop, computes base + i * size at each iteration; it is replaced by a
+// pointer p, that starts at &base[init] in the preheader, and is advanced
+// with &p[c] next to the increment of i.
+//
+// Only the element sizes, that are not valid index scales, are reduced; the
+// code generator addresses the other elements with one instruction already.
+//
+// [1]  Keith D. Cooper, L. Taylor Simpson and Christopher A. Vick, 2001.
+//      Operator Strength Reduction.
+
+namespace hplang
+{
+
+struct Sr_Name
+{
+    Name name;
+    s64 def_count;
+    s64 def_index;          // The instruction defining the name
+    b32 is_arg;
+    b32 addr_taken;
+};
+
+// An instruction inserted before or after an existing instruction.
+struct Sr_Insert
+{
+    Ir_Instruction instr;
+    s64 next;               // The next insert at the same place, or -1
+};
+
+// A pointer induction variable derived from a basic induction variable.
+struct Sr_Pointer
+{
+    Ir_Operand base;
+    Ir_Operand value;       // The pointer to the current element
+};
+
+struct Sr
+{
+    Memory_Arena arena;
+    Ir_Gen_Context *ctx;
+    Ir_Routine *routine;
+    Ir_Cfg *cfg;
+
+    Array<Sr_Name*> name_table;
+    Array<Sr_Name*> names;
+
+    Array<Sr_Insert> inserts;
+    s64 *insert_before;     // The first insert before each instruction, or -1
+    s64 *insert_after;      // The first insert after each instruction, or -1
+
+    Array<Sr_Pointer> pointers; // The pointers of the current induction variable
+};
+
+static Sr_Name* LookupName(Sr *s, const Ir_Operand &oper)
+{
+    if (!IsIrLocal(oper)) return nullptr;
+    return hashtable::Lookup(s->name_table, GetIrLocalName(oper));
+}
+
+static Sr_Name* AddName(Sr *s, const Ir_Operand &oper)
+{
+    Sr_Name *name = LookupName(s, oper);
+    if (name) return name;
+    name = PushStruct<Sr_Name>(&s->arena);
+    *name = { };
+    name->name = GetIrLocalName(oper);
+    name->def_index = -1;
+    hashtable::Put(s->name_table, name->name, name);
+    array::Push(s->names, name);
+    return name;
+}
+
+static void CollectNames(Sr *s)
+{
+    Ir_Routine *routine = s->routine;
+    s64 instr_count = routine->instructions.count;
+    array::Resize(s->name_table, 2 * instr_count + routine->arg_count + 31);
+
+    for (s64 i = 0; i < routine->arg_count; i++)
+    {
+        if (IsIrLocal(routine->args[i]))
+            AddName(s, routine->args[i])->is_arg = true;
+    }
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode == IR_Phi || IsIrDefinition(instr))
+        {
+            if (IsIrLocal(instr->target))
+            {
+                Sr_Name *name = AddName(s, instr->target);
+                name->def_count++;
+                name->def_index = i;
+            }
+        }
+        if (instr->opcode == IR_Addr && IsIrLocal(instr->oper1))
+            AddName(s, instr->oper1)->addr_taken = true;
+    }
+}
+
+static b32 IsSsaValue(Sr *s, const Ir_Operand &oper)
+{
+    Sr_Name *name = LookupName(s, oper);
+    if (!name || name->addr_taken || TypeIsStruct(oper.type))
+        return false;
+    return name->def_count == 1 || (name->def_count == 0 && name->is_arg);
+}
+
+static b32 SameName(const Ir_Operand &a, const Ir_Operand &b)
+{
+    return IsIrLocal(a) && IsIrLocal(b) &&
+        a.oper_type == b.oper_type && GetIrLocalName(a) == GetIrLocalName(b);
+}
+
+static b32 InLoop(const Ir_Block *block, const Ir_Loop *loop)
+{
+    for (Ir_Loop *l = block->loop; l; l = l->parent)
+    {
+        if (l == loop) return true;
+    }
+    return false;
+}
+
+static b32 IsJump(Ir_Opcode opcode)
+{
+    return opcode == IR_Jump || opcode == IR_Jz || opcode == IR_Jnz;
+}
+
+static Ir_Label* GetBlockLabel(Sr *s, Ir_Block *block)
+{
+    Ir_Instruction *instr = &s->routine->instructions[block->start];
+    ASSERT(instr->opcode == IR_Label);
+    return instr->target.label;
+}
+
+static Ir_Operand ImmediateOperand(Type *type, s64 value)
+{
+    Ir_Operand oper = { };
+    oper.oper_type = IR_OPER_Immediate;
+    oper.type = type;
+    oper.imm_s64 = value;
+    return oper;
+}
+
+static void AddInsert(Sr *s, s64 *list, s64 index, const Ir_Instruction &instr)
+{
+    Sr_Insert insert = { };
+    insert.instr = instr;
+    insert.next = list[index];
+    list[index] = s->inserts.count;
+    array::Push(s->inserts, insert);
+}
+
+
+// Induction variables
+
+// Returns true, if the operand is an SSA name defined outside the loop.
+static b32 IsLoopInvariant(Sr *s, const Ir_Operand &oper, Ir_Loop *loop)
+{
+    if (!IsSsaValue(s, oper)) return false;
+    Sr_Name *name = LookupName(s, oper);
+    if (name->def_count == 0) return true;
+    return !InLoop(s->cfg->instr_blocks[name->def_index], loop);
+}
+
+// Finds the step of the basic induction variable defined by the phi. The
+// step is the index of the instruction, that computes the next value.
+static b32 FindStep(Sr *s, Ir_Loop *loop, Ir_Instruction *phi_instr,
+        Ir_Label *latch_label, s64 *step_index, s64 *step)
+{
+    Ir_Phi *phi = phi_instr->oper1.phi;
+    Ir_Operand next = { };
+    for (s64 a = 0; a < phi->args.count; a++)
+    {
+        if (phi->args[a].pred == latch_label)
+            next = phi->args[a].value;
+    }
+    if (!IsSsaValue(s, next)) return false;
+    Sr_Name *name = LookupName(s, next);
+    if (name->def_count != 1) return false;
+
+    // NOTE(henrik): The increment must be executed once at every iteration,
+    // so it cannot be inside an inner loop.
+    s64 index = name->def_index;
+    if (s->cfg->instr_blocks[index]->loop != loop) return false;
+
+    Ir_Instruction *instr = &s->routine->instructions[index];
+    Ir_Operand *c = nullptr;
+    if (instr->opcode == IR_Add)
+    {
+        if (SameName(instr->oper1, phi_instr->target))
+            c = &instr->oper2;
+        else if (SameName(instr->oper2, phi_instr->target))
+            c = &instr->oper1;
+    }
+    else if (instr->opcode == IR_Sub && SameName(instr->oper1, phi_instr->target))
+    {
+        c = &instr->oper2;
+    }
+    if (!c || c->oper_type != IR_OPER_Immediate || !TypeIsIntegral(c->type))
+        return false;
+
+    s64 value = (s64)NormalizeIrValue(c->type, c->imm_u64);
+    *step = (instr->opcode == IR_Sub) ? -value : value;
+    *step_index = index;
+    return true;
+}
+
+static b32 IsReducible(Sr *s, Ir_Loop *loop, Ir_Instruction *instr, const Ir_Operand &iv)
+{
+    if (instr->opcode != IR_LoadElementAddr && instr->opcode != IR_MovElement)
+        return false;
+    if (!SameName(instr->oper2, iv) || !TypeIsPointer(instr->oper1.type))
+        return false;
+    s64 size = GetAlignedElementSize(instr->oper1.type);
+    if (size == 1 || size == 2 || size == 4 || size == 8)
+        return false;
+    return IsLoopInvariant(s, instr->oper1, loop);
+}
+
+static Sr_Pointer* GetPointer(Sr *s, const Ir_Operand &base)
+{
+    for (s64 i = 0; i < s->pointers.count; i++)
+    {
+        Sr_Pointer *ptr = &s->pointers[i];
+        if (SameName(ptr->base, base) && ptr->base.type == base.type)
+            return ptr;
+    }
+    return nullptr;
+}
+
+static void ReduceInductionVariable(Sr *s, Ir_Loop *loop, Ir_Block *preheader,
+        Ir_Block *latch, s64 phi_index)
+{
+    Ir_Routine *routine = s->routine;
+    Ir_Instruction *phi_instr = &routine->instructions[phi_index];
+    Ir_Operand iv = phi_instr->target;
+    if (!IsSsaValue(s, iv) || !TypeIsIntegral(iv.type) || GetSize(iv.type) != 8)
+        return;
+
+    Ir_Label *pre_label = GetBlockLabel(s, preheader);
+    Ir_Label *latch_label = GetBlockLabel(s, latch);
+    Ir_Phi *phi = phi_instr->oper1.phi;
+    Ir_Operand init = { };
+    for (s64 a = 0; a < phi->args.count; a++)
+    {
+        if (phi->args[a].pred == pre_label)
+            init = phi->args[a].value;
+    }
+    if (init.oper_type == IR_OPER_None) return;
+
+    s64 step_index, step;
+    if (!FindStep(s, loop, phi_instr, latch_label, &step_index, &step))
+        return;
+
+    s->pointers.count = 0;
+    for (s64 b = 0; b < loop->blocks.count; b++)
+    {
+        Ir_Block *block = loop->blocks[b];
+        for (s64 i = block->start; i < block->end; i++)
+        {
+            Ir_Instruction *instr = &routine->instructions[i];
+            if (!IsReducible(s, loop, instr, iv))
+                continue;
+            s64 size = GetAlignedElementSize(instr->oper1.type);
+            const s64 max_offset = 0x7fffffff;
+            if (step > max_offset / size || step < -max_offset / size)
+                continue;
+
+            Sr_Pointer *ptr = GetPointer(s, instr->oper1);
+            if (!ptr)
+            {
+                Sr_Pointer new_ptr = { };
+                new_ptr.base = instr->oper1;
+                new_ptr.value = NewIrTemp(s->ctx, routine, instr->oper1.type);
+                array::Push(s->pointers, new_ptr);
+                ptr = &s->pointers[s->pointers.count - 1];
+
+                Ir_Operand start = NewIrTemp(s->ctx, routine, ptr->value.type);
+                Ir_Operand next = NewIrTemp(s->ctx, routine, ptr->value.type);
+
+                Ir_Instruction start_instr = { };
+                start_instr.opcode = IR_LoadElementAddr;
+                start_instr.target = start;
+                start_instr.oper1 = ptr->base;
+                start_instr.oper2 = init;
+                Ir_Instruction *last = &routine->instructions[preheader->end - 1];
+                if (IsJump(last->opcode))
+                    AddInsert(s, s->insert_before, preheader->end - 1, start_instr);
+                else
+                    AddInsert(s, s->insert_after, preheader->end - 1, start_instr);
+
+                Ir_Phi *ptr_phi = PushStruct<Ir_Phi>(&s->ctx->arena);
+                *ptr_phi = { };
+                Ir_Phi_Arg arg = { };
+                arg.pred = pre_label;
+                arg.value = start;
+                array::Push(ptr_phi->args, arg);
+                arg.pred = latch_label;
+                arg.value = next;
+                array::Push(ptr_phi->args, arg);
+
+                Ir_Instruction phi_instr = { };
+                phi_instr.opcode = IR_Phi;
+                phi_instr.target = ptr->value;
+                phi_instr.oper1.oper_type = IR_OPER_Phi;
+                phi_instr.oper1.type = ptr->value.type;
+                phi_instr.oper1.phi = ptr_phi;
+                AddInsert(s, s->insert_after, loop->header->start, phi_instr);
+
+                Ir_Instruction next_instr = { };
+                next_instr.opcode = IR_LoadElementAddr;
+                next_instr.target = next;
+                next_instr.oper1 = ptr->value;
+                next_instr.oper2 = ImmediateOperand(iv.type, step);
+                AddInsert(s, s->insert_after, step_index, next_instr);
+            }
+
+            // NOTE(henrik): The element is at the pointer, which the code
+            // generator addresses with the constant index 0.
+            if (instr->opcode == IR_LoadElementAddr && instr->target.type == ptr->value.type)
+            {
+                instr->opcode = IR_Mov;
+                instr->oper1 = ptr->value;
+                instr->oper2 = { };
+            }
+            else
+            {
+                instr->oper1 = ptr->value;
+                instr->oper2 = ImmediateOperand(iv.type, 0);
+            }
+            s->ctx->opt_counts.reduced_instrs++;
+        }
+    }
+}
+
+static void ReduceLoop(Sr *s, Ir_Loop *loop)
+{
+    // NOTE(henrik): The loop must have one latch and a preheader, that jumps
+    // only to the header, so that the new pointers can be initialized there.
+    Ir_Block *header = loop->header;
+    if (loop->latches.count != 1 || header->preds.count != 2)
+        return;
+    Ir_Block *latch = loop->latches[0];
+    Ir_Block *preheader = header->preds[0];
+    if (preheader == latch)
+        preheader = header->preds[1];
+    if (InLoop(preheader, loop) || preheader->succs.count != 1)
+        return;
+
+    for (s64 i = header->start + 1; i < header->end; i++)
+    {
+        if (s->routine->instructions[i].opcode != IR_Phi)
+            break;
+        ReduceInductionVariable(s, loop, preheader, latch, i);
+    }
+}
+
+static void RewriteRoutine(Sr *s)
+{
+    Ir_Routine *routine = s->routine;
+    s64 instr_count = routine->instructions.count;
+    Ir_Rewrite rw;
+    BeginRewrite(&rw, routine);
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        for (s64 n = s->insert_before[i]; n != -1; n = s->inserts[n].next)
+            PushInstruction(&rw, s->inserts[n].instr);
+        CopyInstruction(&rw, i);
+        for (s64 n = s->insert_after[i]; n != -1; n = s->inserts[n].next)
+            PushInstruction(&rw, s->inserts[n].instr);
+    }
+    EndRewrite(&rw);
+}
+
+static void FreeSr(Sr *s)
+{
+    array::Free(s->name_table);
+    array::Free(s->names);
+    array::Free(s->inserts);
+    array::Free(s->pointers);
+    FreeMemoryArena(&s->arena);
+}
+
+void ReduceStrength(Ir_Gen_Context *ctx, Ir_Routine *routine)
+{
+    if (routine->instructions.count == 0)
+        return;
+
+    Sr sr = { };
+    Sr *s = &sr;
+    s->ctx = ctx;
+    s->routine = routine;
+    s->cfg = GetCfg(routine);
+    if (s->cfg->loops.count == 0)
+        return;
+
+    s64 instr_count = routine->instructions.count;
+    s->insert_before = PushArray<s64>(&s->arena, instr_count);
+    s->insert_after = PushArray<s64>(&s->arena, instr_count);
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        s->insert_before[i] = -1;
+        s->insert_after[i] = -1;
+    }
+
+    CollectNames(s);
+    for (s64 i = 0; i < s->cfg->loops.count; i++)
+        ReduceLoop(s, s->cfg->loops[i]);
+    if (s->inserts.count > 0)
+        RewriteRoutine(s);
+
+    FreeSr(s);
+}
+
+void ReduceStrength(Ir_Gen_Context *ctx)
+{
+    for (s64 i = 0; i < ctx->routines.count; i++)
+    {
+        ReduceStrength(ctx, ctx->routines[i]);
+    }
+}
+
+} // hplang
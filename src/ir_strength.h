@@ -0,0 +1,21 @@
+#ifndef H_HPLANG_IR_STRENGTH_H
+
+#include "ir_types.h"
+
+namespace hplang
+{
+
+struct Ir_Gen_Context;
+
+// Reduces the strength of the element addressing in the loops of the routine
+// in the SSA form. The element accesses indexed by an induction variable,
+// whose element size cannot be used as the index scale of an address, are
+// made through a pointer, that is advanced by the step of the induction
+// variable at each iteration.
+void ReduceStrength(Ir_Gen_Context *ctx, Ir_Routine *routine);
+void ReduceStrength(Ir_Gen_Context *ctx);
+
+} // hplang
+
+#define H_HPLANG_IR_STRENGTH_H
+#endif
@@ -0,0 +1,219 @@
+#include "ir_tail.h"
+#include "ir_cfg.h"
+#include "ir_gen.h"
+#include "symbols.h"
+#include "common.h"
+#include "assert.h"
+
+// A call in the tail position [1] is the last thing a routine does before
+// returning. When the callee is the routine itself, the call is replaced by
+// moving the arguments to the parameters and jumping to the beginning of the
+// routine, which turns the tail recursion into a loop. The arguments are
+// first moved to temporaries, where they are evaluated, as the arguments may
+// read the parameters, and the evaluation of the other calls may be between
+// the arguments and the call.
+//
+// The routines that take the address of a local or have struct locals are
+// not changed, as the new iteration would overwrite a local, that a pointer
+// given to the call may refer to. The code generator jumps to the callee of
+// the other tail calls, after tearing down the frame of the routine.
+//
+// [1]  Guy L. Steele Jr., 1977.
+//      Debunking the "Expensive Procedure Call" Myth, or, Procedure Call
+//      Implementations Considered Harmful, or, Lambda: The Ultimate GOTO.
+
+namespace hplang
+{
+
+static const s64 TAIL_MAX_JUMPS = 8;
+
+b32 IsTailCall(Ir_Routine *routine, s64 index)
+{
+    const Ir_Instruction *call = &routine->instructions[index];
+    if (call->opcode != IR_Call && call->opcode != IR_CallForeign)
+        return false;
+
+    // Follow the labels and the jumps to the return.
+    s64 jumps = 0;
+    s64 i = index + 1;
+    while (i < routine->instructions.count)
+    {
+        const Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode == IR_Label)
+        {
+            i++;
+        }
+        else if (instr->opcode == IR_Jump && jumps < TAIL_MAX_JUMPS)
+        {
+            i = instr->target.label->target_loc;
+            jumps++;
+        }
+        else if (instr->opcode == IR_Return)
+        {
+            if (instr->target.oper_type == IR_OPER_None)
+                return true;
+            return call->target.oper_type != IR_OPER_None &&
+                   instr->target == call->target;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    // NOTE(henrik): A routine without a result may end without a return.
+    return true;
+}
+
+b32 HasLocalAddresses(Ir_Routine *routine)
+{
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        const Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode == IR_Addr)
+            return true;
+        if (instr->opcode == IR_VarDecl && TypeIsStruct(instr->target.type))
+            return true;
+    }
+    return false;
+}
+
+static b32 IsSelfTailCall(Ir_Routine *routine, s64 index)
+{
+    const Ir_Instruction *call = &routine->instructions[index];
+    if (call->opcode != IR_Call ||
+        call->oper1.oper_type != IR_OPER_Routine ||
+        call->oper1.var.name != routine->name)
+    {
+        return false;
+    }
+    if (TypeIsStruct(call->target.type))
+        return false;
+    s64 arg_index = call->oper2.imm_s64;
+    while (arg_index != -1)
+    {
+        const Ir_Instruction *arg = &routine->instructions[arg_index];
+        if (TypeIsStruct(arg->target.type))
+            return false;
+        arg_index = arg->oper1.imm_s64;
+    }
+    return IsTailCall(routine, index);
+}
+
+static b32 HasCalls(Ir_Routine *routine)
+{
+    for (s64 i = 0; i < routine->instructions.count; i++)
+    {
+        Ir_Opcode opcode = routine->instructions[i].opcode;
+        if (opcode == IR_Call || opcode == IR_CallForeign)
+            return true;
+    }
+    return false;
+}
+
+static void EliminateTailCalls(Ir_Gen_Context *ctx, Ir_Routine *routine)
+{
+    s64 instr_count = routine->instructions.count;
+    s64 tail_calls = 0;
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        if (IsSelfTailCall(routine, i))
+            tail_calls++;
+    }
+    if (tail_calls == 0 || HasLocalAddresses(routine))
+        return;
+
+    Memory_Arena arena = { };
+    // The temporary of each argument of a tail call; none for the other
+    // instructions.
+    Ir_Operand *arg_temps = PushArray<Ir_Operand>(&arena, instr_count);
+    for (s64 i = 0; i < instr_count; i++)
+        arg_temps[i] = { };
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        if (!IsSelfTailCall(routine, i))
+            continue;
+        s64 arg_index = routine->instructions[i].oper2.imm_s64;
+        while (arg_index != -1)
+        {
+            Ir_Instruction *arg = &routine->instructions[arg_index];
+            arg_temps[arg_index] = NewIrTemp(ctx, routine, arg->target.type);
+            arg_index = arg->oper1.imm_s64;
+        }
+    }
+
+    Ir_Operand entry_label = NewIrLabel(ctx, routine);
+
+    Ir_Rewrite rw;
+    BeginRewrite(&rw, routine);
+
+    Ir_Instruction label = { };
+    label.opcode = IR_Label;
+    label.target = entry_label;
+    PushInstruction(&rw, label);
+
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (arg_temps[i].oper_type != IR_OPER_None)
+        {
+            Ir_Instruction mov = { };
+            mov.opcode = IR_Mov;
+            mov.target = arg_temps[i];
+            mov.oper1 = instr->target;
+            mov.comment = instr->comment;
+            PushInstruction(&rw, mov);
+        }
+        else if (IsSelfTailCall(routine, i))
+        {
+            s64 param = 0;
+            s64 arg_index = instr->oper2.imm_s64;
+            while (arg_index != -1)
+            {
+                Ir_Instruction mov = { };
+                mov.opcode = IR_Mov;
+                mov.target = routine->args[param++];
+                mov.oper1 = arg_temps[arg_index];
+                mov.comment = instr->comment;
+                PushInstruction(&rw, mov);
+                arg_index = routine->instructions[arg_index].oper1.imm_s64;
+            }
+            ASSERT(param == routine->arg_count);
+
+            Ir_Instruction jump = { };
+            jump.opcode = IR_Jump;
+            jump.target = entry_label;
+            PushInstruction(&rw, jump);
+
+            // NOTE(henrik): The return right after the call is left
+            // without a value, so it is removed.
+            if (i + 1 < instr_count &&
+                routine->instructions[i + 1].opcode == IR_Return)
+            {
+                i++;
+            }
+        }
+        else
+        {
+            CopyInstruction(&rw, i);
+        }
+    }
+    EndRewrite(&rw);
+    FreeMemoryArena(&arena);
+
+    if (!HasCalls(routine))
+        routine->flags |= ROUT_Leaf;
+    ctx->opt_counts.tail_calls += tail_calls;
+}
+
+void EliminateTailCalls(Ir_Gen_Context *ctx)
+{
+    for (s64 i = 0; i < ctx->routines.count; i++)
+    {
+        Ir_Routine *routine = ctx->routines[i];
+        // NOTE(henrik): The top level routine is entered only once.
+        if (routine->name.str.size > 0)
+            EliminateTailCalls(ctx, routine);
+    }
+}
+
+} // hplang
@@ -0,0 +1,30 @@
+#ifndef H_HPLANG_IR_TAIL_H
+
+#include "ir_types.h"
+
+namespace hplang
+{
+
+struct Ir_Gen_Context;
+
+// Returns true, if the instruction at the index is a call, whose result is
+// returned by the routine as is, or a call at the end of a routine without
+// a result. Nothing is executed after a call in the tail position, so the
+// code generator can jump to the callee, when the frame of the routine is
+// not needed by the call.
+b32 IsTailCall(Ir_Routine *routine, s64 index);
+
+// Returns true, if the routine may take the address of a local, which a call
+// could use after the frame of the routine is gone.
+b32 HasLocalAddresses(Ir_Routine *routine);
+
+// Replaces the calls of the routines to themselves in the tail position with
+// jumps to the beginning of the routine, after moving the arguments to the
+// parameters. Runs before the inlining, so that the loops made of the
+// recursive routines can be inlined.
+void EliminateTailCalls(Ir_Gen_Context *ctx);
+
+} // hplang
+
+#define H_HPLANG_IR_TAIL_H
+#endif
@@ -8,6 +8,7 @@ namespace hplang
 
 #define IR_OPCODES\
     PASTE_IR(IR_Label)\
+    PASTE_IR(IR_Phi)\
     \
     PASTE_IR(IR_VarDecl)\
     \
@@ -62,6 +63,9 @@ namespace hplang
     PASTE_IR(IR_F64_TO_F32)\
     \
     PASTE_IR(IR_Sqrt)\
+    PASTE_IR(IR_Broadcast)\
+    PASTE_IR(IR_Shuffle)\
+    PASTE_IR(IR_MoveMask)\
     PASTE_IR(IR_COUNT)
 
 #define PASTE_IR(ir) ir,
@@ -85,6 +89,10 @@ enum Ir_Opcode
 // NOTE(henrik): Only the operand type needs to have the notion of
 // foreign/native routine; there should not be need for both call and
 // call_foreign ir instructions.
+// NOTE(henrik): The direct calls to the routines, whose address is not taken,
+// use the "hplang native" calling convention. The routines called through
+// routine pointers are flagged ROUT_AddressTaken and use the platform ABI, so
+// the routine pointers need not differentiate between the two.
 enum Ir_Oper_Type
 {
     IR_OPER_None,
@@ -95,6 +103,7 @@ enum Ir_Oper_Type
     IR_OPER_Label,
     IR_OPER_Routine,
     IR_OPER_ForeignRoutine,
+    IR_OPER_Phi,
 };
 
 struct Type;
@@ -116,6 +125,7 @@ struct Ir_Label
 };
 
 struct Ir_Routine;
+struct Ir_Phi;
 
 struct Ir_Operand
 {
@@ -125,6 +135,7 @@ struct Ir_Operand
         Ir_Variable var;
         Ir_Temp temp;
         Ir_Label *label;
+        Ir_Phi *phi;
 
         bool imm_bool;
         s8 imm_s8;
@@ -160,11 +171,32 @@ struct Ir_Instruction
 
 typedef Array<Ir_Instruction> Ir_Instruction_List;
 
+// The phi instructions exist only in the SSA form. The phi is placed after
+// the label of a block, and it has an argument for each predecessor of the
+// block. The predecessors are identified by their labels, as every block
+// begins with a label in the SSA form.
+//   IR_Phi target, oper1
+// where oper1 is the IR_OPER_Phi operand, that holds the arguments.
+struct Ir_Phi_Arg
+{
+    Ir_Label *pred;
+    Ir_Operand value;
+};
+
+struct Ir_Phi
+{
+    Array<Ir_Phi_Arg> args;
+};
+
 struct Symbol;
+struct Ir_Cfg;
 
 enum Routine_Flags
 {
     ROUT_Leaf = 1,
+    ROUT_Inline = 2,        // Declared #inline
+    ROUT_NoInline = 4,      // Declared #noinline
+    ROUT_AddressTaken = 8,  // Called through routine pointers; uses the platform ABI
 };
 
 struct Ir_Routine
@@ -177,8 +209,12 @@ struct Ir_Routine
 
     Ir_Instruction_List instructions;
     s64 temp_count;
+    s64 label_count;        // The labels created by the ir transformations
 
     u32 flags;
+
+    // The control flow graph of the instructions; built by BuildCfg.
+    Ir_Cfg *cfg;
 };
 
 typedef Array<Ir_Routine*> Ir_Routine_List;
@@ -0,0 +1,894 @@
+
+#include "ir_vectorize.h"
+#include "ir_ssa.h"
+#include "ir_cfg.h"
+#include "ir_gen.h"
+#include "ir_eval.h"
+#include "compiler.h"
+#include "symbols.h"
+#include "hashtable.h"
+#include "common.h"
+#include "assert.h"
+
+// The loop vectorization [1] of the innermost counted loops on the SSA form.
+// A loop is vectorized, when it has the shape
+//
+//  H:  i = phi(P: init, B: i')
+//      c = i < n
+//      jz X, c
+//  B:  ...
+//      i' = i + 1
+//      jump H
+//
+// and every instruction of the body B is an element load a[i] or store
+// a[i] = x, where a is defined outside the loop, or an arithmetic instruction
+// on the loaded values and the values defined outside the loop. The elements
+// must have the same size, so that each vector has the same number of them,
+// VF. Then the iterations are independent, apart from the arrays that may
+// overlap. A vector loop, that runs VF iterations at a time, is inserted to
+// the end of the preheader P:
+//
+//      (jnz VX, the arrays overlap)
+//  VS: broadcasts of the values defined outside the loop
+//  VH: vi = phi(VS: init, VB: vi')
+//      c = vi < n - (VF - 1)
+//      jz VX, c
+//  VB: the body on vectors at vi
+//      vi' = vi + VF
+//      jump VH
+//  VX: vi_end = phi(P: init, VH: vi)
+//
+// and the original loop continues from vi_end with the remaining elements.
+//
+// The overlap check of a stored array a and another array b accessed in the
+// loop is |a - b| < VF * size, i.e. the elements of one vector iteration
+// would overlap. Otherwise a dependence between the arrays has the distance
+// of at least VF iterations, and is preserved by the vector loop.
+//
+// [1]  Randy Allen and Ken Kennedy, 2001. Optimizing Compilers for Modern
+//      Architectures. Chapter 5.
+
+namespace hplang
+{
+
+// NOTE(henrik): Each pair of a stored array and another array needs a check,
+// so a loop accessing many arrays is left scalar.
+static const s64 max_overlap_checks = 8;
+
+struct Vec_Name
+{
+    Name name;
+    s64 def_count;
+    s64 def_index;          // The instruction defining the name
+    s64 use_count;
+    b32 is_arg;
+    b32 addr_taken;
+};
+
+// The vector of a name defined in the loop body, or the address of the
+// first element of the vector, if the name is an element address.
+struct Vec_Value
+{
+    Name name;
+    Ir_Operand value;
+    b32 is_addr;
+    Ir_Operand base;        // The array of the element address
+};
+
+struct Vec_Broadcast
+{
+    Ir_Operand scalar;
+    Ir_Operand value;
+};
+
+struct Vec_Insert
+{
+    s64 start, count;       // The inserted instructions in Vec::code
+};
+
+struct Vec_Loop
+{
+    Ir_Loop *loop;
+    Ir_Operand iv;
+    Ir_Operand vi;          // The induction variable of the vector loop
+    s64 step_index;         // The instruction computing i + 1
+    s64 vector_size;        // The size of the vectors in bytes
+    s64 elem_size;          // The size of the elements, or 0 if not known yet
+    b32 emit;               // Only checks the body, if false
+};
+
+struct Vec
+{
+    Memory_Arena arena;
+    Ir_Gen_Context *ctx;
+    Ir_Routine *routine;
+    Ir_Cfg *cfg;
+
+    Array<Vec_Name*> name_table;
+    Array<Vec_Name*> names;
+
+    // The state of the current loop
+    Array<Vec_Value> values;
+    Array<Vec_Broadcast> broadcasts;
+    Array<Ir_Operand> load_bases;
+    Array<Ir_Operand> store_bases;
+    Array<Ir_Instruction> setup;    // The broadcasts
+    Array<Ir_Instruction> body;
+
+    Array<Ir_Instruction> code;
+    Array<Vec_Insert> inserts;
+    s64 *insert_before;     // The insert before each instruction, or -1
+    s64 *insert_after;      // The insert after each instruction, or -1
+};
+
+static Vec_Name* LookupName(Vec *v, const Ir_Operand &oper)
+{
+    if (!IsIrLocal(oper)) return nullptr;
+    return hashtable::Lookup(v->name_table, GetIrLocalName(oper));
+}
+
+static Vec_Name* AddName(Vec *v, const Ir_Operand &oper)
+{
+    Vec_Name *name = LookupName(v, oper);
+    if (name) return name;
+    name = PushStruct<Vec_Name>(&v->arena);
+    *name = { };
+    name->name = GetIrLocalName(oper);
+    name->def_index = -1;
+    hashtable::Put(v->name_table, name->name, name);
+    array::Push(v->names, name);
+    return name;
+}
+
+static void CollectNames(Vec *v)
+{
+    Ir_Routine *routine = v->routine;
+    s64 instr_count = routine->instructions.count;
+    array::Resize(v->name_table, 2 * instr_count + routine->arg_count + 31);
+
+    for (s64 i = 0; i < routine->arg_count; i++)
+    {
+        if (IsIrLocal(routine->args[i]))
+            AddName(v, routine->args[i])->is_arg = true;
+    }
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        Ir_Instruction *instr = &routine->instructions[i];
+        if (instr->opcode == IR_Phi || IsIrDefinition(instr))
+        {
+            if (IsIrLocal(instr->target))
+            {
+                Vec_Name *name = AddName(v, instr->target);
+                name->def_count++;
+                name->def_index = i;
+            }
+        }
+        if (instr->opcode == IR_Addr && IsIrLocal(instr->oper1))
+            AddName(v, instr->oper1)->addr_taken = true;
+
+        if (instr->opcode == IR_Phi)
+        {
+            Ir_Phi *phi = instr->oper1.phi;
+            for (s64 a = 0; a < phi->args.count; a++)
+            {
+                if (IsIrLocal(phi->args[a].value))
+                    AddName(v, phi->args[a].value)->use_count++;
+            }
+            continue;
+        }
+        Ir_Operand *uses[2];
+        s64 use_count = GetIrUses(instr, uses);
+        for (s64 u = 0; u < use_count; u++)
+        {
+            if (IsIrLocal(*uses[u]))
+                AddName(v, *uses[u])->use_count++;
+        }
+    }
+}
+
+static b32 IsSsaValue(Vec *v, const Ir_Operand &oper)
+{
+    Vec_Name *name = LookupName(v, oper);
+    if (!name || name->addr_taken || TypeIsStruct(oper.type))
+        return false;
+    return name->def_count == 1 || (name->def_count == 0 && name->is_arg);
+}
+
+static b32 SameName(const Ir_Operand &a, const Ir_Operand &b)
+{
+    return IsIrLocal(a) && IsIrLocal(b) &&
+        a.oper_type == b.oper_type && GetIrLocalName(a) == GetIrLocalName(b);
+}
+
+static b32 InLoop(const Ir_Block *block, const Ir_Loop *loop)
+{
+    for (Ir_Loop *l = block->loop; l; l = l->parent)
+    {
+        if (l == loop) return true;
+    }
+    return false;
+}
+
+static b32 IsJump(Ir_Opcode opcode)
+{
+    return opcode == IR_Jump || opcode == IR_Jz || opcode == IR_Jnz;
+}
+
+static Ir_Label* GetBlockLabel(Vec *v, Ir_Block *block)
+{
+    Ir_Instruction *instr = &v->routine->instructions[block->start];
+    ASSERT(instr->opcode == IR_Label);
+    return instr->target.label;
+}
+
+static Ir_Operand ImmediateOperand(Type *type, s64 value)
+{
+    Ir_Operand oper = { };
+    oper.oper_type = IR_OPER_Immediate;
+    oper.type = type;
+    oper.imm_s64 = value;
+    return oper;
+}
+
+// Returns true, if the operand is an SSA name defined outside the loop.
+static b32 IsLoopInvariant(Vec *v, const Ir_Operand &oper, Ir_Loop *loop)
+{
+    if (!IsSsaValue(v, oper)) return false;
+    Vec_Name *name = LookupName(v, oper);
+    if (name->def_count == 0) return true;
+    return !InLoop(v->cfg->instr_blocks[name->def_index], loop);
+}
+
+
+// Element types
+
+static b32 IsVectorizableType(Type *type)
+{
+    switch (type->tag)
+    {
+        case TYP_f32: case TYP_f64:
+        case TYP_s32: case TYP_u32:
+        case TYP_s64: case TYP_u64:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+// Returns true, if the elements of the type can be in the vectors of the
+// loop; all elements must have the same size.
+static b32 CheckElementType(Vec_Loop *vl, Type *type)
+{
+    if (!IsVectorizableType(type)) return false;
+    s64 size = GetSize(type);
+    if (vl->elem_size == 0)
+        vl->elem_size = size;
+    return size == vl->elem_size;
+}
+
+static Type* GetVectorType(Vec *v, Vec_Loop *vl, Type *type)
+{
+    b32 wide = (vl->vector_size == 32);
+    Type_Tag tag = TYP_none;
+    switch (type->tag)
+    {
+        case TYP_f32:
+            tag = wide ? TYP_f32x8 : TYP_f32x4; break;
+        case TYP_f64:
+            tag = wide ? TYP_f64x4 : TYP_f64x2; break;
+        case TYP_s32: case TYP_u32:
+            tag = wide ? TYP_s32x8 : TYP_s32x4; break;
+        case TYP_s64: case TYP_u64:
+            tag = wide ? TYP_s64x4 : TYP_s64x2; break;
+        default:
+            INVALID_CODE_PATH;
+    }
+    return GetBuiltinType(v->ctx->env, tag);
+}
+
+// Returns true, if the code generator has a packed instruction for the
+// operation on the vectors of the type. The 32 bit integer multiplication
+// needs AVX2.
+static b32 HasVectorOp(Vec_Loop *vl, Ir_Opcode opcode, Type *type)
+{
+    if (TypeIsFloat(type))
+    {
+        return opcode == IR_Add || opcode == IR_Sub ||
+            opcode == IR_Mul || opcode == IR_Div || opcode == IR_Sqrt;
+    }
+    switch (opcode)
+    {
+        case IR_Add: case IR_Sub:
+        case IR_And: case IR_Or: case IR_Xor:
+            return true;
+        case IR_Mul:
+            return GetSize(type) == 4 && vl->vector_size == 32;
+        default:
+            break;
+    }
+    return false;
+}
+
+
+// Body
+
+static Vec_Value* LookupValue(Vec *v, const Ir_Operand &oper)
+{
+    if (!IsIrLocal(oper)) return nullptr;
+    for (s64 i = 0; i < v->values.count; i++)
+    {
+        if (v->values[i].name == GetIrLocalName(oper))
+            return &v->values[i];
+    }
+    return nullptr;
+}
+
+static void AddValue(Vec *v, const Ir_Operand &oper, const Ir_Operand &value,
+        b32 is_addr, const Ir_Operand &base)
+{
+    Vec_Value vec_value = { };
+    vec_value.name = GetIrLocalName(oper);
+    vec_value.value = value;
+    vec_value.is_addr = is_addr;
+    vec_value.base = base;
+    array::Push(v->values, vec_value);
+}
+
+static b32 SameScalar(const Ir_Operand &a, const Ir_Operand &b)
+{
+    if (a.type != b.type) return false;
+    if (a.oper_type == IR_OPER_Immediate && b.oper_type == IR_OPER_Immediate)
+        return a.imm_u64 == b.imm_u64;
+    return SameName(a, b);
+}
+
+// Returns the vector, that has the scalar in every element. The broadcast is
+// done once before the vector loop.
+static Ir_Operand GetBroadcast(Vec *v, Vec_Loop *vl, const Ir_Operand &scalar)
+{
+    if (!vl->emit) return { };
+    for (s64 i = 0; i < v->broadcasts.count; i++)
+    {
+        if (SameScalar(v->broadcasts[i].scalar, scalar))
+            return v->broadcasts[i].value;
+    }
+    Vec_Broadcast broadcast = { };
+    broadcast.scalar = scalar;
+    broadcast.value = NewIrTemp(v->ctx, v->routine, GetVectorType(v, vl, scalar.type));
+    array::Push(v->broadcasts, broadcast);
+
+    Ir_Instruction instr = { };
+    instr.opcode = IR_Broadcast;
+    instr.target = broadcast.value;
+    instr.oper1 = scalar;
+    array::Push(v->setup, instr);
+    return broadcast.value;
+}
+
+// Gets the vector of an operand of the body; the operand is either defined
+// in the body, or a broadcast value defined outside the loop.
+static b32 GetVectorOperand(Vec *v, Vec_Loop *vl, const Ir_Operand &oper,
+        Ir_Operand *result)
+{
+    if (IsIrLocal(oper))
+    {
+        Vec_Value *value = LookupValue(v, oper);
+        if (value)
+        {
+            if (value->is_addr) return false;
+            *result = value->value;
+            return true;
+        }
+        if (!IsLoopInvariant(v, oper, vl->loop))
+            return false;
+    }
+    else if (oper.oper_type != IR_OPER_Immediate)
+    {
+        return false;
+    }
+    if (!CheckElementType(vl, oper.type))
+        return false;
+    *result = GetBroadcast(v, vl, oper);
+    return true;
+}
+
+static b32 VectorizeInstruction(Vec *v, Vec_Loop *vl, Ir_Instruction *instr)
+{
+    switch (instr->opcode)
+    {
+    case IR_MovElement:
+    case IR_LoadElementAddr:
+        {
+            Type *ptr_type = instr->oper1.type;
+            if (!IsSsaValue(v, instr->target) || !TypeIsPointer(ptr_type))
+                return false;
+            if (!SameName(instr->oper2, vl->iv) ||
+                !IsLoopInvariant(v, instr->oper1, vl->loop))
+            {
+                return false;
+            }
+            Type *elem_type = ptr_type->base_type;
+            if (!CheckElementType(vl, elem_type))
+                return false;
+
+            b32 is_addr = (instr->opcode == IR_LoadElementAddr);
+            if (!is_addr && !TypesEqual(instr->target.type, elem_type))
+                return false;
+
+            Ir_Operand value = { };
+            if (vl->emit)
+            {
+                Type *type = is_addr ? instr->target.type : GetVectorType(v, vl, elem_type);
+                value = NewIrTemp(v->ctx, v->routine, type);
+                Ir_Instruction vec_instr = *instr;
+                vec_instr.target = value;
+                vec_instr.oper2 = vl->vi;
+                array::Push(v->body, vec_instr);
+            }
+            if (!is_addr)
+                array::Push(v->load_bases, instr->oper1);
+            AddValue(v, instr->target, value, is_addr, instr->oper1);
+        } break;
+    case IR_Store:
+        {
+            Vec_Value *addr = LookupValue(v, instr->target);
+            if (!addr || !addr->is_addr)
+                return false;
+            if (!TypesEqual(instr->oper1.type, addr->base.type->base_type))
+                return false;
+            Ir_Operand value;
+            if (!GetVectorOperand(v, vl, instr->oper1, &value))
+                return false;
+            if (vl->emit)
+            {
+                Ir_Instruction vec_instr = *instr;
+                vec_instr.target = addr->value;
+                vec_instr.oper1 = value;
+                array::Push(v->body, vec_instr);
+            }
+            array::Push(v->store_bases, addr->base);
+        } break;
+    case IR_Load:
+        {
+            // NOTE(henrik): An assignment expression loads the assigned
+            // element back; the value is not used by a statement.
+            Vec_Name *name = LookupName(v, instr->target);
+            if (!name || name->use_count != 0)
+                return false;
+        } break;
+    case IR_Mov:
+        {
+            if (!IsSsaValue(v, instr->target) ||
+                !TypesEqual(instr->target.type, instr->oper1.type) ||
+                !CheckElementType(vl, instr->target.type))
+            {
+                return false;
+            }
+            Ir_Operand value;
+            if (!GetVectorOperand(v, vl, instr->oper1, &value))
+                return false;
+            AddValue(v, instr->target, value, false, { });
+        } break;
+    case IR_Add: case IR_Sub:
+    case IR_Mul: case IR_Div:
+    case IR_And: case IR_Or: case IR_Xor:
+    case IR_Sqrt:
+        {
+            Type *type = instr->target.type;
+            if (!IsSsaValue(v, instr->target) || !CheckElementType(vl, type) ||
+                !HasVectorOp(vl, instr->opcode, type))
+            {
+                return false;
+            }
+            b32 unary = (instr->opcode == IR_Sqrt);
+            if (!TypesEqual(instr->oper1.type, type) ||
+                (!unary && !TypesEqual(instr->oper2.type, type)))
+            {
+                return false;
+            }
+            Ir_Operand a, b;
+            if (!GetVectorOperand(v, vl, instr->oper1, &a))
+                return false;
+            if (unary)
+                b = a;
+            else if (!GetVectorOperand(v, vl, instr->oper2, &b))
+                return false;
+
+            Ir_Operand value = { };
+            if (vl->emit)
+            {
+                value = NewIrTemp(v->ctx, v->routine, GetVectorType(v, vl, type));
+                Ir_Instruction vec_instr = *instr;
+                vec_instr.target = value;
+                vec_instr.oper1 = a;
+                vec_instr.oper2 = b;
+                array::Push(v->body, vec_instr);
+            }
+            AddValue(v, instr->target, value, false, { });
+        } break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+static b32 VectorizeBody(Vec *v, Vec_Loop *vl, Ir_Block *latch)
+{
+    v->values.count = 0;
+    v->broadcasts.count = 0;
+    v->load_bases.count = 0;
+    v->store_bases.count = 0;
+    v->setup.count = 0;
+    v->body.count = 0;
+
+    // NOTE(henrik): The latch begins with a label and ends with the jump to
+    // the header.
+    for (s64 i = latch->start + 1; i < latch->end - 1; i++)
+    {
+        if (i == vl->step_index) continue;
+        if (!VectorizeInstruction(v, vl, &v->routine->instructions[i]))
+            return false;
+    }
+    return v->store_bases.count > 0;
+}
+
+// Collects the pairs of a stored array and another array, that may overlap.
+static s64 CollectOverlapPairs(Vec *v, Ir_Operand *pairs, s64 max_pairs)
+{
+    s64 count = 0;
+    for (s64 s = 0; s < v->store_bases.count; s++)
+    {
+        Ir_Operand a = v->store_bases[s];
+        for (s64 k = 0; k < v->store_bases.count + v->load_bases.count; k++)
+        {
+            Ir_Operand b = (k < v->store_bases.count) ?
+                v->store_bases[k] : v->load_bases[k - v->store_bases.count];
+            if (SameName(a, b)) continue;
+
+            b32 found = false;
+            for (s64 p = 0; p < count && !found; p++)
+            {
+                found = (SameName(pairs[2*p], a) && SameName(pairs[2*p + 1], b)) ||
+                        (SameName(pairs[2*p], b) && SameName(pairs[2*p + 1], a));
+            }
+            if (found) continue;
+            if (count == max_pairs) return max_pairs + 1;
+            pairs[2*count] = a;
+            pairs[2*count + 1] = b;
+            count++;
+        }
+    }
+    return count;
+}
+
+
+// Code
+
+static void PushCode(Vec *v, Ir_Opcode opcode, const Ir_Operand &target,
+        const Ir_Operand &oper1 = { }, const Ir_Operand &oper2 = { })
+{
+    Ir_Instruction instr = { };
+    instr.opcode = opcode;
+    instr.target = target;
+    instr.oper1 = oper1;
+    instr.oper2 = oper2;
+    array::Push(v->code, instr);
+}
+
+static Ir_Operand PushPhi(Vec *v, const Ir_Operand &target,
+        Ir_Label *pred1, const Ir_Operand &value1,
+        Ir_Label *pred2, const Ir_Operand &value2)
+{
+    Ir_Phi *phi = PushStruct<Ir_Phi>(&v->ctx->arena);
+    *phi = { };
+    Ir_Phi_Arg arg = { };
+    arg.pred = pred1;
+    arg.value = value1;
+    array::Push(phi->args, arg);
+    arg.pred = pred2;
+    arg.value = value2;
+    array::Push(phi->args, arg);
+
+    Ir_Operand phi_oper = { };
+    phi_oper.oper_type = IR_OPER_Phi;
+    phi_oper.type = target.type;
+    phi_oper.phi = phi;
+    PushCode(v, IR_Phi, target, phi_oper);
+    return target;
+}
+
+// Returns a condition, that is true when the arrays a and b are closer than
+// width bytes to each other.
+static Ir_Operand PushOverlapCheck(Vec *v, Ir_Operand a, Ir_Operand b,
+        s64 width, Type *bool_type)
+{
+    Ir_Gen_Context *ctx = v->ctx;
+    Ir_Routine *routine = v->routine;
+    Type *u64_type = GetBuiltinType(ctx->env, TYP_u64);
+
+    Ir_Operand a_addr = NewIrTemp(ctx, routine, u64_type);
+    Ir_Operand b_addr = NewIrTemp(ctx, routine, u64_type);
+    Ir_Operand dist = NewIrTemp(ctx, routine, u64_type);
+    Ir_Operand biased = NewIrTemp(ctx, routine, u64_type);
+    Ir_Operand cond = NewIrTemp(ctx, routine, bool_type);
+    PushCode(v, IR_Mov, a_addr, a);
+    PushCode(v, IR_Mov, b_addr, b);
+    PushCode(v, IR_Sub, dist, a_addr, b_addr);
+    // NOTE(henrik): -width < a - b < width, when (a - b + width - 1) as
+    // unsigned is less than 2 * width - 1.
+    PushCode(v, IR_Add, biased, dist, ImmediateOperand(u64_type, width - 1));
+    PushCode(v, IR_Lt, cond, biased, ImmediateOperand(u64_type, 2 * width - 1));
+    return cond;
+}
+
+static void VectorizeLoop(Vec *v, Ir_Loop *loop, s64 vector_size)
+{
+    Ir_Gen_Context *ctx = v->ctx;
+    Ir_Routine *routine = v->routine;
+
+    // NOTE(henrik): The loop must be innermost, have the header and the body
+    // in this order, and a preheader, that jumps only to the header.
+    Ir_Block *header = loop->header;
+    if (loop->blocks.count != 2 || loop->latches.count != 1 || header->preds.count != 2)
+        return;
+    Ir_Block *latch = loop->latches[0];
+    if (latch == header || latch->loop != loop || header->loop != loop)
+        return;
+    if (header->end != latch->start || latch->succs.count != 1)
+        return;
+    Ir_Block *preheader = header->preds[0];
+    if (preheader == latch)
+        preheader = header->preds[1];
+    if (InLoop(preheader, loop) || preheader->succs.count != 1)
+        return;
+    s64 pre_last = preheader->end - 1;
+    Ir_Opcode pre_last_op = routine->instructions[pre_last].opcode;
+    if (pre_last_op == IR_Jz || pre_last_op == IR_Jnz)
+        return;
+    if (v->insert_before[pre_last] != -1 || v->insert_after[pre_last] != -1)
+        return;
+
+    // The header is: i = phi(..); c = i < n; jz X, c
+    if (header->end - header->start != 4)
+        return;
+    Ir_Instruction *phi_instr = &routine->instructions[header->start + 1];
+    Ir_Instruction *cmp_instr = &routine->instructions[header->start + 2];
+    Ir_Instruction *jz_instr = &routine->instructions[header->start + 3];
+    if (phi_instr->opcode != IR_Phi || cmp_instr->opcode != IR_Lt || jz_instr->opcode != IR_Jz)
+        return;
+    Ir_Operand iv = phi_instr->target;
+    if (!IsSsaValue(v, iv) || iv.type->tag != TYP_s64)
+        return;
+    if (!SameName(cmp_instr->oper1, iv) || !SameName(jz_instr->oper1, cmp_instr->target))
+        return;
+    if (!IsSsaValue(v, cmp_instr->target) || LookupName(v, cmp_instr->target)->use_count != 1)
+        return;
+    Ir_Operand limit = cmp_instr->oper2;
+    if (limit.type->tag != TYP_s64)
+        return;
+    if (limit.oper_type != IR_OPER_Immediate && !IsLoopInvariant(v, limit, loop))
+        return;
+
+    Ir_Label *pre_label = GetBlockLabel(v, preheader);
+    Ir_Label *latch_label = GetBlockLabel(v, latch);
+    Ir_Phi *phi = phi_instr->oper1.phi;
+    Ir_Operand init = { };
+    Ir_Operand next = { };
+    for (s64 a = 0; a < phi->args.count; a++)
+    {
+        if (phi->args[a].pred == pre_label)
+            init = phi->args[a].value;
+        else if (phi->args[a].pred == latch_label)
+            next = phi->args[a].value;
+    }
+    if (init.oper_type == IR_OPER_None || !IsSsaValue(v, next))
+        return;
+
+    // The step is i' = i + 1 in the body, and i' is used only by the phi.
+    Vec_Name *next_name = LookupName(v, next);
+    if (next_name->use_count != 1 || v->cfg->instr_blocks[next_name->def_index] != latch)
+        return;
+    Ir_Instruction *step_instr = &routine->instructions[next_name->def_index];
+    if (step_instr->opcode != IR_Add)
+        return;
+    Ir_Operand *step = nullptr;
+    if (SameName(step_instr->oper1, iv))
+        step = &step_instr->oper2;
+    else if (SameName(step_instr->oper2, iv))
+        step = &step_instr->oper1;
+    if (!step || step->oper_type != IR_OPER_Immediate || !TypeIsIntegral(step->type) ||
+        NormalizeIrValue(step->type, step->imm_u64) != 1)
+    {
+        return;
+    }
+
+    Vec_Loop vl = { };
+    vl.loop = loop;
+    vl.iv = iv;
+    vl.step_index = next_name->def_index;
+    vl.vector_size = vector_size;
+    if (!VectorizeBody(v, &vl, latch))
+        return;
+
+    Ir_Operand pairs[2 * max_overlap_checks];
+    s64 pair_count = CollectOverlapPairs(v, pairs, max_overlap_checks);
+    if (pair_count > max_overlap_checks)
+        return;
+
+    vl.emit = true;
+    vl.vi = NewIrTemp(ctx, routine, iv.type);
+    b32 vectorized = VectorizeBody(v, &vl, latch);
+    ASSERT(vectorized); (void)vectorized;
+
+    s64 vf = vector_size / vl.elem_size;
+    Type *bool_type = cmp_instr->target.type;
+    Ir_Operand vh_label = NewIrLabel(ctx, routine);
+    Ir_Operand vb_label = NewIrLabel(ctx, routine);
+    Ir_Operand vx_label = NewIrLabel(ctx, routine);
+
+    Vec_Insert insert = { };
+    insert.start = v->code.count;
+
+    // Preheader
+    Ir_Operand overlap = { };
+    for (s64 p = 0; p < pair_count; p++)
+    {
+        Ir_Operand cond = PushOverlapCheck(v, pairs[2*p], pairs[2*p + 1],
+                vector_size, bool_type);
+        if (overlap.oper_type == IR_OPER_None)
+        {
+            overlap = cond;
+        }
+        else
+        {
+            Ir_Operand either = NewIrTemp(ctx, routine, bool_type);
+            PushCode(v, IR_Or, either, overlap, cond);
+            overlap = either;
+        }
+    }
+    Ir_Label *setup_label = pre_label;
+    if (overlap.oper_type != IR_OPER_None)
+    {
+        Ir_Operand label = NewIrLabel(ctx, routine);
+        PushCode(v, IR_Jnz, vx_label, overlap);
+        PushCode(v, IR_Label, label);
+        setup_label = label.label;
+    }
+
+    Ir_Operand vec_limit;
+    if (limit.oper_type == IR_OPER_Immediate)
+    {
+        vec_limit = ImmediateOperand(iv.type, limit.imm_s64 - (vf - 1));
+    }
+    else
+    {
+        vec_limit = NewIrTemp(ctx, routine, iv.type);
+        PushCode(v, IR_Sub, vec_limit, limit, ImmediateOperand(iv.type, vf - 1));
+    }
+    for (s64 i = 0; i < v->setup.count; i++)
+        array::Push(v->code, v->setup[i]);
+
+    // Vector loop
+    Ir_Operand vi_next = NewIrTemp(ctx, routine, iv.type);
+    Ir_Operand vcond = NewIrTemp(ctx, routine, bool_type);
+    PushCode(v, IR_Label, vh_label);
+    PushPhi(v, vl.vi, setup_label, init, vb_label.label, vi_next);
+    PushCode(v, IR_Lt, vcond, vl.vi, vec_limit);
+    PushCode(v, IR_Jz, vx_label, vcond);
+    PushCode(v, IR_Label, vb_label);
+    for (s64 i = 0; i < v->body.count; i++)
+        array::Push(v->code, v->body[i]);
+    PushCode(v, IR_Add, vi_next, vl.vi, ImmediateOperand(iv.type, vf));
+    PushCode(v, IR_Jump, vh_label);
+
+    // The original loop continues from the first element not handled.
+    PushCode(v, IR_Label, vx_label);
+    Ir_Operand vi_end = vl.vi;
+    if (overlap.oper_type != IR_OPER_None)
+    {
+        vi_end = PushPhi(v, NewIrTemp(ctx, routine, iv.type),
+                pre_label, init, vh_label.label, vl.vi);
+    }
+    for (s64 a = 0; a < phi->args.count; a++)
+    {
+        if (phi->args[a].pred == pre_label)
+        {
+            phi->args[a].pred = vx_label.label;
+            phi->args[a].value = vi_end;
+        }
+    }
+
+    insert.count = v->code.count - insert.start;
+    if (IsJump(pre_last_op))
+        v->insert_before[pre_last] = v->inserts.count;
+    else
+        v->insert_after[pre_last] = v->inserts.count;
+    array::Push(v->inserts, insert);
+
+    ctx->opt_counts.vectorized_loops++;
+}
+
+static void RewriteRoutine(Vec *v)
+{
+    Ir_Routine *routine = v->routine;
+    s64 instr_count = routine->instructions.count;
+    Ir_Rewrite rw;
+    BeginRewrite(&rw, routine);
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        if (v->insert_before[i] != -1)
+        {
+            Vec_Insert insert = v->inserts[v->insert_before[i]];
+            for (s64 k = 0; k < insert.count; k++)
+                PushInstruction(&rw, v->code[insert.start + k]);
+        }
+        CopyInstruction(&rw, i);
+        if (v->insert_after[i] != -1)
+        {
+            Vec_Insert insert = v->inserts[v->insert_after[i]];
+            for (s64 k = 0; k < insert.count; k++)
+                PushInstruction(&rw, v->code[insert.start + k]);
+        }
+    }
+    EndRewrite(&rw);
+}
+
+static void FreeVec(Vec *v)
+{
+    array::Free(v->name_table);
+    array::Free(v->names);
+    array::Free(v->values);
+    array::Free(v->broadcasts);
+    array::Free(v->load_bases);
+    array::Free(v->store_bases);
+    array::Free(v->setup);
+    array::Free(v->body);
+    array::Free(v->code);
+    array::Free(v->inserts);
+    FreeMemoryArena(&v->arena);
+}
+
+void VectorizeLoops(Ir_Gen_Context *ctx, Ir_Routine *routine)
+{
+    if (routine->instructions.count == 0)
+        return;
+
+    Vec vec = { };
+    Vec *v = &vec;
+    v->ctx = ctx;
+    v->routine = routine;
+    v->cfg = GetCfg(routine);
+    if (v->cfg->loops.count == 0)
+        return;
+
+    s64 instr_count = routine->instructions.count;
+    v->insert_before = PushArray<s64>(&v->arena, instr_count);
+    v->insert_after = PushArray<s64>(&v->arena, instr_count);
+    for (s64 i = 0; i < instr_count; i++)
+    {
+        v->insert_before[i] = -1;
+        v->insert_after[i] = -1;
+    }
+
+    u32 features = ctx->comp_ctx->options.target_features;
+    s64 vector_size = ((features & TF_Avx2) != 0) ? 32 : 16;
+
+    CollectNames(v);
+    for (s64 i = 0; i < v->cfg->loops.count; i++)
+        VectorizeLoop(v, v->cfg->loops[i], vector_size);
+    if (v->inserts.count > 0)
+        RewriteRoutine(v);
+
+    FreeVec(v);
+}
+
+void VectorizeLoops(Ir_Gen_Context *ctx)
+{
+    for (s64 i = 0; i < ctx->routines.count; i++)
+    {
+        VectorizeLoops(ctx, ctx->routines[i]);
+    }
+}
+
+} // hplang
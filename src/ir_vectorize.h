@@ -0,0 +1,22 @@
+#ifndef H_HPLANG_IR_VECTORIZE_H
+
+#include "ir_types.h"
+
+namespace hplang
+{
+
+struct Ir_Gen_Context;
+
+// Vectorizes the innermost counted loops of the routine in the SSA form, that
+// load, compute and store the elements of arrays at the induction variable
+// without dependences between the iterations. A vector loop, that handles
+// several elements at each iteration, is placed before the original loop,
+// which handles the remaining elements. The vectors are 128 bit, or 256 bit
+// when the target has AVX2.
+void VectorizeLoops(Ir_Gen_Context *ctx, Ir_Routine *routine);
+void VectorizeLoops(Ir_Gen_Context *ctx);
+
+} // hplang
+
+#define H_HPLANG_IR_VECTORIZE_H
+#endif
@@ -0,0 +1,316 @@
+
+#include "hplang.h"
+#include "jit.h"
+#include "object_code.h"
+#include "common.h"
+#include "memory.h"
+#include "assert.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <csetjmp>
+
+#if defined(HP_UNIX)
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// The jit loads the object code of the encoder into memory and runs it in the
+// compiler process. The sections are laid out like in an executable: text and
+// the call stubs are mapped executable, the got and rodata read only, and data
+// and bss writable. The foreign routines are called through the stubs, as the
+// shared library may be mapped further than 2GB from the program.
+
+namespace hplang
+{
+
+#if defined(HP_UNIX)
+
+static const s64 JIT_STUB_SIZE = 8;             // jmp [rip + got], int3, int3
+static const s64 JIT_ENTRY_STUB_SIZE = 16;
+
+// NOTE(henrik): The entry routine init_ exits the program by calling exit.
+// The jit redirects the call here and jumps back to RunJitProgram, so that
+// the compiler can continue after the program has run.
+static jmp_buf jit_exit_jump;
+static s32 jit_exit_code;
+
+static void JitExit(s32 exit_code)
+{
+    jit_exit_code = exit_code;
+    longjmp(jit_exit_jump, 1);
+}
+
+static s64 AlignUp(s64 x, s64 alignment)
+{
+    return (x + alignment - 1) & ~(alignment - 1);
+}
+
+static void* ResolveForeignSymbol(void *library, Name name)
+{
+    char sym_name[256];
+    if (name.str.size >= (s64)sizeof(sym_name))
+        return nullptr;
+    memcpy(sym_name, name.str.data, name.str.size);
+    sym_name[name.str.size] = 0;
+
+    if (strcmp(sym_name, "exit") == 0)
+        return (void*)JitExit;
+
+    void *address = dlsym(library, sym_name);
+    if (!address)
+        address = dlsym(RTLD_DEFAULT, sym_name);
+    return address;
+}
+
+static b32 WriteReloc32(u8 *patch, s64 value, b32 sign_extended)
+{
+    if (sign_extended && (value < INT32_MIN || value > INT32_MAX))
+        return false;
+    if (!sign_extended && (value < 0 || value > UINT32_MAX))
+        return false;
+    u32 value32 = (u32)value;
+    memcpy(patch, &value32, 4);
+    return true;
+}
+
+b32 LoadJitProgram(Jit_Program *program, Object_Code *obj,
+        const char *entry_name, const char *library_filename, IoFile *err_file)
+{
+    *program = { };
+
+    String entry_str;
+    entry_str.data = const_cast<char*>(entry_name);
+    entry_str.size = strlen(entry_name);
+    Object_Symbol *entry = GetObjectSymbol(obj, MakeName(entry_str));
+    if (!entry || entry->section != OBJ_SECT_Text)
+    {
+        fprintf((FILE*)err_file, "Entry routine '%s' not found\n", entry_name);
+        return false;
+    }
+
+    program->library = dlopen(library_filename, RTLD_NOW | RTLD_GLOBAL);
+    if (!program->library)
+    {
+        fprintf((FILE*)err_file, "Could not load '%s': %s\n",
+                library_filename, dlerror());
+        return false;
+    }
+
+    // Each undefined symbol gets a got entry and a stub
+    s64 *stub_index = PushArray<s64>(&obj->arena, obj->symbols.count);
+    for (s64 i = 0; i < obj->symbols.count; i++)
+        stub_index[i] = -1;
+    Array<void*> got = { };
+    for (s64 i = 0; i < obj->relocs.count; i++)
+    {
+        s64 symbol_index = obj->relocs[i].symbol_index;
+        Object_Symbol *symbol = obj->symbols[symbol_index];
+        if (symbol->section != OBJ_SECT_Undefined || stub_index[symbol_index] >= 0)
+            continue;
+
+        void *address = ResolveForeignSymbol(program->library, symbol->name);
+        if (!address)
+        {
+            fprintf((FILE*)err_file, "Undefined reference to '%.*s'\n",
+                    (int)symbol->name.str.size, symbol->name.str.data);
+            array::Free(got);
+            FreeJitProgram(program);
+            return false;
+        }
+        stub_index[symbol_index] = got.count;
+        array::Push(got, address);
+    }
+
+    s64 page_size = sysconf(_SC_PAGESIZE);
+    s64 section_offset[OBJ_SECT_COUNT];
+
+    section_offset[OBJ_SECT_Text] = 0;
+    s64 offset = obj->sections[OBJ_SECT_Text].size;
+    s64 stub_offset = AlignUp(offset, JIT_ENTRY_STUB_SIZE);
+    s64 entry_offset = stub_offset + got.count * JIT_STUB_SIZE;
+    s64 text_end = AlignUp(entry_offset + JIT_ENTRY_STUB_SIZE, page_size);
+
+    s64 got_offset = text_end;
+    offset = got_offset + got.count * sizeof(void*);
+    section_offset[OBJ_SECT_Rodata] = AlignUp(offset,
+            obj->sections[OBJ_SECT_Rodata].alignment);
+    offset = section_offset[OBJ_SECT_Rodata] + obj->sections[OBJ_SECT_Rodata].size;
+    s64 rodata_end = AlignUp(offset, page_size);
+
+    section_offset[OBJ_SECT_Data] = rodata_end;
+    offset = section_offset[OBJ_SECT_Data] + obj->sections[OBJ_SECT_Data].size;
+    section_offset[OBJ_SECT_Bss] = AlignUp(offset,
+            obj->sections[OBJ_SECT_Bss].alignment);
+    offset = section_offset[OBJ_SECT_Bss] + obj->sections[OBJ_SECT_Bss].size;
+    s64 memory_size = AlignUp(offset, page_size);
+
+    void *memory = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        fprintf((FILE*)err_file, "Could not map memory for the program\n");
+        array::Free(got);
+        FreeJitProgram(program);
+        return false;
+    }
+    program->memory = (u8*)memory;
+    program->memory_size = memory_size;
+    u8 *base = program->memory;
+
+    // The bss and the padding stay zeroed, as the mapping is anonymous.
+    for (s64 i = 0; i < OBJ_SECT_COUNT; i++)
+    {
+        if (i == OBJ_SECT_Bss) continue;
+        Object_Section *section = &obj->sections[i];
+        ASSERT(section->data.count == section->size);
+        memcpy(base + section_offset[i], section->data.data, section->size);
+    }
+    memset(base + obj->sections[OBJ_SECT_Text].size, 0xcc,
+            text_end - obj->sections[OBJ_SECT_Text].size);
+    memcpy(base + got_offset, got.data, got.count * sizeof(void*));
+
+    for (s64 i = 0; i < got.count; i++)
+    {
+        u8 *stub = base + stub_offset + i * JIT_STUB_SIZE;
+        s32 disp = (s32)((got_offset + i * sizeof(void*)) - (stub_offset + i * JIT_STUB_SIZE + 6));
+        stub[0] = 0xff;
+        stub[1] = 0x25;
+        memcpy(stub + 2, &disp, 4);
+    }
+
+    // The entry stub aligns the stack and clears the frame pointer like at the
+    // process entry, as init_ aligns the stack based on rbp.
+    {
+        u8 entry_stub[] = {
+            0x48, 0x83, 0xe4, 0xf0,         // and rsp, -16
+            0x31, 0xed,                     // xor ebp, ebp
+            0xe9, 0, 0, 0, 0,               // jmp entry
+        };
+        s32 rel = (s32)(entry->offset - (entry_offset + sizeof(entry_stub)));
+        memcpy(entry_stub + 7, &rel, 4);
+        memcpy(base + entry_offset, entry_stub, sizeof(entry_stub));
+        program->entry = base + entry_offset;
+    }
+
+    b32 result = true;
+    for (s64 i = 0; i < obj->relocs.count && result; i++)
+    {
+        Object_Reloc reloc = obj->relocs[i];
+        Object_Symbol *symbol = obj->symbols[reloc.symbol_index];
+        ASSERT(reloc.section != OBJ_SECT_Bss && reloc.section != OBJ_SECT_Undefined);
+
+        s64 place = (s64)(base + section_offset[reloc.section] + reloc.offset);
+        u8 *patch = (u8*)place;
+
+        s64 target = 0;
+        s64 foreign_target = 0;
+        if (symbol->section == OBJ_SECT_Undefined)
+        {
+            s64 index = stub_index[reloc.symbol_index];
+            target = (s64)(base + stub_offset + index * JIT_STUB_SIZE);
+            foreign_target = (s64)got[index];
+        }
+        else
+        {
+            target = (s64)(base + section_offset[symbol->section] + symbol->offset);
+            foreign_target = target;
+        }
+
+        switch (reloc.type)
+        {
+        case OBJ_RELOC_Pc32:
+        case OBJ_RELOC_Plt32:
+            result = WriteReloc32(patch, target + reloc.addend - place, true);
+            break;
+        case OBJ_RELOC_Abs64:
+            {
+                s64 value = foreign_target + reloc.addend;
+                memcpy(patch, &value, 8);
+            } break;
+        case OBJ_RELOC_Abs32:
+            result = WriteReloc32(patch, foreign_target + reloc.addend, false);
+            break;
+        case OBJ_RELOC_Abs32S:
+            result = WriteReloc32(patch, foreign_target + reloc.addend, true);
+            break;
+        case OBJ_RELOC_GotPc32:
+            result = false;
+            break;
+        }
+        if (!result)
+        {
+            fprintf((FILE*)err_file, "Could not relocate the reference to '%.*s'\n",
+                    (int)symbol->name.str.size, symbol->name.str.data);
+        }
+    }
+    array::Free(got);
+
+    if (result)
+    {
+        result =
+            mprotect(base, text_end, PROT_READ | PROT_EXEC) == 0 &&
+            mprotect(base + text_end, rodata_end - text_end, PROT_READ) == 0;
+        if (!result)
+            fprintf((FILE*)err_file, "Could not protect the program memory\n");
+    }
+    if (!result)
+        FreeJitProgram(program);
+    return result;
+}
+
+s32 RunJitProgram(Jit_Program *program)
+{
+    ASSERT(program->entry != nullptr);
+    typedef void (*Entry_Func)();
+    Entry_Func entry = (Entry_Func)program->entry;
+
+    jit_exit_code = 0;
+    if (setjmp(jit_exit_jump) == 0)
+    {
+        entry();
+    }
+    // NOTE(henrik): Flush the output of the program, as exit would.
+    fflush(nullptr);
+    return jit_exit_code;
+}
+
+void FreeJitProgram(Jit_Program *program)
+{
+    if (program->memory)
+        munmap(program->memory, program->memory_size);
+    if (program->library)
+        dlclose(program->library);
+    *program = { };
+}
+
+#else
+
+b32 LoadJitProgram(Jit_Program *program, Object_Code *obj,
+        const char *entry_name, const char *library_filename, IoFile *err_file)
+{
+    (void)obj;
+    (void)entry_name;
+    (void)library_filename;
+    *program = { };
+    fprintf((FILE*)err_file, "Running programs is not supported on this platform\n");
+    return false;
+}
+
+s32 RunJitProgram(Jit_Program *program)
+{
+    (void)program;
+    INVALID_CODE_PATH;
+    return -1;
+}
+
+void FreeJitProgram(Jit_Program *program)
+{
+    *program = { };
+}
+
+#endif
+
+} // hplang
@@ -0,0 +1,35 @@
+#ifndef H_HPLANG_JIT_H
+
+#include "types.h"
+#include "io.h"
+
+namespace hplang
+{
+
+struct Object_Code;
+
+struct Jit_Program
+{
+    u8 *memory;         // The mapped sections of the program
+    s64 memory_size;
+    void *library;      // The shared library of the foreign routines
+    u8 *entry;          // The entry stub, that jumps to the entry routine
+};
+
+// Maps the encoded object code into executable memory, binds the foreign
+// routines to the shared library and resolves the relocations. The program
+// enters through the routine entry_name, like an executable enters through
+// its entry point. Reports the errors to err_file.
+b32 LoadJitProgram(Jit_Program *program, Object_Code *obj,
+        const char *entry_name, const char *library_filename, IoFile *err_file);
+
+// Runs the program until it calls exit and returns the exit code. The process
+// keeps running after the program exits.
+s32 RunJitProgram(Jit_Program *program);
+
+void FreeJitProgram(Jit_Program *program);
+
+} // hplang
+
+#define H_HPLANG_JIT_H
+#endif
@@ -40,6 +40,25 @@ static const char *target_args[] = {
     "win_amd64",
     "elf64",
     "linux64",
+    "avx2",
+    nullptr
+};
+
+static const char *assembler_args[] = {
+    "nasm",
+    "builtin",
+    nullptr
+};
+
+static const char *linker_args[] = {
+    "gcc",
+    "builtin",
+    nullptr
+};
+
+static const char *optimize_args[] = {
+    "0",
+    "1",
     nullptr
 };
 
@@ -47,7 +66,10 @@ static const char *diag_args[] = {
     "memory",
     "ast",
     "ir",
+    "cfg",
+    "ssa",
     "regalloc",
+    "encoding",
     nullptr
 };
 
@@ -60,7 +82,11 @@ static const char *profile_args[] = {
 static const Arg_Option options[] = {
     {"output", 'o', nullptr, nullptr, "Sets the output filename", "filename", nullptr},
     {"target", 'T', nullptr, nullptr, "Sets the output target", "target", target_args},
-    {"diagnostic", 'd', diag_args, "MAIR", "Selects the diagnostic options", nullptr, nullptr},
+    {"assembler", 'a', nullptr, nullptr, "Selects the assembler backend", "assembler", assembler_args},
+    {"linker", 'l', nullptr, nullptr, "Selects the linker", "linker", linker_args},
+    {"run", 'r', nullptr, nullptr, "Runs the program in-process instead of writing an executable", nullptr, nullptr},
+    {"optimize", 'O', optimize_args, "01", "Sets the optimization level; 0 turns the optimizations off", nullptr, nullptr},
+    {"diagnostic", 'd', diag_args, "MAICSRE", "Selects the diagnostic options", nullptr, nullptr},
     {"profile", 'p', profile_args, "ti", "Selects profiling options", nullptr, nullptr},
     {"help", 'h', nullptr, nullptr, "Shows this help and exits", nullptr, nullptr},
     {"version", 'v', nullptr, nullptr, "Prints the version information", nullptr, nullptr},
@@ -85,6 +111,12 @@ static int ParseTargetOption(Arg_Option_Result option_result, Compiler_Options *
     {
         options->target = CGT_AMD64_Unix;
     }
+    else if (strcmp(arg, "avx2") == 0)
+    {
+        // NOTE(henrik): A target feature is given in addition to the target,
+        // e.g. -T linux64 -T avx2.
+        options->target_features |= TF_Avx2;
+    }
     else
     {
         printf("Invalid target \"%s\"\n, aborting...", arg);
@@ -93,6 +125,81 @@ static int ParseTargetOption(Arg_Option_Result option_result, Compiler_Options *
     return 0;
 }
 
+static int ParseAssemblerOption(Arg_Option_Result option_result, Compiler_Options *options)
+{
+    const char *arg = option_result.arg;
+    if (!arg)
+    {
+        printf("No <assembler> given for -a <assembler>, aborting...\n");
+        return -1;
+    }
+    if (strcmp(arg, "nasm") == 0)
+    {
+        options->assembler = ASM_Nasm;
+    }
+    else if (strcmp(arg, "builtin") == 0)
+    {
+        options->assembler = ASM_Builtin;
+    }
+    else
+    {
+        printf("Invalid assembler \"%s\", aborting...\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
+static int ParseLinkerOption(Arg_Option_Result option_result, Compiler_Options *options)
+{
+    const char *arg = option_result.arg;
+    if (!arg)
+    {
+        printf("No <linker> given for -l <linker>, aborting...\n");
+        return -1;
+    }
+    if (strcmp(arg, "gcc") == 0)
+    {
+        options->linker = LINK_Gcc;
+    }
+    else if (strcmp(arg, "builtin") == 0)
+    {
+        options->linker = LINK_Builtin;
+    }
+    else
+    {
+        printf("Invalid linker \"%s\", aborting...\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
+static int ParseOptimizeOption(Arg_Option_Result option_result, Compiler_Options *options)
+{
+    // NOTE(henrik): The long option gives no argument, if the level is not
+    // one of the optimize_args.
+    const char *arg = option_result.short_args ?
+        option_result.short_args : option_result.arg;
+    if (!arg || arg[0] == '\0')
+    {
+        printf("No valid level given for -O<level>, aborting...\n");
+        return -1;
+    }
+    if (strcmp(arg, "0") == 0)
+    {
+        options->optimize = false;
+    }
+    else if (strcmp(arg, "1") == 0)
+    {
+        options->optimize = true;
+    }
+    else
+    {
+        printf("Invalid optimization level \"%s\", aborting...\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
 static int ParseDiagnosticOption(Arg_Option_Result option_result, Compiler_Options *options)
 {
     if (option_result.short_args)
@@ -111,9 +218,18 @@ static int ParseDiagnosticOption(Arg_Option_Result option_result, Compiler_Optio
                 case 'I':
                     options->debug_ir = true;
                     break;
+                case 'C':
+                    options->debug_cfg = true;
+                    break;
+                case 'S':
+                    options->debug_ssa = true;
+                    break;
                 case 'R':
                     options->debug_reg_alloc = true;
                     break;
+                case 'E':
+                    options->debug_encoding = true;
+                    break;
 
                 default:
                     printf("Unrecognized argument %c for -%c\n",
@@ -131,8 +247,14 @@ static int ParseDiagnosticOption(Arg_Option_Result option_result, Compiler_Optio
             options->debug_ast = true;
         else if (strcmp(arg, "ir") == 0)
             options->debug_ir = true;
+        else if (strcmp(arg, "cfg") == 0)
+            options->debug_cfg = true;
+        else if (strcmp(arg, "ssa") == 0)
+            options->debug_ssa = true;
         else if (strcmp(arg, "regalloc") == 0)
             options->debug_reg_alloc = true;
+        else if (strcmp(arg, "encoding") == 0)
+            options->debug_encoding = true;
         else
         {
             printf("Unrecognized argument %s for --%s\n",
@@ -227,6 +349,25 @@ int main(int argc, char **argv)
                     int result = ParseTargetOption(option_result, &options);
                     if (result != 0) return result;
                 } break;
+                case 'a':
+                {
+                    int result = ParseAssemblerOption(option_result, &options);
+                    if (result != 0) return result;
+                } break;
+                case 'l':
+                {
+                    int result = ParseLinkerOption(option_result, &options);
+                    if (result != 0) return result;
+                } break;
+                case 'r':
+                {
+                    options.run_program = true;
+                } break;
+                case 'O':
+                {
+                    int result = ParseOptimizeOption(option_result, &options);
+                    if (result != 0) return result;
+                } break;
                 case 'd':
                 {
                     int result = ParseDiagnosticOption(option_result, &options);
@@ -272,14 +413,18 @@ int main(int argc, char **argv)
     }
     if (file && Compile(&compiler_ctx, file))
     {
-        printf("Compilation ok\n");
+        // NOTE(henrik): When running the program, its exit code is returned
+        // and its output is not followed by the compiler output.
+        if (!options.run_program)
+            printf("Compilation ok\n");
     }
     else
     {
         printf("Compilation failed\n");
     }
 
+    int exit_code = compiler_ctx.program_exit_code;
     FreeCompilerContext(&compiler_ctx);
 
-    return 0;
+    return exit_code;
 }
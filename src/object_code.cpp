@@ -0,0 +1,150 @@
+
+#include "object_code.h"
+#include "common.h"
+#include "hashtable.h"
+#include "assert.h"
+
+namespace hplang
+{
+
+Object_Code NewObjectCode()
+{
+    Object_Code obj = { };
+    for (s64 i = 0; i < OBJ_SECT_COUNT; i++)
+    {
+        obj.sections[i].alignment = 1;
+    }
+    return obj;
+}
+
+void FreeObjectCode(Object_Code *obj)
+{
+    for (s64 i = 0; i < OBJ_SECT_COUNT; i++)
+    {
+        array::Free(obj->sections[i].data);
+        obj->sections[i].size = 0;
+    }
+    array::Free(obj->symbols);
+    array::Free(obj->symbol_table);
+    array::Free(obj->relocs);
+    FreeMemoryArena(&obj->arena);
+}
+
+s64 GetSectionOffset(Object_Code *obj, Object_Section_Id section)
+{
+    ASSERT(section >= 0 && section < OBJ_SECT_COUNT);
+    return obj->sections[section].size;
+}
+
+s64 AlignSection(Object_Code *obj, Object_Section_Id section, s64 alignment)
+{
+    ASSERT(section >= 0 && section < OBJ_SECT_COUNT);
+    ASSERT(alignment > 0 && (alignment & (alignment - 1)) == 0);
+    Object_Section *sect = &obj->sections[section];
+    if (sect->alignment < alignment)
+        sect->alignment = alignment;
+
+    s64 padding = (alignment - (sect->size & (alignment - 1))) & (alignment - 1);
+    if (padding > 0)
+        ReserveSectionData(obj, section, padding);
+    return sect->size;
+}
+
+s64 PushSectionData(Object_Code *obj, Object_Section_Id section,
+        const void *data, s64 size)
+{
+    ASSERT(section >= 0 && section < OBJ_SECT_COUNT);
+    ASSERT(section != OBJ_SECT_Bss);
+    Object_Section *sect = &obj->sections[section];
+    s64 offset = sect->size;
+    const u8 *bytes = (const u8*)data;
+    for (s64 i = 0; i < size; i++)
+    {
+        array::Push(sect->data, bytes[i]);
+    }
+    sect->size += size;
+    return offset;
+}
+
+s64 ReserveSectionData(Object_Code *obj, Object_Section_Id section, s64 size)
+{
+    ASSERT(section >= 0 && section < OBJ_SECT_COUNT);
+    Object_Section *sect = &obj->sections[section];
+    s64 offset = sect->size;
+    if (section != OBJ_SECT_Bss)
+    {
+        for (s64 i = 0; i < size; i++)
+        {
+            array::Push(sect->data, (u8)0);
+        }
+    }
+    sect->size += size;
+    return offset;
+}
+
+void PatchSectionData(Object_Code *obj, Object_Section_Id section,
+        s64 offset, const void *data, s64 size)
+{
+    ASSERT(section >= 0 && section < OBJ_SECT_COUNT);
+    ASSERT(section != OBJ_SECT_Bss);
+    Object_Section *sect = &obj->sections[section];
+    ASSERT(offset >= 0 && offset + size <= sect->data.count);
+    const u8 *bytes = (const u8*)data;
+    for (s64 i = 0; i < size; i++)
+    {
+        sect->data[offset + i] = bytes[i];
+    }
+}
+
+Object_Symbol* AddObjectSymbol(Object_Code *obj, Name name,
+        Object_Section_Id section, s64 offset, u32 flags)
+{
+    b32 named = (name.str.size > 0);
+    ASSERT(!named || GetObjectSymbol(obj, name) == nullptr);
+    Object_Symbol *symbol = PushStruct<Object_Symbol>(&obj->arena);
+    *symbol = { };
+    symbol->name = name;
+    symbol->index = obj->symbols.count;
+    symbol->section = section;
+    symbol->offset = offset;
+    symbol->flags = flags;
+    array::Push(obj->symbols, symbol);
+    if (named)
+        hashtable::Put(obj->symbol_table, name, symbol);
+    return symbol;
+}
+
+Object_Symbol* GetObjectSymbol(Object_Code *obj, Name name)
+{
+    return hashtable::Lookup(obj->symbol_table, name);
+}
+
+void AddRelocation(Object_Code *obj, Object_Reloc_Type type,
+        Object_Section_Id section, s64 offset,
+        Object_Symbol *symbol, s64 addend)
+{
+    ASSERT(section >= 0 && section < OBJ_SECT_COUNT);
+    ASSERT(section != OBJ_SECT_Bss);
+    Object_Reloc reloc = { };
+    reloc.type = type;
+    reloc.section = section;
+    reloc.offset = offset;
+    reloc.symbol_index = symbol->index;
+    reloc.addend = addend;
+    array::Push(obj->relocs, reloc);
+}
+
+static const char *section_names[OBJ_SECT_COUNT] = {
+    /*[OBJ_SECT_Text] =*/     ".text",
+    /*[OBJ_SECT_Data] =*/     ".data",
+    /*[OBJ_SECT_Rodata] =*/   ".rodata",
+    /*[OBJ_SECT_Bss] =*/      ".bss",
+};
+
+const char* GetSectionName(Object_Section_Id section)
+{
+    ASSERT(section >= 0 && section < OBJ_SECT_COUNT);
+    return section_names[section];
+}
+
+} // hplang
@@ -0,0 +1,107 @@
+#ifndef H_HPLANG_OBJECT_CODE_H
+
+#include "types.h"
+#include "array.h"
+#include "memory.h"
+
+namespace hplang
+{
+
+// Object code is the output of the machine code encoder. It is a target
+// independent representation of the sections, symbols and relocations of a
+// relocatable object, that can be written out as an object file or linked in
+// memory.
+
+enum Object_Section_Id
+{
+    OBJ_SECT_Undefined = -1,    // Symbols defined outside of the object
+
+    OBJ_SECT_Text,
+    OBJ_SECT_Data,
+    OBJ_SECT_Rodata,
+    OBJ_SECT_Bss,
+    OBJ_SECT_COUNT
+};
+
+struct Object_Section
+{
+    Array<u8> data;             // Not used for bss
+    s64 size;
+    s64 alignment;
+};
+
+enum Object_Symbol_Flag_Bits
+{
+    OSYM_Global     = 1,        // The symbol is visible outside of the object
+    OSYM_Routine    = 2,        // The symbol names a routine
+    OSYM_Weak       = 4,        // The symbol may be left undefined or be overridden
+};
+
+struct Object_Symbol
+{
+    Name name;
+    s64 index;
+    Object_Section_Id section;
+    s64 offset;
+    s64 size;
+    u32 flags;
+};
+
+enum Object_Reloc_Type
+{
+    OBJ_RELOC_Pc32,     // S + A - P, 32 bits
+    OBJ_RELOC_Plt32,    // L + A - P, 32 bits, L is the plt entry of S
+    OBJ_RELOC_Abs64,    // S + A, 64 bits
+    OBJ_RELOC_Abs32,    // S + A, 32 bits zero extended
+    OBJ_RELOC_Abs32S,   // S + A, 32 bits sign extended
+    OBJ_RELOC_GotPc32,  // G + A - P, 32 bits, G is the got entry of S
+};
+
+struct Object_Reloc
+{
+    Object_Reloc_Type type;
+    Object_Section_Id section;
+    s64 offset;
+    s64 symbol_index;
+    s64 addend;
+};
+
+struct Object_Code
+{
+    Memory_Arena arena;
+
+    Object_Section sections[OBJ_SECT_COUNT];
+
+    Array<Object_Symbol*> symbols;
+    Array<Object_Symbol*> symbol_table;     // hashtable of symbols
+
+    Array<Object_Reloc> relocs;
+};
+
+Object_Code NewObjectCode();
+void FreeObjectCode(Object_Code *obj);
+
+s64 GetSectionOffset(Object_Code *obj, Object_Section_Id section);
+s64 AlignSection(Object_Code *obj, Object_Section_Id section, s64 alignment);
+s64 PushSectionData(Object_Code *obj, Object_Section_Id section,
+        const void *data, s64 size);
+s64 ReserveSectionData(Object_Code *obj, Object_Section_Id section, s64 size);
+void PatchSectionData(Object_Code *obj, Object_Section_Id section,
+        s64 offset, const void *data, s64 size);
+
+// NOTE(henrik): Symbols with an empty name are not added to the symbol table,
+// and can only be referred to by their index.
+Object_Symbol* AddObjectSymbol(Object_Code *obj, Name name,
+        Object_Section_Id section, s64 offset, u32 flags);
+Object_Symbol* GetObjectSymbol(Object_Code *obj, Name name);
+
+void AddRelocation(Object_Code *obj, Object_Reloc_Type type,
+        Object_Section_Id section, s64 offset,
+        Object_Symbol *symbol, s64 addend);
+
+const char* GetSectionName(Object_Section_Id section);
+
+} // hplang
+
+#define H_HPLANG_OBJECT_CODE_H
+#endif
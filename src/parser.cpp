@@ -1674,9 +1674,57 @@ static Ast_Node* ParseTopLevelNamedStmt(Parser_Context *ctx)
     return stmt;
 }
 
+static Ast_Node* ParseInlineDirective(Parser_Context *ctx, const Token *ident_tok,
+        Inline_Hint inline_hint)
+{
+    Ast_Node *func_def = ParseTopLevelNamedStmt(ctx);
+    if (!func_def || func_def->type != AST_FunctionDef)
+    {
+        Error(ctx, ident_tok, "Expecting function definition after the directive");
+        return func_def;
+    }
+    func_def->function_def.inline_hint = inline_hint;
+    return func_def;
+}
+
+static Ast_Node* ParseDirective(Parser_Context *ctx)
+{
+    const Token *hash_tok = Accept(ctx, TOK_Hash);
+    if (!hash_tok)
+        return nullptr;
+
+    const Token *ident_tok = Expect(ctx, TOK_Identifier);
+    if (!ident_tok)
+        return nullptr;
+
+    String directive = { };
+    directive.data = const_cast<char*>(ident_tok->value);
+    directive.size = ident_tok->value_end - ident_tok->value;
+    if (directive == MakeConstName("inline").str)
+        return ParseInlineDirective(ctx, ident_tok, INL_Inline);
+    if (directive == MakeConstName("noinline").str)
+        return ParseInlineDirective(ctx, ident_tok, INL_NoInline);
+    if (directive != MakeConstName("exec").str)
+    {
+        Error(ctx, ident_tok, "Unknown directive");
+        return nullptr;
+    }
+
+    Ast_Node *exec = PushNode<Ast_Exec_Directive>(ctx, AST_ExecDirective, hash_tok);
+    exec->exec_directive.expr = ParseExpression(ctx);
+    if (!exec->exec_directive.expr)
+    {
+        Error(ctx, "Expecting expression after #exec");
+        return nullptr;
+    }
+    ExpectAfterLast(ctx, TOK_Semicolon);
+    return exec;
+}
+
 static Ast_Node* ParseTopLevelStmt(Parser_Context *ctx)
 {
     Ast_Node *stmt = ParseGlobalImport(ctx);
+    if (!stmt) stmt = ParseDirective(ctx);
     if (!stmt) stmt = ParseForeignBlock(ctx);
     if (!stmt) stmt = ParseVarDeclStatement(ctx);
     if (!stmt) stmt = ParseTopLevelNamedStmt(ctx);
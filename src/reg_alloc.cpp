@@ -24,6 +24,23 @@ static void ReorderIndexedRegs(Array<Reg> &regs, const Reg_Info *reg_info)
     }
 }
 
+static void AppendNativeArgRegs(Reg_Alloc *reg_alloc, Reg_Class &reg_class, u8 float_flag)
+{
+    for (s64 i = 0; i < reg_class.arg_regs.count; i++)
+        array::Push(reg_class.native_arg_regs, reg_class.arg_regs[i]);
+
+    for (s64 i = 0; i < reg_alloc->reg_count; i++)
+    {
+        Reg_Info reg_info = reg_alloc->reg_info[i];
+        u8 mask = RF_NonAllocable | RF_Float | RF_CallerSave | RF_Arg | RF_Return;
+        if ((reg_info.reg_flags & mask) == (float_flag | RF_CallerSave))
+        {
+            Reg reg = { reg_info.reg_index };
+            array::Push(reg_class.native_arg_regs, reg);
+        }
+    }
+}
+
 void InitRegAlloc(Reg_Alloc *reg_alloc,
         s64 total_reg_count, const Reg_Info *reg_info,
         b32 arg_index_shared, s32 shadow_arg_reg_count)
@@ -41,6 +58,9 @@ void InitRegAlloc(Reg_Alloc *reg_alloc,
         Reg_Info reg_info = reg_alloc->reg_info[i];
         ASSERT(reg_info.reg_index == i);
 
+        if ((reg_info.reg_flags & RF_CallerSave) != 0)
+            reg_alloc->caller_save_regs |= (1ull << reg_info.reg_index);
+
         if ((reg_info.reg_flags & RF_NonAllocable) == 0)
         {
             Reg reg = { reg_info.reg_index };
@@ -68,6 +88,9 @@ void InitRegAlloc(Reg_Alloc *reg_alloc,
     ReorderIndexedRegs(reg_alloc->float_regs.return_regs, reg_info);
     ReorderIndexedRegs(reg_alloc->float_regs.arg_regs, reg_info);
 
+    AppendNativeArgRegs(reg_alloc, reg_alloc->general_regs, 0);
+    AppendNativeArgRegs(reg_alloc, reg_alloc->float_regs, RF_Float);
+
     array::Reserve(reg_alloc->general_regs.free_regs, general_reg_count);
     array::Reserve(reg_alloc->float_regs.free_regs, float_reg_count);
 }
@@ -78,9 +101,11 @@ void FreeRegAlloc(Reg_Alloc *reg_alloc)
 
     array::Free(reg_alloc->general_regs.return_regs);
     array::Free(reg_alloc->general_regs.arg_regs);
+    array::Free(reg_alloc->general_regs.native_arg_regs);
     array::Free(reg_alloc->general_regs.free_regs);
     array::Free(reg_alloc->float_regs.return_regs);
     array::Free(reg_alloc->float_regs.arg_regs);
+    array::Free(reg_alloc->float_regs.native_arg_regs);
     array::Free(reg_alloc->float_regs.free_regs);
 }
 
@@ -153,10 +178,12 @@ b32 IsFloatRegister(Reg_Alloc *reg_alloc, Reg reg)
 }
 
 
-static b32 DataTypeIsFloat(Oper_Data_Type data_type)
+b32 DataTypeIsFloat(Oper_Data_Type data_type)
 {
     return (data_type == Oper_Data_Type::F32) ||
-           (data_type == Oper_Data_Type::F64);
+           (data_type == Oper_Data_Type::F64) ||
+           (data_type == Oper_Data_Type::V128) ||
+           (data_type == Oper_Data_Type::V256);
 }
 
 const Reg* GetReturnRegister(Reg_Alloc *reg_alloc, Oper_Data_Type data_type, s64 ret_index)
@@ -177,14 +204,16 @@ const Reg* GetReturnRegister(Reg_Alloc *reg_alloc, Oper_Data_Type data_type, s64
 static void AdvanceArgIndex(Reg_Alloc *reg_alloc,
         Oper_Data_Type data_type, Reg_Seq_Index *arg_index, bool arg_passed_in_reg)
 {
-    arg_index->total_arg_count++;
+    s32 slots = (data_type == Oper_Data_Type::V128) ? 2 : 1;
+    arg_index->last_arg_slots = slots;
+    arg_index->total_arg_count += slots;
     if (!arg_passed_in_reg)
     {
-        arg_index->stack_arg_count++;
+        arg_index->stack_arg_count += slots;
         return;
     }
 
-    if (reg_alloc->arg_index_shared)
+    if (reg_alloc->arg_index_shared && !arg_index->native)
     {
         arg_index->general_reg++;
         arg_index->float_reg++;
@@ -206,9 +235,15 @@ enum {
     WORD_SIZE = 8
 };
 
+// NOTE(henrik): The native calling convention has no shadow space.
+static s32 GetShadowArgRegCount(Reg_Alloc *reg_alloc, Reg_Seq_Index arg_index)
+{
+    return arg_index.native ? 0 : reg_alloc->shadow_arg_reg_count;
+}
+
 s64 GetArgStackAllocSize(Reg_Alloc *reg_alloc, Reg_Seq_Index arg_index)
 {
-    s32 stack_arg_count = reg_alloc->shadow_arg_reg_count;
+    s32 stack_arg_count = GetShadowArgRegCount(reg_alloc, arg_index);
     stack_arg_count += arg_index.stack_arg_count;
     return stack_arg_count * WORD_SIZE;
 }
@@ -216,7 +251,7 @@ s64 GetArgStackAllocSize(Reg_Alloc *reg_alloc, Reg_Seq_Index arg_index)
 s64 GetOffsetFromBasePointer(Reg_Alloc *reg_alloc, Reg_Seq_Index arg_index)
 {
     s64 stack_slots = 0;
-    if (reg_alloc->shadow_arg_reg_count)
+    if (GetShadowArgRegCount(reg_alloc, arg_index))
     {
         stack_slots += arg_index.total_arg_count;
     }
@@ -227,14 +262,14 @@ s64 GetOffsetFromBasePointer(Reg_Alloc *reg_alloc, Reg_Seq_Index arg_index)
     // NOTE(henrik): Return -1 when there is no local offset for the argument.
     if (stack_slots == 0) return -1;
 
-    stack_slots += 2 - 1; // old rbp, return address
+    stack_slots += 2 - arg_index.last_arg_slots; // old rbp, return address
     return stack_slots * WORD_SIZE;
 }
 
 s64 GetOffsetFromStackPointer(Reg_Alloc *reg_alloc, Reg_Seq_Index arg_index)
 {
     s64 stack_slots = 0;
-    if (reg_alloc->shadow_arg_reg_count)
+    if (GetShadowArgRegCount(reg_alloc, arg_index))
     {
         stack_slots += arg_index.total_arg_count;
     }
@@ -245,30 +280,23 @@ s64 GetOffsetFromStackPointer(Reg_Alloc *reg_alloc, Reg_Seq_Index arg_index)
     // NOTE(henrik): Return -1 when there is no local offset for the argument.
     if (stack_slots == 0) return -1;
 
-    stack_slots -= 1; // old rbp, return address
+    stack_slots -= arg_index.last_arg_slots; // old rbp, return address
     return stack_slots * WORD_SIZE;
 }
 
 const Reg* GetArgRegister(Reg_Alloc *reg_alloc,
         Oper_Data_Type data_type, Reg_Seq_Index *arg_index)
 {
-    if (DataTypeIsFloat(data_type))
+    Reg_Class &reg_class = DataTypeIsFloat(data_type) ?
+        reg_alloc->float_regs : reg_alloc->general_regs;
+    Array<Reg> &arg_regs = arg_index->native ?
+        reg_class.native_arg_regs : reg_class.arg_regs;
+    s32 index = DataTypeIsFloat(data_type) ?
+        arg_index->float_reg : arg_index->general_reg;
+    if (index < arg_regs.count)
     {
-        s32 index = arg_index->float_reg;
-        if (index < reg_alloc->float_regs.arg_regs.count)
-        {
-            AdvanceArgIndex(reg_alloc, data_type, arg_index, true);
-            return &reg_alloc->float_regs.arg_regs[index];
-        }
-    }
-    else
-    {
-        s32 index = arg_index->general_reg;
-        if (index < reg_alloc->general_regs.arg_regs.count)
-        {
-            AdvanceArgIndex(reg_alloc, data_type, arg_index, true);
-            return &reg_alloc->general_regs.arg_regs[index];
-        }
+        AdvanceArgIndex(reg_alloc, data_type, arg_index, true);
+        return &arg_regs[index];
     }
     AdvanceArgIndex(reg_alloc, data_type, arg_index, false);
     return nullptr;
@@ -312,6 +340,29 @@ Reg AllocateFreeRegister(Reg_Alloc *reg_alloc, Oper_Data_Type data_type)
         return GetFreeGeneralRegister(reg_alloc);
 }
 
+Reg AllocateFreeRegister(Reg_Alloc *reg_alloc, Oper_Data_Type data_type, u64 clobbered_regs)
+{
+    Array<Reg> &free_regs = DataTypeIsFloat(data_type) ?
+        reg_alloc->float_regs.free_regs : reg_alloc->general_regs.free_regs;
+    u64 preferred[2] = {
+        reg_alloc->caller_save_regs & ~clobbered_regs,
+        ~reg_alloc->caller_save_regs,
+    };
+    for (s64 p = 0; p < 2; p++)
+    {
+        for (s64 i = free_regs.count - 1; i >= 0; i--)
+        {
+            Reg reg = free_regs[i];
+            if ((preferred[p] & (1ull << reg.reg_index)) != 0)
+            {
+                array::Erase(free_regs, i);
+                return reg;
+            }
+        }
+    }
+    return AllocateFreeRegister(reg_alloc, data_type);
+}
+
 static bool TryRemoveFromFreeRegs(Array<Reg> &free_regs, Reg reg)
 {
     for (s64 i = 0; i < free_regs.count; i++)
@@ -35,6 +35,15 @@ struct Live_Interval
     Oper_Data_Type data_type;
     b32 is_fixed;
     b32 is_spilled;
+
+    // The instruction indices, where the virtual register is read or written,
+    // in ascending order. Shared by all the intervals of the register.
+    const s32 *uses;
+    s32 use_count;
+
+    // The instruction defining the value, if the value is loaded again with
+    // it instead of reloading it from a stack slot; null otherwise.
+    const Instruction *remat;
 };
 
 enum class Spill_Type : u8
@@ -63,12 +72,22 @@ struct Reg_Seq_Index
     s32 float_reg;
     s32 total_arg_count;
     s32 stack_arg_count;
+    // The stack slots taken by the last argument; 2 for the 128 bit vectors.
+    s32 last_arg_slots;
+    // Specifies if the arguments are passed with the native calling
+    // convention of the calls between hplang routines instead of the ABI of
+    // the platform.
+    b32 native;
 };
 
 struct Reg_Class
 {
     Array<Reg> return_regs;
     Array<Reg> arg_regs;
+    // The argument registers of the native calling convention: the argument
+    // registers of the platform followed by the other caller save registers,
+    // that are not return registers.
+    Array<Reg> native_arg_regs;
     Array<Reg> free_regs;
 };
 
@@ -93,6 +112,9 @@ struct Reg_Alloc
 
     // Used to determine callee save registers used by a routine.
     u64 dirty_regs; // NOTE(henrik): Assumes that total register count < 64
+
+    // The registers a call may overwrite by the calling convention.
+    u64 caller_save_regs;
 };
 
 void InitRegAlloc(Reg_Alloc *reg_alloc,
@@ -108,9 +130,14 @@ b32 IsRegisterDirty(Reg_Alloc *reg_alloc, Reg reg);
 b32 IsCallerSave(Reg_Alloc *reg_alloc, Reg reg);
 b32 IsCalleeSave(Reg_Alloc *reg_alloc, Reg reg);
 b32 IsFloatRegister(Reg_Alloc *reg_alloc, Reg reg);
+b32 DataTypeIsFloat(Oper_Data_Type data_type);
 
 b32 HasFreeRegisters(Reg_Alloc *reg_alloc, Oper_Data_Type data_type);
 Reg AllocateFreeRegister(Reg_Alloc *reg_alloc, Oper_Data_Type data_type);
+// Allocates a free register for a value live across calls, that overwrite
+// "clobbered_regs". Prefers a caller save register not overwritten by the
+// calls, then a callee save register.
+Reg AllocateFreeRegister(Reg_Alloc *reg_alloc, Oper_Data_Type data_type, u64 clobbered_regs);
 void AllocateRegister(Reg_Alloc *reg_alloc, Reg reg, Oper_Data_Type data_type);
 b32 TryAllocateRegister(Reg_Alloc *reg_alloc, Reg reg, Oper_Data_Type data_type);
 void ReleaseRegister(Reg_Alloc *reg_alloc, Reg reg, Oper_Data_Type data_type);
@@ -569,6 +569,25 @@ static s64 CheckFunctionArgs(Type *ftype, s64 arg_count, Type **arg_types)
     return score;
 }
 
+// The shuffle indices select the elements at compile time, so they must be
+// integer literals in the range of the vector elements.
+static void CheckIntrinsicArgs(Sem_Check_Context *ctx,
+        Symbol *intrinsic, Ast_Function_Call *function_call)
+{
+    if (intrinsic->name != MakeConstName("shuffle"))
+        return;
+    s64 length = GetVectorLength(intrinsic->type->function_type.parameter_types[0]);
+    for (s64 i = 1; i < function_call->args.count; i++)
+    {
+        Ast_Expr *arg = array::At(function_call->args, i);
+        if (arg->type != AST_IntLiteral ||
+            arg->int_literal.value >= (u64)length)
+        {
+            Error(ctx, arg->file_loc, "Shuffle index must be an integer literal less than the vector length");
+        }
+    }
+}
+
 static Type* CheckFunctionCall(Sem_Check_Context *ctx, Ast_Expr *expr)
 {
     Ast_Function_Call *function_call = &expr->function_call;
@@ -663,6 +682,8 @@ static Type* CheckFunctionCall(Sem_Check_Context *ctx, Ast_Expr *expr)
                 else
                 {
                     CoerceFunctionArgs(ctx, best_overload->type, function_call);
+                    if (SymbolIsIntrinsic(best_overload))
+                        CheckIntrinsicArgs(ctx, best_overload, function_call);
                 }
                 fexpr->variable_ref.symbol = best_overload;
                 return best_overload->type->function_type.return_type;
@@ -749,6 +770,29 @@ static Type* CheckTypecastExpr(Sem_Check_Context *ctx, Ast_Expr *expr, Value_Typ
 
     if (TypeIsPointer(oper_type) && TypeIsPointer(to_type))
         return to_type;
+    if (TypeIsVector(to_type))
+    {
+        if (TypesEqual(oper_type, to_type))
+            return to_type;
+        // NOTE(henrik): The conversion between s32x4 and f32x4 converts the
+        // elements.
+        Type *from_type = TypeIsPending(oper_type) ? oper_type->base_type : oper_type;
+        if (from_type &&
+            ((from_type->tag == TYP_s32x4 && to_type->tag == TYP_f32x4) ||
+             (from_type->tag == TYP_f32x4 && to_type->tag == TYP_s32x4)))
+        {
+            return to_type;
+        }
+        // The scalar is converted to the element type and copied to every
+        // element of the vector.
+        if (TypeIsNumeric(oper_type))
+        {
+            Type *elem_type = GetVectorElementType(ctx->env, to_type);
+            if (!TypesEqual(oper_type, elem_type))
+                expr->typecast_expr.expr = MakeTypecast(ctx, oper, elem_type);
+            return to_type;
+        }
+    }
     if (TypeIsNumeric(oper_type) && TypeIsNumeric(to_type))
         return to_type;
     if (TypeIsNumeric(oper_type) && TypeIsChar(to_type))
@@ -955,6 +999,8 @@ static Type* CheckUnaryExpr(Sem_Check_Context *ctx, Ast_Expr *expr, Value_Type *
     {
     case UN_OP_Positive:
         {
+            if (TypeIsVector(type))
+                return type;
             if (!TypeIsNumeric(type))
             {
                 Error(ctx, expr->file_loc, "Invalid operand for unary +");
@@ -995,6 +1041,8 @@ static Type* CheckUnaryExpr(Sem_Check_Context *ctx, Ast_Expr *expr, Value_Type *
         } break;
     case UN_OP_Negative:
         {
+            if (TypeIsVector(type))
+                return type;
             if (!TypeIsNumeric(type))
             {
                 Error(ctx, expr->file_loc, "Invalid operand for unary -");
@@ -1031,6 +1079,8 @@ static Type* CheckUnaryExpr(Sem_Check_Context *ctx, Ast_Expr *expr, Value_Type *
         } break;
     case UN_OP_Complement:
         {
+            if (TypeIsIntegralVector(type))
+                return type;
             if (!TypeIsIntegral(type))
             {
                 Error(ctx, expr->file_loc, "Invalid operand for unary ~");
@@ -1297,6 +1347,106 @@ static Type* CoerceBinaryExprType(Sem_Check_Context *ctx,
     return type;
 }
 
+static const char* GetBinaryOpString(Binary_Op op)
+{
+    switch (op)
+    {
+        case BIN_OP_Add:        return "+";
+        case BIN_OP_Subtract:   return "-";
+        case BIN_OP_Multiply:   return "*";
+        case BIN_OP_Divide:     return "/";
+        case BIN_OP_Modulo:     return "%";
+        case BIN_OP_LeftShift:  return "<<";
+        case BIN_OP_RightShift: return ">>";
+        case BIN_OP_BitAnd:     return "&";
+        case BIN_OP_BitOr:      return "|";
+        case BIN_OP_BitXor:     return "^";
+        case BIN_OP_And:        return "&&";
+        case BIN_OP_Or:         return "||";
+        case BIN_OP_Equal:      return "==";
+        case BIN_OP_NotEqual:   return "!=";
+        case BIN_OP_Less:       return "<";
+        case BIN_OP_LessEq:     return "<=";
+        case BIN_OP_Greater:    return ">";
+        case BIN_OP_GreaterEq:  return ">=";
+        case BIN_OP_Range:      return "..";
+    }
+    INVALID_CODE_PATH;
+    return "";
+}
+
+// Returns true, if the element-wise operation is defined for the vector type.
+// SSE2 has no packed 64 bit integer multiplication or comparison, and no
+// packed integer division.
+static b32 IsVectorOperation(Binary_Op op, Type *type)
+{
+    switch (op)
+    {
+        case BIN_OP_Add:
+        case BIN_OP_Subtract:
+            return true;
+        case BIN_OP_Multiply:
+        case BIN_OP_Equal: case BIN_OP_NotEqual:
+        case BIN_OP_Less: case BIN_OP_LessEq:
+        case BIN_OP_Greater: case BIN_OP_GreaterEq:
+            return type->tag != TYP_s64x2;
+        case BIN_OP_Divide:
+            return TypeIsFloatVector(type);
+        case BIN_OP_BitAnd:
+        case BIN_OP_BitOr:
+        case BIN_OP_BitXor:
+            return TypeIsIntegralVector(type);
+        default:
+            break;
+    }
+    return false;
+}
+
+// Coerces the operand of a vector operation to the vector type. A scalar
+// operand is converted to the element type and copied to every element.
+static b32 CoerceVectorOperand(Sem_Check_Context *ctx,
+        Ast_Expr **oper, Type *type, Type *vector_type)
+{
+    if (TypesEqual(type, vector_type))
+        return true;
+    if (TypeIsFloatVector(vector_type) ? !TypeIsNumeric(type) : !TypeIsIntegral(type))
+        return false;
+    Type *elem_type = GetVectorElementType(ctx->env, vector_type);
+    Ast_Expr *scalar = *oper;
+    if (!TypesEqual(type, elem_type))
+        scalar = MakeTypecast(ctx, scalar, elem_type);
+    *oper = MakeTypecast(ctx, scalar, vector_type);
+    return true;
+}
+
+// The operations on vectors are element-wise. The comparisons result in a
+// mask vector, see GetVectorMaskType.
+static Type* CheckVectorBinaryExpr(Sem_Check_Context *ctx, Ast_Expr *expr,
+        Type *ltype, Type *rtype)
+{
+    Binary_Op op = expr->binary_expr.op;
+    Type *type = TypeIsVector(ltype) ? ltype : rtype;
+    if (TypeIsPending(type)) type = type->base_type;
+
+    if (!IsVectorOperation(op, type) ||
+        !CoerceVectorOperand(ctx, &expr->binary_expr.left, ltype, type) ||
+        !CoerceVectorOperand(ctx, &expr->binary_expr.right, rtype, type))
+    {
+        ErrorBinaryOperands(ctx, expr->file_loc, GetBinaryOpString(op), ltype, rtype);
+        return GetBuiltinType(ctx->env, TYP_none);
+    }
+    switch (op)
+    {
+        case BIN_OP_Equal: case BIN_OP_NotEqual:
+        case BIN_OP_Less: case BIN_OP_LessEq:
+        case BIN_OP_Greater: case BIN_OP_GreaterEq:
+            return GetVectorMaskType(ctx->env, type);
+        default:
+            break;
+    }
+    return type;
+}
+
 static Type* CheckBinaryExpr(Sem_Check_Context *ctx, Ast_Expr *expr, Value_Type *vt)
 {
     Binary_Op op = expr->binary_expr.op;
@@ -1328,6 +1478,9 @@ static Type* CheckBinaryExpr(Sem_Check_Context *ctx, Ast_Expr *expr, Value_Type
 
     ASSERT(ltype && rtype);
 
+    if (TypeIsVector(ltype) || TypeIsVector(rtype))
+        return CheckVectorBinaryExpr(ctx, expr, ltype, rtype);
+
     switch (op)
     {
     case BIN_OP_Add:
@@ -1616,6 +1769,15 @@ static Type* CoerceAssignmentExprType(Sem_Check_Context *ctx,
     return ltype;
 }
 
+// Checks the compound assignment to a vector as the binary operation op.
+static b32 CheckVectorAssignment(Sem_Check_Context *ctx, Ast_Expr *expr,
+        Binary_Op op, Type *ltype, Type *rtype)
+{
+    if (!TypeIsVector(ltype) || !IsVectorOperation(op, ltype))
+        return false;
+    return CoerceVectorOperand(ctx, &expr->assignment.right, rtype, ltype);
+}
+
 static Type* CheckAssignmentExpr(Sem_Check_Context *ctx, Ast_Expr *expr, Value_Type *vt)
 {
     Assignment_Op op = expr->assignment.op;
@@ -1655,6 +1817,8 @@ static Type* CheckAssignmentExpr(Sem_Check_Context *ctx, Ast_Expr *expr, Value_T
                 return CoerceAssignmentExprType(ctx, expr, left, right, ltype, rtype);
             else if (TypeIsPointer(ltype) && TypeIsIntegral(rtype))
                 break;
+            else if (CheckVectorAssignment(ctx, expr, BIN_OP_Add, ltype, rtype))
+                return ltype;
             ErrorBinaryOperands(ctx, expr->file_loc, "+=", ltype, rtype);
         } break;
     case AS_OP_SubtractAssign:
@@ -1663,18 +1827,24 @@ static Type* CheckAssignmentExpr(Sem_Check_Context *ctx, Ast_Expr *expr, Value_T
                 return CoerceAssignmentExprType(ctx, expr, left, right, ltype, rtype);
             else if (TypeIsPointer(ltype) && TypeIsIntegral(rtype))
                 break;
+            else if (CheckVectorAssignment(ctx, expr, BIN_OP_Subtract, ltype, rtype))
+                return ltype;
             ErrorBinaryOperands(ctx, expr->file_loc, "-=", ltype, rtype);
         } break;
     case AS_OP_MultiplyAssign:
         {
             if (TypeIsNumeric(ltype) && TypeIsNumeric(rtype))
                 return CoerceAssignmentExprType(ctx, expr, left, right, ltype, rtype);
+            else if (CheckVectorAssignment(ctx, expr, BIN_OP_Multiply, ltype, rtype))
+                return ltype;
             ErrorBinaryOperands(ctx, expr->file_loc, "*=", ltype, rtype);
         } break;
     case AS_OP_DivideAssign:
         {
             if (TypeIsNumeric(ltype) && TypeIsNumeric(rtype))
                 return CoerceAssignmentExprType(ctx, expr, left, right, ltype, rtype);
+            else if (CheckVectorAssignment(ctx, expr, BIN_OP_Divide, ltype, rtype))
+                return ltype;
             ErrorBinaryOperands(ctx, expr->file_loc, "/=", ltype, rtype);
         } break;
     case AS_OP_ModuloAssign:
@@ -1701,18 +1871,24 @@ static Type* CheckAssignmentExpr(Sem_Check_Context *ctx, Ast_Expr *expr, Value_T
         {
             if (TypeIsIntegral(ltype) && TypeIsIntegral(rtype))
                 return CoerceAssignmentExprType(ctx, expr, left, right, ltype, rtype);
+            else if (CheckVectorAssignment(ctx, expr, BIN_OP_BitAnd, ltype, rtype))
+                return ltype;
             ErrorBinaryOperands(ctx, expr->file_loc, "&=", ltype, rtype);
         } break;
     case AS_OP_BitOrAssign:
         {
             if (TypeIsIntegral(ltype) && TypeIsIntegral(rtype))
                 return CoerceAssignmentExprType(ctx, expr, left, right, ltype, rtype);
+            else if (CheckVectorAssignment(ctx, expr, BIN_OP_BitOr, ltype, rtype))
+                return ltype;
             ErrorBinaryOperands(ctx, expr->file_loc, "|=", ltype, rtype);
         } break;
     case AS_OP_BitXorAssign:
         {
             if (TypeIsIntegral(ltype) && TypeIsIntegral(rtype))
                 return CoerceAssignmentExprType(ctx, expr, left, right, ltype, rtype);
+            else if (CheckVectorAssignment(ctx, expr, BIN_OP_BitXor, ltype, rtype))
+                return ltype;
             ErrorBinaryOperands(ctx, expr->file_loc, "^=", ltype, rtype);
         } break;
     }
@@ -2141,6 +2317,7 @@ static void CheckStatement(Sem_Check_Context *ctx, Ast_Node *node)
         case AST_StructDef:
         case AST_StructMember:
         case AST_Typealias:
+        case AST_ExecDirective:
         case AST_Type_Plain:
         case AST_Type_Pointer:
         case AST_Type_Array:
@@ -2441,6 +2618,11 @@ static void CheckTopLevelStmt(Sem_Check_Context *ctx, Ast_Node *node)
         case AST_StructDef:     CheckStruct(ctx, node); break;
         case AST_Typealias:     CheckTypealias(ctx, node); break;
         case AST_VariableDecl:  CheckVariableDecl(ctx, node); break;
+        case AST_ExecDirective:
+            {
+                Value_Type vt;
+                CheckExpression(ctx, node->exec_directive.expr, &vt);
+            } break;
         default:
             INVALID_CODE_PATH;
     }
@@ -24,6 +24,11 @@ static const Type_Info builtin_type_infos[] = {
     {TYP_null,      SYM_PrimitiveType, 8, 8,  "null_type"},
     {TYP_pointer,   SYM_PrimitiveType, 8, 8,  "pointer_type"},
 
+    {TYP_f32x8,     SYM_PrimitiveType, 32, 32, "f32x8"},
+    {TYP_f64x4,     SYM_PrimitiveType, 32, 32, "f64x4"},
+    {TYP_s32x8,     SYM_PrimitiveType, 32, 32, "s32x8"},
+    {TYP_s64x4,     SYM_PrimitiveType, 32, 32, "s64x4"},
+
     {TYP_void,      SYM_PrimitiveType, 0, 1,  "void"},
     {TYP_bool,      SYM_PrimitiveType, 1, 1,  "bool"},
     {TYP_char,      SYM_PrimitiveType, 1, 1,  "char"},
@@ -37,6 +42,10 @@ static const Type_Info builtin_type_infos[] = {
     {TYP_s64,       SYM_PrimitiveType, 8, 8,  "s64"},
     {TYP_f32,       SYM_PrimitiveType, 4, 4,  "f32"},
     {TYP_f64,       SYM_PrimitiveType, 8, 8,  "f64"},
+    {TYP_f32x4,     SYM_PrimitiveType, 16, 16, "f32x4"},
+    {TYP_f64x2,     SYM_PrimitiveType, 16, 16, "f64x2"},
+    {TYP_s32x4,     SYM_PrimitiveType, 16, 16, "s32x4"},
+    {TYP_s64x2,     SYM_PrimitiveType, 16, 16, "s64x2"},
     {TYP_string,    SYM_Struct,        0, 0,  "string"},
 
     /*TYP_Function,*/
@@ -120,6 +129,43 @@ b32 TypeIsNumeric(Type *t)
     return TypeIsIntegral(t) || TypeIsFloat(t);
 }
 
+b32 TypeIsVector(Type *t)
+{
+    if (!t) return false;
+    if (TypeIsPending(t)) return TypeIsVector(t->base_type);
+    switch (t->tag)
+    {
+        case TYP_f32x4: case TYP_f64x2:
+        case TYP_s32x4: case TYP_s64x2:
+        case TYP_f32x8: case TYP_f64x4:
+        case TYP_s32x8: case TYP_s64x4:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+b32 TypeIsFloatVector(Type *t)
+{
+    if (!t) return false;
+    if (TypeIsPending(t)) return TypeIsFloatVector(t->base_type);
+    switch (t->tag)
+    {
+        case TYP_f32x4: case TYP_f64x2:
+        case TYP_f32x8: case TYP_f64x4:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+b32 TypeIsIntegralVector(Type *t)
+{
+    return TypeIsVector(t) && !TypeIsFloatVector(t);
+}
+
 b32 TypeIsString(Type *t)
 {
     if (!t) return false;
@@ -201,6 +247,14 @@ b32 TypesEqual(Type *a, Type *b)
     case TYP_f32:
     case TYP_f64:
     case TYP_string:
+    case TYP_f32x4:
+    case TYP_f64x2:
+    case TYP_s32x4:
+    case TYP_s64x2:
+    case TYP_f32x8:
+    case TYP_f64x4:
+    case TYP_s32x8:
+    case TYP_s64x4:
         return true;
 
     case TYP_Function:
@@ -332,6 +386,61 @@ Type* GetPointerType(Environment *env, Type *base_type)
     return pointer_type;
 }
 
+Type* GetVectorElementType(Environment *env, Type *vector_type)
+{
+    switch (vector_type->tag)
+    {
+        case TYP_f32x4: case TYP_f32x8:
+            return GetBuiltinType(env, TYP_f32);
+        case TYP_f64x2: case TYP_f64x4:
+            return GetBuiltinType(env, TYP_f64);
+        case TYP_s32x4: case TYP_s32x8:
+            return GetBuiltinType(env, TYP_s32);
+        case TYP_s64x2: case TYP_s64x4:
+            return GetBuiltinType(env, TYP_s64);
+        default:
+            break;
+    }
+    INVALID_CODE_PATH;
+    return nullptr;
+}
+
+// Returns the type of the result of a vector comparison; every element is
+// set to all ones, if the comparison was true for the element, and to zero
+// otherwise.
+Type* GetVectorMaskType(Environment *env, Type *vector_type)
+{
+    switch (vector_type->tag)
+    {
+        case TYP_f32x4: case TYP_s32x4:
+            return GetBuiltinType(env, TYP_s32x4);
+        case TYP_f64x2: case TYP_s64x2:
+            return GetBuiltinType(env, TYP_s64x2);
+        default:
+            break;
+    }
+    INVALID_CODE_PATH;
+    return nullptr;
+}
+
+s64 GetVectorLength(Type *vector_type)
+{
+    switch (vector_type->tag)
+    {
+        case TYP_f64x2: case TYP_s64x2:
+            return 2;
+        case TYP_f32x4: case TYP_s32x4:
+        case TYP_f64x4: case TYP_s64x4:
+            return 4;
+        case TYP_f32x8: case TYP_s32x8:
+            return 8;
+        default:
+            break;
+    }
+    INVALID_CODE_PATH;
+    return 0;
+}
+
 
 s64 PrintFunctionType(IoFile *file, Type *return_type, s64 param_count, Type **param_types)
 {
@@ -449,6 +558,20 @@ static void AddBuiltinTypes(Environment *env)
     members[1].offset = 8;
 }
 
+// Adds an overload of the intrinsic function name, that takes an argument of
+// arg_tag type followed by index_count s32 indices.
+static void AddIntrinsic(Environment *env, Name name,
+        Type_Tag return_tag, Type_Tag arg_tag, s64 index_count = 0)
+{
+    Type *ftype = PushFunctionType(env, TYP_Function, 1 + index_count);
+    ftype->function_type.return_type = GetBuiltinType(env, return_tag);
+    ftype->function_type.parameter_types[0] = GetBuiltinType(env, arg_tag);
+    for (s64 i = 0; i < index_count; i++)
+        ftype->function_type.parameter_types[1 + i] = GetBuiltinType(env, TYP_s32);
+    Symbol *symbol = AddFunction(env, name, ftype, NoFileLocation());
+    symbol->flags = SYMF_Intrinsic;
+}
+
 static void AddBuiltinFunctions(Environment *env)
 {
     Type *void_type = GetBuiltinType(env, TYP_void);
@@ -469,11 +592,25 @@ static void AddBuiltinFunctions(Environment *env)
     AddSymbol(env, SYM_ForeignFunction, PushName(&env->arena, "exit"), c_exit_type, env->builtin_file_loc);
 
     Name sqrt_name = PushName(&env->arena, "sqrt");
-    Type *sqrt_f64_type = PushFunctionType(env, TYP_Function, 1);
-    sqrt_f64_type->function_type.return_type = GetBuiltinType(env, TYP_f64);
-    sqrt_f64_type->function_type.parameter_types[0] = GetBuiltinType(env, TYP_f64);
-    Symbol *sqrt_sym = AddFunction(env, sqrt_name, sqrt_f64_type, NoFileLocation());
-    sqrt_sym->flags = SYMF_Intrinsic;
+    AddIntrinsic(env, sqrt_name, TYP_f64, TYP_f64);
+    AddIntrinsic(env, sqrt_name, TYP_f32x4, TYP_f32x4);
+    AddIntrinsic(env, sqrt_name, TYP_f64x2, TYP_f64x2);
+
+    // NOTE(henrik): movemask(v) returns the sign bits of the elements of the
+    // vector as the low bits of the result, the first element in the bit 0.
+    Name movemask_name = PushName(&env->arena, "movemask");
+    AddIntrinsic(env, movemask_name, TYP_s32, TYP_f32x4);
+    AddIntrinsic(env, movemask_name, TYP_s32, TYP_f64x2);
+    AddIntrinsic(env, movemask_name, TYP_s32, TYP_s32x4);
+    AddIntrinsic(env, movemask_name, TYP_s32, TYP_s64x2);
+
+    // NOTE(henrik): shuffle(v, i0, i1, ...) returns the vector, whose element
+    // k is the element ik of v. The indices must be integer literals.
+    Name shuffle_name = PushName(&env->arena, "shuffle");
+    AddIntrinsic(env, shuffle_name, TYP_f32x4, TYP_f32x4, 4);
+    AddIntrinsic(env, shuffle_name, TYP_f64x2, TYP_f64x2, 2);
+    AddIntrinsic(env, shuffle_name, TYP_s32x4, TYP_s32x4, 4);
+    AddIntrinsic(env, shuffle_name, TYP_s64x2, TYP_s64x2, 2);
 }
 
 Environment NewEnvironment(const char *main_func_name)
@@ -803,6 +940,14 @@ static s64 UniqueTypeString(char *buf, s64 bufsize, Type *type)
             return snprintf(buf, bufsize, "f4");
         case TYP_f64:
             return snprintf(buf, bufsize, "f8");
+        case TYP_f32x4:
+            return snprintf(buf, bufsize, "f4x4");
+        case TYP_f64x2:
+            return snprintf(buf, bufsize, "f8x2");
+        case TYP_s32x4:
+            return snprintf(buf, bufsize, "s4x4");
+        case TYP_s64x2:
+            return snprintf(buf, bufsize, "s8x2");
         case TYP_string:
             return snprintf(buf, bufsize, "S");
         case TYP_Function:
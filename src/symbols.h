@@ -19,6 +19,13 @@ enum Type_Tag
     TYP_null,
     TYP_pointer,
 
+    // The 256 bit vector types used by the loop vectorizer. These are not
+    // visible to the language.
+    TYP_f32x8,
+    TYP_f64x4,
+    TYP_s32x8,
+    TYP_s64x4,
+
     TYP_void,
     TYP_FIRST_BUILTIN_SYM = TYP_void,
 
@@ -34,6 +41,10 @@ enum Type_Tag
     TYP_s64,
     TYP_f32,
     TYP_f64,
+    TYP_f32x4,
+    TYP_f64x2,
+    TYP_s32x4,
+    TYP_s64x2,
     TYP_string,
 
     TYP_LAST_BUILTIN = TYP_string,
@@ -98,6 +109,9 @@ b32 TypeIsChar(Type *t);
 b32 TypeIsIntegral(Type *t);
 b32 TypeIsFloat(Type *t);
 b32 TypeIsNumeric(Type *t);
+b32 TypeIsVector(Type *t);
+b32 TypeIsFloatVector(Type *t);
+b32 TypeIsIntegralVector(Type *t);
 b32 TypeIsString(Type *t);
 b32 TypeIsStruct(Type *t);
 
@@ -232,6 +246,9 @@ b32 SymbolIsIntrinsic(Symbol *symbol);
 
 Type* GetBuiltinType(Environment *env, Type_Tag tag);
 Type* GetPointerType(Environment *env, Type *base_type);
+Type* GetVectorElementType(Environment *env, Type *vector_type);
+Type* GetVectorMaskType(Environment *env, Type *vector_type);
+s64 GetVectorLength(Type *vector_type);
 
 b32 TypesEqual(Type *a, Type *b);
 
@@ -0,0 +1,43 @@
+#!/bin/bash
+# Measures the run time of the numeric test programs compiled with each of
+# the given compilers, e.g. to compare the code before and after a change:
+#   bash tests/bench.sh ./hplangc_old ./hplangc
+# The programs are run BENCH_RUNS times, and the total time is reported in
+# milliseconds.
+
+PROGRAMS="nbody nbody_p mandelbrot bintrees reg_pressure"
+RUNS=${BENCH_RUNS:-20}
+BENCH_DIR=${BENCH_DIR:-/tmp/hplang_bench}
+
+if [ $# -eq 0 ]; then
+    echo "usage: bench.sh <compiler>..."
+    exit 1
+fi
+
+mkdir -p "$BENCH_DIR"
+
+printf "%-14s" "program"
+for compiler in "$@"; do
+    printf "%16s" "$(basename "$compiler")"
+done
+printf "\n"
+
+for program in $PROGRAMS; do
+    printf "%-14s" "$program"
+    c=0
+    for compiler in "$@"; do
+        c=$((c + 1))
+        exe="$BENCH_DIR/$program.$c"
+        if ! "$compiler" -o "$exe" "tests/exec/$program.hp" > /dev/null 2>&1; then
+            printf "%16s" "failed"
+            continue
+        fi
+        start=$(date +%s%N)
+        for ((r = 0; r < RUNS; r++)); do
+            "$exe" > /dev/null
+        done
+        end=$(date +%s%N)
+        printf "%13d ms" $(((end - start) / 1000000))
+    done
+    printf "\n"
+done
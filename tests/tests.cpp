@@ -9,6 +9,9 @@
 #include <cinttypes>
 #include <cstdlib> // for WIFEXITED etc.
 #include <cctype> // for isprint
+#ifndef HP_WIN
+#include <unistd.h> // for dup, dup2
+#endif
 
 #define NO_CRASH_TESTS
 
@@ -122,6 +125,12 @@ struct Execute_Test
     s32 expected_exit_code;
 };
 
+struct Run_Test
+{
+    const char *source_filename;
+    s32 expected_exit_code;
+};
+
 #ifndef NO_CRASH_TESTS
 static Crash_Test crash_tests[] = {
     { "tests/crash/id-000000,sig-11,src-000000,op-flip1,pos-43" },
@@ -372,6 +381,7 @@ static Fail_Test fail_tests[] = {
     (Fail_Test){ PHASE_SemanticCheck,   "tests/sem_check_fail/deref_void_ptr.hp",               {7, 10} },
     (Fail_Test){ PHASE_SemanticCheck,   "tests/sem_check_fail/break_out_of_place.hp",           {6, 5} },
     (Fail_Test){ PHASE_SemanticCheck,   "tests/sem_check_fail/undefined_func_call.hp",          {6, 14} },
+    (Fail_Test){ PHASE_SemanticCheck,   "tests/sem_check_fail/shuffle_index.hp",                {6, 24} },
 };
 
 static Succeed_Test succeed_tests[] = {
@@ -415,8 +425,97 @@ static Execute_Test exec_tests[] = {
     (Execute_Test){ "tests/pointer_arith.hp",       nullptr,                            0 },
     (Execute_Test){ "tests/member_access.hp",       nullptr,                            0 },
     (Execute_Test){ "tests/function_var.hp",        nullptr,                            0 },
+    (Execute_Test){ "tests/exec/global_routine_ptr.hp", "tests/exec/global_routine_ptr.stdout", 0 },
+    (Execute_Test){ "tests/exec/compile_time.hp",   nullptr,                            126 },
+    (Execute_Test){ "tests/exec/compile_time_io.hp", nullptr,                           0 },
+    (Execute_Test){ "tests/exec/ssa.hp",            "tests/exec/ssa.stdout",            0 },
+    (Execute_Test){ "tests/exec/ssa_two_address.hp", "tests/exec/ssa_two_address.stdout", 0 },
+    (Execute_Test){ "tests/exec/const_prop.hp",     "tests/exec/const_prop.stdout",     0 },
+    (Execute_Test){ "tests/exec/value_numbering.hp", "tests/exec/value_numbering.stdout", 0 },
+    (Execute_Test){ "tests/exec/gvn_phi_operands.hp", "tests/exec/gvn_phi_operands.stdout", 0 },
+    (Execute_Test){ "tests/exec/licm.hp",           "tests/exec/licm.stdout",           0 },
+    (Execute_Test){ "tests/exec/strength.hp",       "tests/exec/strength.stdout",       0 },
+    (Execute_Test){ "tests/exec/inline.hp",         "tests/exec/inline.stdout",         0 },
+    (Execute_Test){ "tests/exec/dead_code.hp",      "tests/exec/dead_code.stdout",      0 },
+    (Execute_Test){ "tests/exec/tail_call.hp",      "tests/exec/tail_call.stdout",      0 },
+    (Execute_Test){ "tests/exec/vectorize.hp",      "tests/exec/vectorize.stdout",      0 },
+    (Execute_Test){ "tests/exec/simd.hp",           "tests/exec/simd.stdout",           0 },
+    (Execute_Test){ "tests/exec/live_split.hp",     "tests/exec/live_split.stdout",     0 },
+    (Execute_Test){ "tests/exec/edge_moves.hp",     "tests/exec/edge_moves.stdout",     0 },
+    (Execute_Test){ "tests/exec/edge_split.hp",     "tests/exec/edge_split.stdout",     0 },
+    (Execute_Test){ "tests/exec/coalesce.hp",       "tests/exec/coalesce.stdout",       0 },
+    (Execute_Test){ "tests/exec/stack_slots.hp",    "tests/exec/stack_slots.stdout",    0 },
+    (Execute_Test){ "tests/exec/remat.hp",          "tests/exec/remat.stdout",          0 },
+    (Execute_Test){ "tests/exec/call_saves.hp",     "tests/exec/call_saves.stdout",     0 },
+    (Execute_Test){ "tests/exec/reg_summary.hp",    "tests/exec/reg_summary.stdout",    0 },
+    (Execute_Test){ "tests/exec/tail_clobbers.hp",  "tests/exec/tail_clobbers.stdout",  0 },
+    (Execute_Test){ "tests/exec/native_calls.hp",   "tests/exec/native_calls.stdout",   0 },
+    (Execute_Test){ "tests/exec/leaf_frames.hp",    "tests/exec/leaf_frames.stdout",    0 },
+};
+
+// The execute tests built for the AVX2 target (-T avx2). They are skipped, if
+// the CPU running the tests does not support AVX2.
+static Execute_Test avx2_exec_tests[] = {
+    //              test source                     expected output                     expected exit code
+    (Execute_Test){ "tests/exec/vectorize.hp",      "tests/exec/vectorize.stdout",      0 },
+    (Execute_Test){ "tests/exec/simd.hp",           "tests/exec/simd.stdout",           0 },
 };
 
+// NOTE(henrik): The output of the programs run in-process is discarded, so
+// only their exit codes are tested.
+static Run_Test run_tests[] = {
+    //          test source                     expected exit code
+    (Run_Test){ "tests/exec/and_or.hp",         0 },
+    (Run_Test){ "tests/exec/struct_as_arg.hp",  10 },
+    (Run_Test){ "tests/exec/module_test.hp",    42 },
+    (Run_Test){ "tests/exec/modules_test.hp",   210 },
+    (Run_Test){ "tests/exec/compile_time_io.hp", 0 },
+    (Run_Test){ "tests/exec/ssa.hp",            0 },
+    (Run_Test){ "tests/exec/const_prop.hp",     0 },
+    (Run_Test){ "tests/exec/value_numbering.hp", 0 },
+    (Run_Test){ "tests/exec/licm.hp",           0 },
+    (Run_Test){ "tests/exec/strength.hp",       0 },
+    (Run_Test){ "tests/exec/inline.hp",         0 },
+    (Run_Test){ "tests/exec/dead_code.hp",      0 },
+    (Run_Test){ "tests/exec/tail_call.hp",      0 },
+    (Run_Test){ "tests/exec/vectorize.hp",      0 },
+    (Run_Test){ "tests/exec/simd.hp",           0 },
+    (Run_Test){ "tests/exec/live_split.hp",     0 },
+    (Run_Test){ "tests/exec/coalesce.hp",       0 },
+    (Run_Test){ "tests/exec/stack_slots.hp",    0 },
+    (Run_Test){ "tests/exec/remat.hp",          0 },
+    (Run_Test){ "tests/exec/call_saves.hp",     0 },
+    (Run_Test){ "tests/exec/reg_summary.hp",    0 },
+    (Run_Test){ "tests/exec/tail_clobbers.hp",  0 },
+    (Run_Test){ "tests/exec/native_calls.hp",   0 },
+    (Run_Test){ "tests/exec/leaf_frames.hp",    0 },
+};
+
+// The execute and run tests are run with the optimizations on and off.
+static const b32 optimize_modes[] = { true, false };
+
+// The execute tests are linked with each of the linkers.
+static const Linker_Backend linkers[] = { LINK_Gcc, LINK_Builtin };
+
+static b32 CpuSupportsAvx2()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+static const char *GetLinkerName(Linker_Backend linker)
+{
+    switch (linker)
+    {
+    case LINK_Gcc:      return "gcc";
+    case LINK_Builtin:  return "builtin";
+    }
+    return "?";
+}
+
 //static void PrintError(const char *filename, s64 line, s64 column, const char *message)
 //{
 //    fprintf(stderr, "%s:%" PRId64 ":%" PRId64 ": TEST ERROR: %s\n",
@@ -638,16 +737,20 @@ static void print_buf_contents(FILE *outfile, const char *title,
 
 }
 
-b32 RunTest(const Execute_Test &test)
+b32 RunTest(const Execute_Test &test, b32 optimize, Linker_Backend linker,
+        u32 target_features)
 {
     b32 failed = false;
     Compiler_Context compiler_ctx = NewCompilerContext();
+    compiler_ctx.options.optimize = optimize;
+    compiler_ctx.options.target_features = target_features;
 
     Open_File *file = OpenFile(&compiler_ctx, test.source_filename);
     if (file)
     {
         compiler_ctx.error_ctx.file = (IoFile*)outfile;
         compiler_ctx.options.output_filename = test_exe;
+        compiler_ctx.options.linker = linker;
         //compiler_ctx.options.profile_instr_count = true;
 
         Compile(&compiler_ctx, file);
@@ -781,7 +884,62 @@ b32 RunTest(const Execute_Test &test)
 
     if (failed)
     {
-        fprintf(outfile, "Test '%s' failed\n", test.source_filename);
+        fprintf(outfile, "Test '%s' failed (-O%d, %s linker%s)\n",
+                test.source_filename, optimize ? 1 : 0, GetLinkerName(linker),
+                (target_features & TF_Avx2) ? ", avx2" : "");
+        fprintf(outfile, "----\n"); fflush(outfile);
+    }
+    return !failed;
+}
+
+b32 RunTest(const Run_Test &test, b32 optimize)
+{
+    b32 failed = false;
+    Compiler_Context compiler_ctx = NewCompilerContext();
+    compiler_ctx.options.optimize = optimize;
+
+    Open_File *file = OpenFile(&compiler_ctx, test.source_filename);
+    if (file)
+    {
+        compiler_ctx.error_ctx.file = (IoFile*)outfile;
+        compiler_ctx.options.run_program = true;
+
+#ifndef HP_WIN
+        fflush(nullptr);
+        int stdout_fd = dup(STDOUT_FILENO);
+        dup2(fileno(nulldev), STDOUT_FILENO);
+#endif
+        Compile(&compiler_ctx, file);
+#ifndef HP_WIN
+        fflush(nullptr);
+        dup2(stdout_fd, STDOUT_FILENO);
+        close(stdout_fd);
+#endif
+
+        if (compiler_ctx.result != RES_OK)
+        {
+            fprintf(outfile, "TEST ERROR: Unexpected errors\n");
+            failed = true;
+        }
+        else if (compiler_ctx.program_exit_code != test.expected_exit_code)
+        {
+            fprintf(outfile, "TEST ERROR: Run test's exit code was %d and not %d\n\tfor test '%s'\n",
+                    compiler_ctx.program_exit_code, test.expected_exit_code,
+                    test.source_filename);
+            failed = true;
+        }
+    }
+    else
+    {
+        fprintf(outfile, "TEST ERROR: Could not open test source file '%s'\n", test.source_filename);
+        failed = true;
+    }
+
+    FreeCompilerContext(&compiler_ctx);
+
+    if (failed)
+    {
+        fprintf(outfile, "Test '%s' failed (-O%d)\n", test.source_filename, optimize ? 1 : 0);
         fprintf(outfile, "----\n"); fflush(outfile);
     }
     return !failed;
@@ -792,7 +950,15 @@ int main(int argc, char **argv)
     (void)argc;
     (void)argv;
 
+    // NOTE(henrik): The test results are written to a copy of the standard
+    // output, as the standard output is redirected, while running the tests
+    // in-process.
+#ifdef HP_WIN
     outfile = stdout;
+#else
+    outfile = fdopen(dup(STDOUT_FILENO), "w");
+    setvbuf(outfile, nullptr, _IOLBF, 0);
+#endif
 
     nulldev = fopen("/dev/null", "w");
     if (!nulldev)
@@ -808,7 +974,11 @@ int main(int argc, char **argv)
     s64 total_tests = 0;
     total_tests += array_length(fail_tests);
     total_tests += array_length(succeed_tests);
-    total_tests += array_length(exec_tests);
+    total_tests += array_length(exec_tests) * array_length(optimize_modes) * array_length(linkers);
+    total_tests += array_length(run_tests) * array_length(optimize_modes);
+    b32 has_avx2 = CpuSupportsAvx2();
+    if (has_avx2)
+        total_tests += array_length(avx2_exec_tests) * array_length(optimize_modes) * array_length(linkers);
 
     s64 failed_tests = 0;
 #ifndef NO_CRASH_TESTS
@@ -825,16 +995,36 @@ int main(int argc, char **argv)
     {
         failed_tests += RunTest(test) ? 0 : 1;
     }
-    for (const Execute_Test &test : exec_tests)
+    for (b32 optimize : optimize_modes)
     {
-        failed_tests += RunTest(test) ? 0 : 1;
+        for (Linker_Backend linker : linkers)
+        {
+            for (const Execute_Test &test : exec_tests)
+            {
+                failed_tests += RunTest(test, optimize, linker, 0) ? 0 : 1;
+            }
+            for (const Execute_Test &test : avx2_exec_tests)
+            {
+                if (!has_avx2) break;
+                failed_tests += RunTest(test, optimize, linker, TF_Avx2) ? 0 : 1;
+            }
+        }
+        for (const Run_Test &test : run_tests)
+        {
+            failed_tests += RunTest(test, optimize) ? 0 : 1;
+        }
     }
 
     fprintf(outfile, "----\n");
+    if (!has_avx2)
+        fprintf(outfile, "The CPU does not support AVX2; skipped the avx2 tests\n");
     fprintf(outfile, "%" PRId64 " tests run, %" PRId64 " failed\n", total_tests, failed_tests);
     fprintf(outfile, "----\n");
 
     fclose(nulldev);
+#ifndef HP_WIN
+    fclose(outfile);
+#endif
 
     return 0; //failed_tests;
 }